@@ -0,0 +1,330 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <QtDebug>
+#include <QMetaObject>
+
+#include "armorpipe.h"
+#include "flow.h"
+#include "sock.h"
+
+using namespace SST;
+
+
+////////// ArmorClient //////////
+
+ArmorClient::~ArmorClient()
+{
+}
+
+void ArmorClient::armorRelease(QByteArray &buf)
+{
+	buf.clear();
+}
+
+Socket *ArmorClient::armorSocket()
+{
+	return NULL;
+}
+
+
+////////// ArmorJob //////////
+
+void ArmorJob::process()
+{
+	bool ok = true;
+	if (tx)
+		armor->txenc(pktseq, pkt, epkt);
+	else
+		ok = armor->rxdec(pktseq, pkt);
+
+	// Publish the results to the owning thread.
+	state.fetchAndStoreRelease(ok ? Done : Failed);
+}
+
+
+////////// ArmorRing //////////
+
+bool ArmorRing::push(ArmorJob *job)
+{
+	unsigned t = tail;
+	unsigned h = head.fetchAndAddAcquire(0);
+	if (t - h >= size)
+		return false;	// full
+
+	slots[t & (size-1)] = job;
+	tail.fetchAndStoreRelease(t + 1);
+	return true;
+}
+
+ArmorJob *ArmorRing::pop()
+{
+	unsigned h = head;
+	unsigned t = tail.fetchAndAddAcquire(0);
+	if (h == t)
+		return NULL;	// empty
+
+	ArmorJob *job = slots[h & (size-1)];
+	head.fetchAndStoreRelease(h + 1);
+	return job;
+}
+
+
+////////// ArmorWorker //////////
+
+ArmorWorker::ArmorWorker(ArmorPipeline *pipe)
+:	pipe(pipe),
+	stopping(false)
+{
+}
+
+void ArmorWorker::run()
+{
+	forever {
+		avail.acquire();
+		ArmorJob *job = ring.pop();
+		if (job == NULL) {
+			Q_ASSERT(stopping);
+			return;
+		}
+		job->process();
+		pipe->notify();
+	}
+}
+
+
+////////// ArmorPipeline //////////
+
+ArmorPipeline::ArmorPipeline(int nthreads, ArmorHostState *hs,
+				QObject *parent)
+:	QObject(parent),
+	nextworker(0),
+	wakeup(0),
+	draining(false),
+	hs(hs)
+{
+	for (int i = 0; i < nthreads; i++) {
+		ArmorWorker *w = new ArmorWorker(this);
+		workers.append(w);
+		w->start();
+	}
+}
+
+ArmorPipeline::~ArmorPipeline()
+{
+	foreach (ArmorClient *client, clients.keys())
+		cancel(client);
+
+	foreach (ArmorWorker *w, workers) {
+		w->stopping = true;
+		w->avail.release();
+		w->wait();
+		delete w;
+	}
+
+	foreach (ArmorJob *job, freejobs)
+		delete job;
+}
+
+ArmorJob *ArmorPipeline::newJob(ArmorClient *client, FlowArmor *armor,
+				quint64 pktseq, bool tx)
+{
+	ArmorJob *job = freejobs.isEmpty() ? new ArmorJob : freejobs.takeLast();
+	job->client = client;
+	job->armor = armor;
+	job->pktseq = pktseq;
+	job->tx = tx;
+	job->state = ArmorJob::Pending;
+	return job;
+}
+
+void ArmorPipeline::submitTx(ArmorClient *client, FlowArmor *armor,
+			quint64 pktseq, const QByteArray &pkt, QByteArray &epkt)
+{
+	Q_ASSERT(armor->isReentrant());
+
+	ArmorJob *job = newJob(client, armor, pktseq, true);
+	job->pkt = pkt;
+	job->epkt = epkt;
+	epkt = QByteArray();
+
+	clients[client].tx.enqueue(job);
+	dispatch(job);
+}
+
+void ArmorPipeline::submitRx(ArmorClient *client, FlowArmor *armor,
+			quint64 pktseq, QByteArray &pkt, int ecn)
+{
+	Q_ASSERT(armor->isReentrant());
+
+	ArmorJob *job = newJob(client, armor, pktseq, false);
+	job->ecn = ecn;
+	job->pkt = pkt;
+	pkt = QByteArray();
+
+	clients[client].rx.enqueue(job);
+	dispatch(job);
+}
+
+void ArmorPipeline::dispatch(ArmorJob *job)
+{
+	// Hand the job to the next worker whose ring has room.
+	int nw = workers.size();
+	for (int i = 0; i < nw; i++) {
+		ArmorWorker *w = workers[nextworker];
+		if (++nextworker == nw)
+			nextworker = 0;
+		if (w->ring.push(job)) {
+			w->avail.release();
+			return;
+		}
+	}
+
+	// No workers, or all of them backed up: just do it ourselves.
+	// We may be deep inside a client's transmit or receive path,
+	// so hand back the result later from the event loop as usual.
+	job->process();
+	notify();
+}
+
+void ArmorPipeline::notify()
+{
+	// Called from worker threads: post at most one drain() at a time.
+	if (wakeup.testAndSetOrdered(0, 1)) {
+		QMetaObject::invokeMethod(this, "drain", Qt::QueuedConnection);
+		if (hs)
+			hs->wakeEventLoop();
+	}
+}
+
+void ArmorPipeline::drain()
+{
+	// Client callbacks may run a nested event loop that leads back here;
+	// don't recurse, but make sure we get called again.
+	if (draining) {
+		notify();
+		return;
+	}
+	draining = true;
+
+	// Clear the wakeup flag before looking at job states,
+	// so that any job finishing after this point posts another drain.
+	wakeup.fetchAndStoreOrdered(0);
+
+	// Hold each socket we send completed packets on in a batch
+	// until this pass is over, rather than one send per packet.
+	QHash<Socket*, SocketBatch*> batches;
+
+	bool progress;
+	do {
+		progress = false;
+		foreach (ArmorClient *client, clients.keys()) {
+			for (int dir = 0; dir < 2; dir++) {
+				forever {
+					// Callbacks may cancel clients, so look again each time.
+					QHash<ArmorClient*, ClientQueues>::iterator it =
+						clients.find(client);
+					if (it == clients.end())
+						break;
+					QQueue<ArmorJob*> &q = dir ? it->rx : it->tx;
+					if (q.isEmpty() || q.head()->state.fetchAndAddAcquire(0)
+							== ArmorJob::Pending)
+						break;
+					if (!dir) {
+						Socket *sock = client->armorSocket();
+						if (sock && !batches.contains(sock))
+							batches.insert(sock,
+								new SocketBatch(sock));
+					}
+					finish(q.dequeue());
+					progress = true;
+				}
+			}
+		}
+	} while (progress);
+
+	qDeleteAll(batches);
+	draining = false;
+}
+
+void ArmorPipeline::finish(ArmorJob *job)
+{
+	if (job->state == ArmorJob::Done) {
+		if (job->tx)
+			job->client->armorTxDone(job->pktseq, job->epkt);
+		else
+			job->client->armorRxDone(job->pktseq, job->pkt,
+						job->ecn);
+	}
+	release(job);
+}
+
+void ArmorPipeline::release(ArmorJob *job)
+{
+	job->client->armorRelease(job->pkt);
+	job->client->armorRelease(job->epkt);
+	freejobs.append(job);
+}
+
+int ArmorPipeline::pending(ArmorClient *client)
+{
+	QHash<ArmorClient*, ClientQueues>::const_iterator it =
+		clients.find(client);
+	if (it == clients.end())
+		return 0;
+	return it->tx.size() + it->rx.size();
+}
+
+void ArmorPipeline::cancel(ArmorClient *client)
+{
+	if (!clients.contains(client))
+		return;
+	ClientQueues cq = clients.take(client);
+
+	// Workers may still be touching these jobs; wait them out.
+	QList<ArmorJob*> jobs = cq.tx + cq.rx;
+	foreach (ArmorJob *job, jobs) {
+		while (job->state.fetchAndAddAcquire(0) == ArmorJob::Pending)
+			QThread::yieldCurrentThread();
+		release(job);
+	}
+}
+
+
+////////// ArmorHostState //////////
+
+ArmorHostState::~ArmorHostState()
+{
+	delete pipe;
+}
+
+void ArmorHostState::setArmorThreads(int nthreads)
+{
+	delete pipe;
+	pipe = NULL;
+
+	if (nthreads > 0)
+		pipe = new ArmorPipeline(nthreads, this);
+}
+
+void ArmorHostState::wakeEventLoop()
+{
+}
+
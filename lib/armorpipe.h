@@ -0,0 +1,232 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#ifndef SST_ARMORPIPE_H
+#define SST_ARMORPIPE_H
+
+#include <QHash>
+#include <QList>
+#include <QQueue>
+#include <QThread>
+#include <QAtomicInt>
+#include <QSemaphore>
+#include <QByteArray>
+
+namespace SST {
+
+class FlowArmor;
+class Socket;
+class ArmorPipeline;
+class ArmorHostState;
+
+
+// Interface through which ArmorPipeline hands armored or dearmored packets
+// back to their owner (normally a Flow) on the owner's thread,
+// in the same order the owner submitted them.
+class ArmorClient
+{
+public:
+	// Called with a packet encrypted by ArmorPipeline::submitTx().
+	virtual void armorTxDone(quint64 pktseq, QByteArray &epkt) = 0;
+
+	// Called with a packet successfully authenticated and decrypted
+	// by ArmorPipeline::submitRx(); packets that fail are dropped.
+	// 'ecn' is the ECN codepoint passed to submitRx().
+	virtual void armorRxDone(quint64 pktseq, QByteArray &pkt, int ecn) = 0;
+
+	// Called with each packet buffer the pipeline is finished with,
+	// including those of failed and cancelled jobs,
+	// so that the client can recycle it.  The default just frees it.
+	virtual void armorRelease(QByteArray &buf);
+
+	// Return the socket armorTxDone() sends on, if any,
+	// so that drain() can hold it in a batch across completions.
+	virtual Socket *armorSocket();
+
+	virtual ~ArmorClient();
+};
+
+
+// One packet's worth of armor work.
+struct ArmorJob
+{
+	enum State {
+		Pending = 0,
+		Done,
+		Failed
+	};
+
+	ArmorClient *client;
+	FlowArmor *armor;
+	quint64 pktseq;
+	bool tx;			// txenc if true, rxdec if false
+	quint8 ecn;			// ECN codepoint received with (rx only)
+	QByteArray pkt;			// Cleartext (tx) or received (rx)
+	QByteArray epkt;		// Armored output (tx only)
+	QAtomicInt state;		// Set by the worker when finished
+
+	void process();
+};
+
+
+// Fixed-size lock-free ring carrying jobs from one producer thread
+// to one consumer thread.
+class ArmorRing
+{
+public:
+	static const unsigned size = 1024;	// Must be a power of two
+
+private:
+	ArmorJob *slots[size];
+	QAtomicInt head;	// Next slot to pop, advanced by consumer
+	QAtomicInt tail;	// Next slot to fill, advanced by producer
+
+public:
+	inline ArmorRing() : head(0), tail(0) { }
+
+	// Producer side: returns false if the ring is full.
+	bool push(ArmorJob *job);
+
+	// Consumer side: returns NULL if the ring is empty.
+	ArmorJob *pop();
+};
+
+
+// A crypto worker thread serving one ArmorRing.
+class ArmorWorker : public QThread
+{
+	friend class ArmorPipeline;
+
+	ArmorPipeline *const pipe;
+	ArmorRing ring;
+	QSemaphore avail;	// Counts jobs pushed onto the ring
+	volatile bool stopping;
+
+	ArmorWorker(ArmorPipeline *pipe);
+
+	virtual void run();
+};
+
+
+/** Optional multi-threaded pipeline for FlowArmor processing.
+ * The owning thread (normally the Qt event loop driving the flows)
+ * submits packets to be armored or dearmored;
+ * a pool of worker threads does the cryptographic work in parallel,
+ * and the results are handed back to each ArmorClient
+ * on the owning thread strictly in submission order,
+ * separately for each direction.
+ * Only FlowArmor objects whose isReentrant() method returns true
+ * may be used with the pipeline.
+ * All methods must be called from the owning thread.
+ */
+class ArmorPipeline : public QObject
+{
+	friend class ArmorWorker;
+	Q_OBJECT
+
+	// Per-client queues of jobs outstanding, in submission order
+	struct ClientQueues {
+		QQueue<ArmorJob*> tx, rx;
+	};
+
+	QList<ArmorWorker*> workers;
+	int nextworker;				// Round-robin dispatch index
+	QHash<ArmorClient*, ClientQueues> clients;
+	QList<ArmorJob*> freejobs;		// Recycled job records
+	QAtomicInt wakeup;			// Drain notification pending
+	bool draining;
+	ArmorHostState *const hs;		// Host to wake for drain()
+
+public:
+	/** Create a pipeline with a given number of worker threads.
+	 * With zero threads all work is done inline on submission,
+	 * with results still handed back from the event loop,
+	 * which is mainly useful as a baseline for comparison.
+	 * If @a hs is given, its wakeEventLoop() is called
+	 * each time a drain() is posted. */
+	ArmorPipeline(int nthreads, ArmorHostState *hs = NULL,
+			QObject *parent = NULL);
+	~ArmorPipeline();
+
+	inline int threads() { return workers.size(); }
+
+	/** Submit a cleartext packet for encryption into @a epkt,
+	 * a buffer from the host's packet pool.
+	 * The pipeline takes over @a epkt, leaving it empty,
+	 * and returns it through the client's armorRelease(). */
+	void submitTx(ArmorClient *client, FlowArmor *armor, quint64 pktseq,
+			const QByteArray &pkt, QByteArray &epkt);
+
+	/** Submit a received packet for authentication and decryption.
+	 * The pipeline takes over @a pkt, leaving it empty,
+	 * hands @a ecn back along with the result,
+	 * and returns the buffer through the client's armorRelease(). */
+	void submitRx(ArmorClient *client, FlowArmor *armor, quint64 pktseq,
+			QByteArray &pkt, int ecn = 0);
+
+	/** Return the number of jobs outstanding for a client. */
+	int pending(ArmorClient *client);
+
+	/** Wait for all of a client's outstanding jobs to finish
+	 * and discard their results, e.g., before the client is destroyed. */
+	void cancel(ArmorClient *client);
+
+public slots:
+	/** Hand back all results that are ready, in order. */
+	void drain();
+
+private:
+	ArmorJob *newJob(ArmorClient *client, FlowArmor *armor,
+			quint64 pktseq, bool tx);
+	void dispatch(ArmorJob *job);
+	void notify();
+	void finish(ArmorJob *job);
+	void release(ArmorJob *job);
+};
+
+
+// Per-host state for the armor pipeline.
+class ArmorHostState
+{
+	ArmorPipeline *pipe;
+
+public:
+	inline ArmorHostState() : pipe(NULL) { }
+	virtual ~ArmorHostState();
+
+	/** Get the host's armor pipeline, or NULL if none is enabled,
+	 * in which case flows armor their packets inline. */
+	inline ArmorPipeline *armorPipeline() { return pipe; }
+
+	/** Enable the armor pipeline with a given number of worker threads,
+	 * or disable it if @a nthreads is zero.
+	 * Should be called before any flows are started. */
+	void setArmorThreads(int nthreads);
+
+	/** Called from worker threads after posting the pipeline's
+	 * drain() to the owning thread.  Hosts whose event loop
+	 * doesn't notice posted events by itself must wake it up here.
+	 * The default does nothing, since Qt's event loop does. */
+	virtual void wakeEventLoop();
+};
+
+
+} // namespace SST
+
+#endif	// SST_ARMORPIPE_H
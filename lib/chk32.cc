@@ -25,9 +25,192 @@
 
 #include "chk32.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CHK32_X86
+#include <immintrin.h>
+#endif
+
 using namespace SST;
 
 
+////////// Vector kernels //////////
+
+// A vector kernel sums the 16-bit big-endian words at the start of 'buf'
+// in whole blocks of its vector width, up to one chunk at a time,
+// so that its 32-bit lane counters cannot overflow.
+// It returns the plain sum of the words it consumed in 'sum',
+// and their sum weighted by distance from the end of the chunk
+// (so that the last word has weight 1) in 'wsum',
+// which is exactly what the scalar loop would add to the a and b counters.
+// Returns the number of words consumed, or 0 if less than one block remains.
+typedef int (*Chk32Kernel)(const uint16_t *buf, int nwords,
+				uint64_t &sum, uint64_t &wsum);
+
+// Blocks per chunk: the weighted lane sums grow as
+// ChunkBlocks * (ChunkBlocks+1) / 2 * 65535, which must fit in 32 bits.
+static const int ChunkBlocks = 256;
+
+// Don't bother with vector code for very short runs.
+static const int VectorMinWords = 32;
+
+// Fold the per-lane plain sums 's1' and running sums 's2'
+// of a 'width'-word kernel into the chunk's plain and weighted sums.
+static inline void chk32Fold(const uint32_t *s1, const uint32_t *s2,
+			int width, uint64_t &sum, uint64_t &wsum)
+{
+	sum = wsum = 0;
+	for (int j = 0; j < width; j++) {
+		sum += s1[j];
+		wsum += (uint64_t)width * s2[j] - (uint64_t)j * s1[j];
+	}
+}
+
+#ifdef CHK32_X86
+
+__attribute__((target("sse2")))
+static int chk32Sse2(const uint16_t *buf, int nwords,
+			uint64_t &sum, uint64_t &wsum)
+{
+	const int width = 8;
+	int nblocks = std::min(nwords / width, ChunkBlocks);
+	if (nblocks == 0)
+		return 0;
+
+	const __m128i zero = _mm_setzero_si128();
+	__m128i s1lo = zero, s1hi = zero, s2lo = zero, s2hi = zero;
+	const __m128i *p = (const __m128i*)buf;
+	for (int k = 0; k < nblocks; k++) {
+		// Load and byte-swap eight words, then widen to 32 bits.
+		__m128i x = _mm_loadu_si128(p + k);
+		x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+		s1lo = _mm_add_epi32(s1lo, _mm_unpacklo_epi16(x, zero));
+		s1hi = _mm_add_epi32(s1hi, _mm_unpackhi_epi16(x, zero));
+		s2lo = _mm_add_epi32(s2lo, s1lo);
+		s2hi = _mm_add_epi32(s2hi, s1hi);
+	}
+
+	uint32_t s1[width], s2[width];
+	_mm_storeu_si128((__m128i*)s1, s1lo);
+	_mm_storeu_si128((__m128i*)(s1 + 4), s1hi);
+	_mm_storeu_si128((__m128i*)s2, s2lo);
+	_mm_storeu_si128((__m128i*)(s2 + 4), s2hi);
+	chk32Fold(s1, s2, width, sum, wsum);
+
+	return nblocks * width;
+}
+
+__attribute__((target("avx2")))
+static int chk32Avx2(const uint16_t *buf, int nwords,
+			uint64_t &sum, uint64_t &wsum)
+{
+	const int width = 16;
+	int nblocks = std::min(nwords / width, ChunkBlocks);
+	if (nblocks == 0)
+		return 0;
+
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i s1lo = zero, s1hi = zero, s2lo = zero, s2hi = zero;
+	const __m256i *p = (const __m256i*)buf;
+	for (int k = 0; k < nblocks; k++) {
+		// Load and byte-swap sixteen words, then widen to 32 bits.
+		__m256i x = _mm256_loadu_si256(p + k);
+		x = _mm256_or_si256(_mm256_slli_epi16(x, 8),
+					_mm256_srli_epi16(x, 8));
+		s1lo = _mm256_add_epi32(s1lo,
+			_mm256_cvtepu16_epi32(_mm256_castsi256_si128(x)));
+		s1hi = _mm256_add_epi32(s1hi,
+			_mm256_cvtepu16_epi32(_mm256_extracti128_si256(x, 1)));
+		s2lo = _mm256_add_epi32(s2lo, s1lo);
+		s2hi = _mm256_add_epi32(s2hi, s1hi);
+	}
+
+	uint32_t s1[width], s2[width];
+	_mm256_storeu_si256((__m256i*)s1, s1lo);
+	_mm256_storeu_si256((__m256i*)(s1 + 8), s1hi);
+	_mm256_storeu_si256((__m256i*)s2, s2lo);
+	_mm256_storeu_si256((__m256i*)(s2 + 8), s2hi);
+	chk32Fold(s1, s2, width, sum, wsum);
+
+	return nblocks * width;
+}
+
+#endif	// CHK32_X86
+
+
+////////// Implementation selection //////////
+
+static const Chk32Kernel kernels[Chk32::NImpls] = {
+	NULL,
+#ifdef CHK32_X86
+	chk32Sse2,
+	chk32Avx2,
+#else
+	NULL,
+	NULL,
+#endif
+};
+
+static Chk32::Impl bestImpl()
+{
+	for (int i = Chk32::NImpls - 1; i > Chk32::Scalar; i--)
+		if (Chk32::haveImpl((Chk32::Impl)i))
+			return (Chk32::Impl)i;
+	return Chk32::Scalar;
+}
+
+static Chk32::Impl curimpl = bestImpl();
+static Chk32Kernel kernel = kernels[curimpl];
+
+bool Chk32::haveImpl(Impl impl)
+{
+#ifdef CHK32_X86
+	// We may run from a static initializer, before libgcc's own
+	// constructor has probed the CPU for __builtin_cpu_supports().
+	__builtin_cpu_init();
+#endif
+
+	switch (impl) {
+	case Scalar:
+		return true;
+#ifdef CHK32_X86
+	case SSE2:
+		return __builtin_cpu_supports("sse2");
+	case AVX2:
+		return __builtin_cpu_supports("avx2");
+#endif
+	default:
+		return false;
+	}
+}
+
+bool Chk32::setImpl(Impl impl)
+{
+	if (impl < Scalar || impl >= NImpls || !haveImpl(impl))
+		return false;
+	curimpl = impl;
+	kernel = kernels[impl];
+	return true;
+}
+
+Chk32::Impl Chk32::impl()
+{
+	return curimpl;
+}
+
+const char *Chk32::implName(Impl impl)
+{
+	switch (impl) {
+	case Scalar:	return "scalar";
+	case SSE2:	return "sse2";
+	case AVX2:	return "avx2";
+	default:	return "unknown";
+	}
+}
+
+
+////////// Chk32 //////////
+
+
 // Compute a 32-bit checksum over a block of data.
 // This checksum algorithm operates on similar principles as Adler-32, except:
 //
@@ -41,6 +224,22 @@ using namespace SST;
 //
 void Chk32::update16(const uint16_t *buf, int nwords)
 {
+	// Let the vector kernel, if any, consume as many whole blocks as it can,
+	// reducing the counters after each chunk.
+	if (kernel != NULL && nwords >= VectorMinWords) {
+		a %= Modulus;
+		b %= Modulus;
+		uint64_t sum, wsum;
+		int n;
+		while ((n = kernel(buf, nwords, sum, wsum)) > 0) {
+			b = (b + (uint64_t)n * a + wsum) % Modulus;
+			a = (a + sum) % Modulus;
+			buf += n;
+			nwords -= n;
+		}
+		run = MaxRun;
+	}
+
 	// With our 64-bit counters we can process 23726746 16-bit words
 	// before risk of overflow.
 	while (nwords > run) {
@@ -53,6 +53,23 @@ private:
 	bool haveodd;
 
 public:
+	// Available implementations of the inner update16() loop.
+	// The fastest one the CPU supports is selected automatically.
+	enum Impl {
+		Scalar = 0,	// Portable C loop
+		SSE2,		// 128-bit vectors (x86)
+		AVX2,		// 256-bit vectors (x86)
+		NImpls
+	};
+
+	// Query or override the implementation in use,
+	// e.g., for equivalence testing and benchmarking.
+	// setImpl() returns false if the CPU doesn't support 'impl'.
+	static bool haveImpl(Impl impl);
+	static bool setImpl(Impl impl);
+	static Impl impl();
+	static const char *implName(Impl impl);
+
 	inline Chk32() : a(InitA), b(InitB), run(MaxRun), haveodd(false) { }
 
 	// Primitive init/update/final API for 
@@ -0,0 +1,696 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#include <string.h>
+#include <errno.h>
+
+#include <QCoreApplication>
+#include <QtDebug>
+
+// epoll.h defines SST_EPOLL on the same test.
+#if defined(__linux__)
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#endif
+
+#include "epoll.h"
+#include "os.h"
+
+#ifdef SST_EPOLL
+
+using namespace SST;
+
+
+////////// EpollBatch //////////
+
+// Size of the ancillary data buffer for an IP_TOS cmsg
+// carrying the ECN bits of a received datagram.
+#define EPOLLCMSGLEN	CMSG_SPACE(sizeof(int))
+
+// Private I/O buffers for an EpollSocket.
+// Like UdpBatch, but without UDP segmentation offload:
+// each held packet goes out as its own message.
+struct SST::EpollBatch
+{
+	// Receive state: one slot per datagram in a recvmmsg() call
+	char rxbuf[EpollSocket::rxBatchMax * EpollSocket::rxSlotSize];
+	mmsghdr rxmsgs[EpollSocket::rxBatchMax];
+	iovec rxiovs[EpollSocket::rxBatchMax];
+	sockaddr_in rxaddrs[EpollSocket::rxBatchMax];
+	char rxctl[EpollSocket::rxBatchMax][EPOLLCMSGLEN];
+
+	// Transmit state: packets held contiguously in txbuf
+	char txbuf[EpollSocket::txBufSize];
+	int ntx;		// Number of packets held
+	int txused;		// Bytes of txbuf in use
+	mmsghdr txmsgs[EpollSocket::txBatchMax];
+	iovec txiovs[EpollSocket::txBatchMax];
+	sockaddr_in txaddrs[EpollSocket::txBatchMax];
+
+	// Set while packets are held after the kernel refused them
+	// with EAGAIN, and the host is watching for room.
+	bool txblocked;
+
+	inline EpollBatch() : ntx(0), txused(0), txblocked(false) { }
+
+	void discard(int n);
+};
+
+// Remove the first n held packets, keeping the rest in order.
+void EpollBatch::discard(int n)
+{
+	Q_ASSERT(n >= 0 && n <= ntx);
+	if (n == ntx) {
+		ntx = txused = 0;
+		return;
+	}
+	int ofs = (char*)txiovs[n].iov_base - txbuf;
+	memmove(txbuf, txbuf + ofs, txused - ofs);
+	txused -= ofs;
+	for (int i = n; i < ntx; i++) {
+		txiovs[i-n].iov_base = (char*)txiovs[i].iov_base - ofs;
+		txiovs[i-n].iov_len = txiovs[i].iov_len;
+		txaddrs[i-n] = txaddrs[i];
+	}
+	ntx -= n;
+}
+
+
+////////// EpollTimerEngine //////////
+
+EpollTimerEngine::~EpollTimerEngine()
+{
+	stop();
+}
+
+void EpollTimerEngine::start(quint64 usecs)
+{
+	stop();
+	wake = eh->currentTime().usecs + usecs;
+	eh->timerInsert(this);
+}
+
+void EpollTimerEngine::stop()
+{
+	if (slot >= 0)
+		eh->timerRemove(this);
+}
+
+
+////////// EpollSocket //////////
+
+EpollSocket::EpollSocket(EpollHost *host, QObject *parent)
+:	Socket(host, parent),
+	eh(host),
+	fd(-1),
+	port(0),
+	batch(NULL),
+	st()
+{
+	eh->socks.append(this);
+}
+
+EpollSocket::~EpollSocket()
+{
+	if (fd >= 0) {
+		flushBatch();
+		eh->unwatch(this);
+		::close(fd);
+		fd = -1;
+		setActive(false);
+	}
+	delete batch;
+	batch = NULL;
+	eh->socks.removeAll(this);
+}
+
+bool EpollSocket::bind(const QHostAddress &addr, quint16 port,
+			QUdpSocket::BindMode mode)
+{
+	Q_ASSERT(fd < 0);
+
+	sockaddr_in sin;
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	if (addr == QHostAddress::Any)
+		sin.sin_addr.s_addr = htonl(INADDR_ANY);
+	else if (addr.protocol() == QAbstractSocket::IPv4Protocol)
+		sin.sin_addr.s_addr = htonl(addr.toIPv4Address());
+	else {
+		err = "EpollSocket supports only IPv4";
+		return false;
+	}
+
+	fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		err = strerror(errno);
+		return false;
+	}
+
+	int val = 1;
+	if (mode & (QUdpSocket::ShareAddress | QUdpSocket::ReuseAddressHint))
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+
+	socklen_t len = sizeof(sin);
+	if (::bind(fd, (sockaddr*)&sin, sizeof(sin)) < 0 ||
+			getsockname(fd, (sockaddr*)&sin, &len) < 0) {
+		err = strerror(errno);
+		::close(fd);
+		fd = -1;
+		return false;
+	}
+	this->port = ntohs(sin.sin_port);
+
+	// Never let the OS fragment our packets, as with UdpSocket.
+#ifdef IP_MTU_DISCOVER
+	val = IP_PMTUDISC_DO;
+	if (setsockopt(fd, IPPROTO_IP, IP_MTU_DISCOVER, &val, sizeof(val)) < 0)
+		qDebug() << this << "IP_MTU_DISCOVER failed:" << strerror(errno);
+#endif
+
+	batch = new EpollBatch;
+	if (ecnCapable())
+		initEcn();
+
+	eh->watch(this);
+	setActive(true);
+	return true;
+}
+
+void EpollSocket::setEcnCapable(bool enable)
+{
+	Socket::setEcnCapable(enable);
+	if (fd >= 0)
+		initEcn();
+}
+
+void EpollSocket::initEcn()
+{
+	int tos = ecnCapable() ? EcnEct0 : EcnNotEct;
+	if (setsockopt(fd, IPPROTO_IP, IP_TOS, &tos, sizeof(tos)) < 0)
+		qWarning("Can't set IP TOS for ECN: %s", strerror(errno));
+
+	int val = ecnCapable();
+	if (setsockopt(fd, IPPROTO_IP, IP_RECVTOS, &val, sizeof(val)) < 0)
+		qDebug() << this << "IP_RECVTOS failed:" << strerror(errno);
+}
+
+bool EpollSocket::send(const Endpoint &ep, const char *data, int size)
+{
+	if (fd < 0 || ep.addr.protocol() != QAbstractSocket::IPv4Protocol)
+		return false;
+
+	sockaddr_in sin;
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(ep.addr.toIPv4Address());
+	sin.sin_port = htons(ep.port);
+
+	// Hold the packet if a transmit batch is open.
+	if (inBatch() && size <= txBufSize) {
+		EpollBatch &b = *batch;
+
+		// Make room for this packet if necessary.
+		// If the kernel's buffer is full too, drop it as it would.
+		if (b.ntx == txBatchMax || b.txused + size > txBufSize) {
+			flushBatch();
+			if (b.ntx == txBatchMax
+					|| b.txused + size > txBufSize)
+				return false;
+		}
+
+		int i = b.ntx++;
+		memcpy(b.txbuf + b.txused, data, size);
+		b.txiovs[i].iov_base = b.txbuf + b.txused;
+		b.txiovs[i].iov_len = size;
+		b.txaddrs[i] = sin;
+		b.txused += size;
+		return true;
+	}
+
+	// Don't let an unbatched packet overtake held ones.
+	// If some are still waiting for buffer space, so must this one.
+	flushBatch();
+	if (batch->ntx > 0)
+		return false;
+
+	st.txpackets++;
+	st.txcalls++;
+	if (::sendto(fd, data, size, 0, (sockaddr*)&sin, sizeof(sin)) == size)
+		return true;
+	err = strerror(errno);
+	qDebug() << "EpollSocket::send:" << err;
+	return false;
+}
+
+void EpollSocket::flushBatch()
+{
+	if (!batch || batch->ntx == 0)
+		return;
+	EpollBatch &b = *batch;
+
+	// Still waiting for room in the socket buffer.
+	if (b.txblocked)
+		return;
+
+	for (int i = 0; i < b.ntx; i++) {
+		msghdr &mh = b.txmsgs[i].msg_hdr;
+		memset(&mh, 0, sizeof(mh));
+		mh.msg_name = &b.txaddrs[i];
+		mh.msg_namelen = sizeof(sockaddr_in);
+		mh.msg_iov = &b.txiovs[i];
+		mh.msg_iovlen = 1;
+	}
+
+	int sent = 0;
+	bool full = false;
+	while (sent < b.ntx) {
+		int rc = sendmmsg(fd, b.txmsgs + sent, b.ntx - sent, 0);
+		st.txcalls++;
+		if (rc > 0) {
+			sent += rc;
+			continue;
+		}
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			// Socket buffer full: hold on to the rest
+			// until the socket becomes writable again.
+			full = true;
+			break;
+		}
+		if (rc < 0 && (errno == EMSGSIZE || errno == ENETUNREACH
+				|| errno == EHOSTUNREACH || errno == ECONNREFUSED
+				|| errno == EACCES || errno == EPERM)) {
+			// A problem with this datagram or its destination,
+			// e.g., a path MTU probe too big for the path
+			// as far as the OS knows: drop just this one.
+			qDebug() << this << "flushBatch:" << strerror(errno);
+			sent++;
+			continue;
+		}
+		qDebug() << "EpollSocket::flushBatch:" << strerror(errno)
+			<< "dropped" << (b.ntx - sent) << "of" << b.ntx;
+		sent = b.ntx;
+		break;
+	}
+
+	// Forget what went out, and keep what didn't.
+	st.txpackets += sent;
+	b.discard(sent);
+
+	if (full) {
+		b.txblocked = true;
+		eh->watchWrite(this, true);
+	}
+}
+
+void EpollSocket::readyWrite()
+{
+	if (!batch || !batch->txblocked)
+		return;
+	batch->txblocked = false;
+	eh->watchWrite(this, false);
+	flushBatch();
+}
+
+void EpollSocket::readyRead()
+{
+	EpollBatch &b = *batch;
+	PacketPool &pool = host()->packetPool();
+	SocketEndpoint src;
+	src.sock = this;
+
+	// Send any responses we generate (e.g., ACKs) as one batch too.
+	SocketBatch txbatch(this);
+
+	int n;
+	do {
+		for (int i = 0; i < rxBatchMax; i++) {
+			b.rxiovs[i].iov_base = b.rxbuf + i * rxSlotSize;
+			b.rxiovs[i].iov_len = rxSlotSize;
+			msghdr &mh = b.rxmsgs[i].msg_hdr;
+			mh.msg_name = &b.rxaddrs[i];
+			mh.msg_namelen = sizeof(sockaddr_in);
+			mh.msg_iov = &b.rxiovs[i];
+			mh.msg_iovlen = 1;
+			mh.msg_control = b.rxctl[i];
+			mh.msg_controllen = EPOLLCMSGLEN;
+			mh.msg_flags = 0;
+		}
+
+		n = recvmmsg(fd, b.rxmsgs, rxBatchMax, MSG_DONTWAIT, NULL);
+		st.rxcalls++;
+		if (n < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK
+					&& errno != EINTR)
+				qWarning("Error receiving UDP datagrams: %s",
+					strerror(errno));
+			break;
+		}
+
+		for (int i = 0; i < n; i++) {
+			msghdr &mh = b.rxmsgs[i].msg_hdr;
+			int len = b.rxmsgs[i].msg_len;
+			if (mh.msg_flags & MSG_TRUNC) {
+				qWarning("Dropping oversized UDP datagram");
+				continue;
+			}
+			const sockaddr_in &sin = b.rxaddrs[i];
+			if (sin.sin_family != AF_INET)
+				continue;
+			src.addr.setAddress(ntohl(sin.sin_addr.s_addr));
+			src.port = ntohs(sin.sin_port);
+
+			int ecn = EcnNotEct;
+			for (cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm != NULL;
+					cm = CMSG_NXTHDR(&mh, cm)) {
+				if (cm->cmsg_level == IPPROTO_IP
+						&& cm->cmsg_type == IP_TOS)
+					ecn = *(quint8*)CMSG_DATA(cm) & 3;
+			}
+
+			QByteArray msg = pool.alloc(qMax(len, 1));
+			memcpy(msg.data(), b.rxiovs[i].iov_base, len);
+			msg.resize(len);
+			st.rxpackets++;
+			receive(msg, src, ecn);
+			pool.release(msg);
+		}
+
+		// A short batch means we've drained the socket.
+	} while (n == rxBatchMax);
+}
+
+QList<Endpoint> EpollSocket::localEndpoints()
+{
+	QList<Endpoint> eps;
+	foreach (const QHostAddress &addr, localHostAddrs())
+		eps.append(Endpoint(addr, port));
+	return eps;
+}
+
+
+////////// EpollHost //////////
+
+EpollHost::EpollHost()
+{
+	init();
+}
+
+EpollHost::EpollHost(QSettings *settings, quint16 defaultport)
+{
+	init();
+
+	// Create the main socket only now,
+	// so that it comes from our newSocket() and not SocketHostState's.
+	initSocket(settings, defaultport);
+	initHostIdent(settings);
+}
+
+EpollHost::~EpollHost()
+{
+	// Stop the armor workers first, so none can wake us once efd closes.
+	setArmorThreads(0);
+
+	// Close our sockets while we can still unwatch them.
+	while (!socks.isEmpty())
+		delete socks.first();
+
+	// Timers still queued belong to host state torn down after us;
+	// just forget them so their engines don't touch our heap.
+	foreach (EpollTimerEngine *te, timers)
+		te->slot = -1;
+	timers.clear();
+
+	::close(efd);
+	efd = -1;
+	::close(tfd);
+	::close(epfd);
+	delete [] evs;
+}
+
+void EpollHost::init()
+{
+	tfdwake = 0;
+	nevs = 0;
+	stopped = false;
+	st = Stats();
+	evs = new epoll_event[eventsMax];
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0)
+		qFatal("EpollHost: can't create epoll instance: %s",
+			strerror(errno));
+
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (tfd < 0)
+		qFatal("EpollHost: can't create timerfd: %s", strerror(errno));
+
+	// The timerfd's events carry our own pointer to tell them apart.
+	epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = this;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev) < 0)
+		qFatal("EpollHost: can't watch timerfd: %s", strerror(errno));
+
+	// Likewise the eventfd's carry a pointer to efd itself.
+	efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (efd < 0)
+		qFatal("EpollHost: can't create eventfd: %s", strerror(errno));
+	ev.data.ptr = &efd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, efd, &ev) < 0)
+		qFatal("EpollHost: can't watch eventfd: %s", strerror(errno));
+}
+
+void EpollHost::wake()
+{
+	if (efd < 0)
+		return;
+	quint64 one = 1;
+	if (::write(efd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		qWarning("EpollHost: eventfd write: %s", strerror(errno));
+}
+
+void EpollHost::wakeEventLoop()
+{
+	wake();
+}
+
+TimerEngine *EpollHost::newTimerEngine(Timer *timer)
+{
+	return new EpollTimerEngine(this, timer);
+}
+
+Socket *EpollHost::newSocket(QObject *parent)
+{
+	return new EpollSocket(this, parent);
+}
+
+void EpollHost::watch(EpollSocket *sock)
+{
+	epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = sock;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, sock->fd, &ev) < 0)
+		qWarning("EpollHost: can't watch socket: %s", strerror(errno));
+}
+
+// Watch a socket for writability too, while its batch is blocked.
+void EpollHost::watchWrite(EpollSocket *sock, bool enable)
+{
+	epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = enable ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+	ev.data.ptr = sock;
+	if (epoll_ctl(epfd, EPOLL_CTL_MOD, sock->fd, &ev) < 0)
+		qWarning("EpollHost: can't modify socket watch: %s",
+			strerror(errno));
+}
+
+void EpollHost::unwatch(EpollSocket *sock)
+{
+	epoll_ctl(epfd, EPOLL_CTL_DEL, sock->fd, NULL);
+
+	// A socket deleted while we're dispatching
+	// may still have a pending event from the same epoll_wait().
+	for (int i = 0; i < nevs; i++)
+		if (evs[i].data.ptr == sock)
+			evs[i].data.ptr = NULL;
+}
+
+void EpollHost::run()
+{
+	stopped = false;
+	while (!stopped)
+		runOnce();
+}
+
+void EpollHost::runOnce(qint64 maxwait)
+{
+	timerArm();
+
+	int ms = maxwait < 0 ? -1 : (int)((maxwait + 999) / 1000);
+	int n = epoll_wait(epfd, evs, eventsMax, ms);
+	st.wakeups++;
+	if (n < 0) {
+		if (errno != EINTR)
+			qWarning("EpollHost: epoll_wait: %s", strerror(errno));
+		n = 0;
+	}
+
+	nevs = n;
+	for (int i = 0; i < nevs; i++) {
+		void *ptr = evs[i].data.ptr;
+		if (ptr == this) {
+			// Clear the expiration; timerDispatch() does the rest.
+			quint64 exp;
+			if (::read(tfd, &exp, sizeof(exp)) < 0 && errno != EAGAIN)
+				qWarning("EpollHost: timerfd read: %s",
+					strerror(errno));
+			tfdwake = 0;
+		} else if (ptr == &efd) {
+			// Just clear the count; posted events go out below.
+			quint64 cnt;
+			if (::read(efd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+				qWarning("EpollHost: eventfd read: %s",
+					strerror(errno));
+		} else if (ptr != NULL) {
+			st.events++;
+			EpollSocket *sock = (EpollSocket*)ptr;
+			if (evs[i].events & EPOLLOUT)
+				sock->readyWrite();
+			if (evs[i].events & ~EPOLLOUT)
+				sock->readyRead();
+		}
+	}
+	nevs = 0;
+
+	timerDispatch();
+
+	// SST relies on Qt's deferred deletion even without its event loop.
+	QCoreApplication::sendPostedEvents();
+	QCoreApplication::sendPostedEvents(0, QEvent::DeferredDelete);
+}
+
+// Arm the timerfd for the earliest queued timer, if it changed.
+void EpollHost::timerArm()
+{
+	qint64 wake = timers.isEmpty() ? 0 : timers[0]->wake;
+	if (wake == tfdwake)
+		return;
+
+	itimerspec its;
+	memset(&its, 0, sizeof(its));
+	if (wake) {
+		// The timerfd is relative to CLOCK_MONOTONIC,
+		// while host time may be virtualized, so arm it relatively.
+		qint64 usecs = qMax(wake - currentTime().usecs, (qint64)1);
+		its.it_value.tv_sec = usecs / 1000000;
+		its.it_value.tv_nsec = (usecs % 1000000) * 1000;
+	}
+	if (timerfd_settime(tfd, 0, &its, NULL) < 0)
+		qWarning("EpollHost: can't arm timerfd: %s", strerror(errno));
+	tfdwake = wake;
+}
+
+// Fire all timers due as of now, in order of expiry.
+// Timers restarted from a timeout handler wait for the next pass.
+void EpollHost::timerDispatch()
+{
+	qint64 now = currentTime().usecs;
+	while (!timers.isEmpty() && timers[0]->wake <= now) {
+		EpollTimerEngine *te = timers[0];
+		timerRemove(te);
+		st.timeouts++;
+		te->timeout();
+	}
+}
+
+void EpollHost::timerInsert(EpollTimerEngine *te)
+{
+	Q_ASSERT(te->slot < 0);
+	te->slot = timers.size();
+	timers.append(te);
+	timerUp(te->slot);
+}
+
+void EpollHost::timerRemove(EpollTimerEngine *te)
+{
+	int i = te->slot;
+	Q_ASSERT(i >= 0 && i < timers.size() && timers[i] == te);
+	te->slot = -1;
+
+	// Move the last entry into the hole and restore heap order.
+	EpollTimerEngine *last = timers.last();
+	timers.removeLast();
+	if (last == te)
+		return;
+	timers[i] = last;
+	last->slot = i;
+	timerUp(i);
+	timerDown(last->slot);
+}
+
+void EpollHost::timerUp(int i)
+{
+	EpollTimerEngine *te = timers[i];
+	while (i > 0) {
+		int parent = (i - 1) / 2;
+		if (timers[parent]->wake <= te->wake)
+			break;
+		timers[i] = timers[parent];
+		timers[i]->slot = i;
+		i = parent;
+	}
+	timers[i] = te;
+	te->slot = i;
+}
+
+void EpollHost::timerDown(int i)
+{
+	EpollTimerEngine *te = timers[i];
+	int n = timers.size();
+	forever {
+		int child = 2 * i + 1;
+		if (child >= n)
+			break;
+		if (child + 1 < n && timers[child + 1]->wake < timers[child]->wake)
+			child++;
+		if (te->wake <= timers[child]->wake)
+			break;
+		timers[i] = timers[child];
+		timers[i]->slot = i;
+		i = child;
+	}
+	timers[i] = te;
+	te->slot = i;
+}
+
+#endif	// SST_EPOLL
@@ -0,0 +1,229 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+//
+// Native event loop runtime for SST hosts on Linux,
+// which drives timers and UDP sockets from one epoll loop
+// instead of through Qt's event dispatcher and QUdpSocket.
+//
+#ifndef SST_EPOLL_H
+#define SST_EPOLL_H
+
+#include <QList>
+#include <QVector>
+
+#include "host.h"
+
+// Linux provides epoll, timerfd, and recvmmsg()/sendmmsg().
+#if defined(__linux__)
+#define SST_EPOLL	1
+#endif
+
+#ifdef SST_EPOLL
+
+struct epoll_event;
+
+
+namespace SST {
+
+class EpollHost;
+struct EpollBatch;
+
+
+/** @internal
+ * @brief TimerEngine queued in its EpollHost's timer heap.
+ */
+class EpollTimerEngine : public TimerEngine
+{
+	friend class EpollHost;
+
+	EpollHost *const eh;
+	qint64 wake;		// Time the timer expires, while queued
+	int slot;		// Position in the timer heap, -1 if not queued
+
+	inline EpollTimerEngine(EpollHost *host, Timer *t)
+		: TimerEngine(t), eh(host), wake(0), slot(-1) { }
+	~EpollTimerEngine();
+
+	virtual void start(quint64 usecs);
+	virtual void stop();
+};
+
+
+/** Socket implementation for EpollHost,
+ * using a raw nonblocking IPv4 UDP socket that the host's loop polls,
+ * with batched I/O via recvmmsg() and sendmmsg().
+ */
+class EpollSocket : public Socket
+{
+	friend class EpollHost;
+
+public:
+	/// Max datagrams to receive per recvmmsg() call.
+	static const int rxBatchMax = UdpSocket::rxBatchMax;
+
+	/// Receive buffer space per datagram.
+	static const int rxSlotSize = 16384;
+
+	/// Max datagrams to hold in a transmit batch before flushing.
+	static const int txBatchMax = UdpSocket::txBatchMax;
+
+	/// Transmit batch buffer size.
+	static const int txBufSize = UdpSocket::txBufSize;
+
+	/// Same system call counters as UdpSocket keeps.
+	typedef UdpSocket::Stats Stats;
+
+private:
+	EpollHost *const eh;
+	int fd;			// Socket descriptor, -1 if not bound
+	quint16 port;		// Local port bound to
+	QString err;		// Last error description
+	EpollBatch *batch;	// I/O buffers, allocated on bind
+	Stats st;
+
+public:
+	EpollSocket(EpollHost *host, QObject *parent = NULL);
+	~EpollSocket();
+
+	/** Bind to a local IPv4 address and port.
+	 * Shares the port with other sockets if @a mode allows it. */
+	bool bind(const QHostAddress &addr = QHostAddress::Any,
+		quint16 port = 0,
+		QUdpSocket::BindMode mode = QUdpSocket::DefaultForPlatform);
+
+	bool send(const Endpoint &ep, const char *data, int size);
+
+	QList<Endpoint> localEndpoints();
+	quint16 localPort() { return port; }
+	inline QString errorString() { return err; }
+
+	virtual void setEcnCapable(bool enable);
+
+	/// Return the socket's system call counters.
+	inline const Stats &stats() const { return st; }
+	inline void resetStats() { st = Stats(); }
+
+protected:
+	virtual void flushBatch();
+
+private:
+	void initEcn();
+	void readyRead();	// Called by the host when fd is readable
+	void readyWrite();	// Called by the host when fd is writable
+};
+
+
+/** Host running SST from a native Linux event loop.
+ * Timers live in a binary heap whose earliest expiry
+ * arms a single timerfd, and sockets are EpollSocket descriptors,
+ * all waited on together with epoll_wait().
+ * Like SimHost, it plugs in through the newTimerEngine()
+ * and newSocket() virtualization hooks, so the rest of SST runs
+ * unchanged; but the application must drive it with run()
+ * or runOnce() rather than with QCoreApplication::exec().
+ * Qt's posted events, such as deferred deletions,
+ * are still delivered after each pass through the loop,
+ * but QTimers and QSocketNotifiers won't fire.
+ * Other threads posting events to this one must call wake()
+ * for them to be delivered promptly;
+ * the armor pipeline does so through wakeEventLoop().
+ */
+class EpollHost : public Host
+{
+	friend class EpollTimerEngine;
+	friend class EpollSocket;
+
+public:
+	/// Max readiness events to take per epoll_wait() call.
+	static const int eventsMax = 64;
+
+	/// Counters for measuring event loop overhead.
+	struct Stats {
+		quint64 wakeups;	///< Returns from epoll_wait()
+		quint64 timeouts;	///< Timers dispatched
+		quint64 events;		///< Socket readiness events dispatched
+	};
+
+private:
+	int epfd;		// epoll instance
+	int tfd;		// timerfd armed for the earliest timer
+	int efd;		// eventfd other threads signal to wake us
+	qint64 tfdwake;		// Time tfd is armed for, 0 if disarmed
+	QVector<EpollTimerEngine*> timers; // Heap ordered by wake time
+	QList<EpollSocket*> socks;	// Sockets we've created
+	epoll_event *evs;	// Events from the last epoll_wait()
+	int nevs;		// Number of them not yet dispatched
+	bool stopped;		// Set by stop() to make run() return
+	Stats st;
+
+public:
+	/** Create a "bare-bones" host as with Host::Host(). */
+	EpollHost();
+
+	/** Create a host with an identity and a UDP socket
+	 * as with Host::Host(QSettings*, quint16),
+	 * but with the socket polled by this host's loop. */
+	EpollHost(QSettings *settings, quint16 defaultUdpPort);
+
+	~EpollHost();
+
+	virtual TimerEngine *newTimerEngine(Timer *timer);
+	virtual Socket *newSocket(QObject *parent = NULL);
+
+	/** Run the event loop until stop() is called. */
+	void run();
+
+	/** Wait for events and dispatch them once.
+	 * @param maxwait the longest to wait in microseconds
+	 *	if no timer is due sooner, or -1 to wait indefinitely. */
+	void runOnce(qint64 maxwait = -1);
+
+	/** Make run() return after the current pass. */
+	inline void stop() { stopped = true; }
+
+	/** Wake the loop from epoll_wait() to deliver posted events.
+	 * May be called from any thread. */
+	void wake();
+	virtual void wakeEventLoop();
+
+	/// Return the event loop's counters.
+	inline const Stats &stats() const { return st; }
+	inline void resetStats() { st = Stats(); }
+
+private:
+	void init();
+	void watch(EpollSocket *sock);
+	void watchWrite(EpollSocket *sock, bool enable);
+	void unwatch(EpollSocket *sock);
+
+	// Timer heap maintenance
+	void timerInsert(EpollTimerEngine *te);
+	void timerRemove(EpollTimerEngine *te);
+	void timerUp(int i);
+	void timerDown(int i);
+	void timerArm();
+	void timerDispatch();
+};
+
+
+} // namespace SST
+
+#endif	// SST_EPOLL
+#endif	// SST_EPOLL_H
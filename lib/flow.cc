@@ -20,11 +20,13 @@
 
 
 #include <cmath>
+#include <string.h>
 
 #include <QDataStream>
 #include <QtDebug>
 
 #include "flow.h"
+#include "flowcc.h"
 #include "sock.h"
 #include "host.h"
 #include "xdr.h"
@@ -35,12 +37,48 @@ using namespace SST;
 #define RTT_INIT	(500*1000)	// Initial RTT estimate: 1/2 second
 #define RTT_MAX		(10*1000*1000)	// Max round-trip time: ten seconds
 
-#define CWND_MIN	((unsigned)2)	// Min congestion window (packets/RTT)
-#define CWND_MAX	((unsigned)1<<20)// Max congestion window (packets/RTT)
+#define RTO_INIT	(1000*1000)	// Initial retransmit timeout: 1 second
+#define RTO_MIN		(200*1000)	// Min retransmit timeout: 200 ms
+#define RTO_MAX		(60*1000*1000)	// Max retransmit timeout: 1 minute
+#define RTO_GRANULARITY	(1000)		// Timer granularity: 1 ms
+#define MINRTT_WIN	(10*1000*1000)	// Min RTT filter window: 10 seconds
+
+#define CWND_MIN	FlowCC::cwndMin
+#define CWND_MAX	FlowCC::cwndMax
 
 #define ACKDELAY	(10*1000)	// 10 milliseconds (1/100 sec)
 #define ACKPACKETS	2		// Max outstanding packets to be ACKed
 #define ACKACKPACKETS	4		// Delay before for ACKing only ACKs
+#define ACKFREQ_PER_WIN	8		// ACKs per window we ask a peer for
+#define ACKDELAY_MIN	(1000)		// Min ACK delay we ask for: 1 ms
+
+#define REO_STEPS_MAX	16		// Max reordering window: 4 min RTTs
+#define REO_DECAY_ROUNDS 64		// Round trips before it shrinks back
+
+#define PACE_GAIN_SS	2.0f		// Window pacing gain in slow start
+#define PACE_GAIN_CA	1.2f		// Window pacing gain otherwise
+#define PACE_QUANTUM	(1000)		// Max pacer burst in microseconds
+#define PACE_QUANTUM_RTT 8		// ...but at most this fraction of SRTT
+#define PACE_BURST_MIN	2.0f		// Min pacer burst in packets
+
+#define PMTU_PRECISION	16		// Stop searching within 16 bytes
+#define PMTU_PROBES	3		// Lost probes before a size fails
+#define PMTU_RAISE	(600*1000*1000)	// Look for a larger MTU: 10 minutes
+#define PMTU_BLACKHOLE	2		// RTOs in a row before falling back
+
+#define FEC_GROUP_MIN	2		// Most redundancy: 1 repair per 2 pkts
+#define FEC_GROUP_INIT	8		// Initial packets per repair
+#define FEC_LOSS_TARGET	0.01f		// Loss to leave for retransmission
+#define FEC_FLUSH_MIN	(1000)		// Min unfinished group delay: 1ms
+
+#define HS_SAMPLES	8		// RTT samples per round HyStart++ needs
+#define HS_ETA_MIN	(4*1000)	// Min RTT rise to leave slow start: 4ms
+#define HS_ETA_MAX	(16*1000)	// Max RTT rise to leave slow start: 16ms
+#define HS_CSS_DIVISOR	4		// Slow start slowdown during CSS
+#define HS_CSS_ROUNDS	5		// Rounds of CSS before leaving slow start
+
+#define METRICS_MAX	1024		// Max remote addresses to keep metrics for
+#define METRICS_AGE	(600*1000*1000)	// Forget metrics after 10 minutes
 
 
 
@@ -50,40 +88,85 @@ FlowArmor::~FlowArmor()
 {
 }
 
+bool FlowArmor::isReentrant()
+{
+	return false;
+}
+
+int FlowArmor::overhead()
+{
+	return 0;
+}
+
 
 ////////// Flow //////////
 
+const int Flow::ackFreqMax;
+const int Flow::fecGroupMax;
+
 Flow::Flow(Host *host, QObject *parent)
 :	SocketFlow(parent),
 	h(host),
 	armr(NULL),
-	ccmode(CC_TCP), nocc(false),
-	missthresh(3),	// XX make adaptive for robustness to reordering
+	cc(NULL), nocc(false),
+	initcwnd(qBound((int)CWND_MIN, host->defaultInitialWindow(),
+			(int)CWND_MAX)),
+	coupled(host->defaultCoupledCC()),
+	ccgroup(NULL),
+	hystart(host->defaultHyStart()),
+	pacing(host->defaultTxPacing()),
+	pacetimer(host),
 	rtxtimer(host),
 	linkstat(LinkDown),
+	racktimer(host),
+	tlptimer(host),
 	delayack(true),
+	sack(false),
+	ecnecho(false),
 	acktimer(host),
+	ackfreq(false),
+	pmtud(host->defaultPathMtuDiscovery()),
+	pmtutimer(host),
+	fec(host->defaultForwardErrorCorrection()),
+	fectimer(host),
 	statstimer(host)
 {
-	Q_ASSERT(sizeof(txackmask)*8 == maskBits);
-
 	// Initialize transmit congestion control state
 	txseq = 1;
-	txevts.enqueue(TxEvent(0, false)); Q_ASSERT(txevts.size() == 1);
-	txevtseq = 0;
+	txevts.append(TxEvent(0, false)); Q_ASSERT(txevts.size() == 1);
 	txackseq = 0;
-	txackmask = 1;	// Ficticious packet 0 already "received"
+	txcecount = 0;
+	txsacked = 0;
+	txackmask.reset(defaultWindowBits, 0);	// Ficticious packet 0 "ACK'd"
 	txfltcnt = txfltsize = 0;
 	recovseq = 1;
 	markseq = 1;
 	marktime = host->currentTime();
 
+	// Initialize loss detection state
+	rackseq = 0;
+	rackrtt = 0;
+	racklow = 1;
+	reosteps = 1;
+	reoquiet = 0;
+	reospurious = false;
+	tlpseq = 0;
+	tlpout = false;
+
 	// Initialize congestion control state
-	ccReset();
+	setCongestionController(FlowCC::create(host->defaultCCMode()));
+
+	// Transmit pacing state
+	connect(&pacetimer, SIGNAL(timeout(bool)),
+		this, SLOT(paceTimeout()));
 
 	// Initialize retransmit state
 	connect(&rtxtimer, SIGNAL(timeout(bool)),
 		this, SLOT(rtxTimeout(bool)));
+	connect(&racktimer, SIGNAL(timeout(bool)),
+		this, SLOT(rackTimeout()));
+	connect(&tlptimer, SIGNAL(timeout(bool)),
+		this, SLOT(tlpTimeout()));
 
 	// Delayed ACK state
 	connect(&acktimer, SIGNAL(timeout(bool)),
@@ -91,13 +174,45 @@ Flow::Flow(Host *host, QObject *parent)
 
 	// Initialize receive sequencing/replay protection state
 	rxseq = 0;
-	rxmask = 1;	// Ficticious packet 0
+	rxmask.reset(defaultWindowBits, 0);	// Ficticious packet 0
 
 	// Initialize receive acknowledgment/congestion control state
 	rxackseq = 0;
-	//rxackmask = 1;	// Ficticious packet 0
+	rxackmask.reset(defaultWindowBits, 0);	// Ficticious packet 0
 	rxackct = 0;
 	rxunacked = 0;
+	rxcecount = 0;
+	ackpackets = ACKPACKETS;
+	ackdelay = ACKDELAY;
+	rxackfreqseq = 0;
+
+	// ACK frequency request state
+	ackfreqreq = 0;
+	ackfreqseq = 0;
+	ackfreqacked = false;
+
+	// Path MTU discovery state
+	pmtu = pmtuBase;
+	pmtuhi = pmtuMax + 1;
+	pmtuprobe = 0;
+	pmtupad = 0;
+	pmtuprobeseq = 0;
+	pmtutries = 0;
+	pmturtos = 0;
+	connect(&pmtutimer, SIGNAL(timeout(bool)),
+		this, SLOT(pmtuTimeout()));
+
+	// Forward error correction state
+	fecgroup = FEC_GROUP_INIT;
+	fecn = 0;
+	fecbase = 0;
+	feclen = 0;
+	fecsize = 0;
+	fecrx = false;
+	for (int i = 0; i < fecRxKeep; i++)
+		fecrxpkts[i].seq = 0;
+	connect(&fectimer, SIGNAL(timeout(bool)),
+		this, SLOT(fecTimeout()));
 
 	// Statistics gathering state
 	connect(&statstimer, SIGNAL(timeout(bool)),
@@ -109,28 +224,43 @@ Flow::~Flow()
 {
 	//qDebug() << this << "~Flow()";
 
+	// Make sure no armor worker is still using our packets or armor.
+	if (ArmorPipeline *pipe = h->armorPipeline())
+		pipe->cancel(this);
+
+	for (int i = 0; i < fecRxKeep; i++)
+		host()->packetPool().release(fecrxpkts[i].data);
+
 	if (armr)
 		delete armr;
-	//if (cc)
-	//	delete cc;
+	if (cc)
+		delete cc;
+	if (isActive())
+		metricsSave();
+	ccLeave();
+}
+
+void Flow::setArmor(FlowArmor *armor)
+{
+	// Pipeline jobs in flight still refer to the old armor.
+	if (ArmorPipeline *pipe = h->armorPipeline())
+		pipe->cancel(this);
+	armr = armor;
 }
 
 void
 Flow::ccReset()
 {
-	qDebug() << this << "ccReset: mode" << ccmode;
+	qDebug() << this << "ccReset: mode" << cc->mode();
 
-	cwnd = CWND_MIN;
+	cwnd = initcwnd;
 	cwndlim = true;
 	ssthresh = CWND_MAX;
-	sstoggle = true;
-	ssbase = 0;
-	cwndinc = 1;
-	cwndmax = CWND_MIN;
-	lastrtt = 0;
-	lastpps = 0;
-	basertt = 0;
-	basepps = 0;
+	ccincr = 0;
+	hsround = -1;
+	hslastmin = hscurmin = 0;
+	hssamples = 0;
+	hscssacks = 0;
 	cumrtt = RTT_INIT;
 	cumrttvar = 0;
 	cumpps = 0;
@@ -138,30 +268,100 @@ Flow::ccReset()
 	cumpwr = 0;
 	cumbps = 0;
 	cumloss = 0;
+
+	srtt = 0;
+	rttvar = 0;
+	rto = RTO_INIT;
+	minrtt = 0;
+	minrtttime = h->currentTime();
+
+	pacerate = 0;
+	pacetokens = PACE_BURST_MIN;
+	pacetime = h->currentTime();
+	pacetimer.stop();
+
+	cc->reset();
+}
+
+void Flow::setCongestionController(FlowCC *newcc)
+{
+	Q_ASSERT(newcc != NULL && newcc->fl == NULL);
+	if (cc)
+		delete cc;
+	cc = newcc;
+	cc->fl = this;
+	ccReset();
+}
+
+CCMode Flow::ccMode() const
+{
+	return cc->mode();
+}
+
+void Flow::setCCMode(CCMode mode)
+{
+	setCongestionController(FlowCC::create(mode));
+}
+
+void Flow::setTxPacing(bool enabled)
+{
+	pacing = enabled;
+	if (!cc->pacesItself())
+		pacerate = 0;
 }
 
 void Flow::start(bool initiator)
 {
 	Q_ASSERT(armr);
 
-	SocketFlow::start(initiator);
-
 	// Test whether we actually need congestion control
 	if (isSocketCongestionControlled())
 		nocc = true;
 
+	// Start from what other flows to the same host have learned,
+	// or failing that, from what the last one did.
+	if (coupled)
+		ccJoin();
+	if (srtt == 0 && !nocc)
+		metricsSeed();
+
+	// With SACK our windows bound how far back a hole can be reported,
+	// so make them cover a few of the windows we expect to keep in flight.
+	// They can only be resized before we go active.
+	if (sack) {
+		int bits = defaultWindowBits;
+		while (bits < maxWindowBits && (quint32)bits < 4 * cwnd)
+			bits *= 2;
+		if (bits != windowBits())
+			setWindowBits(bits);
+	}
+
+	SocketFlow::start(initiator);
+
 	// We're ready to go!
 	rtxstart();
 	readyTransmit();
 
 	setLinkStatus(LinkUp);
+
+	pmtuNext();
 }
 
 void Flow::stop()
 {
 	rtxtimer.stop();
+	racktimer.stop();
+	tlptimer.stop();
 	acktimer.stop();
+	pacetimer.stop();
+	pmtutimer.stop();
+	fectimer.stop();
 	statstimer.stop();
+	pmtuprobe = 0;
+	fecn = 0;
+	if (isActive())
+		metricsSave();
+	ccLeave();
 
 	SocketFlow::stop();
 
@@ -171,7 +371,88 @@ void Flow::stop()
 	// XXX then auto-delete self?
 }
 
-inline qint64 Flow::markElapsed()
+void Flow::setPathMtuDiscovery(bool enabled)
+{
+	pmtud = enabled;
+	if (enabled)
+		return pmtuNext();
+
+	pmtutimer.stop();
+	pmtu = pmtuBase;
+	pmtuhi = pmtuMax + 1;
+	pmtuprobe = 0;
+	pmtutries = 0;
+}
+
+// flowTransmit() may append an ACK frequency request word
+// and an ECN echo word to any data packet, even a retransmission
+// of one sized before we had a request to send, so leave room for them.
+int Flow::txMtu() const
+{
+	bool ackfreqword = ackfreq || (ackfreqreq && !ackfreqacked);
+	return pmtu - ipOverhead - (armr ? armr->overhead() : 0)
+		- (fec ? fecOverhead : 0) - (ackfreqword ? 4 : 0)
+		- (ecnecho ? 4 : 0);
+}
+
+// Send the next path MTU probe, if we're still searching.
+// We search between the largest packet size known to get through
+// and the smallest known not to, trying pmtuMax first,
+// since a path that carries jumbo frames usually does so end to end,
+// then bisecting the range.  Each probe is an ACK packet padded
+// to the probe size, which our peer acknowledges right away.
+void Flow::pmtuNext()
+{
+	if (!pmtud || !isActive() || pmtuprobe)
+		return;
+
+	// Take into account any smaller MTU the OS has learned about
+	// from ICMP "packet too big" messages.
+	int osmtu = udpPathMtu();
+	if (osmtu >= pmtuBase && osmtu < pmtuhi) {
+		pmtuhi = osmtu + 1;
+		pmtu = qMin(pmtu, osmtu);
+	}
+
+	// Once we've narrowed it down, check back much later
+	// in case the path has changed to allow larger packets.
+	if (pmtuhi - pmtu <= PMTU_PRECISION) {
+		qDebug() << this << "path MTU" << pmtu;
+		pmtutimer.start(PMTU_RAISE);
+		return;
+	}
+
+	// Finish any FEC group first, since probes are left out of them.
+	if (fecn)
+		fecRepair();
+
+	pmtuprobe = pmtuhi > pmtuMax ? pmtuMax : (pmtu + pmtuhi) / 2;
+	pmtupad = pmtuprobe - ipOverhead - armr->overhead();
+	txack(rxackseq, rxackct);
+	pmtupad = 0;
+	pmtutimer.start(rto);
+}
+
+// Flow::pmtutimer invokes this slot when a path MTU probe has been lost,
+// when it's time to send the next one, or to search again for a larger MTU.
+// The probe may have been lost for other reasons, so we only conclude
+// that a size doesn't fit after losing PMTU_PROBES probes of that size.
+void Flow::pmtuTimeout()
+{
+	pmtutimer.stop();
+	if (pmtuprobe) {
+		qDebug() << this << "path MTU probe of" << pmtuprobe << "lost";
+		if (++pmtutries >= PMTU_PROBES) {
+			pmtuhi = pmtuprobe;
+			pmtutries = 0;
+		}
+		pmtuprobe = 0;
+	} else if (pmtuhi - pmtu <= PMTU_PRECISION)
+		pmtuhi = pmtuMax + 1;
+	pmtuNext();
+}
+
+qint64 Flow::markElapsed()
 {
 	return host()->currentTime().since(marktime).usecs;
 }
@@ -198,15 +479,27 @@ bool Flow::tx(QByteArray &pkt, quint32 packseq, quint64 &pktseq, bool isdata)
 	pkt32[0] = htonl(ptxseq);
 	pkt32[1] = htonl(packseq);
 
-	// Encrypt and compute the MAC for the packet
-	QByteArray epkt = armr->txenc(txseq, pkt);
+	// Fold the packet into the current FEC group, starting a new group
+	// only with a data packet.  Padded packets are left out,
+	// being either probes that may be too large or repairs themselves.
+	if (fec && !(packseq & padFlag) && (isdata || fecn))
+		fecAdd(pkt);
+
+	// Encrypt and compute the MAC for the packet,
+	// unless the armor pipeline is going to do so.
+	PacketPool &pool = host()->packetPool();
+	QByteArray epkt = pool.alloc(pkt.size());
+	ArmorPipeline *pipe = armorPipe();
+	if (!pipe)
+		armr->txenc(txseq, pkt, epkt);
 
 	// Bump transmit sequence number,
 	// and timestamp if this packet is marked for RTT measurement
 	// This is the "Point of no return" -
 	// a failure after this still consumes sequence number space.
+	Time now = host()->currentTime();
 	if (txseq == markseq) {
-		marktime = host()->currentTime();
+		marktime = now;
 		markacks = 0;
 		markbase = txackseq;
 		marksent = txseq - txackseq;
@@ -215,20 +508,62 @@ bool Flow::tx(QByteArray &pkt, quint32 packseq, quint64 &pktseq, bool isdata)
 
 	// Record the transmission event
 	TxEvent evt(pkt.size(), isdata);
+	evt.txtime = now;
 	if (isdata) {
 		txfltcnt++;
 		txfltsize += evt.size;
+		if (pacerate > 0)
+			paceSent();
 		//qDebug() << this << "tx-data seq" << txseq
 		//	<< "txfltcnt" << txfltcnt;
 	}
-	txevts.enqueue(evt);
-	Q_ASSERT(txevtseq + txevts.size() == txseq);
+	txevts.append(evt);
+	Q_ASSERT(txevts.end() == txseq);
 	Q_ASSERT(txfltcnt <= (unsigned)txevts.size());
 
 	//qDebug() << this << "tx seq" << txseq << "size" << epkt.size();
 
-	// Ship it out
-	return udpSend(epkt);
+	// Ship it out, and recycle the armored copy once the socket is done.
+	// The pipeline sends it via armorTxDone() instead, in txseq order.
+	if (pipe) {
+		pipe->submitTx(this, armr, pktseq, pkt, epkt);
+		return true;
+	}
+	bool ok = !epkt.isEmpty() && udpSend(epkt);
+	pool.release(epkt);
+	return ok;
+}
+
+void Flow::armorTxDone(quint64, QByteArray &epkt)
+{
+	if (isActive() && !epkt.isEmpty())
+		udpSend(epkt);
+}
+
+void Flow::armorRelease(QByteArray &buf)
+{
+	host()->packetPool().release(buf);
+}
+
+Socket *Flow::armorSocket()
+{
+	return isActive() ? remoteEndpoint().sock : NULL;
+}
+
+ArmorPipeline *Flow::armorPipe()
+{
+	ArmorPipeline *pipe = h->armorPipeline();
+	return pipe && armr->isReentrant() ? pipe : NULL;
+}
+
+// Send a standalone ACK packet built in a pooled buffer
+bool Flow::txack(quint64 ackseq, unsigned ackct)
+{
+	PacketPool &pool = host()->packetPool();
+	QByteArray pkt = pool.alloc(hdrlen);
+	bool ok = transmitAck(pkt, ackseq, ackct);
+	pool.release(pkt);
+	return ok;
 }
 
 // Send a standalone ACK packet
@@ -241,8 +576,91 @@ bool Flow::transmitAck(QByteArray &pkt, quint64 ackseq, unsigned ackct)
 	if (pkt.size() < hdrlen)
 		pkt.resize(hdrlen);
 	quint32 packseq = (ackct << ackctShift) | (ackseq & ackSeqMask);
+	if (ecnecho && rxcecount) {
+		quint32 cnt = htonl(rxcecount);
+		pkt.append((const char*)&cnt, 4);
+		packseq |= ecnFlag;
+	}
+	if (sack)
+		packseq |= txsack(pkt, ackseq, ackct);
+	if (pmtupad >= pkt.size() + 4) {
+		int ofs = pkt.size();
+		quint32 len = pmtupad - ofs;
+		pkt.resize(pmtupad);
+		memset(pkt.data() + ofs, 0, len - 4);
+		len = htonl(padProbe << padTypeShift | len);
+		memcpy(pkt.data() + pmtupad - 4, &len, 4);
+		packseq |= padFlag;
+	}
 	quint64 pktseq;
-	return tx(pkt, packseq, pktseq, false);
+	bool ok = tx(pkt, packseq, pktseq, false);
+	if (packseq & padFlag)
+		pmtuprobeseq = pktseq;
+	return ok;
+}
+
+// Append a selective ACK trailer to an ACK packet, describing
+// the most recent ranges of packets we've received and acknowledged
+// below the contiguous run of ackct+1 packets ending at ackseq.
+// Returns sackFlag if a trailer was added,
+// or 0 if there are no gaps within our window to report.
+quint32 Flow::txsack(QByteArray &pkt, quint64 ackseq, unsigned ackct)
+{
+	if (ackseq <= ackct)
+		return 0;
+	quint64 lim = rxackmask.base() ? rxackmask.base() - 1 : 0;
+
+	// Find the most recent hole, then alternate between
+	// the top of each received range and the hole below it.
+	quint64 seq = rxackmask.findBelow(ackseq - ackct - 1, false, lim);
+	if (seq == lim)
+		return 0;
+	quint32 blks[sackMaxBlocks];
+	int nblks = 0;
+	while (nblks < sackMaxBlocks) {
+		quint64 top = rxackmask.findBelow(seq, true, lim);
+		if (top == lim)
+			break;
+		seq = rxackmask.findBelow(top, false, lim);
+		quint64 len = qMin(top - seq, (quint64)0xffff);
+		blks[nblks++] = htonl((ackseq - top) << 16 | len);
+		if (seq == lim)
+			break;
+	}
+	if (nblks == 0)
+		return 0;
+
+	int ofs = pkt.size();
+	pkt.resize(ofs + (nblks + 1) * 4);
+	char *p = pkt.data() + ofs;
+	memcpy(p, blks, nblks * 4);
+	quint32 cnt = htonl(nblks);
+	memcpy(p + nblks * 4, &cnt, 4);
+	return sackFlag;
+}
+
+void Flow::setPeerOptions(quint32 opts)
+{
+	Q_ASSERT(!isActive());
+	setSelectiveAcks(h->defaultSelectiveAcks()
+			&& (opts & optSelectiveAcks));
+	setEcnEcho(h->defaultEcnEcho() && (opts & optEcnEcho));
+	setAckFrequency(h->defaultAckFrequency() && (opts & optAckFrequency));
+
+	// A peer that will send us repair packets needs us to hold onto
+	// packets from the start, or its first group can't be rebuilt.
+	if (opts & optRepairs)
+		fecrx = true;
+}
+
+void Flow::setWindowBits(int bits)
+{
+	Q_ASSERT(!isActive());
+	bits = qMin(bits, maxWindowBits);
+
+	txackmask.reset(bits, txackmask.top());
+	rxmask.reset(bits, rxmask.top());
+	rxackmask.reset(bits, rxackmask.top());
 }
 
 // High-level public transmit function.
@@ -257,8 +675,32 @@ bool Flow::flowTransmit(QByteArray &pkt, quint64 &pktseq)
 		acktimer.stop();
 	}
 
+	// Repeat any ACK frequency request until the peer has received it,
+	// and echo our CE count along with the ACK we're piggybacking,
+	// appending them only for the duration of the transmit,
+	// since the caller holds onto the packet for retransmission.
+	int size = pkt.size();
+	if (ackfreqreq && !ackfreqacked) {
+		quint32 req = htonl(ackfreqreq);
+		pkt.append((const char*)&req, 4);
+		packseq |= ackFreqFlag;
+		if (!ackfreqseq)
+			ackfreqseq = txseq;
+	}
+	if (ecnecho && rxcecount) {
+		quint32 cnt = htonl(rxcecount);
+		pkt.append((const char*)&cnt, 4);
+		packseq |= ecnFlag;
+	}
+
 	// Send the packet
 	bool success = tx(pkt, packseq, pktseq, true);
+	if (pkt.size() != size)
+		PacketPool::setSize(pkt, size);
+
+	// Follow a complete FEC group with its repair packet
+	if (fecn >= fecgroup)
+		fecRepair();
 
 	// If the retransmission timer is inactive, start it afresh.
 	// (If this was a retransmission, rtxTimeout() would have restarted it.)
@@ -277,12 +719,72 @@ int Flow::mayTransmit()
 	if (nocc)	// socket already provides congestion control
 		return SocketFlow::mayTransmit();
 
-	if (cwnd > txfltcnt) {
-		return cwnd - txfltcnt;
-	} else {
+	if (cwnd <= txfltcnt) {
 		cwndlim = true;
 		return 0;
 	}
+
+	// Let the pacer spread the window out over the round-trip.
+	int win = cwnd - txfltcnt;
+	if (pacerate > 0)
+		win = qMin(win, paceAllowance());
+	return win;
+}
+
+// Return the pacer's quantum in microseconds: the longest burst it allows.
+// On short paths a fixed millisecond could be the whole round trip,
+// so shrink it to a fraction of the smoothed RTT there.
+int Flow::paceQuantum()
+{
+	int q = PACE_QUANTUM;
+	if (srtt > 0)
+		q = qMin(q, qMax(srtt / PACE_QUANTUM_RTT, 1));
+	return q;
+}
+
+// Replenish the pacer's token bucket for the time elapsed.
+// The bucket holds at most a quantum's worth of packets,
+// which bounds the size of any burst after an idle period.
+void Flow::paceRefill()
+{
+	Time now = host()->currentTime();
+	float burst = qMax(PACE_BURST_MIN,
+			pacerate * (paceQuantum() / 1000000.0f));
+	pacetokens += now.since(pacetime).usecs * (pacerate / 1000000.0f);
+	pacetokens = qMin(pacetokens, burst);
+	pacetime = now;
+}
+
+// Return the number of packets the pacer lets us send right now.
+int Flow::paceAllowance()
+{
+	paceRefill();
+	return pacetokens >= 1.0 ? (int)pacetokens : 0;
+}
+
+// Take a token for a data packet we just sent.  If that empties
+// the bucket, arm pacetimer to tell the upper layer when it may
+// send again.  Since the bucket holds a quantum's worth of packets,
+// we lose nothing by waiting at least that long,
+// and it keeps the timer from firing for every packet.
+void Flow::paceSent()
+{
+	paceRefill();
+	pacetokens -= 1.0;
+	if (pacetokens >= 1.0 || pacetimer.isActive())
+		return;
+
+	qint64 wait = (qint64)ceilf((1.0f - pacetokens)
+				* 1000000.0f / pacerate);
+	pacetimer.start(qMax(wait, (qint64)paceQuantum()));
+}
+
+// Flow::pacetimer invokes this slot when the pacer lets us send again.
+void Flow::paceTimeout()
+{
+	pacetimer.stop();
+	if (mayTransmit())
+		readyTransmit();
 }
 
 // Flow::rtxtimer invokes this slot when the retransmission timer expires.
@@ -297,17 +799,22 @@ void Flow::rtxTimeout(bool fail)
 	// with an exponentially increased backoff delay.
 	rtxtimer.restart();
 
-	if (!nocc) switch (ccmode) {
-	default:
-		// Reset cwnd and go back to slow start
-		ssthresh = txfltcnt / 2;
-		ssthresh = qMax(ssthresh, CWND_MIN);
-		cwnd = CWND_MIN;
-		//qDebug("rtxTimeout: ssthresh = %d, cwnd = %d",
-		//		ssthresh, cwnd);
-
-	case CC_FIXED:
-		break;	// fixed cwnd, no congestion control
+	if (!nocc)
+		cc->timeout();
+
+	// Repeated timeouts with no large packets getting through may mean
+	// the path has stopped carrying packets of the size we found,
+	// without telling us via ICMP.  Fall back to pmtuBase,
+	// which we never need to confirm, and search again from there.
+	if (pmtud && pmtu > pmtuBase && ++pmturtos >= PMTU_BLACKHOLE) {
+		qDebug() << this << "path MTU black hole: falling back from"
+			<< pmtu << "to" << pmtuBase;
+		pmtuhi = pmtu;
+		pmtu = pmtuBase;
+		pmtuprobe = 0;
+		pmtutries = 0;
+		pmturtos = 0;
+		pmtuNext();
 	}
 
 
@@ -316,8 +823,8 @@ void Flow::rtxTimeout(bool fail)
 	// Snapshot txseq first, because the missed() calls in the loop
 	// might cause more packets to be transmitted.
 	quint64 seqlim = txseq;
-	for (quint64 seq = txevtseq; seq < seqlim; seq++) {
-		TxEvent &e = txevts[seq - txevtseq];
+	for (quint64 seq = txevts.base(); seq < seqlim; seq++) {
+		TxEvent &e = txevts[seq];
 		if (e.pipe) {
 			e.pipe = false;
 			txfltcnt--;
@@ -344,7 +851,137 @@ void Flow::rtxTimeout(bool fail)
 	setLinkStatus(fail ? LinkDown : LinkStalled);
 }
 
-void Flow::receive(QByteArray &pkt, const SocketEndpoint &)
+// (Re)start the retransmission timer, along with the tail loss probe
+// timer if a probe would usefully fire sooner.
+void Flow::rtxstart()
+{
+	rtxtimer.start(rto);
+
+	if (srtt == 0 || tlpout) {
+		tlptimer.stop();
+		return;
+	}
+
+	// Allow for a delayed ACK if only one packet is outstanding.
+	int pto = 2 * srtt;
+	if (txfltcnt == 1)
+		pto += ACKDELAY;
+	if (pto < rto)
+		tlptimer.start(pto);
+	else
+		tlptimer.stop();
+}
+
+// Flow::tlptimer invokes this slot when nothing has been acknowledged
+// for a couple of round trips.  The last packets we sent were probably
+// lost, leaving no later packets whose ACKs would let RACK detect it.
+// Resend the most recent one without touching the congestion window,
+// so its ACK either accounts for the tail or exposes the losses
+// without waiting for the retransmission timeout.
+void Flow::tlpTimeout()
+{
+	tlptimer.stop();
+	if (tlpout || !txfltcnt)
+		return;
+
+	for (quint64 seq = txseq - 1; seq >= txevts.base() && seq > 0; seq--) {
+		TxEvent &e = txevts[seq];
+		if (!e.pipe)
+			continue;
+		qDebug() << this << "tail loss probe: resending seq" << seq;
+		e.pipe = false;
+		txfltcnt--;
+		txfltsize -= e.size;
+		tlpseq = seq;
+		tlpout = true;
+		missed(seq, 1);
+		break;
+	}
+
+	// Force a transmission regardless of cwnd, as in rtxTimeout().
+	readyTransmit();
+}
+
+// Note a packet newly acknowledged by an ACK we're processing.
+// A data packet we already gave up on as lost (other than to a probe)
+// means RACK's reordering window was too narrow.
+void Flow::rackAcked(quint64 seq, const TxEvent &e)
+{
+	// A path MTU probe got through: raise our MTU to its size,
+	// and send the next probe once we're done with this ACK.
+	if (pmtuprobe && seq == pmtuprobeseq) {
+		qDebug() << this << "path MTU" << pmtuprobe << "confirmed";
+		pmtu = pmtuprobe;
+		pmtuprobe = 0;
+		pmtutries = 0;
+		pmtutimer.start(0);
+	}
+
+	// Any packet bigger than pmtuBase getting through
+	// means we're not facing a path MTU black hole.
+	if (e.size > pmtuBase - ipOverhead - armr->overhead())
+		pmturtos = 0;
+
+	if (!e.data)
+		return;
+	if (ackfreqseq && seq >= ackfreqseq)
+		ackfreqacked = true;
+	if (seq > rackseq) {
+		rackseq = seq;
+		rackrtt = host()->currentTime().since(e.txtime).usecs;
+	}
+	if (!e.pipe && seq != tlpseq)
+		reospurious = true;
+}
+
+// RACK loss detection: infer that a data packet has been lost
+// once a packet sent after it has been delivered, and it has been
+// outstanding longer than that packet's RTT plus a reordering window.
+// Since our sequence numbers increase with transmission time,
+// we just scan upward from the oldest packet still in flight,
+// and arm racktimer for the first one still within its window.
+void Flow::rackDetect()
+{
+	racklow = qMax(racklow, txevts.base());
+	while (racklow < rackseq && !txevts[racklow].pipe)
+		racklow++;
+	if (racklow >= rackseq) {
+		racktimer.stop();
+		return;
+	}
+
+	int reowin = qMin(reosteps * minrtt / 4, srtt);
+	qint64 now = host()->currentTime().usecs;
+	for (quint64 seq = racklow; seq < rackseq; seq++) {
+		TxEvent &e = txevts[seq];
+		if (!e.pipe)
+			continue;
+		qint64 wait = e.txtime.usecs + rackrtt + reowin - now;
+		if (wait > 0) {
+			racktimer.start(wait);
+			return;
+		}
+		e.pipe = false;
+		txfltcnt--;
+		txfltsize -= e.size;
+		ccMissed(seq);
+		missed(seq, 1);
+		qDebug() << this << "rack-missed seq" << seq
+			<< "txfltcnt" << txfltcnt;
+	}
+	racktimer.stop();
+}
+
+// Flow::racktimer invokes this slot when a reordering window expires.
+void Flow::rackTimeout()
+{
+	racktimer.stop();
+	rackDetect();
+	if (mayTransmit())
+		readyTransmit();
+}
+
+void Flow::receive(QByteArray &pkt, const SocketEndpoint &src)
 {
 	if (!isActive()) {
 		qDebug() << this << "receive: inactive flow";
@@ -367,46 +1004,167 @@ void Flow::receive(QByteArray &pkt, const SocketEndpoint &)
 	//qDebug() << this << "rx seq" << pktseq << "size" << pkt.size();
 
 	// Immediately drop too-old or already-received packets
-	Q_ASSERT(sizeof(rxmask)*8 == maskBits);
 	if (seqdiff > 0) {
 		if (pktseq < rxseq) {
 			qDebug("Flow receive: 64-bit wraparound detected!");
 			return;
 		}
-	} else if (seqdiff <= -maskBits) {
+	} else if (!rxmask.contains(pktseq)) {
 		qDebug("Flow receive: too-old packet dropped");
 		return;
-	} else if (seqdiff <= 0) {
-		if (rxmask & (1 << -seqdiff)) {
-			qDebug("Flow receive: duplicate packet dropped");
-			return;
-		}
+	} else if (rxmask.test(pktseq)) {
+		qDebug("Flow receive: duplicate packet dropped");
+		return;
 	}
 
-	// Authenticate and decrypt the packet
+	// Authenticate and decrypt the packet,
+	// on one of the armor pipeline's worker threads if we have one.
+	int ecn = src.sock ? src.sock->receivedEcn() : EcnNotEct;
+	if (ArmorPipeline *pipe = armorPipe()) {
+		pipe->submitRx(this, armr, pktseq, pkt, ecn);
+		return;
+	}
 	if (!armr->rxdec(pktseq, pkt)) {
 		qDebug() << this << "receive: auth failed on rx" << pktseq;
 		return;
 	}
+	rxdecoded(pktseq, pkt, ecn);
+}
 
-	// Record this packet as received for replay protection
-	if (seqdiff > 0) {
-		// Roll rxseq and rxmask forward appropriately.
-		rxseq = pktseq;
-		if (seqdiff < maskBits)
-			rxmask = (rxmask << seqdiff) + 1;
-		else
-			rxmask = 1;	// bit 0 = packet just received
-	} else {
-		// Set appropriate bit in rxmask
-		Q_ASSERT(seqdiff < 0 && seqdiff > -maskBits);
-		rxmask |= (1 << -seqdiff);
+void Flow::armorRxDone(quint64 pktseq, QByteArray &pkt, int ecn)
+{
+	if (!isActive())
+		return;
+	rxdecoded(pktseq, pkt, ecn);
+}
+
+// Second half of receive(), processing an authenticated packet
+// that arrived with ECN codepoint 'ecn'.
+void Flow::rxdecoded(quint64 pktseq, QByteArray &pkt, int ecn)
+{
+	// Check again for replays, since with the armor pipeline
+	// other packets may have been accepted in the meantime.
+	if (pktseq <= rxseq
+			&& (!rxmask.contains(pktseq) || rxmask.test(pktseq))) {
+		qDebug("Flow receive: duplicate packet dropped");
+		return;
 	}
 
+	// Record this packet as received for replay protection,
+	// rolling rxseq and rxmask forward if appropriate.
+	rxmask.set(pktseq);
+	rxseq = rxmask.top();
+	udpAuthenticated();
+
 	// Decode the rest of the flow header
-	pkt32 = (quint32*)pkt.data(); // might have changed in armr->rxdec()!
+	quint32 *pkt32 = (quint32*)pkt.data();
 	quint32 packseq = ntohl(pkt32[1]);
 
+	// Once we know our peer sends repair packets, from key exchange
+	// or from the first one to arrive, hold onto each packet
+	// as received, for rebuilding its lost neighbors.
+	// Copy just the part a repair covers into the slot's own buffer,
+	// leaving pkt unshared so stripping its trailers below
+	// doesn't detach it from the pool.
+	if (fecrx) {
+		FecRxPkt &r = fecrxpkts[pktseq % fecRxKeep];
+		int len = pkt.size() - 4;
+		if (r.data.isNull())
+			r.data = host()->packetPool().alloc(len);
+		else
+			PacketPool::setSize(r.data, len);
+		memcpy(r.data.data(), pkt.constData() + 4, len);
+		r.seq = pktseq;
+	}
+
+	// Strip off any padding trailer: path MTU probe padding,
+	// or FEC repair data for packets our peer sent before this one.
+	bool padded = false;
+	QByteArray repair;
+	if (packseq & padFlag) {
+		int size = pkt.size();
+		quint32 word = 0;
+		if (size >= hdrlen + 4) {
+			memcpy(&word, pkt.constData() + size - 4, 4);
+			word = ntohl(word);
+		}
+		quint32 len = word & padLenMask;
+		if (len < 4 || len > (quint32)(size - hdrlen)) {
+			qDebug() << this << "receive: bad padding";
+			return;
+		}
+		if ((word >> padTypeShift) == padRepair)
+			repair = pkt.mid(size - len, len - 4);
+		else
+			padded = true;
+		PacketPool::setSize(pkt, size - len);
+	}
+
+	// Strip off any selective ACK trailer
+	quint32 sackblks[sackMaxBlocks];
+	int nsack = 0;
+	if (packseq & sackFlag) {
+		int size = pkt.size();
+		quint32 cnt = sackMaxBlocks + 1;
+		if (size >= hdrlen + 4) {
+			memcpy(&cnt, pkt.constData() + size - 4, 4);
+			cnt = ntohl(cnt);
+		}
+		if (cnt > (unsigned)sackMaxBlocks
+				|| size < hdrlen + (int)(cnt + 1) * 4) {
+			qDebug() << this << "receive: bad SACK trailer";
+			return;
+		}
+		nsack = cnt;
+		size -= (nsack + 1) * 4;
+		memcpy(sackblks, pkt.constData() + size, nsack * 4);
+		PacketPool::setSize(pkt, size);
+	}
+
+	// Strip off any ECN echo word, noting newly reported CE marks.
+	// The count is cumulative, so lost or reordered ACKs don't matter.
+	quint32 newce = 0;
+	if (packseq & ecnFlag) {
+		int size = pkt.size() - 4;
+		if (size < hdrlen) {
+			qDebug() << this << "receive: bad ECN echo";
+			return;
+		}
+		quint32 cnt;
+		memcpy(&cnt, pkt.constData() + size, 4);
+		cnt = ntohl(cnt);
+		if ((qint32)(cnt - txcecount) > 0) {
+			newce = cnt - txcecount;
+			txcecount = cnt;
+		}
+		PacketPool::setSize(pkt, size);
+	}
+	if (ecn == EcnCE)
+		rxcecount++;
+
+	// Strip off any ACK frequency request, and apply it
+	// unless we've already applied one our peer sent later.
+	if (packseq & ackFreqFlag) {
+		int size = pkt.size() - 4;
+		if (size < hdrlen) {
+			qDebug() << this << "receive: bad ACK frequency request";
+			return;
+		}
+		quint32 req;
+		memcpy(&req, pkt.constData() + size, 4);
+		req = ntohl(req);
+		if (pktseq > rxackfreqseq) {
+			rxackfreqseq = pktseq;
+			ackpackets = qBound(1, (int)(req >> 24), ackFreqMax);
+
+			// Don't let a peer make us sit on ACKs long enough
+			// to provoke its retransmit timer.
+			ackdelay = qMin((int)(req & 0xffffff),
+					qMin(ACKDELAY, rto / 2));
+		}
+		PacketPool::setSize(pkt, size);
+	}
+
 	// Update our transmit state with the ack info in this packet
 	unsigned ackct = (packseq >> ackctShift) & ackctMask;
 	qint32 ackdiff = ((qint32)(packseq << chanBits)
@@ -423,15 +1181,45 @@ void Flow::receive(QByteArray &pkt, const SocketEndpoint &)
 
 	// Account for newly acknowledged packets
 	unsigned newpackets = 0;
+
+	// First take any selective ACK ranges into account,
+	// so that packets they cover aren't inferred dropped below.
+	unsigned sackpackets = 0;
+	for (int i = 0; i < nsack; i++) {
+		quint32 blk = ntohl(sackblks[i]);
+		quint64 gap = blk >> 16, len = blk & 0xffff;
+		if (gap > ackseq || len == 0)
+			continue;
+		quint64 hi = ackseq - gap;
+		quint64 lim = hi - qMin(len, hi);
+
+		// Skip quickly over packets already known to be ACK'd.
+		for (quint64 seq = txackmask.findBelow(hi, false, lim);
+				seq != lim;
+				seq = txackmask.findBelow(seq - 1, false, lim)) {
+			txackmask.set(seq);
+			sackpackets++;
+			txsacked++;
+			if (!txevts.contains(seq))
+				continue;
+			TxEvent &e = txevts[seq];
+			rttAcked(e);
+			rackAcked(seq, e);
+			if (e.pipe) {
+				e.pipe = false;
+				txfltcnt--;
+				txfltsize -= e.size;
+
+				acked(seq, 1, pktseq);
+			}
+		}
+	}
+
 	if (ackdiff > 0) {
 
 		// Received acknowledgment for one or more new packets.
-		// Roll forward txackseq and txackmask.
+		// Roll forward txackseq; txackmask follows as we set bits.
 		txackseq = ackseq;
-		if (ackdiff < maskBits)
-			txackmask <<= ackdiff;
-		else
-			txackmask = 0;
 
 		// Determine the number of newly-acknowledged packets
 		// since the highest previously acknowledged sequence number.
@@ -443,14 +1231,15 @@ void Flow::receive(QByteArray &pkt, const SocketEndpoint &)
 		//	<< "newpackets" << newpackets
 		//	<< "txackseq" << txackseq;
 
-		// Record the new in-sequence packets in txackmask as received.
+		// Record the new in-sequence packets in txackmask as received,
+		// and notify the upper layer of newly-acknowledged data packets.
 		// (But note: ackct+1 may also include out-of-sequence pkts.)
-		txackmask |= (1 << newpackets) - 1;
-
-		// Notify the upper layer of newly-acknowledged data packets
 		for (quint64 seq = txackseq - newpackets + 1;
 				seq <= txackseq; seq++) {
-			TxEvent &e = txevts[seq - txevtseq];
+			txackmask.set(seq);
+			TxEvent &e = txevts[seq];
+			rttAcked(e);
+			rackAcked(seq, e);
 			if (e.pipe) {
 				e.pipe = false;
 				txfltcnt--;
@@ -460,46 +1249,29 @@ void Flow::receive(QByteArray &pkt, const SocketEndpoint &)
 			}
 		}
 
-		// Infer that packets left un-acknowledged sufficiently late
-		// have been dropped, and notify the upper layer as such.
-		// XX we could avoid some of this arithmetic if we just
-		// made sequence numbers start a bit higher.
-		quint64 misslim = txackseq - qMin(txackseq, (quint64)
-					qMax(missthresh, newpackets));
-		for (quint64 missseq = txackseq - qMin(txackseq, (quint64)
-					(missthresh+ackdiff-1));
-				missseq <= misslim; missseq++) {
-			TxEvent &e = txevts[missseq - txevtseq];
+		// Finally, notice packets as they exit our ack window,
+		// and garbage collect their transmit records,
+		// since they can never be acknowledged after that.
+		// Any still awaiting RACK's verdict must be given up on.
+		while (txevts.base() < txackmask.base()) {
+			quint64 seq = txevts.base();
+			//qDebug() << this << "seq" << seq << "expired";
+			TxEvent &e = txevts.head();
 			if (e.pipe) {
-				//qDebug() << this << "seq" << txevtseq
-				//	<< "inferred dropped";
 				e.pipe = false;
 				txfltcnt--;
 				txfltsize -= e.size;
-				ccMissed(missseq);
-				missed(missseq, 1);
-				qDebug() << this << "infer-missed seq"
-					<< missseq << "txfltcnt" << txfltcnt;
-			}
-		}
-
-		// Finally, notice packets as they exit our ack window,
-		// and garbage collect their transmit records,
-		// since they can never be acknowledged after that.
-		if (txackseq > (unsigned)maskBits) {
-			while (txevtseq <= txackseq-maskBits) {
-				//qDebug() << this << "seq" << txevtseq
-				//	<< "expired";
-				Q_ASSERT(!txevts.head().pipe);
-				txevts.removeFirst();
-				txevtseq++;
-				expire(txevtseq-1, 1);
+				ccMissed(seq);
+				missed(seq, 1);
 			}
+			expire(seq, 1);
+			txevts.removeFirst();
 		}
 
 		// Reset the retransmission timer, since we've made progress.
 		// Only re-arm it if there's still outstanding unACKed data.
 		setLinkStatus(LinkUp);
+		tlpout = false;
 		if (txfltcnt) {
 			//qDebug() << this << "receive: rtxstart at time"
 			//	<< QDateTime::currentDateTime()
@@ -507,6 +1279,7 @@ void Flow::receive(QByteArray &pkt, const SocketEndpoint &)
 			rtxstart();
 		} else {
 			rtxtimer.stop();
+			tlptimer.stop();
 		}
 
 		// Now that we've moved txackseq forward to the packet's ackseq,
@@ -519,73 +1292,42 @@ void Flow::receive(QByteArray &pkt, const SocketEndpoint &)
 	// (or an out-of-order acknowledgment for in-order packets).
 	// Set the appropriate bits in our txackmask,
 	// and count newly acknowledged packets within our window.
-	quint32 newmask = (1 << ackct) - 1;
-	if ((txackmask & newmask) != newmask) {
-		for (unsigned i = 0; i <= ackct; i++) {
-			int bit = -ackdiff + i;
-			if (bit >= maskBits)
-				break;
-			if (txackmask & (1 << bit))
-				continue;	// already ACKed
-			txackmask |= (1 << bit);
-
-			TxEvent &e = txevts[txackseq - bit - txevtseq];
-			if (e.pipe) {
-				e.pipe = false;
-				txfltcnt--;
-				txfltsize -= e.size;
+	for (unsigned i = 0; i <= ackct; i++) {
+		quint64 seq = ackseq - i;
+		if (!txackmask.contains(seq))
+			break;
+		if (txackmask.test(seq))
+			continue;	// already ACKed
+		txackmask.set(seq);
 
-				acked(txackseq - bit, 1, pktseq);
-			}
+		TxEvent &e = txevts[seq];
+		rttAcked(e);
+		rackAcked(seq, e);
+		if (e.pipe) {
+			e.pipe = false;
+			txfltcnt--;
+			txfltsize -= e.size;
 
-			newpackets++;
+			acked(seq, 1, pktseq);
 		}
-	}
-
-	// Count the total number of acknowledged packets since the last mark.
-	markacks += newpackets;
 
-	if (!nocc) switch (ccmode) {
-	case CC_VEGAS:
-		sstoggle = !sstoggle;
-		if (sstoggle)
-			break;	// do slow start only once every two RTTs
-
-		// fall through...
-	case CC_TCP: {
-		// During standard TCP slow start procedure,
-		// increment cwnd for each newly-ACKed packet.
-		// XX TCP spec allows this to be <=,
-		// which puts us in slow start briefly after each loss...
-		if (newpackets && cwndlim && cwnd < ssthresh) {
-			cwnd = qMin(cwnd + newpackets, ssthresh);
-			qDebug("Slow start: %d new ACKs; boost cwnd to %d "
-				"(ssthresh %d)",
-				newpackets, cwnd, ssthresh);
-		}
-		break; }
+		newpackets++;
+	}
+	newpackets += sackpackets;
 
-	case CC_DELAY:
-		if (cwndinc < 0)	// Only slow start during up-phase
-			break;
+	// Infer that packets sent sufficiently earlier than
+	// the latest one we know was delivered have been dropped.
+	rackDetect();
 
-		// fall through...
-	case CC_AGGRESSIVE: {
-		// We're always in slow start, but we only count ACKs received
-		// on schedule and after a per-roundtrip baseline.
-		if (markacks > ssbase && markElapsed() <= lastrtt) {
-			cwnd += qMin(newpackets, markacks - ssbase);
-		//	qDebug("Slow start: %d new ACKs; boost cwnd to %d",
-		//		newpackets, cwnd);
-		}
-		break; }
+	// React to packets the network marked instead of dropping.
+	if (newce)
+		ccMarked(ackseq, newce);
 
-	case CC_CTCP:
-		Q_ASSERT(0);	// XXX
+	// Count the total number of acknowledged packets since the last mark.
+	markacks += newpackets;
 
-	case CC_FIXED:
-		break;	// fixed cwnd, no congestion control
-	}
+	if (!nocc)
+		cc->acked(newpackets);
 
 	// When ackseq passes markseq, we've observed a round-trip,
 	// so update our round-trip statistics.
@@ -625,119 +1367,31 @@ void Flow::receive(QByteArray &pkt, const SocketEndpoint &)
 		loss = qMax(0.0f, qMin(1.0f, loss));
 		cumloss = ((cumloss * 7.0) + loss) / 8.0;
 
+		// Adapt RACK's reordering window: widen it after round trips
+		// in which it proved too narrow, and let it shrink back
+		// after a long spell in which it hasn't.
+		if (reospurious) {
+			reosteps = qMin(reosteps + 1, REO_STEPS_MAX);
+			reospurious = false;
+			reoquiet = 0;
+		} else if (++reoquiet >= REO_DECAY_ROUNDS) {
+			reosteps = 1;
+			reoquiet = 0;
+		}
+
 		// Reset markseq to be the next packet transmitted.
 		// The new timestamp will be taken when that packet is sent.
 		markseq = txseq;
 
-		if (!nocc) switch (ccmode) {
-		case CC_TCP:
-			// Normal TCP congestion control:
-			// during congestion avoidance,
-			// increment cwnd once each RTT,
-			// but only on round-trips that were cwnd-limited.
-			if (cwndlim) {
-				cwnd++;
-				//qDebug("cwnd %d ssthresh %d",
-				//	cwnd, ssthresh);
-			}
-			cwndlim = false;
-			break;
-
-		case CC_AGGRESSIVE:
-			break;
-
-		case CC_DELAY:
-			if (pwr > basepwr) {
-				basepwr = pwr;
-				basertt = rtt;
-				basepps = pps;
-				basewnd = markacks;
-			} else if (markacks <= basewnd && rtt > basertt) {
-				basertt = rtt;
-				basepwr = basepps / basertt;
-			} else if (markacks >= basewnd && pps < basepps) {
-				basepps = pps;
-				basepwr = basepps / basertt;
-			}
-
-			if (cwndinc > 0) {
-				// Window going up.
-				// If RTT makes a significant jump, reverse.
-				if (rtt > basertt || cwnd >= CWND_MAX) {
-					cwndinc = -1;
-				} else {
-					// Additively increase the window
-					cwnd += cwndinc;
-				}
-			} else {
-				// Window going down.
-				// If PPS makes a significant dive, reverse.
-				if (pps < basepps || cwnd <= CWND_MIN) {
-					ssbase = cwnd++;
-					cwndinc = +1;
-				} else {
-					// Additively decrease the window
-					cwnd += cwndinc;
-				}
-			}
-			cwnd = qMax(CWND_MIN, cwnd);
-			cwnd = qMin(CWND_MAX, cwnd);
-			qDebug("RT: pwr %.0f[%.0f/%.0f]@%d "
-				"base %.0f[%.0f/%.0f]@%d "
-				"cwnd %d%+d",
-				pwr*1000.0, pps, (float)rtt, markacks,
-				basepwr*1000.0, basepps, basertt, basewnd,
-				cwnd, cwndinc);
-			break;
-
-		case CC_VEGAS: {
-			// Keep track of the lowest RTT ever seen,
-			// as per the original Vegas algorithm.
-			// This has the known problem that it screws up
-			// if the path's actual base RTT changes.
-			if (basertt == 0)	// first packet
-				basertt = rtt;
-			else if (rtt < basertt)
-				basertt = rtt;
-			//else
-			//	basertt = (basertt * 255.0 + rtt) / 256.0;
-
-			float expect = (float)marksent / basertt;
-			float actual = (float)marksent / rtt;
-			float diffpps = expect - actual;
-			Q_ASSERT(diffpps >= 0.0);
-			float diffpprt = diffpps * rtt;
-
-			if (diffpprt < 1.0 && cwnd < CWND_MAX && cwndlim) {
-				cwnd++;
-				// ssthresh = qMax(ssthresh, cwnd / 2); ??
-			} else if (diffpprt > 3.0 && cwnd > CWND_MIN) {
-				cwnd--;
-				ssthresh = qMin(ssthresh, cwnd); // /2??
-			}
-
-			qDebug("Round-trip: win %d basertt %.3f rtt %d "
-				"exp-pps %f act-pps %f diff-pprt %.3f cwnd %d",
-				marksent, basertt, rtt,
-				expect*1000000.0, actual*1000000.0,
-				diffpprt, cwnd);
-			break; }
-
-		case CC_CTCP: {
-#if 0
-			k = 0.8; a = 1/8; B = 1/2
-			if (in-recovery)
-				...
-			else if (diff < y) {
-				dwnd += sqrt(win)/8.0 - 1;
-			} else
-				dwnd -= C * diff;
-#endif
-			break; }
-
-		case CC_FIXED:
-			break;	// fixed cwnd, no congestion control
+		if (!nocc) {
+			if (hystart)
+				hystartRoundTrip();
+			cc->roundTrip(rtt, pps);
+			paceRoundTrip();
+			ackFreqRoundTrip();
 		}
+		if (fec)
+			fecRoundTrip();
 
 		if (nocc)
 			qDebug() << "End-to-end rtt" << rtt << "cum" << cumrtt;
@@ -745,9 +1399,6 @@ void Flow::receive(QByteArray &pkt, const SocketEndpoint &)
 		qDebug("Cumulative: rtt %.3f[%.3f] pps %.3f[%.3f] pwr %.3f "
 			"loss %.3f",
 			cumrtt, cumrttvar, cumpps, cumppsvar, cumpwr, cumloss);
-
-		lastrtt = rtt;
-		lastpps = pps;
 	}
 
 	// Always clamp cwnd against CWND_MAX.
@@ -755,16 +1406,34 @@ void Flow::receive(QByteArray &pkt, const SocketEndpoint &)
 
 	// Pass the received packet to the upper layer for processing.
 	// It'll return true if it wants us to ack the packet, false otherwise.
-	if (flowReceive(pktseq, pkt))
+	// Repair packets carry nothing for it, but we ACK them anyway
+	// so that our peer doesn't count them as lost.
+	if (!repair.isNull())
+		acknowledge(pktseq, false);
+	else if (flowReceive(pktseq, pkt))
 		acknowledge(pktseq, true);
 		// XX should still replay-protect even if no ack!
 
+	// Acknowledge path MTU probes right away, even ACK-only ones,
+	// so that the sender can tell them from losses within a round trip.
+	// Don't delay reporting a congestion mark to the sender either.
+	if (padded) {
+		rxunacked = 0;
+		acktimer.stop();
+		txack(rxackseq, rxackct);
+	} else if (ecn == EcnCE && ecnecho && rxunacked)
+		acktimer.start(0);
+
 	// Signal upper layer that we can transmit more, if appropriate
 	if (newpackets > 0 && mayTransmit())
 		readyTransmit();
+
+	// Rebuild a packet lost from the group a repair packet covers
+	if (!repair.isNull())
+		fecRecover(repair);
 }
 
-void Flow::acknowledge(quint16 pktseq, bool sendack)
+void Flow::acknowledge(quint64 pktseq, bool sendack)
 {
 	//qDebug() << this << "acknowledging" << pktseq
 	//	<< (sendack ? "(sending)" : "(not sending)")
@@ -777,14 +1446,15 @@ void Flow::acknowledge(quint16 pktseq, bool sendack)
 		// Received packet is in-order and contiguous.
 		// Roll rxackseq and rxackmask forward appropriately.
 		rxackseq = pktseq;
-		//rxackmask = (rxackmask << 1) + 1;
+		rxackmask.set(pktseq);
 		rxackct++;
 		if (rxackct > ackctMax)
 			rxackct = ackctMax;
 
 		// ACK the received packet if appropriate.
-		// Delay our ACK for up to ACKPACKETS
-		// received non-ACK-only packets,
+		// Delay our ACK for up to ackpackets
+		// received non-ACK-only packets (ACKPACKETS
+		// unless our peer has asked for something else),
 		// or up to ACKACKPACKETS continuous ack-only packets.
 		++rxunacked;
 		if (!sendack && rxunacked < ACKACKPACKETS) {
@@ -792,17 +1462,17 @@ void Flow::acknowledge(quint16 pktseq, bool sendack)
 			// and don't start the ack timer for them.
 			return;
 		}
-		if (rxunacked < ACKACKPACKETS) {
+		if (rxunacked < qMax(ackpackets, ACKACKPACKETS)) {
 			// Schedule an ack for transmission
 			// by starting the ack timer.
 			// We normally do this even in for non-delayed acks,
 			// so that we can process any other
 			// already-received packets first
 			// and have a chance to combine multiple acks into one.
-			if (delayack && rxunacked < ACKPACKETS) {
+			if (delayack && rxunacked < ackpackets) {
 				// Data packet - start delayed ack timer.
 				if (!acktimer.isActive())
-					acktimer.start(ACKDELAY);
+					acktimer.start(ackdelay);
 			} else {
 				// Start with zero timeout -
 				// immediate callback from event loop
@@ -824,10 +1494,7 @@ void Flow::acknowledge(quint16 pktseq, bool sendack)
 
 		// Roll rxackseq and rxackmask forward appropriately.
 		rxackseq = pktseq;
-		//if (seqdiff < maskBits)
-		//	rxackmask = (rxackmask << seqdiff) + 1;
-		//else
-		//	rxackmask = 1;	// bit 0 = packet just received
+		rxackmask.set(pktseq);
 
 		// Reset the contiguous packet counter
 		rxackct = 0;	// (0 means 1 packet received)
@@ -844,12 +1511,17 @@ void Flow::acknowledge(quint16 pktseq, bool sendack)
 		flushack();
 
 		// Set appropriate bit in rxackmask
-		//if (-seqdiff < maskBits)
-		//	rxackmask |= (1 << -seqdiff);
-
-		// ACK this out-of-order packet immediately.
-		if (sendack)
-			txack(pktseq, 0);
+		if (rxackmask.contains(pktseq))
+			rxackmask.set(pktseq);
+
+		// ACK this out-of-order packet immediately -
+		// with selective ACKs our usual ACK covers it.
+		if (sendack) {
+			if (sack)
+				txack(rxackseq, rxackct);
+			else
+				txack(pktseq, 0);
+		}
 	}
 }
 
@@ -858,56 +1530,358 @@ void Flow::ccMissed(quint64 pktseq)
 	qDebug() << "Missed seq" << pktseq;
 
 	// Notify congestion control
-	if (!nocc) switch (ccmode) {
-	case CC_TCP: 
-	case CC_DELAY:
-	case CC_VEGAS: {
-		// Packet loss detected -
-		// perform standard TCP congestion control
-		if (pktseq <= recovseq) {
-			// We're in a fast recovery window:
-			// this isn't a new loss event.
-			break;
-		}
+	if (!nocc)
+		cc->missed(pktseq);
+}
+
+// React to a report that the network marked 'nmarked' of our packets
+// Congestion Experienced, as of an ACK for packet 'pktseq'.
+void Flow::ccMarked(quint64 pktseq, unsigned nmarked)
+{
+	qDebug() << this << "CE marks" << nmarked << "by seq" << pktseq;
+
+	if (!nocc)
+		cc->marked(pktseq, nmarked);
+}
+
+// Take an RTT sample from each data packet the first time
+// we see it acknowledged, whether by the ACK's own range or a SACK range.
+// Since we never reuse a sequence number for a retransmission,
+// unlike in TCP the sample is never ambiguous,
+// and our transmit record serves in place of a timestamp
+// echoed back by the receiver.
+void Flow::rttAcked(const TxEvent &e)
+{
+	if (!e.data)
+		return;
+	rttSample(host()->currentTime().since(e.txtime).usecs,
+		ackDelayBound());
+}
+
+// The longest our peer may hold back an ACK:
+// the delay we asked for once it has our ACK frequency request,
+// and otherwise the standard delayed ACK timeout.
+int Flow::ackDelayBound() const
+{
+	if (ackfreqreq && ackfreqacked)
+		return ackfreqreq & 0xffffff;
+	return ACKDELAY;
+}
+
+// Fold a per-packet RTT sample in microseconds into our estimates:
+// SRTT, RTTVAR and RTO as in RFC 6298, and a windowed minimum RTT.
+// Since the receiver may have delayed its ACK by up to 'ackdelay',
+// we discount that much from the sample before smoothing it,
+// but never below the minimum RTT, which uses the raw sample.
+void Flow::rttSample(int rtt, int ackdelay)
+{
+	rtt = qMax(1, qMin(RTT_MAX, rtt));
+
+	// The minimum expires after MINRTT_WIN so that we notice
+	// when the path gets longer.  BBR instead refreshes it itself
+	// from ProbeRTT, and needs to see when it has gone stale.
+	Time now = host()->currentTime();
+	if (minrtt == 0 || rtt <= minrtt || (!cc->refreshesMinRtt()
+			&& now.since(minrtttime).usecs > MINRTT_WIN)) {
+		minrtt = rtt;
+		minrtttime = now;
+	}
+
+	int adj = rtt - qMin(ackdelay, rtt - minrtt);
+	if (srtt == 0) {
+		srtt = adj;
+		rttvar = adj / 2;
+	} else {
+		rttvar = (3 * rttvar + qAbs(srtt - adj)) / 4;
+		srtt = (7 * srtt + adj) / 8;
+	}
+	rto = srtt + qMax(RTO_GRANULARITY, 4 * rttvar);
+	rto = qMax(RTO_MIN, qMin(RTO_MAX, rto));
+
+	if (!nocc) {
+		if (hystart)
+			hystartSample(rtt);
+		cc->rttSampled(rtt);
+	}
+}
+
+void Flow::setInitialWindow(int packets)
+{
+	initcwnd = qBound((int)CWND_MIN, packets, (int)CWND_MAX);
+}
+
+void Flow::setCoupledCC(bool enabled)
+{
+	coupled = enabled;
+	if (!enabled)
+		ccLeave();
+	else if (isActive())
+		ccJoin();
+}
+
+// Join our host's coupled congestion control group
+// for our remote address.  If we haven't measured the path ourselves,
+// start from the members' average RTT estimates and an equal share
+// of their combined window, as TCP control block sharing does
+// (RFC 2140), so that we needn't slow start from scratch
+// on a path the group already knows.  The others give up
+// what we take, so the group as a whole sends no faster than before.
+void Flow::ccJoin()
+{
+	if (ccgroup || nocc)
+		return;
+
+	const QHostAddress addr = remoteEndpoint().addr;
+	FlowCCGroup *&g = h->ccgroups[addr];
+	if (g == NULL)
+		g = new FlowCCGroup(addr);
+	ccgroup = g;
+
+	int n = 0, minr = 0;
+	qint64 rttsum = 0, varsum = 0;
+	quint32 total = 0, thresh = CWND_MAX;
+	foreach (Flow *f, g->flows) {
+		total += f->cwnd;
+		thresh = qMin(thresh, f->ssthresh);
+		if (f->srtt == 0)
+			continue;
+		n++;
+		rttsum += f->srtt;
+		varsum += f->rttvar;
+		if (minr == 0 || f->minrtt < minr)
+			minr = f->minrtt;
+	}
+	if (n == 0 || srtt != 0) {
+		g->flows.append(this);
+		return;
+	}
+
+	// Shrink each member to its share of the combined window,
+	// without knocking those in congestion avoidance back into
+	// slow start, and take what's left over.
+	int members = g->flows.size() + 1;
+	quint32 rest = total;
+	foreach (Flow *f, g->flows) {
+		bool ca = f->cwnd >= f->ssthresh;
+		f->cwnd = qMax(CWND_MIN, f->cwnd * (members - 1) / members);
+		if (ca)
+			f->ssthresh = f->cwnd;
+		f->paceRoundTrip();
+		rest -= qMin(rest, f->cwnd);
+	}
+	g->flows.append(this);
 
-		// new loss event: cut ssthresh and cwnd
-		//ssthresh = (txseq - txackseq) / 2;	XXX
-		ssthresh = cwnd / 2;
-		ssthresh = qMax(ssthresh, CWND_MIN);
-		//qDebug("%d PACKETS LOST: cwnd %d -> %d",
-		//	ackdiff - newpackets, cwnd, ssthresh);
-		cwnd = ssthresh;
-
-		// fast recovery for the rest of this window
-		recovseq = txseq;
-
-		break; }
-
-	case CC_AGGRESSIVE: {
-		// Number of packets we think have been lost
-		// so far during this round-trip.
-		int lost = (txackseq - markbase) - markacks;
-		lost = qMax(0, lost);
-
-		// Number of packets we expect to receive,
-		// assuming the lost ones are really lost
-		// and we don't lose any more this round-trip.
-		unsigned expected = marksent - lost;
-
-		// Clamp the congestion window to this value.
-		if (expected < cwnd) {
-			qDebug("PACKETS LOST: cwnd %d -> %d", cwnd, expected);
-			cwnd = ssbase = expected;
-			cwnd = qMax(CWND_MIN, cwnd);
+	rttSeed(rttsum / n, varsum / n, minr);
+	cwnd = qMax(initcwnd, rest);
+
+	// Stay in slow start only if all the members still are.
+	ssthresh = qMax(cwnd, thresh);
+	paceRoundTrip();
+
+	qDebug() << this << "ccJoin:" << g->flows.size() << "flows to"
+		<< addr.toString() << "srtt" << srtt << "cwnd" << cwnd;
+}
+
+void Flow::ccLeave()
+{
+	if (!ccgroup)
+		return;
+
+	ccgroup->flows.removeAll(this);
+	if (ccgroup->flows.isEmpty()) {
+		h->ccgroups.remove(ccgroup->addr);
+		delete ccgroup;
+	}
+	ccgroup = NULL;
+	ccincr = 0;
+}
+
+// Start our RTT estimates from another flow's to the same host,
+// as if we had taken samples from it ourselves.
+void Flow::rttSeed(int srtt, int rttvar, int minrtt)
+{
+	this->srtt = srtt;
+	this->rttvar = rttvar;
+	rto = srtt + qMax(RTO_GRANULARITY, 4 * rttvar);
+	rto = qMax(RTO_MIN, qMin(RTO_MAX, rto));
+	this->minrtt = minrtt;
+	minrtttime = host()->currentTime();
+	cumrtt = srtt;
+}
+
+void FlowHostState::setPathMetricsCache(bool enabled)
+{
+	metricscache = enabled;
+	if (!enabled)
+		metrics.clear();
+}
+
+// Start a new flow from the metrics the last flow
+// to the same remote address left in our host's cache, if recent.
+// Resume from half its window, since the path may be busier now;
+// with pacing on, the first flight doesn't go out in a burst.
+void Flow::metricsSeed()
+{
+	if (!h->metricscache)
+		return;
+
+	const QHostAddress addr = remoteEndpoint().addr;
+	QHash<QHostAddress, FlowMetrics>::iterator i = h->metrics.find(addr);
+	if (i == h->metrics.end())
+		return;
+	const FlowMetrics &m = i.value();
+	if (host()->currentTime().since(m.time).usecs > METRICS_AGE) {
+		h->metrics.erase(i);
+		return;
+	}
+
+	rttSeed(m.srtt, m.rttvar, m.minrtt);
+	cwnd = qMin(qMax(initcwnd, m.cwnd / 2), CWND_MAX);
+	ssthresh = qMax(cwnd, m.ssthresh);
+	paceRoundTrip();
+
+	qDebug() << this << "metricsSeed:" << addr.toString()
+		<< "srtt" << srtt << "cwnd" << cwnd << "ssthresh" << ssthresh;
+}
+
+void Flow::metricsSave()
+{
+	if (!h->metricscache || nocc || srtt == 0)
+		return;
+
+	const QHostAddress addr = remoteEndpoint().addr;
+	if (h->metrics.size() >= METRICS_MAX && !h->metrics.contains(addr))
+		h->metrics.erase(h->metrics.begin());
+
+	FlowMetrics &m = h->metrics[addr];
+	m.srtt = srtt;
+	m.rttvar = rttvar;
+	m.minrtt = minrtt;
+	m.cwnd = cwnd;
+	m.ssthresh = ssthresh;
+	m.time = host()->currentTime();
+}
+
+// With each RTT sample in slow start, watch for the minimum RTT
+// of this round rising enough above last round's to suggest
+// we've started to fill a queue, and if so, enter HyStart++'s
+// conservative slow start (CSS).  If the RTT falls back below
+// where it was on entering CSS, the rise was spurious:
+// resume normal slow start.
+void Flow::hystartSample(int rtt)
+{
+	if (cwnd >= ssthresh || !cc->standardSlowStart())
+		return;
+
+	hssamples++;
+	if (hscurmin == 0 || rtt < hscurmin)
+		hscurmin = rtt;
+	if (hssamples < HS_SAMPLES || hslastmin == 0)
+		return;
+
+	if (hsround < 0) {
+		int eta = qBound(HS_ETA_MIN, hslastmin / 8, HS_ETA_MAX);
+		if (hscurmin >= hslastmin + eta) {
+			qDebug() << this << "HyStart++: rtt" << hscurmin
+				<< "last" << hslastmin << "cwnd" << cwnd
+				<< "- conservative slow start";
+			hscssbase = hscurmin;
+			hscssacks = 0;
+			hsround = 0;
 		}
-		break; }
+	} else if (hscurmin < hscssbase) {
+		qDebug() << this << "HyStart++: rtt" << hscurmin
+			<< "back below" << hscssbase << "- slow start";
+		hsround = -1;
+	}
+}
+
+// Once per round trip, leave slow start after HS_CSS_ROUNDS rounds
+// of CSS, and start gathering the next round's RTT samples.
+void Flow::hystartRoundTrip()
+{
+	if (cwnd >= ssthresh)
+		hsround = -1;	// Loss already ended slow start
+	else if (hsround >= 0 && ++hsround >= HS_CSS_ROUNDS) {
+		qDebug() << this << "HyStart++: leaving slow start at cwnd"
+			<< cwnd;
+		ssthresh = cwnd;
+		hsround = -1;
+	}
+
+	hslastmin = hscurmin;
+	hscurmin = 0;
+	hssamples = 0;
+}
 
-	case CC_CTCP:
-		Q_ASSERT(0);	// XXX
+// Return how much slow start may grow the window
+// for 'newpackets' newly acknowledged packets.
+unsigned Flow::hystartGrowth(unsigned newpackets)
+{
+	if (hsround < 0)
+		return newpackets;
+
+	hscssacks += newpackets;
+	unsigned inc = hscssacks / HS_CSS_DIVISOR;
+	hscssacks -= inc * HS_CSS_DIVISOR;
+	return inc;
+}
 
-	case CC_FIXED:
-		break;	// fixed cwnd, no congestion control
+// Once per round trip, set the pacing rate for window-based CC modes
+// so that a full window goes out over a bit less than one RTT;
+// the higher gain in slow start leaves room for the window to grow.
+// CC_BBR sets its own pacing rate from its bandwidth model instead.
+// We don't pace at all until we have a first RTT measurement.
+void Flow::paceRoundTrip()
+{
+	if (cc->pacesItself())
+		return;
+	if (!pacing) {
+		pacerate = 0;
+		return;
 	}
+	float gain = cwnd < ssthresh ? PACE_GAIN_SS : PACE_GAIN_CA;
+	pacerate = gain * cwnd * 1000000.0f / (srtt ? srtt : cumrtt);
+}
+
+void Flow::setAckFrequency(bool enabled)
+{
+	ackfreq = enabled;
+
+	// Put our peer back to its defaults if we'd asked otherwise.
+	if (!enabled && ackfreqreq)
+		ackFreqRequest(ACKPACKETS, ACKDELAY);
+}
+
+// Once per round trip, choose how often we'd like our peer to ACK:
+// about ACKFREQ_PER_WIN times per congestion window, so that
+// ACK clocking and loss detection stay responsive,
+// and within a quarter of the RTT, but no less often than
+// every ackFreqMax packets or ACKDELAY, as without a request.
+void Flow::ackFreqRoundTrip()
+{
+	if (!ackfreq)
+		return;
+
+	int packets = qBound(ACKPACKETS, (int)cwnd / ACKFREQ_PER_WIN,
+				ackFreqMax);
+	int delay = srtt ? qBound(ACKDELAY_MIN, srtt / 4, ACKDELAY) : ACKDELAY;
+	ackFreqRequest(packets, delay);
+}
+
+// Start sending a new ACK frequency request on our data packets,
+// unless it's the one we're already sending.
+void Flow::ackFreqRequest(int packets, int delay)
+{
+	quint32 req = (quint32)packets << 24 | qMin(delay, 0xffffff);
+	if (req == ackfreqreq)
+		return;
+
+	//qDebug() << this << "requesting ACK every" << packets
+	//	<< "packets or" << delay << "usecs";
+	ackfreqreq = req;
+	ackfreqseq = 0;
+	ackfreqacked = false;
 }
 
 void Flow::ackTimeout()
@@ -915,6 +1889,155 @@ void Flow::ackTimeout()
 	flushack();
 }
 
+void Flow::setForwardErrorCorrection(bool enabled)
+{
+	fec = enabled;
+	if (!enabled) {
+		fectimer.stop();
+		fecn = 0;
+	}
+}
+
+static inline void fecXor(char *dst, const char *src, int len)
+{
+	for (int i = 0; i < len; i++)
+		dst[i] ^= src[i];
+}
+
+// Fold a packet about to be armored and sent into the current FEC group.
+// The first header word needn't be covered,
+// since the receiver knows the sequence number of the packet it rebuilds.
+void Flow::fecAdd(const QByteArray &pkt)
+{
+	if (fecn == 0) {
+		fecbase = txseq;
+		feclen = 0;
+		fecsize = 0;
+		fecacc.fill(0);
+
+		// Don't leave the group waiting long for more packets,
+		// as losses at the tail of a burst are the costliest.
+		fectimer.start(qMax(FEC_FLUSH_MIN, srtt / 4));
+	}
+
+	int len = pkt.size() - 4;
+	if (len > fecacc.size()) {
+		int old = fecacc.size();
+		fecacc.resize(len);
+		memset(fecacc.data() + old, 0, len - old);
+	}
+	fecXor(fecacc.data(), pkt.constData() + 4, len);
+	fecsize = qMax(fecsize, len);
+	feclen ^= pkt.size();
+	fecn++;
+}
+
+// Send the repair packet for the current FEC group.
+// Like an ACK packet, it carries our latest ACK information.
+void Flow::fecRepair()
+{
+	fectimer.stop();
+	if (!fecn || !isActive()) {
+		fecn = 0;
+		return;
+	}
+
+	PacketPool &pool = host()->packetPool();
+	int len = 8 + fecsize + 4;
+	QByteArray pkt = pool.alloc(hdrlen + len);
+	char *p = pkt.data() + hdrlen;
+	quint32 words[2];
+	words[0] = htonl((quint32)fecn << 24 | ((quint32)fecbase & seqMask));
+	words[1] = htonl(feclen);
+	memcpy(p, words, 8);
+	memcpy(p + 8, fecacc.constData(), fecsize);
+	quint32 trailer = htonl(padRepair << padTypeShift | len);
+	memcpy(p + 8 + fecsize, &trailer, 4);
+	fecn = 0;
+
+	quint32 packseq = (rxackct << ackctShift) | (rxackseq & ackSeqMask)
+			| padFlag;
+	quint64 pktseq;
+	tx(pkt, packseq, pktseq, false);
+	pool.release(pkt);
+}
+
+// Rebuild the one packet lost from the group a repair trailer covers,
+// provided only one is missing and we still hold all the others,
+// and process it as if it had just arrived.
+void Flow::fecRecover(const QByteArray &rep)
+{
+	fecrx = true;
+	if (rep.size() < 8)
+		return;
+
+	quint32 words[2];
+	memcpy(words, rep.constData(), 8);
+	quint32 grp = ntohl(words[0]);
+	quint32 len = ntohl(words[1]);
+	int n = grp >> 24;
+	qint32 diff = ((qint32)(grp << chanBits) - ((qint32)rxseq << chanBits))
+			>> chanBits;
+	quint64 base = rxseq + diff;
+	if (diff >= 0 || n == 0)
+		return;
+
+	// Find the lost packet, if any, giving up if the group
+	// isn't all within our window or more than one was lost.
+	quint64 lost = 0;
+	for (quint64 seq = base; seq < base + n; seq++) {
+		if (!rxmask.contains(seq))
+			return;
+		if (rxmask.test(seq))
+			continue;
+		if (lost)
+			return;
+		lost = seq;
+	}
+	if (!lost)
+		return;
+
+	// XOR the others out of the repair data to leave the lost one.
+	QByteArray acc = rep.mid(8);
+	for (quint64 seq = base; seq < base + n; seq++) {
+		if (seq == lost)
+			continue;
+		const FecRxPkt &r = fecrxpkts[seq % fecRxKeep];
+		if (r.seq != seq || r.data.size() > acc.size())
+			return;
+		fecXor(acc.data(), r.data.constData(), r.data.size());
+		len ^= r.data.size() + 4;
+	}
+	if (len < (quint32)hdrlen || len - 4 > (quint32)acc.size())
+		return;
+
+	quint32 word = htonl(((quint32)lost & seqMask)
+				| (quint32)localChannel() << chanShift);
+	QByteArray pkt((const char*)&word, 4);
+	pkt.append(acc.constData(), len - 4);
+
+	qDebug() << this << "FEC recovered packet" << lost;
+	rxdecoded(lost, pkt, EcnNotEct);
+}
+
+// Once per round trip, adapt the number of packets each repair covers.
+// Packets FEC rebuilds reach our peer, so cumloss counts only the
+// losses it leaves to retransmission.  Cover half as many packets
+// while that's above FEC_LOSS_TARGET, and creep back up otherwise
+// to find the least redundancy that keeps it there.
+void Flow::fecRoundTrip()
+{
+	if (cumloss > FEC_LOSS_TARGET)
+		fecgroup = qMax(FEC_GROUP_MIN, fecgroup / 2);
+	else
+		fecgroup = qMin(fecgroup + 1, fecGroupMax);
+}
+
+void Flow::fecTimeout()
+{
+	fecRepair();
+}
+
 void Flow::statsTimeout()
 {
 	qDebug("Stats: txseq %llu txackseq %llu "
@@ -941,6 +2064,16 @@ void Flow::expire(quint64, int)
 }
 
 
+////////// FlowHostState //////////
+
+FlowHostState::~FlowHostState()
+{
+	// Deleting the groups detaches any flows still in them,
+	// which may outlive us until their owners get around to them.
+	qDeleteAll(ccgroups);
+}
+
+
 ////////// ChecksumArmor //////////
 
 ChecksumArmor::ChecksumArmor(uint32_t txkey, uint32_t rxkey,
@@ -949,24 +2082,24 @@ ChecksumArmor::ChecksumArmor(uint32_t txkey, uint32_t rxkey,
 {
 }
 
-QByteArray ChecksumArmor::txenc(qint64 pktseq, const QByteArray &pkt)
+void ChecksumArmor::txenc(qint64 pktseq, const QByteArray &pkt,
+				QByteArray &epkt)
 {
-	// Copy the packet so we can append the checksum
-	QByteArray epkt = pkt;
-	int size = epkt.size();
+	int size = pkt.size();
 
 	// Compute the checksum for the packet,
 	// including the full 64-bit packet sequence number as a pseudo-header.
 	Chk32 chk;
 	quint32 ivec[2] = { htonl(pktseq >> 32), htonl(pktseq) };
 	chk.update(ivec, 8);
-	chk.update(epkt.data(), size);
+	chk.update(pkt.constData(), size);
 	quint32 sum = htonl(chk.final() + txkey);
-	QByteArray sumbuf((const char*)&sum, 4);
 
-	// Append it and return the resulting packet.
-	epkt.append(sumbuf);
-	return epkt;
+	// Copy the packet and append the checksum.
+	epkt.resize(size + 4);
+	char *ebuf = epkt.data();
+	memcpy(ebuf, pkt.constData(), size);
+	memcpy(ebuf + size, &sum, 4);
 }
 
 bool ChecksumArmor::rxdec(qint64 pktseq, QByteArray &pkt)
@@ -980,17 +2113,26 @@ bool ChecksumArmor::rxdec(qint64 pktseq, QByteArray &pkt)
 	Chk32 chk;
 	quint32 ivec[2] = { htonl(pktseq >> 32), htonl(pktseq) };
 	chk.update(ivec, 8);
-	chk.update(pkt.data(), size);
+	chk.update(pkt.constData(), size);
 	quint32 sum = htonl(chk.final() + rxkey);
-	QByteArray sumbuf((const char*)&sum, 4);
 
 	// Verify and strip the packet's checksum.
-	if (pkt.mid(size) != sumbuf)
+	if (memcmp(pkt.constData() + size, &sum, 4) != 0)
 		return false;
-	pkt.resize(size);
+	PacketPool::setSize(pkt, size);
 	return true;
 }
 
+bool ChecksumArmor::isReentrant()
+{
+	return true;
+}
+
+int ChecksumArmor::overhead()
+{
+	return 4;
+}
+
 
 
 ////////// AESArmor //////////
@@ -1009,18 +2151,18 @@ AESArmor::AESArmor(const QByteArray &txenckey, const QByteArray &txmackey,
 	//qDebug() << this << "rxmac" << rxmackey.toBase64();
 }
 
-QByteArray AESArmor::txenc(qint64 pktseq, const QByteArray &pkt)
+void AESArmor::txenc(qint64 pktseq, const QByteArray &pkt, QByteArray &epkt)
 {
 	int size = pkt.size();
 	const quint8 *buf = (const quint8*)pkt.constData();
 
-	// Create a buffer for the encrypted packet
-	QByteArray epkt;
+	// Size the caller's buffer for the encrypted packet
 	epkt.resize(size);
 	quint8 *ebuf = (quint8*)epkt.data();
 
 	// Build the initialization vector template for encryption.
 	// We also use the first 8 bytes as a pseudo-header for the MAC.
+	union ivec ivec;
 	ivec.l[0] = htonl(pktseq >> 32);
 	ivec.l[1] = htonl(pktseq);
 	ivec.l[2] = htonl(0x56584166);	// 'VXAf'
@@ -1042,8 +2184,6 @@ QByteArray AESArmor::txenc(qint64 pktseq, const QByteArray &pkt)
 	Q_ASSERT(epkt.size() == size + HMACLEN);
 
 	//qDebug() << this << "txenc" << pktseq << epkt.size();
-
-	return epkt;
 }
 
 bool AESArmor::rxdec(qint64 pktseq, QByteArray &pkt)
@@ -1058,6 +2198,7 @@ bool AESArmor::rxdec(qint64 pktseq, QByteArray &pkt)
 
 	// Build the initialization vector template for decryption.
 	// We also use the first 8 bytes as a pseudo-header for the MAC.
+	union ivec ivec;
 	ivec.l[0] = htonl(pktseq >> 32);
 	ivec.l[1] = htonl(pktseq);
 	ivec.l[2] = htonl(0x56584166);	// 'VXAf'
@@ -1077,4 +2218,182 @@ bool AESArmor::rxdec(qint64 pktseq, QByteArray &pkt)
 	return true;
 }
 
+bool AESArmor::isReentrant()
+{
+	return true;	// all per-packet state lives on the stack
+}
+
+int AESArmor::overhead()
+{
+	return HMACLEN;
+}
+
+
+////////// AEADArmor //////////
+
+// ChaCha20-Poly1305 first appeared in OpenSSL 1.1.0.
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined(OPENSSL_NO_CHACHA) \
+	&& !defined(OPENSSL_NO_POLY1305)
+#define SST_HAVE_CHACHA
+#endif
+
+static const EVP_CIPHER *aeadCipher(quint32 method, int keylen)
+{
+	switch (method) {
+	case KEYMETH_AESGCM:
+		switch (keylen) {
+		case 128/8:	return EVP_aes_128_gcm();
+		case 192/8:	return EVP_aes_192_gcm();
+		case 256/8:	return EVP_aes_256_gcm();
+		}
+		return NULL;
+#ifdef SST_HAVE_CHACHA
+	case KEYMETH_CHACHA:
+		return keylen == 256/8 ? EVP_chacha20_poly1305() : NULL;
+#endif
+	default:
+		return NULL;
+	}
+}
+
+AEADArmor::AEADArmor(quint32 method,
+		const QByteArray &txkey, const QByteArray &rxkey)
+:	cipher(aeadCipher(method, txkey.size())),
+	txkey(txkey), rxkey(rxkey)
+{
+	if (cipher == NULL || rxkey.size() != txkey.size())
+		qFatal("AEADArmor: unsupported method %x with %d-byte key",
+			method, txkey.size());
+
+	// Key one context per direction up front for the common case.
+	putContext(true, getContext(true));
+	putContext(false, getContext(false));
+}
+
+AEADArmor::~AEADArmor()
+{
+	foreach (EVP_CIPHER_CTX *ctx, txctxs)
+		EVP_CIPHER_CTX_free(ctx);
+	foreach (EVP_CIPHER_CTX *ctx, rxctxs)
+		EVP_CIPHER_CTX_free(ctx);
+}
+
+EVP_CIPHER_CTX *AEADArmor::getContext(bool tx)
+{
+	{
+		QMutexLocker lock(&ctxmutex);
+		QList<EVP_CIPHER_CTX*> &ctxs = tx ? txctxs : rxctxs;
+		if (!ctxs.isEmpty())
+			return ctxs.takeLast();
+	}
+
+	// Key a new context; each packet then only supplies a fresh nonce.
+	const quint8 *key = (const quint8*)(tx ? txkey : rxkey).constData();
+	EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+	if (ctx == NULL
+	    || EVP_CipherInit_ex(ctx, cipher, NULL, NULL, NULL, tx) != 1
+	    || EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN,
+				sizeof(union nonce), NULL) != 1
+	    || EVP_CipherInit_ex(ctx, NULL, NULL, key, NULL, tx) != 1) {
+		qWarning("AEADArmor: can't set up cipher context");
+		EVP_CIPHER_CTX_free(ctx);
+		return NULL;
+	}
+	return ctx;
+}
+
+void AEADArmor::putContext(bool tx, EVP_CIPHER_CTX *ctx)
+{
+	if (ctx == NULL)
+		return;
+	QMutexLocker lock(&ctxmutex);
+	(tx ? txctxs : rxctxs).append(ctx);
+}
+
+bool AEADArmor::isReentrant()
+{
+	return true;
+}
+
+int AEADArmor::overhead()
+{
+	return taglen;
+}
+
+bool AEADArmor::isSupported(quint32 method)
+{
+	return aeadCipher(method, 256/8) != NULL;
+}
+
+void AEADArmor::setNonce(union nonce &nonce, qint64 pktseq)
+{
+	nonce.l[0] = htonl(0x56584166);	// 'VXAf'
+	nonce.l[1] = htonl(pktseq >> 32);
+	nonce.l[2] = htonl(pktseq);
+}
+
+void AEADArmor::txenc(qint64 pktseq, const QByteArray &pkt, QByteArray &epkt)
+{
+	int size = pkt.size();
+	const quint8 *buf = (const quint8*)pkt.constData();
+
+	// The tag goes into the pooled buffer's tailroom.
+	epkt.resize(size + taglen);
+	quint8 *ebuf = (quint8*)epkt.data();
+
+	union nonce nonce;
+	setNonce(nonce, pktseq);
+	EVP_CIPHER_CTX *ctx = getContext(true);
+
+	// Authenticate the cleartext header as associated data,
+	// then encrypt the rest of the packet in the same pass.
+	int outl;
+	memcpy(ebuf, buf, encofs);
+	bool ok = ctx != NULL
+		&& EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, nonce.b) == 1
+		&& EVP_EncryptUpdate(ctx, NULL, &outl, buf, encofs) == 1
+		&& EVP_EncryptUpdate(ctx, ebuf + encofs, &outl,
+				buf + encofs, size - encofs) == 1
+		&& EVP_EncryptFinal_ex(ctx, ebuf + size, &outl) == 1
+		&& EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG,
+				taglen, ebuf + size) == 1;
+	putContext(true, ctx);
+
+	// Never let a partly encrypted or untagged packet out.
+	if (!ok) {
+		qWarning("AEADArmor: encryption failed");
+		epkt.resize(0);
+	}
+}
+
+bool AEADArmor::rxdec(qint64 pktseq, QByteArray &pkt)
+{
+	int size = pkt.size() - taglen;
+	if (size < Flow::hdrlen) {
+		qDebug() << this << "rxdec: received packet too small";
+		return false;	// too small to contain a full tag
+	}
+	quint8 *buf = (quint8*)pkt.data();
+
+	union nonce nonce;
+	setNonce(nonce, pktseq);
+	EVP_CIPHER_CTX *ctx = getContext(false);
+
+	// Decrypt in place, verifying the tag at the end.
+	int outl;
+	bool ok = ctx != NULL
+		&& EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, nonce.b) == 1
+		&& EVP_DecryptUpdate(ctx, NULL, &outl, buf, encofs) == 1
+		&& EVP_DecryptUpdate(ctx, buf + encofs, &outl,
+				buf + encofs, size - encofs) == 1
+		&& EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG,
+				taglen, buf + size) == 1
+		&& EVP_DecryptFinal_ex(ctx, buf + size, &outl) > 0;
+	putContext(false, ctx);
+	if (!ok)
+		return false;
+
+	PacketPool::setSize(pkt, size);
+	return true;
+}
 
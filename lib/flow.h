@@ -23,16 +23,23 @@
 #include <QTime>
 #include <QTimer>
 #include <QQueue>	// XXX FlowSegment
+#include <QMutex>
+#include <QMap>
+#include <QHash>
 
+#include "util.h"
 #include "ident.h"
 #include "sock.h"
 #include "timer.h"
+#include "armorpipe.h"
 
 // XXX for specific armor methods - break into separate module
 #include "chk32.h"
 #include "aes.h"
 #include "hmac.h"
 
+#include <openssl/evp.h>
+
 
 namespace SST {
 
@@ -41,7 +48,9 @@ class Ident;
 class Endpoint;
 class Socket;
 class FlowCC;
+class FlowCCGroup;
 class KeyInitiator;	// XXX
+class BaseStream;	// XXX
 
 
 // Packet sequence numbers are 64-bit unsigned integers
@@ -50,6 +59,28 @@ typedef quint64 PacketSeq;
 static const PacketSeq maxPacketSeq = ~(PacketSeq)0;
 
 
+// A stream-layer packet transmitted on a flow and awaiting acknowledgment.
+// It lives in the flow's transmit ring alongside the packet's TxEvent,
+// which is why it is defined here rather than in BaseStream.  XXX
+struct StreamTxPacket {
+	BaseStream *strm;
+	//qint64 txseq;			// Transmit sequence number
+	qint64 tsn;			// Logical byte position
+	QByteArray buf;			// Packet buffer incl. headers
+	int hdrlen;			// Size of flow + stream hdrs
+	int type;			// StreamProtocol::PacketType
+	bool late;			// on ackwait and presumed lost
+
+	inline StreamTxPacket() : strm(NULL), type(0) { }
+	inline StreamTxPacket(BaseStream *strm, int type)
+		: strm(strm), type(type) { }
+
+	inline bool isNull() const { return strm == NULL; }
+	inline int payloadSize() const
+		{ return buf.size() - hdrlen; }
+};
+
+
 enum CCMode {
 	CC_TCP,
 	CC_AGGRESSIVE,
@@ -57,6 +88,10 @@ enum CCMode {
 	CC_VEGAS,
 	CC_CTCP,
 	CC_FIXED,
+	CC_BBR,		// Model-based: bottleneck bandwidth and min RTT
+	CC_DCTCP,	// ECN-proportional, for datacenter links
+	CC_CUBIC,	// Cubic window growth, for high-BDP paths
+	CC_LEDBAT,	// Delay-based scavenger, for background transfers
 };
 
 
@@ -64,8 +99,17 @@ enum CCMode {
 class FlowArmor : public QObject
 {
 	friend class Flow;
+	friend struct ArmorJob;
 	Q_OBJECT
 
+public:
+	// Returns true if txenc() and rxdec() keep no per-packet state,
+	// so that they may run concurrently on ArmorPipeline worker threads.
+	virtual bool isReentrant();
+
+	// Returns the number of bytes txenc() adds to each packet.
+	virtual int overhead();
+
 protected:
 	// The pseudo-header is a header logically prepended to each packet
 	// for authentication purposes but not actually transmitted.
@@ -76,7 +120,12 @@ protected:
 	// at which encrypted data begins (after authenticate-only data).
 	static const int encofs = 4;
 
-	virtual QByteArray txenc(qint64 pktseq, const QByteArray &pkt) = 0;
+	// Armor the cleartext packet 'pkt' into 'epkt',
+	// a buffer supplied by the caller from the host's packet pool,
+	// which has room to append the armor's MAC or checksum in place.
+	// Leaves 'epkt' empty if armoring fails, so nothing gets sent.
+	virtual void txenc(qint64 pktseq, const QByteArray &pkt,
+				QByteArray &epkt) = 0;
 	virtual bool rxdec(qint64 pktseq, QByteArray &pkt) = 0;
 
 	virtual ~FlowArmor();
@@ -84,18 +133,18 @@ protected:
 
 // Abstract base class representing a flow
 // between a local Socket and a remote endpoint.
-class Flow : public SocketFlow
+class Flow : public SocketFlow, private ArmorClient
 {
 	friend class KeyInitiator;	// XXX
+	friend class FlowCC;
+	friend class FlowCCGroup;
 	Q_OBJECT
 
 private:
 	Host *const h;
 	FlowArmor *armr;	// Encryption/authentication method
-	//FlowCC *cc;		// Congestion control method
-	CCMode ccmode;		// Congestion control method
+	FlowCC *cc;		// Congestion control method
 	bool nocc;		// Disable congestion control.  XXX
-	unsigned missthresh;	// Threshold at which to infer packets dropped
 
 	// Per-direction unique channel IDs for this channel.
 	// Stream layer uses these in assigning USIDs to new streams.
@@ -127,7 +176,10 @@ public:
 
 	// Layout of the second header word: ACK count/sequence number
 	// Encrypted for transmission.
-	static const quint32 resvBits = 4;	// 31-28: reserved field
+	static const quint32 ackFreqFlag = 1U << 31; // 31: ACK freq request
+	static const quint32 padFlag = 1 << 30;	// 30: padding trailer present
+	static const quint32 ecnFlag = 1 << 29;	// 29: ECN echo word present
+	static const quint32 sackFlag = 1 << 28; // 28: SACK trailer present
 	static const quint32 ackctBits = 4;	// 27-24: ack count
 	static const quint32 ackctMask = (1 << ackctBits) - 1;
 	static const quint32 ackctMax = ackctMask;
@@ -135,6 +187,68 @@ public:
 	static const quint32 ackSeqBits = 24;	// 23-0: ack sequence number
 	static const quint32 ackSeqMask = (1 << ackSeqBits) - 1;
 
+	// A packet with sackFlag set ends with a selective ACK trailer:
+	// up to sackMaxBlocks 32-bit words each describing a range
+	// of packets received below the ACK sequence number,
+	// as the distance from the ACK sequence number to the top of the range
+	// (high 16 bits) and the length of the range (low 16 bits),
+	// followed by a 32-bit count of these words.
+	static const int sackMaxBlocks = 8;
+
+	// A packet with ecnFlag set carries an ECN echo word
+	// just before any SACK trailer: the 32-bit count of packets
+	// its sender has received marked Congestion Experienced.
+
+	// A packet with padFlag set ends with a padding trailer
+	// followed by a 32-bit word giving the trailer's type (high 8 bits)
+	// and its length in bytes, including that word (low 24 bits).
+	// The padding comes after any SACK trailer, so it's stripped first.
+	static const quint32 padTypeShift = 24;
+	static const quint32 padLenMask = (1 << padTypeShift) - 1;
+	static const quint32 padProbe = 0;	// Path MTU probe: zero bytes
+	static const quint32 padRepair = 1;	// FEC repair data
+
+	// A repair trailer lets the receiver rebuild any one packet lost
+	// from the group of consecutive packets sent just before it.
+	// It holds the group's first sequence number (low 24 bits)
+	// and packet count (high 8 bits), the XOR of the packets' lengths,
+	// and the XOR of their contents after the first header word,
+	// each zero-extended to the longest.  A repair packet is thus
+	// at most fecOverhead bytes larger than the largest in its group.
+	static const int fecGroupMax = 32;
+	static const int fecOverhead = 16;
+
+	// Received packets a receiver holds onto for rebuilding others.
+	static const int fecRxKeep = 4*fecGroupMax;
+
+	// A packet with ackFreqFlag set carries an ACK frequency request
+	// just before any ECN echo word: the number of packets
+	// its sender would like us to receive before we ACK (high 8 bits),
+	// up to ackFreqMax, and the longest it would like us to delay
+	// an ACK in microseconds (low 24 bits).
+	// We still ACK immediately on any sign of loss.
+	static const int ackFreqMax = ackctMax + 1;
+
+	// Default and maximum sizes of the windows within which
+	// we track packets for replay protection and acknowledgment.
+	// These should cover the path's bandwidth-delay product in packets.
+	static const int defaultWindowBits = 4096;
+	static const int maxWindowBits = 32768;	// SACK offsets are 16-bit
+
+	// Optional features that both ends of a flow must support,
+	// negotiated during key exchange via a KeyChunkFlowOpts chunk.
+	static const quint32 optSelectiveAcks = 0x0001;	// SACK trailers
+	static const quint32 optRepairs = 0x0002;	// We send FEC repairs
+	static const quint32 optEcnEcho = 0x0004;	// ECN echo words
+	static const quint32 optAckFrequency = 0x0008;	// ACK frequency words
+
+	// Path MTU bounds in bytes, counting IP and UDP headers.
+	// We never send larger packets than pmtuBase without having
+	// confirmed with a probe that the path carries them.
+	static const int pmtuBase = 1280;	// IPv6 minimum MTU
+	static const int pmtuMax = 9000;	// Jumbo Ethernet frames
+	static const int ipOverhead = 28;	// IPv4 and UDP headers
+
 
 	Flow(Host *host, QObject *parent = NULL);
 	virtual ~Flow();
@@ -143,7 +257,8 @@ public:
 
 	// Set the encryption/authentication method for this flow.
 	// This MUST be set before a new flow can be activated.
-	inline void setArmor(FlowArmor *armor) { this->armr = armor; }
+	// Any armor pipeline jobs still using the old armor are discarded.
+	void setArmor(FlowArmor *armor);
 	inline FlowArmor *armor() { return armr; }
 
 	// Set the channel IDs for this flow.
@@ -152,10 +267,11 @@ public:
 	inline void setChannelIds(const QByteArray &tx, const QByteArray &rx)
 		{ txchanid = tx; rxchanid = rx; }
 
-	// Set the congestion controller for this flow.
-	// This must be set if the client wishes to call mayTransmit().
-	//inline void setCongestionController(FlowCC *cc) { this->cc = cc; }
-	//inline FlowCC *congestionController() { return cc; }
+	// Set the congestion controller for this flow,
+	// which takes ownership of it and resets its congestion state.
+	// New flows get one for their host's defaultCCMode().
+	void setCongestionController(FlowCC *cc);
+	inline FlowCC *congestionController() { return cc; }
 
 	// Start and stop the flow.
 	virtual void start(bool initiator);
@@ -167,67 +283,134 @@ public:
 
 protected:
 
-	// Size of rxmask, rxackmask, and txackmask fields in bits
-	static const int maskBits = 32;
-
 	struct TxEvent {
 		qint32	size;	// Total size of packet including hdr
 		bool	data;	// Was an upper-layer data packet
 		bool	pipe;	// Currently counted toward txdatpipe
+		Time	txtime;	// Time packet was transmitted, for RTT sampling
+		StreamTxPacket pkt;	// Stream packet awaiting ack, if any
 
+		inline TxEvent()
+			: size(0), data(false), pipe(false) { }
 		inline TxEvent(qint32 size, bool isdata)
 			: size(size), data(isdata), pipe(isdata) { }
 	};
 
 	// Transmit state
 	quint64 txseq;		// Next sequence number to transmit
-	QQueue<TxEvent> txevts;	// Record of transmission events (XX data sizes)
-	quint64 txevtseq;	// Seqno of oldest recorded tx event
+	SeqRing<TxEvent> txevts; // Transmission events from oldest to txseq
 	quint64 txackseq;	// Highest transmit sequence number ACK'd
-	quint64 recovseq;	// Sequence at which fast recovery finishes
 	quint64 markseq;	// Transmit sequence number of "marked" packet
 	quint64 markbase;	// Snapshot of txackseq at time mark was placed
 	Time marktime;		// Time at which marked packet was sent
-	quint32 txackmask;	// Mask of packets transmitted and ACK'd
+	SeqMask txackmask;	// Mask of packets transmitted and ACK'd
 	quint32	txfltcnt;	// Data packets currently in flight
 	quint32	txfltsize;	// Data bytes currently in flight
 	quint32 markacks;	// Number of ACK'd packets since last mark
 	quint32 marksent;	// Number of ACKs expected after last mark
+	quint32 txcecount;	// Peer's last reported count of CE marks
+	quint64 txsacked;	// Packets we learned of only from SACK ranges
+
+	// Congestion window state, adjusted by our FlowCC
+	quint32 initcwnd;	// Congestion window to start from
 	quint32 cwnd;		// Current congestion window
 	bool cwndlim;		// We were cwnd-limited this round-trip
-
-	// TCP congestion control
 	quint32 ssthresh;	// Slow start threshold
-	bool sstoggle;		// Slow start toggle flag for CC_VEGAS
-
-	// Aggressive congestion control
-	quint32 ssbase;		// Slow start baseline
-
-	// Low-delay congestion control
-	int cwndinc;
-	int lastrtt;		// Measured RTT of last round-trip
-	float lastpps;		// Measured PPS of last round-trip
-	quint32 basewnd;
-	float basertt, basepps, basepwr;
+	quint64 recovseq;	// Sequence at which fast recovery finishes
 
-	// TCP Vegas-like congestion control
-	float cwndmax;
+	// Coupled congestion control with other flows to our remote host
+	bool coupled;		// Join our host's group for our remote host
+	FlowCCGroup *ccgroup;	// Group we've joined, NULL if none
+	float ccincr;		// Fractional packets of coupled window growth
+
+	// HyStart++ slow start exit (RFC 9406)
+	bool hystart;		// Leave slow start once queueing delay grows
+	int hsround;		// Rounds of conservative slow start, -1 if not
+	int hslastmin;		// Min RTT sampled last round, 0 if none
+	int hscurmin;		// Min RTT sampled this round, 0 if none
+	int hssamples;		// RTT samples this round
+	int hscssbase;		// Min RTT on entering conservative slow start
+	unsigned hscssacks;	// ACKs not yet turned into window growth
+
+	// Per-packet RTT estimation and retransmit timeout (RFC 6298)
+	int srtt;		// Smoothed RTT in microseconds, 0 if no samples
+	int rttvar;		// RTT variation in microseconds
+	int rto;		// Retransmission timeout in microseconds
+	int minrtt;		// Windowed minimum RTT in microseconds
+	Time minrtttime;	// Time minrtt was last lowered or refreshed
+
+	// Pacing
+	float pacerate;		// Pacing rate in packets/sec, 0 if unpaced
+	bool pacing;		// Also pace window-based CC modes
+	float pacetokens;	// Packets the pacer will let us send now
+	Time pacetime;		// Time pacetokens was last replenished
+	Timer pacetimer;	// Wakes us when the next token accrues
 
 	// Retransmit state
 	Timer rtxtimer;		// Retransmit timer
 	LinkStatus linkstat;	// Current link status
 
+	// Time-based loss detection (RACK) and tail loss probes
+	quint64 rackseq;	// Most recently sent data packet delivered
+	int rackrtt;		// RTT of that packet in microseconds
+	quint64 racklow;	// Lowest data packet possibly still in flight
+	int reosteps;		// Reordering window in units of minrtt/4
+	int reoquiet;		// Round trips without spurious loss inferences
+	bool reospurious;	// Inferred a loss this round trip that wasn't
+	Timer racktimer;	// Wakes us when a reordering window expires
+	quint64 tlpseq;		// Packet last resent by a tail loss probe
+	bool tlpout;		// Tail loss probe awaiting acknowledgment
+	Timer tlptimer;		// Tail loss probe timer
+
 	// Receive state
 	quint64 rxseq;		// Highest sequence number received so far
-	quint32 rxmask;		// Mask of packets received so far
+	SeqMask rxmask;		// Mask of packets received so far
 
 	// Receive-side ACK state
 	quint64 rxackseq;	// Highest sequence number acknowledged so far
-	//quint32 rxackmask;	// Mask of packets received & acknowledged
+	SeqMask rxackmask;	// Mask of packets received & acknowledged
 	quint8 rxackct;		// # contiguous packets received before rxackseq
 	quint8 rxunacked;	// # contiguous packets not yet ACKed
 	bool delayack;		// Enable delayed acknowledgments
+	bool sack;		// Send selective ACK ranges
+	bool ecnecho;		// Echo received CE marks in our ACKs
+	quint32 rxcecount;	// Packets received marked CE
 	Timer acktimer;		// Delayed ACK timer
+	int ackpackets;		// Packets to receive before we ACK
+	int ackdelay;		// Max ACK delay in microseconds
+	quint64 rxackfreqseq;	// Packet carrying the request we applied
+
+	// ACK frequency requests to our peer
+	bool ackfreq;		// Ask our peer to ACK less often at high rates
+	quint32 ackfreqreq;	// Current request, 0 if none
+	quint64 ackfreqseq;	// First packet that carried it, 0 if none yet
+	bool ackfreqacked;	// Peer has received a packet carrying it
+
+	// Datagram path MTU discovery (RFC 8899)
+	bool pmtud;		// Probe for a larger path MTU
+	int pmtu;		// Largest packet size known to get through
+	int pmtuhi;		// Smallest packet size known not to
+	int pmtuprobe;		// Size of the probe in flight, 0 if none
+	int pmtupad;		// Size to pad the next ACK packet to
+	quint64 pmtuprobeseq;	// Sequence number of that probe
+	int pmtutries;		// Probes of this size lost so far
+	int pmturtos;		// RTOs since a large packet was last ACKed
+	Timer pmtutimer;	// Probe loss or periodic re-probe timer
+
+	// Forward error correction
+	bool fec;		// Follow our packets with repair packets
+	int fecgroup;		// Packets each repair packet covers
+	int fecn;		// Packets in the group so far, 0 if none
+	quint64 fecbase;	// First packet in the group
+	quint32 feclen;		// XOR of the group's packet lengths
+	int fecsize;		// Longest packet in the group, less 4 bytes
+	QByteArray fecacc;	// XOR of the group's packet contents
+	Timer fectimer;		// Sends the repair for an unfinished group
+	bool fecrx;		// Our peer sends us repair packets
+	struct FecRxPkt {
+		quint64 seq;		// Sequence number, 0 if slot unused
+		QByteArray data;	// Pooled copy after the first word
+	} fecrxpkts[fecRxKeep];	// Packets repairs may refer to, by seq
 
 	// Statistics gathering
 	float cumrtt;		// Cumulative measured RTT in milliseconds
@@ -274,14 +457,105 @@ public:
 	// so that subsequently transmitted packets include this ack info.
 	// if 'sendack' is true, make sure an acknowledgment gets sent soon:
 	// in the next transmitted packet, or in an ack packet if needed.
-	void acknowledge(quint16 pktseq, bool sendack);
+	void acknowledge(quint64 pktseq, bool sendack);
 
 	inline bool deleyedAcks() const { return delayack; }
 	inline void setDelayedAcks(bool enabled) { delayack = enabled; }
 
+	// Selective acknowledgments: when enabled, our ACK packets describe
+	// up to sackMaxBlocks ranges of received packets below the ACK point.
+	// We always accept them, but the peer must be new enough
+	// to understand them before we may send them,
+	// so the key exchange enables them via setPeerOptions().
+	inline bool selectiveAcks() const { return sack; }
+	inline void setSelectiveAcks(bool enabled) { sack = enabled; }
+
+	// Number of our packets we learned had arrived
+	// only from the peer's selective ACK ranges.
+	inline quint64 selectivelyAcked() const { return txsacked; }
+
+	// Enable those of our host's optional features (opt*)
+	// that the peer also named during key exchange.
+	// Must be called before the flow is started.
+	void setPeerOptions(quint32 opts);
+
+	// ECN echo: when enabled, our ACKs report how many packets
+	// we've received marked Congestion Experienced,
+	// whether in ACK packets or piggybacked on data packets.
+	// We always react to such reports, but again the peer must
+	// understand them before we may send them, so the key exchange
+	// enables this via setPeerOptions() if both ends offer it.
+	// To get marks in the first place,
+	// the sender's Socket must be ECN-capable.
+	inline bool ecnEcho() const { return ecnecho; }
+	inline void setEcnEcho(bool enabled) { ecnecho = enabled; }
+
+	// ACK frequency: when enabled, we ask our peer once per round trip
+	// to ACK only every so many packets, up to ackFreqMax,
+	// according to our congestion window and RTT,
+	// saving both ends per-packet work at high rates.
+	// We always honor such requests, but again the peer must
+	// understand them before we may send them,
+	// so the key exchange enables this like ECN echo.
+	inline bool ackFrequency() const { return ackfreq; }
+	void setAckFrequency(bool enabled);
+
+	// Path MTU discovery: when enabled, we probe the path
+	// with padded ACK packets to find the largest packet size
+	// it delivers, starting from pmtuBase, and fall back to pmtuBase
+	// if larger packets stop getting through.
+	// Again the peer must understand padded packets to answer probes.
+	inline bool pathMtuDiscovery() const { return pmtud; }
+	void setPathMtuDiscovery(bool enabled);
+
+	// Forward error correction: when enabled, we follow each group
+	// of packets with a repair packet from which our peer can rebuild
+	// any one of them that's lost, without waiting a round trip
+	// for a retransmission.  The group size adapts to the loss rate.
+	// Again the peer must understand repair packets to use them.
+	inline bool forwardErrorCorrection() const { return fec; }
+	void setForwardErrorCorrection(bool enabled);
+
+	// Current path MTU in bytes, including IP and UDP headers,
+	// and the largest flow packet including Flow::hdrlen
+	// that currently fits in it after armoring.
+	inline int pathMtu() const { return pmtu; }
+	int txMtu() const;
+
+	// Set the number of packets our replay protection
+	// and acknowledgment windows cover, up to maxWindowBits.
+	// Must be called before the flow is started;
+	// start() sizes them from any cached path metrics for SACK flows.
+	void setWindowBits(int bits);
+	inline int windowBits() const { return rxmask.bits(); }
+
 	void ccReset();
-	inline CCMode ccMode() const { return ccmode; }
-	inline void setCCMode(CCMode mode) { ccmode = mode; ccReset(); }
+	CCMode ccMode() const;
+	void setCCMode(CCMode mode);
+
+	// Coupled congestion control: when enabled, the flow joins
+	// a host-wide group of the flows to the same remote address,
+	// which likely share a bottleneck.  It starts from the group's
+	// RTT and window estimates instead of from scratch,
+	// and in congestion avoidance grows its window only by its share
+	// of what one TCP flow would (RFC 6356), so that the group
+	// competes no harder than a single flow would.
+	inline bool coupledCC() const { return coupled; }
+	void setCoupledCC(bool enabled);
+
+	// Initial congestion window in packets, at least FlowCC::cwndMin,
+	// which takes effect on the next ccReset().
+	// RFC 6928 recommends 10 for flows carrying short transfers.
+	inline int initialWindow() const { return initcwnd; }
+	void setInitialWindow(int packets);
+
+	// HyStart++ (RFC 9406): when enabled, slow start watches
+	// for the RTT rising by more than 1/8 between round trips,
+	// and then slows down for a few rounds before leaving slow start,
+	// instead of overshooting until packets are lost.
+	// It only applies to CC modes that use TCP's slow start.
+	inline bool hyStart() const { return hystart; }
+	inline void setHyStart(bool enabled) { hystart = enabled; }
 
 	// for CC_FIXED: fixed congestion window for reserved-bandwidth links
 	inline void setCCWindow(int cwnd) { this->cwnd = cwnd; }
@@ -291,6 +565,24 @@ public:
 	inline int txBytesInFlight() { return txfltsize; }
 	inline int txPacketsInFlight() { return txfltcnt; }
 
+	// Per-packet RTT estimates in microseconds, 0 until sampled,
+	// and the current retransmission timeout they yield.
+	inline int txSmoothedRtt() const { return srtt; }
+	inline int txRttVariation() const { return rttvar; }
+	inline int txMinRtt() const { return minrtt; }
+	inline int txRetransmitTimeout() const { return rto; }
+
+	// Rate in packets per second at which the congestion controller
+	// wants transmissions spread out, or 0 if it doesn't pace them.
+	inline float txPacingRate() { return pacerate; }
+
+	// Transmit pacing: when enabled, window-based CC modes spread
+	// each window's worth of packets over the round-trip time
+	// instead of sending it in a burst.  Model-based controllers
+	// such as CC_BBR always pace.
+	inline bool txPacing() const { return pacing; }
+	void setTxPacing(bool enabled);
+
 signals:
 	// Indicates when this flow observes a change in link status.
 	void linkStatusChanged(LinkStatus newstatus);
@@ -315,17 +607,25 @@ protected:
 private:
 	// Called by Socket to dispatch a received packet to this flow.
 	virtual void receive(QByteArray &msg, const SocketEndpoint &src);
+	void rxdecoded(quint64 pktseq, QByteArray &pkt, int ecn);
+
+	// Armor pipeline support: returns the host's pipeline
+	// if it is enabled and our armor can use it, NULL otherwise.
+	ArmorPipeline *armorPipe();
+	virtual void armorTxDone(quint64 pktseq, QByteArray &epkt);
+	virtual void armorRxDone(quint64 pktseq, QByteArray &pkt, int ecn);
+	virtual void armorRelease(QByteArray &buf);
+	virtual Socket *armorSocket();
 
 	// Internal transmit methods.
 	bool tx(QByteArray &pkt, quint32 packseq, quint64 &pktseq, bool isdata);
-	inline bool txack(quint64 ackseq, unsigned ackct)
-		{ QByteArray pkt; return transmitAck(pkt, ackseq, ackct); }
+	bool txack(quint64 ackseq, unsigned ackct);
+	quint32 txsack(QByteArray &pkt, quint64 ackseq, unsigned ackct);
 	inline void flushack()
 		{ if (rxunacked) { rxunacked = 0; txack(rxackseq, rxackct); }
 		  acktimer.stop(); }
 
-	inline void rtxstart()
-		{ rtxtimer.start((int)(cumrtt * 2.0)); }
+	void rtxstart();
 
 	// Repeat stall indications but not other link status changes.
 	// XXX hack - maybe "stall severity" or "stall time"
@@ -337,16 +637,159 @@ private:
 
 	// Congestion control
 	void ccMissed(quint64 pktseq);
+	void ccMarked(quint64 pktseq, unsigned nmarked);
+	void rttAcked(const TxEvent &e);
+	int ackDelayBound() const;
+	void rttSample(int rtt, int ackdelay = 0);
+	void ccJoin();
+	void ccLeave();
+	void rttSeed(int srtt, int rttvar, int minrtt);
+
+	// Path metrics cache
+	void metricsSeed();
+	void metricsSave();
+
+	// HyStart++ slow start
+	void hystartSample(int rtt);
+	void hystartRoundTrip();
+	unsigned hystartGrowth(unsigned newpackets);
+
+	// Loss detection
+	void rackAcked(quint64 seq, const TxEvent &e);
+	void rackDetect();
+
+	// Transmit pacing
+	void paceRoundTrip();
+	int paceQuantum();
+	void paceRefill();
+	int paceAllowance();
+	void paceSent();
+
+	// ACK frequency negotiation
+	void ackFreqRoundTrip();
+	void ackFreqRequest(int packets, int delay);
+
+	// Path MTU discovery
+	void pmtuNext();
+
+	// Forward error correction
+	void fecAdd(const QByteArray &pkt);
+	void fecRepair();
+	void fecRecover(const QByteArray &rep);
+	void fecRoundTrip();
 
 
 private slots:
 	void rtxTimeout(bool failed);	// Retransmission timeout
+	void rackTimeout();	// Reordering window expired
+	void tlpTimeout();	// Tail loss probe due
 	void ackTimeout();	// Delayed ACK timeout
+	void paceTimeout();	// Next paced transmission due
+	void pmtuTimeout();	// Path MTU probe lost or re-probe due
+	void fecTimeout();	// Repair for an unfinished group due
 	void statsTimeout();
 };
 
 
 
+// Path metrics a flow leaves behind in its host's cache
+// for the next flow to the same remote address to start from.
+struct FlowMetrics
+{
+	int srtt;		// Smoothed RTT in microseconds
+	int rttvar;		// RTT variation in microseconds
+	int minrtt;		// Minimum RTT in microseconds
+	quint32 cwnd;		// Congestion window in packets
+	quint32 ssthresh;	// Slow start threshold in packets
+	Time time;		// Time the flow saved them
+};
+
+
+// Per-host defaults for new flows,
+// including those created implicitly by the stream layer.
+class FlowHostState
+{
+	CCMode ccmode;
+	bool pacing;
+	bool ecnecho;
+	bool ackfreq;
+	bool pmtud;
+	bool fec;
+	bool coupledcc;
+	int initcwnd;
+	bool hystart;
+	bool metricscache;
+	bool sack;
+
+	// Coupled congestion control groups by remote address
+	QHash<QHostAddress, FlowCCGroup*> ccgroups;
+
+	// Path metrics of recently stopped flows by remote address
+	QHash<QHostAddress, FlowMetrics> metrics;
+
+	friend class Flow;
+
+public:
+	inline FlowHostState()
+		: ccmode(CC_TCP), pacing(false), ecnecho(false),
+		  ackfreq(false), pmtud(false), fec(false),
+		  coupledcc(false), initcwnd(2), hystart(false),
+		  metricscache(false), sack(true) { }
+	virtual ~FlowHostState();
+
+	inline CCMode defaultCCMode() const { return ccmode; }
+	inline void setDefaultCCMode(CCMode mode) { ccmode = mode; }
+
+	// Off by default: pacing costs a timer event per quantum on fast flows.
+	inline bool defaultTxPacing() const { return pacing; }
+	inline void setDefaultTxPacing(bool enabled) { pacing = enabled; }
+
+	// ECN echo is also negotiated, but only offered if enabled here.
+	inline bool defaultEcnEcho() const { return ecnecho; }
+	inline void setDefaultEcnEcho(bool enabled) { ecnecho = enabled; }
+
+	// Likewise only offered to peers if enabled here.
+	inline bool defaultAckFrequency() const { return ackfreq; }
+	inline void setDefaultAckFrequency(bool enabled) { ackfreq = enabled; }
+
+	inline bool defaultPathMtuDiscovery() const { return pmtud; }
+	inline void setDefaultPathMtuDiscovery(bool enabled)
+		{ pmtud = enabled; }
+
+	inline bool defaultForwardErrorCorrection() const { return fec; }
+	inline void setDefaultForwardErrorCorrection(bool enabled)
+		{ fec = enabled; }
+
+	inline bool defaultCoupledCC() const { return coupledcc; }
+	inline void setDefaultCoupledCC(bool enabled) { coupledcc = enabled; }
+
+	inline int defaultInitialWindow() const { return initcwnd; }
+	inline void setDefaultInitialWindow(int packets) { initcwnd = packets; }
+
+	inline bool defaultHyStart() const { return hystart; }
+	inline void setDefaultHyStart(bool enabled) { hystart = enabled; }
+
+	// Selective ACKs are negotiated with each peer at key exchange,
+	// so unlike the features above they're on unless disabled here.
+	inline bool defaultSelectiveAcks() const { return sack; }
+	inline void setDefaultSelectiveAcks(bool enabled) { sack = enabled; }
+
+	// Optional features (Flow::opt*) we offer peers at key exchange.
+	inline quint32 flowOptions() const
+		{ return (sack ? Flow::optSelectiveAcks : 0)
+			| (fec ? Flow::optRepairs : 0)
+			| (ecnecho ? Flow::optEcnEcho : 0)
+			| (ackfreq ? Flow::optAckFrequency : 0); }
+
+	// Path metrics cache: when enabled, each flow that stops
+	// leaves its RTT and window estimates here, and a new flow
+	// to the same remote address starts from them
+	// rather than from RTT_INIT and its initial window.
+	inline bool pathMetricsCache() const { return metricscache; }
+	void setPathMetricsCache(bool enabled);
+};
+
+
 // XX break this stuff into separate module
 
 // Simple 32-bit keyed checksum protection with no encryption,
@@ -361,8 +804,11 @@ public:
 	ChecksumArmor(uint32_t txkey, uint32_t rxkey,
 			const QByteArray &armorid = QByteArray());
 
-	virtual QByteArray txenc(qint64 pktseq, const QByteArray &pkt);
+	virtual void txenc(qint64 pktseq, const QByteArray &pkt,
+				QByteArray &epkt);
 	virtual bool rxdec(qint64 pktseq, QByteArray &pkt);
+	virtual bool isReentrant();
+	virtual int overhead();
 
 	inline QByteArray id() { return armorid; }
 };
@@ -376,14 +822,65 @@ class AESArmor : public FlowArmor
 	union ivec {
 		quint8 b[AES_BLOCK_SIZE];
 		quint32 l[4];
-	} ivec;
+	};
 
 public:
 	AESArmor(const QByteArray &txenckey, const QByteArray &txmackey,
 		const QByteArray &rxenckey, const QByteArray &rxmackey);
 
-	virtual QByteArray txenc(qint64 pktseq, const QByteArray &pkt);
+	virtual void txenc(qint64 pktseq, const QByteArray &pkt,
+				QByteArray &epkt);
+	virtual bool rxdec(qint64 pktseq, QByteArray &pkt);
+	virtual bool isReentrant();
+	virtual int overhead();
+};
+
+
+// Single-pass authenticated encryption using an AEAD cipher via OpenSSL,
+// either AES-GCM (KEYMETH_AESGCM) or ChaCha20-Poly1305 (KEYMETH_CHACHA).
+// The 64-bit packet sequence number forms the per-packet nonce,
+// the cleartext header up to encofs is authenticated as associated data,
+// and the authentication tag is appended to the encrypted packet.
+class AEADArmor : public FlowArmor
+{
+public:
+	static const int taglen = 16;	// Size of appended auth tag
+
+private:
+	const EVP_CIPHER *cipher;
+	const QByteArray txkey, rxkey;
+
+	// Idle keyed cipher contexts for each direction.
+	// Each txenc() or rxdec() call borrows one for its duration,
+	// so that the pool grows to one per concurrent armor worker.
+	QMutex ctxmutex;
+	QList<EVP_CIPHER_CTX*> txctxs, rxctxs;
+
+	union nonce {
+		quint8 b[12];
+		quint32 l[3];
+	};
+
+	static void setNonce(union nonce &nonce, qint64 pktseq);
+	EVP_CIPHER_CTX *getContext(bool tx);
+	void putContext(bool tx, EVP_CIPHER_CTX *ctx);
+
+public:
+	// Create an AEAD armor for one of the KEYMETH_AESGCM or KEYMETH_CHACHA
+	// security methods.  AES-GCM accepts 16-, 24-, or 32-byte keys;
+	// ChaCha20-Poly1305 requires 32-byte keys.
+	AEADArmor(quint32 method,
+		const QByteArray &txkey, const QByteArray &rxkey);
+	~AEADArmor();
+
+	// Return true if this build's OpenSSL supports a given AEAD method.
+	static bool isSupported(quint32 method);
+
+	virtual void txenc(qint64 pktseq, const QByteArray &pkt,
+				QByteArray &epkt);
 	virtual bool rxdec(qint64 pktseq, QByteArray &pkt);
+	virtual bool isReentrant();
+	virtual int overhead();
 };
 
 
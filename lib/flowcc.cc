@@ -0,0 +1,788 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <cmath>
+
+#include <QtDebug>
+
+#include "flowcc.h"
+#include "host.h"
+
+using namespace SST;
+
+
+#define CWND_MIN	FlowCC::cwndMin
+#define CWND_MAX	FlowCC::cwndMax
+
+#define DCTCP_G		(1.0f/16)	// DCTCP alpha estimation gain
+
+#define BBR_HIGH_GAIN	2.885f		// 2/ln(2): Startup gain
+#define BBR_CWND_GAIN	2.0f		// Steady-state cwnd gain over BDP
+#define BBR_PROBERTT_INTERVAL (10*1000*1000) // Min RTT lifetime: 10 s
+#define BBR_PROBERTT_TIME (200*1000)	// Time to spend in ProbeRTT
+#define BBR_PROBERTT_CWND ((unsigned)4)	// cwnd during ProbeRTT
+
+#define CUBIC_C		0.4f		// Cubic scaling constant
+#define CUBIC_BETA	0.7f		// Multiplicative decrease factor
+
+#define LEDBAT_GAIN	1.0f		// Max window growth per round trip
+#define LEDBAT_MINUTE	(60*1000*1000)	// Base RTT history granularity
+
+// Pacing gains BBR cycles through in ProbeBW, one per round trip
+static const float bbrCycleGain[] = { 1.25, 0.75, 1, 1, 1, 1, 1, 1 };
+#define BBR_CYCLE_LEN	((int)(sizeof(bbrCycleGain)/sizeof(float)))
+
+
+////////// FlowCC //////////
+
+const unsigned FlowCC::cwndMin;
+const unsigned FlowCC::cwndMax;
+
+FlowCC::~FlowCC()
+{
+}
+
+FlowCC *FlowCC::create(CCMode mode)
+{
+	switch (mode) {
+	case CC_TCP:		return new TcpCC;
+	case CC_AGGRESSIVE:	return new AggressiveCC;
+	case CC_DELAY:		return new DelayCC;
+	case CC_VEGAS:		return new VegasCC;
+	case CC_FIXED:		return new FixedCC;
+	case CC_BBR:		return new BbrCC;
+	case CC_DCTCP:		return new DctcpCC;
+	case CC_CUBIC:		return new CubicCC;
+	case CC_LEDBAT:		return new LedbatCC;
+
+	case CC_CTCP:
+#if 0
+		k = 0.8; a = 1/8; B = 1/2
+		if (in-recovery)
+			...
+		else if (diff < y) {
+			dwnd += sqrt(win)/8.0 - 1;
+		} else
+			dwnd -= C * diff;
+#endif
+		break;	// XXX not implemented
+	}
+	qWarning("FlowCC: unsupported CC mode %d; using TCP", mode);
+	return new TcpCC;
+}
+
+Time FlowCC::currentTime() const
+{
+	return fl->host()->currentTime();
+}
+
+void FlowCC::reset()
+{
+}
+
+void FlowCC::acked(unsigned newpackets)
+{
+	// During standard TCP slow start procedure,
+	// increment cwnd for each newly-ACKed packet.
+	// XX TCP spec allows this to be <=,
+	// which puts us in slow start briefly after each loss...
+	if (newpackets && cwndlim() && cwnd() < ssthresh()) {
+		cwnd() = qMin(cwnd() + fl->hystartGrowth(newpackets),
+				ssthresh());
+		qDebug("Slow start: %d new ACKs; boost cwnd to %d "
+			"(ssthresh %d)",
+			newpackets, cwnd(), ssthresh());
+	}
+}
+
+void FlowCC::roundTrip(int, float)
+{
+	// Normal TCP congestion control:
+	// during congestion avoidance,
+	// increment cwnd once each RTT,
+	// but only on round-trips that were cwnd-limited.
+	if (cwndlim())
+		additiveIncrease();
+	cwndlim() = false;
+}
+
+void FlowCC::missed(quint64 pktseq)
+{
+	// Packet loss detected -
+	// perform standard TCP congestion control
+	if (pktseq <= recovseq()) {
+		// We're in a fast recovery window:
+		// this isn't a new loss event.
+		return;
+	}
+	backoff();
+
+	// fast recovery for the rest of this window
+	recovseq() = txseq();
+}
+
+void FlowCC::marked(quint64 pktseq, unsigned)
+{
+	// A mark means the same as a loss (RFC 3168),
+	// without any packet to retransmit:
+	// cut cwnd at most once per window.
+	missed(pktseq);
+}
+
+void FlowCC::timeout()
+{
+	// Reset cwnd and go back to slow start
+	ssthresh() = qMax(txfltcnt() / 2, CWND_MIN);
+	cwnd() = CWND_MIN;
+}
+
+void FlowCC::rttSampled(int)
+{
+}
+
+void FlowCC::additiveIncrease()
+{
+	// Slow start isn't coupled, nor is a flow alone in its group.
+	FlowCCGroup *g = fl->ccgroup;
+	if (g == NULL || g->size() < 2 || cwnd() < ssthresh()) {
+		cwnd()++;
+		return;
+	}
+
+	fl->ccincr += g->increase(fl);
+	if (fl->ccincr >= 1.0f) {
+		unsigned n = (unsigned)fl->ccincr;
+		cwnd() += n;
+		fl->ccincr -= n;
+	}
+}
+
+void FlowCC::backoff()
+{
+	// new loss event: cut ssthresh and cwnd
+	ssthresh() = qMax(cwnd() / 2, CWND_MIN);
+	cwnd() = ssthresh();
+}
+
+bool FlowCC::pacesItself() const
+{
+	return false;
+}
+
+bool FlowCC::standardSlowStart() const
+{
+	return true;
+}
+
+bool FlowCC::refreshesMinRtt() const
+{
+	return false;
+}
+
+
+////////// FlowCCGroup //////////
+
+// Leave any remaining members uncoupled rather than pointing at us.
+FlowCCGroup::~FlowCCGroup()
+{
+	foreach (Flow *f, flows) {
+		f->ccgroup = NULL;
+		f->ccincr = 0;
+	}
+}
+
+float FlowCCGroup::increase(Flow *fl) const
+{
+	// RFC 6356 grows a member's window per ACK by the lesser of
+	// alpha/total and 1/cwnd, where total is the group's total window
+	// and alpha = total * max(cwnd/rtt^2) / (sum of cwnd/rtt)^2.
+	// Over a round trip of cwnd ACKs that's min(alpha*cwnd/total, 1).
+	float total = 0, best = 0, sum = 0;
+	foreach (Flow *f, flows) {
+		float rtt = (f->srtt ? f->srtt : f->cumrtt) / 1000.0f;
+		total += f->cwnd;
+		best = qMax(best, f->cwnd / (rtt * rtt));
+		sum += f->cwnd / rtt;
+	}
+	float alpha = total * best / (sum * sum);
+	return qMin(1.0f, alpha * fl->cwnd / total);
+}
+
+
+////////// AggressiveCC //////////
+
+void AggressiveCC::reset()
+{
+	ssbase = 0;
+	lastrtt = 0;
+}
+
+void AggressiveCC::acked(unsigned newpackets)
+{
+	// We're always in slow start, but we only count ACKs received
+	// on schedule and after a per-roundtrip baseline.
+	if (markacks() > ssbase && markElapsed() <= lastrtt) {
+		cwnd() += qMin(newpackets, markacks() - ssbase);
+	//	qDebug("Slow start: %d new ACKs; boost cwnd to %d",
+	//		newpackets, cwnd());
+	}
+}
+
+void AggressiveCC::roundTrip(int rtt, float)
+{
+	lastrtt = rtt;
+}
+
+void AggressiveCC::missed(quint64)
+{
+	// Number of packets we think have been lost
+	// so far during this round-trip.
+	int lost = (txackseq() - markbase()) - markacks();
+	lost = qMax(0, lost);
+
+	// Number of packets we expect to receive,
+	// assuming the lost ones are really lost
+	// and we don't lose any more this round-trip.
+	unsigned expected = marksent() - lost;
+
+	// Clamp the congestion window to this value.
+	if (expected < cwnd()) {
+		qDebug("PACKETS LOST: cwnd %d -> %d", cwnd(), expected);
+		cwnd() = ssbase = expected;
+		cwnd() = qMax(CWND_MIN, cwnd());
+	}
+}
+
+bool AggressiveCC::standardSlowStart() const
+{
+	return false;
+}
+
+
+////////// DelayCC //////////
+
+void DelayCC::reset()
+{
+	AggressiveCC::reset();
+	cwndinc = 1;
+	basewnd = 0;
+	basertt = 0;
+	basepps = 0;
+	basepwr = 0;
+}
+
+void DelayCC::acked(unsigned newpackets)
+{
+	if (cwndinc < 0)	// Only slow start during up-phase
+		return;
+	AggressiveCC::acked(newpackets);
+}
+
+void DelayCC::roundTrip(int rtt, float pps)
+{
+	// "Power" measures network efficiency
+	// in the sense of both minimizing rtt and maximizing pps.
+	float pwr = pps / rtt;
+
+	if (pwr > basepwr) {
+		basepwr = pwr;
+		basertt = rtt;
+		basepps = pps;
+		basewnd = markacks();
+	} else if (markacks() <= basewnd && rtt > basertt) {
+		basertt = rtt;
+		basepwr = basepps / basertt;
+	} else if (markacks() >= basewnd && pps < basepps) {
+		basepps = pps;
+		basepwr = basepps / basertt;
+	}
+
+	if (cwndinc > 0) {
+		// Window going up.
+		// If RTT makes a significant jump, reverse.
+		if (rtt > basertt || cwnd() >= CWND_MAX) {
+			cwndinc = -1;
+		} else {
+			// Additively increase the window
+			cwnd() += cwndinc;
+		}
+	} else {
+		// Window going down.
+		// If PPS makes a significant dive, reverse.
+		if (pps < basepps || cwnd() <= CWND_MIN) {
+			ssbase = cwnd()++;
+			cwndinc = +1;
+		} else {
+			// Additively decrease the window
+			cwnd() += cwndinc;
+		}
+	}
+	cwnd() = qMax(CWND_MIN, cwnd());
+	cwnd() = qMin(CWND_MAX, cwnd());
+	qDebug("RT: pwr %.0f[%.0f/%.0f]@%d "
+		"base %.0f[%.0f/%.0f]@%d "
+		"cwnd %d%+d",
+		pwr*1000.0, pps, (float)rtt, markacks(),
+		basepwr*1000.0, basepps, basertt, basewnd,
+		cwnd(), cwndinc);
+
+	AggressiveCC::roundTrip(rtt, pps);
+}
+
+void DelayCC::missed(quint64 pktseq)
+{
+	FlowCC::missed(pktseq);
+}
+
+
+////////// VegasCC //////////
+
+void VegasCC::reset()
+{
+	sstoggle = true;
+}
+
+void VegasCC::acked(unsigned newpackets)
+{
+	sstoggle = !sstoggle;
+	if (sstoggle)
+		return;	// do slow start only once every two RTTs
+
+	FlowCC::acked(newpackets);
+}
+
+void VegasCC::roundTrip(int rtt, float)
+{
+	// The original Vegas algorithm used the lowest RTT
+	// ever seen, which screws up if the path's actual
+	// base RTT changes.  Use the windowed minimum
+	// of per-packet RTT samples instead.
+	float basertt = minrtt() ? qMin(minrtt(), rtt) : rtt;
+
+	float expect = (float)marksent() / basertt;
+	float actual = (float)marksent() / rtt;
+	float diffpps = expect - actual;
+	Q_ASSERT(diffpps >= 0.0);
+	float diffpprt = diffpps * rtt;
+
+	if (diffpprt < 1.0 && cwnd() < CWND_MAX && cwndlim()) {
+		cwnd()++;
+		// ssthresh = qMax(ssthresh, cwnd / 2); ??
+	} else if (diffpprt > 3.0 && cwnd() > CWND_MIN) {
+		cwnd()--;
+		ssthresh() = qMin(ssthresh(), cwnd()); // /2??
+	}
+
+	qDebug("Round-trip: win %d basertt %.3f rtt %d "
+		"exp-pps %f act-pps %f diff-pprt %.3f cwnd %d",
+		marksent(), basertt, rtt,
+		expect*1000000.0, actual*1000000.0,
+		diffpprt, cwnd());
+}
+
+
+////////// FixedCC //////////
+
+void FixedCC::acked(unsigned)
+{
+	// fixed cwnd, no congestion control
+}
+
+void FixedCC::roundTrip(int, float)
+{
+}
+
+void FixedCC::missed(quint64)
+{
+}
+
+void FixedCC::marked(quint64, unsigned)
+{
+}
+
+void FixedCC::timeout()
+{
+}
+
+bool FixedCC::standardSlowStart() const
+{
+	return false;
+}
+
+
+////////// BbrCC //////////
+
+void BbrCC::reset()
+{
+	phase = Startup;
+	round = 0;
+	cycle = 0;
+	for (int i = 0; i < bwRounds; i++)
+		bw[i] = 0;
+	btlbw = 0;
+	fullbw = 0;
+	fullcnt = 0;
+}
+
+void BbrCC::acked(unsigned newpackets)
+{
+	// Grow the window like slow start during Startup;
+	// otherwise the model sets cwnd once per round trip.
+	if (phase == Startup)
+		cwnd() += newpackets;
+}
+
+// Update the path model at the end of each round trip,
+// given the round trip's RTT and delivery rate measurements,
+// and derive the congestion window and pacing rate from it.
+void BbrCC::roundTrip(int rtt, float pps)
+{
+	Time now = currentTime();
+
+	// Bottleneck bandwidth is the maximum recent delivery rate.
+	// Round trips that weren't cwnd-limited only measure
+	// how fast the application was sending, so they count
+	// only if they raise the estimate.
+	if (cwndlim() || pps > btlbw)
+		bw[round % bwRounds] = pps;
+	round++;
+	btlbw = 0;
+	for (int i = 0; i < bwRounds; i++)
+		btlbw = qMax(btlbw, bw[i]);
+	cwndlim() = false;
+
+	// Propagation delay is the minimum recent RTT,
+	// which the flow tracks for us from per-packet samples.
+	if (minrtt() == 0) {
+		minrtt() = rtt;
+		minrtttime() = now;
+	}
+	float bdp = btlbw * minrtt() / 1000000.0;
+
+	switch (phase) {
+	case Startup:
+		// The pipe is full once bandwidth stops growing
+		// by at least 25% for three round trips.
+		if (btlbw >= fullbw * 1.25f) {
+			fullbw = btlbw;
+			fullcnt = 0;
+		} else if (++fullcnt >= 3)
+			phase = Drain;
+		break;
+
+	case Drain:
+		if (txfltcnt() <= bdp) {
+			phase = ProbeBW;
+			cycle = round % BBR_CYCLE_LEN;
+		}
+		break;
+
+	case ProbeBW:
+		cycle = (cycle + 1) % BBR_CYCLE_LEN;
+		break;
+
+	case ProbeRTT:
+		if (now >= probeend) {
+			minrtttime() = now;
+			phase = fullcnt >= 3 ? ProbeBW : Startup;
+		}
+		break;
+	}
+
+	// If min RTT hasn't been seen in a while, queues may be hiding it:
+	// drain the pipe briefly and take a fresh measurement.
+	if (phase != ProbeRTT
+			&& now.since(minrtttime()).usecs > BBR_PROBERTT_INTERVAL) {
+		phase = ProbeRTT;
+		probeend = now.usecs + qMax(BBR_PROBERTT_TIME, rtt);
+		minrtt() = rtt;
+	}
+
+	// Pace at the estimated bandwidth times a phase-dependent gain,
+	// with a cwnd large enough not to get in the pacer's way.
+	float pgain = 1.0, cgain = BBR_CWND_GAIN;
+	switch (phase) {
+	case Startup:
+		pgain = cgain = BBR_HIGH_GAIN;
+		break;
+	case Drain:
+		pgain = 1.0 / BBR_HIGH_GAIN;
+		cgain = BBR_HIGH_GAIN;
+		break;
+	case ProbeBW:
+		pgain = bbrCycleGain[cycle];
+		break;
+	case ProbeRTT:
+		break;
+	}
+	pacerate() = pgain * btlbw;
+
+	unsigned target = phase == ProbeRTT ? BBR_PROBERTT_CWND
+				: (unsigned)(cgain * bdp + 0.5);
+	target = qMax(CWND_MIN, qMin(CWND_MAX, target));
+	if (phase == Startup)
+		cwnd() = qMax(cwnd(), target);
+	else
+		cwnd() = target;
+
+	qDebug("BBR: phase %d btlbw %.0f minrtt %d bdp %.1f "
+		"pace %.0f cwnd %d",
+		phase, btlbw, minrtt(), bdp, pacerate(), cwnd());
+}
+
+void BbrCC::missed(quint64)
+{
+	// loss alone doesn't mean the model is wrong
+}
+
+void BbrCC::marked(quint64, unsigned)
+{
+	// nor do marks
+}
+
+bool BbrCC::pacesItself() const
+{
+	return true;
+}
+
+bool BbrCC::refreshesMinRtt() const
+{
+	return true;
+}
+
+bool BbrCC::standardSlowStart() const
+{
+	return false;
+}
+
+
+////////// DctcpCC //////////
+
+void DctcpCC::reset()
+{
+	alpha = 1.0;
+	nmarked = 0;
+}
+
+void DctcpCC::roundTrip(int, float)
+{
+	// Fold the fraction of packets marked this round trip
+	// into alpha, and if any were, cut cwnd in proportion;
+	// otherwise grow it as TCP would.
+	float frac = markacks() ? qMin(1.0f,
+		(float)nmarked / markacks()) : 0.0f;
+	alpha = (1.0f - DCTCP_G) * alpha + DCTCP_G * frac;
+	if (nmarked) {
+		cwnd() = (unsigned)(cwnd() * (1.0f - alpha/2));
+		cwnd() = qMax(cwnd(), CWND_MIN);
+		ssthresh() = cwnd();
+	} else if (cwndlim() && cwnd() >= ssthresh())
+		additiveIncrease();
+	nmarked = 0;
+	cwndlim() = false;
+}
+
+void DctcpCC::marked(quint64, unsigned n)
+{
+	// Respond in proportion, once per round trip.
+	nmarked += n;
+}
+
+
+////////// CubicCC //////////
+
+void CubicCC::reset()
+{
+	wmax = 0;
+	k = 0;
+	westimate = 0;
+	wincr = 0;
+	inepoch = false;
+}
+
+// Outside slow start, steer the window toward where the cubic
+// W(t) = C(t-K)^3 + Wmax will be one RTT from now, spreading the
+// growth across the round trip's ACKs as RFC 8312 section 4.1 does.
+void CubicCC::acked(unsigned newpackets)
+{
+	if (!newpackets || !cwndlim())
+		return;
+	if (cwnd() < ssthresh()) {
+		FlowCC::acked(newpackets);
+		return;
+	}
+
+	Time now = currentTime();
+	if (!inepoch) {
+		inepoch = true;
+		epoch = now;
+		wincr = 0;
+		westimate = cwnd();
+		if (wmax > cwnd())
+			k = cbrtf((wmax - cwnd()) / CUBIC_C);
+		else {
+			k = 0;
+			wmax = cwnd();
+		}
+	}
+
+	float t = (now.since(epoch).usecs + srtt()) / 1000000.0f;
+	float target = wmax + CUBIC_C * (t - k) * (t - k) * (t - k);
+
+	// TCP-friendly region: never grow slower than standard TCP would,
+	// with its additive increase scaled so that it stays fair
+	// given CUBIC's gentler multiplicative decrease.
+	westimate += 3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA)
+			* newpackets / cwnd();
+	target = qMax(target, westimate);
+
+	// Grow by at most half the window per round trip.
+	target = qMin(target, 1.5f * cwnd());
+	if (target > cwnd())
+		wincr += (target - cwnd()) * newpackets / cwnd();
+	if (wincr >= 1.0) {
+		unsigned inc = (unsigned)wincr;
+		cwnd() += inc;
+		wincr -= inc;
+	}
+}
+
+void CubicCC::roundTrip(int, float)
+{
+	// Growth happens per ACK in acked().
+	cwndlim() = false;
+}
+
+void CubicCC::timeout()
+{
+	wmax = cwnd();
+	inepoch = false;
+	FlowCC::timeout();
+}
+
+void CubicCC::backoff()
+{
+	// Fast convergence: if we didn't get back up to the last wmax,
+	// a new flow is probably sharing the path, so give it room.
+	float w = cwnd();
+	if (w < wmax)
+		wmax = w * (1 + CUBIC_BETA) / 2;
+	else
+		wmax = w;
+	inepoch = false;
+
+	ssthresh() = qMax((unsigned)(w * CUBIC_BETA), CWND_MIN);
+	cwnd() = ssthresh();
+	qDebug("CUBIC: backoff cwnd %.0f -> %d wmax %.0f", w, cwnd(), wmax);
+}
+
+
+
+////////// LedbatCC //////////
+
+void LedbatCC::reset()
+{
+	for (int i = 0; i < baseHistory; i++)
+		basertt[i] = 0;
+	basecur = 0;
+	baseminute = currentTime();
+	for (int i = 0; i < curFilter; i++)
+		currtt[i] = 0;
+	curnext = 0;
+	wincr = 0;
+}
+
+// We have no one-way delay measurements, so we use RTTs instead:
+// the base RTT is the minimum over the last several minutes,
+// kept per minute so that it can track a path that gets longer,
+// and the current RTT is the minimum of the last few samples,
+// to filter out delayed ACKs and other noise.
+void LedbatCC::rttSampled(int rtt)
+{
+	currtt[curnext] = rtt;
+	curnext = (curnext + 1) % curFilter;
+
+	Time now = currentTime();
+	if (now.since(baseminute).usecs >= LEDBAT_MINUTE) {
+		baseminute = now;
+		basecur = (basecur + 1) % baseHistory;
+		basertt[basecur] = rtt;
+	} else if (basertt[basecur] == 0 || rtt < basertt[basecur])
+		basertt[basecur] = rtt;
+}
+
+// Estimate the queueing delay our packets currently see,
+// or return -1 if we have no RTT samples yet.
+int LedbatCC::queueDelay()
+{
+	int base = 0, cur = 0;
+	for (int i = 0; i < baseHistory; i++)
+		if (basertt[i] && (!base || basertt[i] < base))
+			base = basertt[i];
+	for (int i = 0; i < curFilter; i++)
+		if (currtt[i] && (!cur || currtt[i] < cur))
+			cur = currtt[i];
+	if (!base || !cur)
+		return -1;
+	return cur - base;
+}
+
+void LedbatCC::acked(unsigned newpackets)
+{
+	if (!newpackets)
+		return;
+
+	int qdelay = queueDelay();
+	if (qdelay < 0) {
+		FlowCC::acked(newpackets);
+		return;
+	}
+
+	// Slow start as TCP would, but leave it as soon as
+	// the queue starts to approach our target.
+	if (cwnd() < ssthresh()) {
+		if (qdelay < target / 2) {
+			FlowCC::acked(newpackets);
+			return;
+		}
+		ssthresh() = cwnd();
+	}
+
+	// Grow the window by up to LEDBAT_GAIN packets per round trip
+	// while below the target, and shrink it in proportion
+	// to how far we are above it, by at most half per round trip.
+	float offtarget = (float)(target - qdelay) / target;
+	if (offtarget > 0 && !cwndlim())
+		return;	// don't grow a window we aren't using
+	float delta = LEDBAT_GAIN * offtarget * newpackets / cwnd();
+	wincr += qMax(delta, -0.5f * newpackets);
+
+	int inc = (int)wincr;
+	if (inc) {
+		wincr -= inc;
+		cwnd() = qMax((qint64)cwnd() + inc, (qint64)CWND_MIN);
+	}
+}
+
+void LedbatCC::roundTrip(int, float)
+{
+	// The window changes per ACK in acked().
+	cwndlim() = false;
+}
@@ -0,0 +1,338 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#ifndef SST_FLOWCC_H
+#define SST_FLOWCC_H
+
+#include "flow.h"
+
+namespace SST {
+
+
+// Abstract base class for flow congestion control algorithms.
+// A Flow owns one FlowCC instance, which keeps any per-algorithm state
+// and adjusts the flow's congestion window, slow start threshold
+// and (optionally) pacing rate in response to the events below.
+// The flow itself keeps only the window state all algorithms share.
+//
+// The default event handlers implement standard TCP congestion control:
+// slow start, additive increase, and multiplicative decrease
+// once per window on loss or ECN congestion marks.
+// Subclasses override the handlers in which they differ.
+class FlowCC
+{
+	friend class Flow;
+
+	const CCMode md;
+	Flow *fl;		// Flow we're controlling, set by the flow
+
+public:
+	// Bounds on the congestion window in packets
+	static const unsigned cwndMin = 2;
+	static const unsigned cwndMax = 1 << 20;
+
+	virtual ~FlowCC();
+
+	inline CCMode mode() const { return md; }
+	inline Flow *flow() const { return fl; }
+
+	// Create a congestion controller implementing a given mode.
+	static FlowCC *create(CCMode mode);
+
+protected:
+	inline FlowCC(CCMode mode) : md(mode), fl(NULL) { }
+
+	// Reset the algorithm's state: called on attachment to a flow,
+	// after the flow has reset its own window state to slow start.
+	virtual void reset();
+
+	// Called on each ACK acknowledging 'newpackets' new packets.
+	virtual void acked(unsigned newpackets);
+
+	// Called once per round trip, with the round trip's RTT
+	// in microseconds and delivery rate in packets per second.
+	virtual void roundTrip(int rtt, float pps);
+
+	// Called when packet 'pktseq' is inferred to have been lost.
+	virtual void missed(quint64 pktseq);
+
+	// Called when the receiver reports 'nmarked' of our packets
+	// marked Congestion Experienced, as of an ACK for 'pktseq'.
+	virtual void marked(quint64 pktseq, unsigned nmarked);
+
+	// Called when the retransmission timer expires.
+	virtual void timeout();
+
+	// Called with each per-packet RTT sample in microseconds.
+	virtual void rttSampled(int rtt);
+
+	// Grow the window by one round trip's additive increase:
+	// one packet, or the flow's share of that when it's coupled.
+	void additiveIncrease();
+
+	// Cut the window in response to a new congestion event,
+	// which missed() and marked() detect as in TCP fast recovery.
+	virtual void backoff();
+
+	// Return true if the algorithm sets the flow's pacing rate itself
+	// rather than leaving it to the flow's window-based pacing.
+	virtual bool pacesItself() const;
+
+	// Return true if the algorithm grows the window in slow start
+	// as TCP does, so that HyStart++ may end slow start early.
+	virtual bool standardSlowStart() const;
+
+	// Return true if the algorithm refreshes the flow's windowed
+	// minimum RTT itself instead of letting it expire on a timer.
+	virtual bool refreshesMinRtt() const;
+
+	// Access to the flow's shared congestion state.
+	inline quint32 &cwnd() { return fl->cwnd; }
+	inline quint32 &ssthresh() { return fl->ssthresh; }
+	inline bool &cwndlim() { return fl->cwndlim; }
+	inline quint64 &recovseq() { return fl->recovseq; }
+	inline float &pacerate() { return fl->pacerate; }
+	inline int &minrtt() { return fl->minrtt; }
+	inline Time &minrtttime() { return fl->minrtttime; }
+
+	inline quint64 txseq() const { return fl->txseq; }
+	inline quint64 txackseq() const { return fl->txackseq; }
+	inline quint64 markbase() const { return fl->markbase; }
+	inline quint32 markacks() const { return fl->markacks; }
+	inline quint32 marksent() const { return fl->marksent; }
+	inline quint32 txfltcnt() const { return fl->txfltcnt; }
+	inline int srtt() const { return fl->srtt; }
+	inline qint64 markElapsed() const { return fl->markElapsed(); }
+	Time currentTime() const;
+};
+
+
+// A host-wide group of the flows with coupled congestion control
+// to one remote address (see Flow::setCoupledCC()).  Such flows
+// likely share a bottleneck, so the group couples their additive
+// increase as MPTCP's Linked Increases Algorithm does (RFC 6356),
+// and new members start from the estimates the others already have.
+class FlowCCGroup
+{
+	friend class Flow;
+
+	const QHostAddress addr;	// Remote address of our members
+	QList<Flow*> flows;		// Members, oldest first
+
+	inline FlowCCGroup(const QHostAddress &addr) : addr(addr) { }
+
+public:
+	~FlowCCGroup();
+
+	inline int size() const { return flows.size(); }
+
+	// Return the packets by which member 'fl' may grow its window
+	// per round trip in congestion avoidance: one if it's alone,
+	// and less the more the other members are getting.
+	float increase(Flow *fl) const;
+};
+
+
+// Standard TCP congestion control (CC_TCP).
+class TcpCC : public FlowCC
+{
+public:
+	inline TcpCC() : FlowCC(CC_TCP) { }
+};
+
+// Always-slow-start congestion control that clamps the window
+// to the number of packets it expects delivered (CC_AGGRESSIVE).
+class AggressiveCC : public FlowCC
+{
+protected:
+	quint32 ssbase;		// Slow start baseline
+	int lastrtt;		// Measured RTT of last round-trip
+
+	inline AggressiveCC(CCMode mode) : FlowCC(mode) { }
+
+	virtual void reset();
+	virtual void acked(unsigned newpackets);
+	virtual void roundTrip(int rtt, float pps);
+	virtual void missed(quint64 pktseq);
+	virtual bool standardSlowStart() const;
+
+public:
+	inline AggressiveCC() : FlowCC(CC_AGGRESSIVE) { }
+};
+
+// Low-delay congestion control that walks the window up and down
+// in search of the best network power, pps/rtt (CC_DELAY).
+class DelayCC : public AggressiveCC
+{
+	int cwndinc;
+	quint32 basewnd;
+	float basertt, basepps, basepwr;
+
+protected:
+	virtual void reset();
+	virtual void acked(unsigned newpackets);
+	virtual void roundTrip(int rtt, float pps);
+	virtual void missed(quint64 pktseq);
+
+public:
+	inline DelayCC() : AggressiveCC(CC_DELAY) { }
+};
+
+// TCP Vegas-like congestion control (CC_VEGAS).
+class VegasCC : public FlowCC
+{
+	bool sstoggle;		// Slow start only every other round trip
+
+protected:
+	virtual void reset();
+	virtual void acked(unsigned newpackets);
+	virtual void roundTrip(int rtt, float pps);
+
+public:
+	inline VegasCC() : FlowCC(CC_VEGAS) { }
+};
+
+// No congestion control at all, for reserved-bandwidth links:
+// the window stays wherever Flow::setCCWindow() puts it (CC_FIXED).
+class FixedCC : public FlowCC
+{
+protected:
+	virtual void acked(unsigned newpackets);
+	virtual void roundTrip(int rtt, float pps);
+	virtual void missed(quint64 pktseq);
+	virtual void marked(quint64 pktseq, unsigned nmarked);
+	virtual void timeout();
+	virtual bool standardSlowStart() const;
+
+public:
+	inline FixedCC() : FlowCC(CC_FIXED) { }
+};
+
+// BBR model-based congestion control (CC_BBR):
+// estimates the path's bottleneck bandwidth and minimum RTT,
+// and paces at the former while keeping about a BDP in flight.
+class BbrCC : public FlowCC
+{
+	enum Phase {
+		Startup,	// Exponential growth to find bandwidth
+		Drain,		// Drain the queue built during startup
+		ProbeBW,	// Steady state, cycling pacing gain
+		ProbeRTT,	// Briefly shrink cwnd to re-measure RTT
+	};
+	static const int bwRounds = 10;	// Bandwidth filter length
+
+	Phase phase;
+	int round;		// Round trips observed
+	int cycle;		// Position in ProbeBW pacing gain cycle
+	float bw[bwRounds];	// Recent delivery rates in packets/sec
+	float btlbw;		// Bottleneck bandwidth estimate in packets/sec
+	float fullbw;		// Startup: bandwidth at last significant growth
+	int fullcnt;		// Startup: round trips without such growth
+	Time probeend;		// Time to leave ProbeRTT
+
+protected:
+	virtual void reset();
+	virtual void acked(unsigned newpackets);
+	virtual void roundTrip(int rtt, float pps);
+	virtual void missed(quint64 pktseq);
+	virtual void marked(quint64 pktseq, unsigned nmarked);
+	virtual bool pacesItself() const;
+	virtual bool refreshesMinRtt() const;
+	virtual bool standardSlowStart() const;
+
+public:
+	inline BbrCC() : FlowCC(CC_BBR) { }
+};
+
+// DCTCP-like congestion control, which cuts the window in proportion
+// to the fraction of packets the network marks (CC_DCTCP).
+class DctcpCC : public FlowCC
+{
+	float alpha;		// Estimated fraction of packets being marked
+	quint32 nmarked;	// Packets marked CE this round-trip
+
+protected:
+	virtual void reset();
+	virtual void roundTrip(int rtt, float pps);
+	virtual void marked(quint64 pktseq, unsigned nmarked);
+
+public:
+	inline DctcpCC() : FlowCC(CC_DCTCP) { }
+};
+
+// CUBIC congestion control (CC_CUBIC, RFC 8312), which grows the window
+// as a cubic function of the time since the last congestion event,
+// independent of RTT, so it refills high-BDP paths quickly.
+class CubicCC : public FlowCC
+{
+	float wmax;		// Window just before the last reduction
+	float k;		// Seconds the cubic takes to climb back to wmax
+	float westimate;	// Window standard TCP would have by now
+	float wincr;		// Fractional packets of window growth
+	Time epoch;		// Start of the current growth epoch
+	bool inepoch;		// Whether epoch is valid
+
+protected:
+	virtual void reset();
+	virtual void acked(unsigned newpackets);
+	virtual void roundTrip(int rtt, float pps);
+	virtual void timeout();
+	virtual void backoff();
+
+public:
+	inline CubicCC() : FlowCC(CC_CUBIC) { }
+};
+
+// LEDBAT-style scavenger congestion control (CC_LEDBAT, RFC 6817)
+// for background bulk transfers.  It steers the window to keep
+// the queueing delay it observes near a small target,
+// and so yields to any competing traffic that builds a longer queue.
+class LedbatCC : public FlowCC
+{
+	static const int baseHistory = 10;	// Minutes of base RTT history
+	static const int curFilter = 4;		// Recent RTT samples kept
+
+	const int target;	// Target queueing delay in microseconds
+	int basertt[baseHistory]; // Minimum RTT in each recent minute, or 0
+	int basecur;		// Index of the current minute in basertt
+	Time baseminute;	// Time the current minute started
+	int currtt[curFilter];	// Most recent RTT samples, or 0
+	int curnext;		// Index of the next sample in currtt
+	float wincr;		// Fractional packets of window change
+
+	int queueDelay();
+
+protected:
+	virtual void reset();
+	virtual void acked(unsigned newpackets);
+	virtual void roundTrip(int rtt, float pps);
+	virtual void rttSampled(int rtt);
+
+public:
+	static const int defaultTarget = 25*1000;
+
+	// Create a controller targeting 'target' microseconds of queueing.
+	inline LedbatCC(int target = defaultTarget)
+		: FlowCC(CC_LEDBAT), target(target) { }
+};
+
+
+} // namespace SST
+
+#endif	// SST_FLOWCC_H
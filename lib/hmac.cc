@@ -26,6 +26,7 @@
 
 #include "hmac.h"
 #include "sha2.h"
+#include "pkt.h"
 
 using namespace SST;
 
@@ -145,7 +146,7 @@ bool HMAC::finalVerify(QByteArray &msg, int macsize)
 	bool rc = msg.endsWith(mac);
 
 	// Chop off the MAC
-	msg.resize(msgsize);
+	PacketPool::setSize(msg, msgsize);
 
 	return rc;
 }
@@ -28,6 +28,8 @@
 #include "ident.h"
 #include "dh.h"
 #include "key.h"
+#include "flow.h"
+#include "armorpipe.h"
 #include "regcli.h"
 #include "stream.h"
 
@@ -47,6 +49,8 @@ class Host :	public TimerHostState,
 		public IdentHostState,
 		public DHHostState,
 		public KeyHostState,
+		public ArmorHostState,
+		public FlowHostState,
 		public RegHostState,
 		public StreamHostState
 {
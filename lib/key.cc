@@ -92,7 +92,7 @@ static QByteArray calcChkChanId(quint32 localck, quint32 remoteck)
 
 ////////// Cryptographic security setup //////////
 
-static QByteArray calcSigHash(DhGroup group, int keylen,
+static QByteArray calcSigHash(DhGroup group, int keylen, quint32 armor,
 		const QByteArray &nhi, const QByteArray &nr,
 		const QByteArray &dhi, const QByteArray &dhr,
 		const QByteArray &eid)
@@ -107,10 +107,14 @@ static QByteArray calcSigHash(DhGroup group, int keylen,
 	kp.dhr = dhr;
 	kp.eid = eid;
 
-	// Compute the message to sign
+	// Compute the message to sign.
+	// Only a negotiated armor method extends the original block,
+	// so signatures still match those of peers that predate it.
 	QByteArray ba;
 	XdrStream wds(&ba, QIODevice::WriteOnly);
 	wds << kp;
+	if (armor != KEYMETH_AES)
+		wds << armor;
 	Q_ASSERT(wds.status() == wds.Ok);
 
 	// Return its digest
@@ -139,6 +143,64 @@ static QByteArray calcKey(const QByteArray &master,
 	return key;
 }
 
+// Return the subset of the DH-based flow armor methods in 'meths'
+// that this build actually supports.
+static quint32 supportedArmors(quint32 meths)
+{
+	meths &= KEYMETH_DH;
+	if (!AEADArmor::isSupported(KEYMETH_AESGCM))
+		meths &= ~KEYMETH_AESGCM;
+	if (!AEADArmor::isSupported(KEYMETH_CHACHA))
+		meths &= ~KEYMETH_CHACHA;
+	return meths;
+}
+
+// Pick our preferred flow armor method among those offered:
+// AES-GCM when the CPU accelerates AES and GHASH,
+// otherwise ChaCha20-Poly1305, which is fast in plain software,
+// and only as a last resort the older two-pass AES-CTR + HMAC-SHA256.
+static quint32 chooseArmor(quint32 offered)
+{
+	offered = supportedArmors(offered);
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	bool aeshw = __builtin_cpu_supports("aes")
+			&& __builtin_cpu_supports("pclmul");
+#else
+	bool aeshw = true;	// XX assume ARMv8-style crypto extensions
+#endif
+	if (aeshw && (offered & KEYMETH_AESGCM))
+		return KEYMETH_AESGCM;
+	if (offered & KEYMETH_CHACHA)
+		return KEYMETH_CHACHA;
+	if (offered & KEYMETH_AESGCM)
+		return KEYMETH_AESGCM;
+	return offered & KEYMETH_AES;
+}
+
+// Create the armor for a newly keyed flow using a DH-negotiated method.
+// 'txn' and 'rxn' are the nonces that order the key derivation
+// for our transmit and receive directions, respectively.
+static FlowArmor *newDhArmor(quint32 armor, int keylen,
+		const QByteArray &master,
+		const QByteArray &txn, const QByteArray &rxn)
+{
+	if (armor == KEYMETH_AES) {
+		QByteArray txenckey = calcKey(master, txn, rxn, 'E', 128/8);
+		QByteArray txmackey = calcKey(master, txn, rxn, 'A', 256/8);
+		QByteArray rxenckey = calcKey(master, rxn, txn, 'E', 128/8);
+		QByteArray rxmackey = calcKey(master, rxn, txn, 'A', 256/8);
+		return new AESArmor(txenckey, txmackey, rxenckey, rxmackey);
+	}
+
+	// AEAD methods need just one key per direction.
+	if (armor == KEYMETH_CHACHA)
+		keylen = 256/8;
+	QByteArray txkey = calcKey(master, txn, rxn, 'E', keylen);
+	QByteArray rxkey = calcKey(master, rxn, txn, 'E', keylen);
+	return new AEADArmor(armor, txkey, rxkey);
+}
+
 static QByteArray send(quint32 magic, KeyMessage &msg,
 			const SocketEndpoint &dst)
 {
@@ -159,6 +221,26 @@ static QByteArray send(quint32 magic, KeyChunk &ch, const SocketEndpoint &dst)
 	return send(magic, msg, dst);
 }
 
+// Append an optional DhArmor chunk offering or naming armor methods
+static void appendArmors(KeyMessage &msg, quint32 armors)
+{
+	KeyChunk ch;
+	KeyChunkUnion &chu = ch.alloc();
+	chu.type = KeyChunkDhArmor;
+	chu.dharmor.armors = armors;
+	msg.chunks.append(ch);
+}
+
+// Append an optional FlowOpts chunk naming the flow features we support
+static void appendFlowOpts(KeyMessage &msg, quint32 opts)
+{
+	KeyChunk ch;
+	KeyChunkUnion &chu = ch.alloc();
+	chu.type = KeyChunkFlowOpts;
+	chu.flowopts.opts = opts;
+	msg.chunks.append(ch);
+}
+
 static uint qHash(const KeyEpChk &ch)
 {
 	return qHash(ch.first) + qHash(ch.second);
@@ -213,6 +295,17 @@ void KeyResponder::receive(QByteArray &pkt, XdrStream &,
 	if (rs.status() != rs.Ok)
 		return qDebug("Received malformed key agreement packet");
 
+	// Pick up any armor and flow feature negotiation
+	// accompanying the primary chunk.
+	quint32 armors = 0, opts = 0;
+	for (int i = 0; i < msg.chunks.size(); i++) {
+		KeyChunk &ch = msg.chunks[i];
+		if (ch && ch->type == KeyChunkDhArmor)
+			armors = ch->dharmor.armors;
+		if (ch && ch->type == KeyChunkFlowOpts)
+			opts = ch->flowopts.opts;
+	}
+
 	// Find and process the first recognized primary chunk.
 	for (int i = 0; i < msg.chunks.size(); i++) {
 		KeyChunk &ch = msg.chunks[i];
@@ -221,19 +314,19 @@ void KeyResponder::receive(QByteArray &pkt, XdrStream &,
 
 		// Lightweight checksum negotiation
 		case KeyChunkChkI1:
-			return gotChkI1(ch->chki1, src);
+			return gotChkI1(ch->chki1, opts, src);
 		case KeyChunkChkR1:
-			return KeyInitiator::gotChkR1(h, ch->chkr1, src);
+			return KeyInitiator::gotChkR1(h, ch->chkr1, opts, src);
 
 		// Diffie-Hellman key negotiation
 		case KeyChunkDhI1:
-			return gotDhI1(ch->dhi1, src);
+			return gotDhI1(ch->dhi1, armors, src);
 		case KeyChunkDhI2:
-			return gotDhI2(ch->dhi2, src);
+			return gotDhI2(ch->dhi2, armors, opts, src);
 		case KeyChunkDhR1:
-			return KeyInitiator::gotDhR1(h, ch->dhr1);
+			return KeyInitiator::gotDhR1(h, ch->dhr1, armors);
 		case KeyChunkDhR2:
-			return KeyInitiator::gotDhR2(h, ch->dhr2);
+			return KeyInitiator::gotDhR2(h, ch->dhr2, opts);
 
 		default: break;	// ignore other chunk types
 		}
@@ -254,7 +347,8 @@ void KeyResponder::sendR0(const Endpoint &dst)
 	}
 }
 
-void KeyResponder::gotChkI1(KeyChunkChkI1Data &i1, const SocketEndpoint &src)
+void KeyResponder::gotChkI1(KeyChunkChkI1Data &i1, quint32 opts,
+				const SocketEndpoint &src)
 {
 	qDebug() << this << "got ChkI1 from" << src.toString();
 
@@ -312,7 +406,9 @@ void KeyResponder::gotChkI1(KeyChunkChkI1Data &i1, const SocketEndpoint &src)
 	QByteArray rxchanid = calcChkChanId(i1.cki, ckr);
 	flow->setChannelIds(txchanid, rxchanid);
 
-	// Build, send, XXX and cache our R1 response.
+	// Build, send, XXX and cache our R1 response,
+	// naming our flow features only to initiators that named theirs.
+	KeyMessage msg;
 	KeyChunk ch;
 	KeyChunkUnion &chu = ch.alloc();
 	chu.type = KeyChunkChkR1;
@@ -320,11 +416,15 @@ void KeyResponder::gotChkI1(KeyChunkChkI1Data &i1, const SocketEndpoint &src)
 	chu.chkr1.ckr = ckr;
 	chu.chkr1.chanr = flow->localChannel();
 	chu.chkr1.ulpr = ulpr;
-	QByteArray r2pkt = send(magic(), ch, src);
+	msg.chunks.append(ch);
+	if (opts)
+		appendFlowOpts(msg, h->flowOptions());
+	QByteArray r2pkt = send(magic(), msg, src);
 	// XXX hk->r2cache.insert(hhkr, r2pkt);
 
 	// Let the ball roll
 	flow->setRemoteChannel(i1.chani);
+	flow->setPeerOptions(opts);
 	flow->start(false);
 }
 
@@ -360,7 +460,8 @@ QByteArray KeyResponder::calcDhCookie(DHKey *hk,
 	return hhkr;
 }
 
-void KeyResponder::gotDhI1(KeyChunkDhI1Data &i1, const SocketEndpoint &src)
+void KeyResponder::gotDhI1(KeyChunkDhI1Data &i1, quint32 armors,
+				const SocketEndpoint &src)
 {
 	qDebug() << this << "got DhI1 from" << src.addr.toString() << src.port;
 
@@ -373,13 +474,21 @@ void KeyResponder::gotDhI1(KeyChunkDhI1Data &i1, const SocketEndpoint &src)
 	if (i1.keymin != 128/8 && i1.keymin != 192/8 && i1.keymin != 256/8)
 		return;		// Invalid minimum AES key length
 
+	// An initiator that offers no armor methods predates them,
+	// and only knows AES-CTR with HMAC-SHA256.
+	quint32 armor = armors ? chooseArmor(armors) : KEYMETH_AES;
+	if (armor == 0)
+		return;		// No flow armor method in common
+
 	// Generate an unpredictable responder's nonce
 	QByteArray nr = randBytes(NONCELEN);
 
 	// Compute the hash challenge
 	QByteArray hhkr = calcDhCookie(hk, nr, i1.nhi, src);
 
-	// Build and send the response
+	// Build and send the response,
+	// naming our armor choice only to initiators that asked.
+	KeyMessage msg;
 	KeyChunk ch;
 	KeyChunkUnion &chu = ch.alloc();
 	chu.type = KeyChunkDhR1;
@@ -390,10 +499,14 @@ void KeyResponder::gotDhI1(KeyChunkDhI1Data &i1, const SocketEndpoint &src)
 	chu.dhr1.dhr = hk->pubkey;
 	chu.dhr1.hhkr = hhkr;
 	// Don't offer responder's identity for now
-	send(magic(), ch, src);
+	msg.chunks.append(ch);
+	if (armors)
+		appendArmors(msg, armor);
+	send(magic(), msg, src);
 }
 
-void KeyResponder::gotDhI2(KeyChunkDhI2Data &i2, const SocketEndpoint &src)
+void KeyResponder::gotDhI2(KeyChunkDhI2Data &i2, quint32 armor,
+				quint32 opts, const SocketEndpoint &src)
 {
 	qDebug() << this << "got DhI2";
 
@@ -411,7 +524,7 @@ void KeyResponder::gotDhI2(KeyChunkDhI2Data &i2, const SocketEndpoint &src)
 		i1.keymin = i2.keylen;
 		i1.nhi = nhi;
 		i1.dhi = i2.dhi;
-		return gotDhI1(i1, src);
+		return gotDhI1(i1, armor, src);
 	}
 
 	// See if we've already responded to this particular I2 -
@@ -429,6 +542,15 @@ void KeyResponder::gotDhI2(KeyChunkDhI2Data &i2, const SocketEndpoint &src)
 		return;		// Just drop the bad I2
 	}
 
+	// Make sure the echoed armor method is a single one we support.
+	// Both signatures cover it, so it can't be silently changed.
+	if (armor == 0)
+		armor = KEYMETH_AES;	// Initiator predates armor negotiation
+	if ((armor & (armor - 1)) || supportedArmors(armor) != armor) {
+		qDebug("Received I2 with unsupported armor method");
+		return;
+	}
+
 	// Compute the shared master secret
 	QByteArray master = hk->calcKey(i2.dhi);
 
@@ -478,8 +600,8 @@ void KeyResponder::gotDhI2(KeyChunkDhI2Data &i2, const SocketEndpoint &src)
 		qDebug("Received I2 with bad initiator public key");
 		return;	// XXX generate cached error response instead
 	}
-	QByteArray sighash = calcSigHash(i2.group, i2.keylen, nhi, i2.nr,
-					i2.dhi, i2.dhr, kii.eidr);
+	QByteArray sighash = calcSigHash(i2.group, i2.keylen, armor,
+					nhi, i2.nr, i2.dhi, i2.dhr, kii.eidr);
 	//qDebug("idi %s\nidpki %s\nsighash %s\nsigi %s\n",
 	//	idi.toBase64().data(), idpki.toBase64().data(),
 	//	sighash.toBase64().data(), sigi.toBase64().data());
@@ -504,8 +626,8 @@ void KeyResponder::gotDhI2(KeyChunkDhI2Data &i2, const SocketEndpoint &src)
 	// Should be no failures after this point.
 
 	// Sign the key parameters to prove our own identity
-	sighash = calcSigHash(i2.group, i2.keylen, nhi, i2.nr,
-					i2.dhi, i2.dhr, kii.eidi);
+	sighash = calcSigHash(i2.group, i2.keylen, armor,
+					nhi, i2.nr, i2.dhi, i2.dhr, kii.eidi);
 	QByteArray sigr = hi.sign(sighash);
 
 	// Build the part of the I2 message to be encrypted.
@@ -532,22 +654,22 @@ void KeyResponder::gotDhI2(KeyChunkDhI2Data &i2, const SocketEndpoint &src)
 	encidr = AES().setEncryptKey(enckey).cbcEncrypt(encidr);
 	HMAC(mackey).calcAppend(encidr);
 
-	// Build, send, and cache our R2 response.
+	// Build, send, and cache our R2 response,
+	// naming our flow features only to initiators that named theirs.
+	KeyMessage msg;
 	KeyChunk ch;
 	KeyChunkUnion &chu = ch.alloc();
 	chu.type = KeyChunkDhR2;
 	chu.dhr2.nhi = nhi;
 	chu.dhr2.idr = encidr;
-	QByteArray r2pkt = send(magic(), ch, src);
+	msg.chunks.append(ch);
+	if (opts)
+		appendFlowOpts(msg, h->flowOptions());
+	QByteArray r2pkt = send(magic(), msg, src);
 	hk->r2cache.insert(i2.hhkr, r2pkt);
 
 	// Set up the armor for the new flow
-	QByteArray txenckey = calcKey(master, i2.nr, nhi, 'E', 128/8);
-	QByteArray txmackey = calcKey(master, i2.nr, nhi, 'A', 256/8);
-	QByteArray rxenckey = calcKey(master, nhi, i2.nr, 'E', 128/8);
-	QByteArray rxmackey = calcKey(master, nhi, i2.nr, 'A', 256/8);
-	AESArmor *armor = new AESArmor(txenckey, txmackey, rxenckey, rxmackey);
-	flow->setArmor(armor);
+	flow->setArmor(newDhArmor(armor, i2.keylen, master, i2.nr, nhi));
 
 	// Set up the new flow's channel IDs
 	QByteArray txchanid = calcKey(master, i2.nr, nhi, 'I', 128/8);
@@ -556,6 +678,7 @@ void KeyResponder::gotDhI2(KeyChunkDhI2Data &i2, const SocketEndpoint &src)
 
 	// Let the ball roll
 	flow->setRemoteChannel(kii.chani);
+	flow->setPeerOptions(opts);
 	flow->start(false);
 }
 
@@ -577,6 +700,7 @@ KeyInitiator::KeyInitiator(Flow *fl, quint32 magic,
 	magic(magic),
 	dhgroup(dhgroup ? dhgroup : KEYGROUP_JFDH_DEFAULT),
 	keylen(128/8),
+	armor(0),
 	state(I1),
 	early(true),
 	txtimer(fl->host())
@@ -592,7 +716,7 @@ KeyInitiator::KeyInitiator(Flow *fl, quint32 magic,
 	switch (Ident(idr).scheme()) {
 	case Ident::DSA160:
 	case Ident::RSA160:
-		methods = KEYMETH_AES;
+		methods = supportedArmors(KEYMETH_DEFAULT);
 		break;
 	case Ident::IP:
 		methods = KEYMETH_CHK;
@@ -620,7 +744,7 @@ KeyInitiator::KeyInitiator(Flow *fl, quint32 magic,
 	}
 
 	// DH/AES key agreement state
-	if (methods & KEYMETH_AES) {
+	if (methods & KEYMETH_DH) {
 		ni = randBytes(NONCELEN);
 		nhi = Sha256::hash(ni);
 		Q_ASSERT(nhi.size() == NONCELEN);
@@ -655,7 +779,7 @@ KeyInitiator::cancel()
 			h->initchks.value(KeyEpChk(sepr, chkkey)) == this)
 		h->initchks.remove(KeyEpChk(sepr, chkkey));
 
-	if ((methods & KEYMETH_AES) &&
+	if ((methods & KEYMETH_DH) &&
 			h->initnhis.value(nhi) == this)
 		h->initnhis.remove(nhi);
 
@@ -700,7 +824,7 @@ KeyInitiator::sendI1()
 	}
 
 	// I1 chunk for AES encryption with DH key agreement.
-	if (methods & KEYMETH_AES) {
+	if (methods & KEYMETH_DH) {
 
 		// Clear any DH I2 state,
 		// in case we're restarting at the I1 stage.
@@ -724,14 +848,17 @@ KeyInitiator::sendI1()
 		chu.dhi1.dhi = dhi;
 		// XX ch.dhi1.eidr? (only if the server's identity is public!)
 		msg.chunks.append(ch);
+		appendArmors(msg, methods & KEYMETH_DH);
 	}
 
 	Q_ASSERT(!msg.chunks.isEmpty());
+	if (quint32 opts = h->flowOptions())
+		appendFlowOpts(msg, opts);
 	send(magic, msg, sepr);
 }
 
 void
-KeyInitiator::gotChkR1(Host *h, KeyChunkChkR1Data &r1,
+KeyInitiator::gotChkR1(Host *h, KeyChunkChkR1Data &r1, quint32 opts,
 			const SocketEndpoint &src)
 {
 	qDebug() << "got ChkR1 from" << src.toString();
@@ -763,6 +890,7 @@ KeyInitiator::gotChkR1(Host *h, KeyChunkChkR1Data &r1,
 
 	// Finish flow setup
 	i->fl->setRemoteChannel(r1.chanr);
+	i->fl->setPeerOptions(opts);
 
 	// Our job is done
 	qDebug() << i << "key exchange completed!";
@@ -775,7 +903,7 @@ KeyInitiator::gotChkR1(Host *h, KeyChunkChkR1Data &r1,
 }
 
 void
-KeyInitiator::gotDhR1(Host *h, KeyChunkDhR1Data &r1)
+KeyInitiator::gotDhR1(Host *h, KeyChunkDhR1Data &r1, quint32 armor)
 {
 	// Lookup the Initor based on the received nhi
 	KeyInitiator *i = h->initnhis.value(r1.nhi);
@@ -800,6 +928,13 @@ KeyInitiator::gotDhR1(Host *h, KeyChunkDhR1Data &r1)
 	if (r1.keylen < i->keylen)
 		return;		// Less than our minimum required key length
 
+	// Validate the responder's chosen flow armor method.
+	// A responder that names none predates armor negotiation.
+	if (armor == 0)
+		armor = KEYMETH_AES;
+	if ((armor & (armor - 1)) || (armor & ~(i->methods & KEYMETH_DH)))
+		return;		// Not exactly one of the methods we offered
+
 	// If the group changes or our public key expires, revert to I1 phase.
 	if (i->dhgroup != r1.group) {
 		Q_ASSERT(i->dhgroup < r1.group);
@@ -817,6 +952,7 @@ KeyInitiator::gotDhR1(Host *h, KeyChunkDhR1Data &r1)
 	// we should cache some number of the last R1 responses we get
 	// until we receive a valid R2 response with the correct identity.
 	i->keylen = r1.keylen;
+	i->armor = armor;
 	i->nr = r1.nr;
 	i->dhr = r1.dhr;
 	i->hhkr = r1.hhkr;
@@ -829,8 +965,8 @@ KeyInitiator::gotDhR1(Host *h, KeyChunkDhR1Data &r1)
 	// Sign the key parameters to prove our identity
 	Ident hi = h->hostIdent();
 	QByteArray sighash =
-		calcSigHash((DhGroup)i->dhgroup, i->keylen, i->nhi, i->nr,
-				i->dhi, i->dhr, QByteArray()/*XX*/);
+		calcSigHash((DhGroup)i->dhgroup, i->keylen, i->armor,
+				i->nhi, i->nr, i->dhi, i->dhr, QByteArray()/*XX*/);
 	QByteArray sigi = hi.sign(sighash);
 	//qDebug("sighash %s\nsigi %s\n",
 	//	sighash.toBase64().data(), sigi.toBase64().data());
@@ -881,7 +1017,8 @@ KeyInitiator::sendDhI2()
 	// Once the receiver gets this message, it'll create flow state.
 	early = false;
 
-	// Send the I2 message
+	// Send the I2 message, echoing any negotiated armor method
+	KeyMessage msg;
 	KeyChunk ch;
 	KeyChunkUnion &chu = ch.alloc();
 	chu.type = KeyChunkDhI2;
@@ -893,11 +1030,16 @@ KeyInitiator::sendDhI2()
 	chu.dhi2.dhr = dhr;
 	chu.dhi2.hhkr = hhkr;
 	chu.dhi2.idi = encidi;
-	send(magic, ch, sepr);
+	msg.chunks.append(ch);
+	if (armor != KEYMETH_AES)
+		appendArmors(msg, armor);
+	if (quint32 opts = h->flowOptions())
+		appendFlowOpts(msg, opts);
+	send(magic, msg, sepr);
 }
 
 void
-KeyInitiator::gotDhR2(Host *h, KeyChunkDhR2Data &r2)
+KeyInitiator::gotDhR2(Host *h, KeyChunkDhR2Data &r2, quint32 opts)
 {
 	// Lookup the Initiator based on the received nhi
 	KeyInitiator *i = h->initnhis.value(r2.nhi);
@@ -955,18 +1097,15 @@ KeyInitiator::gotDhR2(Host *h, KeyChunkDhR2Data &r2)
 	}
 	QByteArray eidi = h->hostIdent().id();
 	QByteArray sighash = calcSigHash((DhGroup)i->dhgroup, i->keylen,
-					i->nhi, i->nr, i->dhi, i->dhr, eidi);
+				i->armor, i->nhi, i->nr, i->dhi, i->dhr, eidi);
 	if (!identr.verify(sighash, kir.sigr)) {
 		qDebug("Received I2 with bad responder signature");
 		return;
 	}
 
 	// Set up the new flow's armor
-	QByteArray txenckey = calcKey(i->master, i->nhi, i->nr, 'E', 128/8);
-	QByteArray txmackey = calcKey(i->master, i->nhi, i->nr, 'A', 256/8);
-	QByteArray rxenckey = calcKey(i->master, i->nr, i->nhi, 'E', 128/8);
-	QByteArray rxmackey = calcKey(i->master, i->nr, i->nhi, 'A', 256/8);
-	i->fl->setArmor(new AESArmor(txenckey, txmackey, rxenckey, rxmackey));
+	i->fl->setArmor(newDhArmor(i->armor, i->keylen,
+					i->master, i->nhi, i->nr));
 
 	// Set up the new flow's channel IDs
 	QByteArray txchanid = calcKey(i->master, i->nhi, i->nr, 'I', 128/8);
@@ -975,6 +1114,7 @@ KeyInitiator::gotDhR2(Host *h, KeyChunkDhR2Data &r2)
 
 	// Finish flow setup
 	i->fl->setRemoteChannel(kir.chanr);
+	i->fl->setPeerOptions(opts);
 
 	// Our job is done
 	qDebug("Key exchange completed!");
@@ -43,7 +43,10 @@ namespace SST {
 #define KEYMETH_CHK		0x0002	// Weak 32-bit keyed checksum
 #define KEYMETH_SHA256		0x0010	// HMAC-SHA256 auth, DH key agreement
 #define KEYMETH_AES		0x0020	// AES enc, HMAC-SHA256 auth, DH
-#define KEYMETH_DEFAULT		KEYMETH_AES	// Secure by default
+#define KEYMETH_AESGCM		0x0040	// AES-GCM AEAD, DH
+#define KEYMETH_CHACHA		0x0080	// ChaCha20-Poly1305 AEAD, DH
+#define KEYMETH_DH		(KEYMETH_AES | KEYMETH_AESGCM | KEYMETH_CHACHA)
+#define KEYMETH_DEFAULT		KEYMETH_DH	// Secure by default
 
 
 // Well-known control chunk types for keying
@@ -110,6 +113,7 @@ class KeyInitiator : public QObject
 
 	quint8 dhgroup;		// DH group to use
 	quint8 keylen;		// AES key length to use
+	quint32 armor;		// Flow armor method chosen by responder
 
 	// Protocol state set up before sending I1
 	State state;
@@ -178,10 +182,10 @@ private:
 
 	// Called by KeyResponder::receive() when we get a response packet.
 	static void gotR0(Host *h, const Endpoint &src);
-	static void gotChkR1(Host *h, KeyChunkChkR1Data &r1,
+	static void gotChkR1(Host *h, KeyChunkChkR1Data &r1, quint32 opts,
 				const SocketEndpoint &ep);
-	static void gotDhR1(Host *h, KeyChunkDhR1Data &r1);
-	static void gotDhR2(Host *h, KeyChunkDhR2Data &r2);
+	static void gotDhR1(Host *h, KeyChunkDhR1Data &r1, quint32 armor);
+	static void gotDhR2(Host *h, KeyChunkDhR2Data &r2, quint32 opts);
 
 private slots:
 	void retransmit(bool fail);
@@ -239,12 +243,15 @@ protected:
 
 
 private:
-	void gotChkI1(KeyChunkChkI1Data &i1, const SocketEndpoint &src);
+	void gotChkI1(KeyChunkChkI1Data &i1, quint32 opts,
+			const SocketEndpoint &src);
 
-	void gotDhI1(KeyChunkDhI1Data &i1, const SocketEndpoint &src);
+	void gotDhI1(KeyChunkDhI1Data &i1, quint32 armors,
+			const SocketEndpoint &src);
 	void handleDhI1(quint8 dhgroup, const QByteArray &nhi,
 				QByteArray &pki, const SocketEndpoint &src);
-	void gotDhI2(KeyChunkDhI2Data &i2, const SocketEndpoint &src);
+	void gotDhI2(KeyChunkDhI2Data &i2, quint32 armor, quint32 opts,
+			const SocketEndpoint &src);
 
 	static QByteArray calcDhCookie(DHKey *hk,
 			const QByteArray &nr, const QByteArray &nhi,
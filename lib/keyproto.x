@@ -77,6 +77,25 @@ struct KeyChunkDhR2Data {
 	opaque		idr<>;		// Responder's encrypted identity
 };
 
+// Optional flow armor negotiation, sent in the same message
+// as the DhI1, DhR1, or DhI2 chunk it applies to.
+// Peers that don't recognize it skip it,
+// and without it both sides use AES-CTR with HMAC-SHA256.
+struct KeyChunkDhArmorData {
+	unsigned int	armors;		// I1: methods offered (KEYMETH_*);
+					// R1, I2: the one method chosen
+};
+
+// Optional flow feature negotiation, sent in the same message
+// as the ChkI1, ChkR1, DhI1, DhI2, or DhR2 chunk it applies to.
+// Each side names the optional flow features (Flow::opt*) it supports
+// or will use, and the new flow uses only those both sides named,
+// except that naming optRepairs just warns of repair packets to come.
+// Peers that don't recognize it skip it, and get none of them.
+struct KeyChunkFlowOptsData {
+	unsigned int	opts;
+};
+
 
 // Encrypted and authenticated identity blocks for I2 and R2 messages
 struct KeyIdentI {
@@ -116,6 +135,7 @@ struct KeyParams {
 enum KeyChunkType {
 	// Generic chunks used by multiple negotiation protocols
 	KeyChunkPacket	= 0x0001,	// Piggybacked packet for new channel
+	KeyChunkFlowOpts = 0x0002,	// Optional flow feature negotiation
 
 	// Lightweight checksum negotiation
 	KeyChunkChkI1	= 0x0011,
@@ -125,10 +145,12 @@ enum KeyChunkType {
 	KeyChunkDhI1	= 0x0021,
 	KeyChunkDhR1	= 0x0022,
 	KeyChunkDhI2	= 0x0023,
-	KeyChunkDhR2	= 0x0024
+	KeyChunkDhR2	= 0x0024,
+	KeyChunkDhArmor	= 0x0025	// Optional, alongside DhI1/DhR1/DhI2
 };
 union KeyChunkUnion switch (KeyChunkType type) {
 	case KeyChunkPacket:	opaque packet<>;
+	case KeyChunkFlowOpts:	KeyChunkFlowOptsData flowopts;
 
 	case KeyChunkChkI1:	KeyChunkChkI1Data chki1;
 	case KeyChunkChkR1:	KeyChunkChkR1Data chkr1;
@@ -137,6 +159,7 @@ union KeyChunkUnion switch (KeyChunkType type) {
 	case KeyChunkDhR1:	KeyChunkDhR1Data dhr1;
 	case KeyChunkDhI2:	KeyChunkDhI2Data dhi2;
 	case KeyChunkDhR2:	KeyChunkDhR2Data dhr2;
+	case KeyChunkDhArmor:	KeyChunkDhArmorData dharmor;
 };
 typedef KeyChunkUnion ?KeyChunk;
 
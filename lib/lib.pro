@@ -16,20 +16,21 @@ QMAKE_CXXFLAGS += -fno-strict-aliasing	# XXX
 # Input
 STRM_HEADERS = strm/abs.h strm/base.h \
     strm/dgram.h strm/peer.h strm/sflow.h strm/proto.h
-HEADERS +=	sock.h key.h dh.h ident.h flow.h seg.h \
+HEADERS +=	sock.h pkt.h key.h dh.h ident.h flow.h flowcc.h armorpipe.h seg.h \
 		stream.h reg.h regcli.h \
 		sign.h dsa.h rsa.h aes.h sha2.h hmac.h chk32.h \
 		xdr.h util.h timer.h host.h \
-		os.h
+		os.h epoll.h shard.h xdp.h shm.h
 
 HEADERS += $$STRM_HEADERS
 
-SOURCES +=	sock.cc key.cc dh.cc ident.cc flow.cc seg.cc \
+SOURCES +=	sock.cc pkt.cc key.cc dh.cc ident.cc flow.cc flowcc.cc \
+		armorpipe.cc seg.cc \
 		stream.cc strm/abs.cc strm/base.cc strm/dgram.cc \
 		strm/peer.cc strm/sflow.cc strm/proto.cc \
 		reg.cc regcli.cc \
 		sign.cc dsa.cc rsa.cc aes.cc sha2.cc hmac.cc chk32.cc\
-		xdr.cc util.cc timer.cc host.cc
+		xdr.cc util.cc timer.cc host.cc epoll.cc shard.cc xdp.cc shm.cc
 
 XFILES = keyproto.x
 
@@ -0,0 +1,83 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "pkt.h"
+
+using namespace SST;
+
+
+////////// PacketPool //////////
+
+QByteArray PacketPool::alloc(int size)
+{
+	Q_ASSERT(size > 0);	// resize(0) would free the buffer
+	nreqs++;
+
+	QList<QByteArray> &idle = size <= bufSize ? freebufs : freejumbo;
+	if (size <= jumboSize && !idle.isEmpty()) {
+		QByteArray buf = idle.takeLast();
+		setSize(buf, size);	// within reserved capacity
+		return buf;
+	}
+
+	nallocs++;
+	QByteArray buf;
+	if (size <= bufSize)
+		buf.reserve(bufSize);
+	else if (size <= jumboSize)
+		buf.reserve(jumboSize);
+	buf.resize(size);
+	return buf;
+}
+
+void PacketPool::release(QByteArray &buf)
+{
+	// Only recycle buffers that no one else still refers to,
+	// and that still have exactly one of the pooled capacities;
+	// any others were reallocated somewhere along the way.
+	if (buf.isDetached() && !buf.isNull()) {
+		int cap = buf.capacity();
+		if (cap == bufSize) {
+			if (freebufs.size() < maxFree)
+				freebufs.append(buf);
+		} else if (cap == jumboSize) {
+			if (freejumbo.size() < maxFreeJumbo)
+				freejumbo.append(buf);
+		} else if (cap < jumboSize)
+			nallocs++;	// Reallocated since we handed it out
+	}
+	buf = QByteArray();
+}
+
+void PacketPool::setSize(QByteArray &buf, int size)
+{
+	Q_ASSERT(size >= 0);
+#if QT_VERSION < 0x050000
+	// Qt 4's resize() reallocates when shrinking below half capacity,
+	// so shrink an unshared buffer in place by hand.
+	QByteArray::DataPtr &d = buf.data_ptr();
+	if (d->ref == 1 && size <= d->size) {
+		d->size = size;
+		d->data[size] = 0;
+		return;
+	}
+#endif
+	buf.resize(size);
+}
@@ -0,0 +1,117 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#ifndef SST_PKT_H
+#define SST_PKT_H
+
+#include <QList>
+#include <QByteArray>
+
+namespace SST {
+
+
+/** Per-host pool of reusable packet buffers.
+ * Every packet buffer handed out by the pool is a QByteArray
+ * with enough reserved capacity to hold a maximum-size flow packet,
+ * including the flow header at the front
+ * and the armor's MAC or checksum appended at the end,
+ * so that building, armoring, and transmitting a packet
+ * never has to reallocate it.
+ * There are two size classes: one for standard Ethernet MTUs,
+ * and one for the jumbo frames path MTU discovery may find.
+ * Buffers are passed around as ordinary QByteArrays
+ * and returned to the pool via release() once their owner is done;
+ * a buffer that is still shared with someone else at that point
+ * is simply dropped and freed by Qt when its last reference goes away.
+ * Code that shrinks a pooled buffer, e.g. to strip a trailer,
+ * must do so with setSize(), since under Qt 4
+ * QByteArray::resize() reallocates a buffer shrunk below
+ * half its capacity, which would take it out of the pool.
+ * Once the pool has warmed up, steady-state transfer
+ * recycles the same buffers without touching the heap.
+ */
+class PacketPool
+{
+public:
+	/// Reserved capacity of each standard pooled buffer, in bytes.
+	static const int bufSize = 2048;
+
+	/// Reserved capacity of each jumbo pooled buffer, in bytes:
+	/// room for a Flow::pmtuMax packet plus armor overhead.
+	static const int jumboSize = 9216;
+
+	/// Maximum number of idle buffers the pool holds onto,
+	/// and the part of those that may be jumbo buffers.
+	static const int maxFree = 1024;
+	static const int maxFreeJumbo = 256;
+
+private:
+	QList<QByteArray> freebufs;	// Idle standard buffers
+	QList<QByteArray> freejumbo;	// Idle jumbo buffers
+	quint64 nreqs;			// Buffers requested via alloc()
+	quint64 nallocs;		// Heap allocations of packet buffers
+
+public:
+	inline PacketPool() : nreqs(0), nallocs(0) { }
+
+	/** Obtain a packet buffer of a given size.
+	 * The contents of the returned buffer are undefined.
+	 * Sizes larger than jumboSize are allocated from the heap as usual.
+	 * @param size the desired packet size; must be positive. */
+	QByteArray alloc(int size);
+
+	/** Return a packet buffer to the pool for reuse.
+	 * The buffer is recycled only if the caller holds
+	 * the last reference to it; in either case
+	 * @a buf is left empty on return.
+	 * A buffer that comes back with other than a pooled capacity
+	 * was reallocated while out of the pool, and counts
+	 * as a heap allocation in allocs().
+	 * @param buf the buffer to release. */
+	void release(QByteArray &buf);
+
+	/** Set the size of a packet buffer, keeping its storage
+	 * if it is unshared and large enough,
+	 * where QByteArray::resize() might reallocate it.
+	 * @param buf the buffer to resize.
+	 * @param size the new size. */
+	static void setSize(QByteArray &buf, int size);
+
+	/// Number of buffers requested since the last resetStats().
+	inline quint64 requests() const { return nreqs; }
+
+	/// Number of heap allocations of packet buffers seen:
+	/// requests the pool couldn't satisfy, plus buffers
+	/// that were reallocated while in use.
+	inline quint64 allocs() const { return nallocs; }
+
+	/** Heap allocations per packet buffer requested
+	 * since the last resetStats().
+	 * Approaches zero once the pool reaches steady state. */
+	inline double allocsPerPacket() const
+		{ return nreqs ? (double)nallocs / nreqs : 0.0; }
+
+	/// Reset the request and allocation counters.
+	inline void resetStats() { nreqs = nallocs = 0; }
+};
+
+
+} // namespace SST
+
+#endif	// SST_PKT_H
@@ -113,6 +113,9 @@ void FlowSegment::gotReadyTransmit()
 	// We must be a flow middlebox.
 	Q_ASSERT(other);
 
+	// Forward the whole burst in one socket-level transmit batch.
+	SocketBatch batch(remoteEndpoint().sock);
+
 	while (mayTransmit()) {
 		if (other->rxq.empty())
 			return;		// nothing to transmit
@@ -0,0 +1,258 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#include <QSettings>
+#include <QMutexLocker>
+#include <QSignalMapper>
+#include <QtDebug>
+
+#include "shard.h"
+#include "flow.h"
+
+using namespace SST;
+
+
+////////// ShardHost //////////
+
+// Host whose sockets share their port with the other shards' sockets,
+// and which admits incoming flows only as its shard allows.
+class SST::ShardHost : public Host
+{
+	Shard *const shard;
+
+public:
+	inline ShardHost(Shard *shard) : shard(shard) { }
+
+	virtual Socket *newSocket(QObject *parent = NULL)
+	{
+		UdpSocket *sock = new UdpSocket(this, parent);
+		sock->setReusePort(true);
+		return sock;
+	}
+
+protected:
+	virtual bool admitFlow(Flow *flow, const QByteArray &idi)
+	{
+		return shard->admitFlow(flow, idi);
+	}
+};
+
+
+////////// Shard //////////
+
+Shard::Shard(ShardGroup *group, int index)
+:	QThread(group),
+	grp(group),
+	idx(index),
+	h(NULL)
+{
+}
+
+void Shard::run()
+{
+	ShardHost host(this);
+	host.setHostIdent(Ident(grp->hid, grp->hkey));
+
+	// The first shard settles the port; the rest must share it,
+	// or the OS would have no reason to steer any traffic to them.
+	quint16 port = grp->port;
+	Socket *sock = host.initSocket(NULL, port);
+	if (idx > 0 && sock->localPort() != port)
+		qFatal("Shard %d: can't share UDP port %d", idx, port);
+
+	// Accept on this thread, where the servers live,
+	// even though our QThread object lives on the creating thread.
+	// The mapper lives here too, so it can tell the servers apart.
+	QSignalMapper mapper;
+	connect(&mapper, SIGNAL(mapped(QObject*)),
+		this, SLOT(acceptConnections(QObject*)), Qt::DirectConnection);
+
+	h = &host;
+	foreach (const ShardGroup::Listener &l, grp->listeners) {
+		StreamServer *srv = new StreamServer(&host);
+		if (!srv->listen(l.svname, l.svdesc, l.prname, l.prdesc))
+			qWarning() << "Shard" << idx << "can't listen on"
+				<< l.svname << l.prname << ":"
+				<< srv->errorString();
+
+		connect(srv, SIGNAL(newConnection()), &mapper, SLOT(map()));
+		mapper.setMapping(srv, srv);
+		servers.append(srv);
+	}
+
+	grp->shardStarted(this);
+	grp->shardReady(sock->localPort());
+
+	exec();
+
+	grp->shardStopping(this);
+	qDeleteAll(servers);
+	servers.clear();
+	h = NULL;
+
+	// Our flows go away with the host; give up our peers now.
+	foreach (QObject *fl, flows.keys())
+		flowDestroyed(fl);
+}
+
+void Shard::acceptConnections(QObject *server)
+{
+	StreamServer *srv = (StreamServer*)server;
+	Q_ASSERT(servers.contains(srv));
+
+	while (Stream *strm = srv->accept())
+		grp->newStream(this, strm);
+}
+
+// Called on our thread for each flow a remote host initiates.
+bool Shard::admitFlow(Flow *flow, const QByteArray &eid)
+{
+	if (!grp->claimPeer(eid, idx)) {
+		qDebug() << "Shard" << idx << "refusing flow from"
+			<< eid.toBase64() << "served by another shard";
+		return false;
+	}
+
+	flows.insert(flow, eid);
+	connect(flow, SIGNAL(destroyed(QObject*)),
+		this, SLOT(flowDestroyed(QObject*)), Qt::DirectConnection);
+	return true;
+}
+
+void Shard::flowDestroyed(QObject *flow)
+{
+	if (!flows.contains(flow))
+		return;
+	disconnect(flow, SIGNAL(destroyed(QObject*)),
+		this, SLOT(flowDestroyed(QObject*)));
+	grp->releasePeer(flows.take(flow));
+}
+
+
+////////// ShardGroup //////////
+
+ShardGroup::ShardGroup(QSettings *settings, quint16 defaultport,
+			int nshards, QObject *parent)
+:	QObject(parent),
+	port(defaultport),
+	ready(false)
+{
+	// Settle on one identity up front for all the shards to share.
+	IdentHostState ident;
+	ident.initHostIdent(settings);
+	hid = ident.hostIdent().id();
+	hkey = ident.hostIdent().key(true);
+
+	if (settings) {
+		int p = settings->value("port").toInt();
+		if (p > 0 && p <= 65535)
+			port = p;
+	}
+
+	if (nshards <= 0)
+		nshards = qMax(QThread::idealThreadCount(), 1);
+	for (int i = 0; i < nshards; i++)
+		shards.append(new Shard(this, i));
+}
+
+ShardGroup::~ShardGroup()
+{
+	stop();
+}
+
+void ShardGroup::listen(const QString &serviceName,
+			const QString &serviceDesc,
+			const QString &protocolName,
+			const QString &protocolDesc)
+{
+	Q_ASSERT(!shards.at(0)->isRunning());
+
+	Listener l;
+	l.svname = serviceName;
+	l.svdesc = serviceDesc;
+	l.prname = protocolName;
+	l.prdesc = protocolDesc;
+	listeners.append(l);
+}
+
+void ShardGroup::start()
+{
+	// Start the shards one at a time,
+	// so that each knows the port the first one bound.
+	foreach (Shard *s, shards) {
+		QMutexLocker lock(&mutex);
+		ready = false;
+		s->start();
+		while (!ready)
+			cond.wait(&mutex);
+	}
+	qDebug() << "Started" << shards.size() << "shards on port" << port;
+}
+
+void ShardGroup::shardReady(quint16 boundport)
+{
+	QMutexLocker lock(&mutex);
+	port = boundport;
+	ready = true;
+	cond.wakeAll();
+}
+
+// Assign a remote host to a shard, unless it's already on another one.
+bool ShardGroup::claimPeer(const QByteArray &eid, int shard)
+{
+	QMutexLocker lock(&peermutex);
+	PeerClaim &pc = peers[eid];
+	if (pc.nflows > 0 && pc.shard != shard)
+		return false;
+	pc.shard = shard;
+	pc.nflows++;
+	return true;
+}
+
+void ShardGroup::releasePeer(const QByteArray &eid)
+{
+	QMutexLocker lock(&peermutex);
+	Q_ASSERT(peers.value(eid).nflows > 0);
+	if (--peers[eid].nflows == 0)
+		peers.remove(eid);
+}
+
+void ShardGroup::stop()
+{
+	foreach (Shard *s, shards) {
+		// Repeat in case the shard hasn't entered exec() yet.
+		do {
+			s->quit();
+		} while (!s->wait(100));
+	}
+}
+
+void ShardGroup::shardStarted(Shard *)
+{
+}
+
+void ShardGroup::newStream(Shard *, Stream *)
+{
+}
+
+void ShardGroup::shardStopping(Shard *)
+{
+}
@@ -0,0 +1,203 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+//
+// Sharded server mode: several Hosts sharing one identity and UDP port,
+// each running on its own thread.
+//
+#ifndef SST_SHARD_H
+#define SST_SHARD_H
+
+#include <QHash>
+#include <QList>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include "host.h"
+
+class QSettings;
+
+
+namespace SST {
+
+class ShardGroup;
+class ShardHost;
+
+
+/** One shard of a ShardGroup: a Host with its own thread and event loop.
+ * The shard's Host, its main UdpSocket, and its StreamServers
+ * are all created on the shard's thread when it starts,
+ * and destroyed there when it stops,
+ * so every flow, stream, key exchange and timer on the shard
+ * runs on that thread alone.
+ */
+class Shard : public QThread
+{
+	friend class ShardGroup;
+	friend class ShardHost;
+	Q_OBJECT
+
+	ShardGroup *const grp;
+	const int idx;
+	Host *h;			// Our Host while running, else NULL
+	QList<StreamServer*> servers;	// One per ShardGroup listener
+	QHash<QObject*,QByteArray> flows; // Admitted flows' remote EIDs
+
+public:
+	/// Return the ShardGroup this shard belongs to.
+	inline ShardGroup *group() const { return grp; }
+
+	/// Return this shard's index in its group, from 0.
+	inline int index() const { return idx; }
+
+	/** Return this shard's Host while the shard is running.
+	 * Only use it from the shard's own thread. */
+	inline Host *host() const { return h; }
+
+protected:
+	virtual void run();
+
+private:
+	Shard(ShardGroup *group, int index);
+
+	bool admitFlow(Flow *flow, const QByteArray &eid);
+
+	// These run on the shard's thread, though we live on another;
+	// they take their object explicitly, since sender() is invalid.
+private slots:
+	void acceptConnections(QObject *server);
+	void flowDestroyed(QObject *flow);
+};
+
+
+/** A set of Host shards serving one SST identity on one UDP port,
+ * to spread a server's load across cores.
+ * Each shard binds its own UdpSocket to the shared port
+ * with SO_REUSEPORT, so the OS steers each remote endpoint's datagrams
+ * consistently to one shard by hashing its address and port.
+ * A peer's streams can only be served by the shard holding its flows,
+ * so each remote host is assigned to the first shard it reaches,
+ * and flows it initiates from other source ports, such as
+ * the additional paths of a multipath peer, are refused
+ * if they hash to another shard while it has flows on that one.
+ * Sharded servers therefore don't support multipath peers,
+ * except over paths that happen to land on the same shard.
+ * The shards share one host identity, each holding its own copy
+ * of the private key, and one set of stream listeners
+ * registered through the group with listen().
+ *
+ * Incoming connections are accepted on the owning shard's thread
+ * and passed to newStream() there; subclasses override it,
+ * and shardStarted() or shardStopping() for per-shard setup,
+ * keeping in mind that these run concurrently on different shards.
+ */
+class ShardGroup : public QObject
+{
+	friend class Shard;
+	Q_OBJECT
+
+	struct Listener {
+		QString svname, svdesc;
+		QString prname, prdesc;
+	};
+
+	QByteArray hid, hkey;		// Shared identity and private key
+	quint16 port;			// Shared UDP port, once bound
+	QList<Listener> listeners;
+	QList<Shard*> shards;
+
+	// Startup handshake with each shard's thread
+	QMutex mutex;
+	QWaitCondition cond;
+	bool ready;
+
+	// Shard each remote host's flows are on, and how many,
+	// shared among the shards' threads
+	struct PeerClaim {
+		int shard;
+		int nflows;
+	};
+	QMutex peermutex;
+	QHash<QByteArray,PeerClaim> peers;
+
+public:
+	/** Create a group of shards serving one host identity.
+	 * Locates or creates a persistent identity and UDP port
+	 * in @a settings as Host::Host(QSettings*, quint16) does.
+	 * @param nshards the number of shards to run,
+	 *	or 0 for one per core. */
+	ShardGroup(QSettings *settings, quint16 defaultUdpPort,
+		int nshards = 0, QObject *parent = NULL);
+	~ShardGroup();
+
+	/** Listen for connections to a service and protocol on every shard,
+	 * as with StreamServer::listen().
+	 * Must be called before start(). */
+	void listen(const QString &serviceName, const QString &serviceDesc,
+		const QString &protocolName, const QString &protocolDesc);
+
+	/** Start all shards, returning once each one is bound
+	 * and listening. */
+	void start();
+
+	/// Stop all shards and wait for their threads to finish.
+	void stop();
+
+	/// Return the number of shards.
+	inline int count() const { return shards.size(); }
+
+	/// Return a particular shard.
+	inline Shard *shard(int i) const { return shards.at(i); }
+
+	/// Return the shared UDP port, valid once started.
+	inline quint16 localPort() const { return port; }
+
+	/// Return the shared host identity's EID.
+	inline QByteArray hostId() const { return hid; }
+
+protected:
+	/** Called on a shard's thread once its Host is set up,
+	 * before it handles any traffic.
+	 * The default implementation does nothing. */
+	virtual void shardStarted(Shard *shard);
+
+	/** Called on a shard's thread for each stream it accepts
+	 * from one of the group's listeners.
+	 * The stream's Qt parent is the shard's StreamServer,
+	 * so it is deleted when the shard stops unless reparented
+	 * to another object on the same thread.
+	 * The default implementation does nothing. */
+	virtual void newStream(Shard *shard, Stream *strm);
+
+	/** Called on a shard's thread as it stops,
+	 * before its Host and streams are destroyed.
+	 * The default implementation does nothing. */
+	virtual void shardStopping(Shard *shard);
+
+private:
+	void shardReady(quint16 port);
+	bool claimPeer(const QByteArray &eid, int shard);
+	void releasePeer(const QByteArray &eid);
+};
+
+
+} // namespace SST
+
+#endif	// SST_SHARD_H
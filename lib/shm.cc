@@ -0,0 +1,667 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <QSocketNotifier>
+#include <QtDebug>
+
+// shm.h defines SST_SHM on the same test.
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
+#include <poll.h>
+#endif
+
+#include "shm.h"
+#include "os.h"
+
+using namespace SST;
+
+
+#ifdef SST_SHM
+
+// Older C libraries lack a wrapper for memfd_create().
+#include <sys/syscall.h>
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC	0x0001U
+#endif
+
+static inline int shmMemfd(const char *name)
+{
+	return syscall(SYS_memfd_create, name, MFD_CLOEXEC);
+}
+
+
+////////// ShmRing //////////
+
+// One direction's ring in shared memory.
+// The producer publishes filled slots by advancing head,
+// and the consumer frees them by advancing tail;
+// each index only ever increases, wrapping modulo 2^32,
+// and lives on its own cache line to keep the two sides apart.
+struct ShmRing
+{
+	quint32 head;		// Slots published by the producer
+	quint32 wantspace;	// Producer waits for the consumer to drain
+	char pad1[56];
+	quint32 tail;		// Slots freed by the consumer
+	char pad2[60];
+
+	// Each slot: 32-bit length, 32-bit destination IPv4 address
+	// the sender used, in host byte order, then the packet.
+	char slots[ShmSocket::ringSlots][ShmSocket::slotSize];
+};
+
+#define SHM_MEMSIZE	(2 * sizeof(ShmRing))
+#define SHM_SLOTHDR	8
+
+// Most accepted connections we'll wait on for their setup message
+#define SHM_PENDING_MAX	16
+
+// Returns true if the process at the other end of a Unix socket
+// runs as our own user; abstract socket names have no permissions.
+static bool shmSameUser(int fd)
+{
+	ucred cred;
+	socklen_t len = sizeof(cred);
+	return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0
+		&& len == sizeof(cred) && cred.uid == getuid();
+}
+
+
+////////// ShmChannel //////////
+
+// Our end of a shared-memory channel to one peer port.
+struct SST::ShmChannel
+{
+	ShmSocket *const sock;
+	const quint16 port;	// Peer's UDP port
+	int cfd;		// Unix connection to the peer
+	int rxefd;		// Eventfd the peer signals us on
+	int txefd;		// Eventfd we signal the peer on
+	char *mem;		// Both rings
+	ShmRing *tx, *rx;
+	quint32 txhead;		// Our producer index, ahead of tx->head
+				// by however many packets we're holding
+	QList<Endpoint> blocked;// Endpoints waiting for ring space
+	QSocketNotifier *rxnotifier, *cnotifier;
+
+	ShmChannel(ShmSocket *sock, quint16 port);
+	~ShmChannel();
+
+	bool map(int memfd, bool initiator);
+	void watch();
+	void publish();
+	void signal(int efd);
+
+	inline int freeSlots() const {
+		return ShmSocket::ringSlots
+			- (int)(txhead - __atomic_load_n(&tx->tail,
+							__ATOMIC_SEQ_CST)); }
+};
+
+ShmChannel::ShmChannel(ShmSocket *sock, quint16 port)
+:	sock(sock), port(port),
+	cfd(-1), rxefd(-1), txefd(-1),
+	mem(NULL), tx(NULL), rx(NULL),
+	txhead(0),
+	rxnotifier(NULL), cnotifier(NULL)
+{
+}
+
+ShmChannel::~ShmChannel()
+{
+	// We may be called from one of these notifiers' own signals.
+	if (rxnotifier) {
+		rxnotifier->setEnabled(false);
+		rxnotifier->deleteLater();
+	}
+	if (cnotifier) {
+		cnotifier->setEnabled(false);
+		cnotifier->deleteLater();
+	}
+	if (mem)
+		munmap(mem, SHM_MEMSIZE);
+	if (cfd >= 0) ::close(cfd);
+	if (rxefd >= 0) ::close(rxefd);
+	if (txefd >= 0) ::close(txefd);
+}
+
+// The connecting side transmits on the first ring,
+// and the accepting side on the second.
+bool ShmChannel::map(int memfd, bool initiator)
+{
+	void *p = mmap(NULL, SHM_MEMSIZE, PROT_READ | PROT_WRITE,
+			MAP_SHARED, memfd, 0);
+	::close(memfd);
+	if (p == MAP_FAILED) {
+		qWarning("Can't map shared packet rings: %s", strerror(errno));
+		return false;
+	}
+	mem = (char*)p;
+	ShmRing *rings = (ShmRing*)mem;
+	tx = &rings[initiator ? 0 : 1];
+	rx = &rings[initiator ? 1 : 0];
+	txhead = tx->head;
+	return true;
+}
+
+void ShmChannel::watch()
+{
+	rxnotifier = new QSocketNotifier(rxefd, QSocketNotifier::Read);
+	QObject::connect(rxnotifier, SIGNAL(activated(int)),
+			sock, SLOT(channelReadyRead(int)));
+	cnotifier = new QSocketNotifier(cfd, QSocketNotifier::Read);
+	QObject::connect(cnotifier, SIGNAL(activated(int)),
+			sock, SLOT(channelHangup(int)));
+}
+
+// Make the packets we've written visible, and wake the peer.
+void ShmChannel::publish()
+{
+	if (tx->head == txhead)
+		return;
+	__atomic_store_n(&tx->head, txhead, __ATOMIC_RELEASE);
+	signal(txefd);
+}
+
+void ShmChannel::signal(int efd)
+{
+	quint64 one = 1;
+	if (::write(efd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		qDebug() << "ShmChannel: eventfd write:" << strerror(errno);
+	sock->sst.wakeups++;
+}
+
+#endif	// SST_SHM
+
+
+////////// ShmSocket //////////
+
+ShmSocket::ShmSocket(SocketHostState *host, QObject *parent)
+:	UdpSocket(host, parent),
+	lfd(-1),
+	lnotifier(NULL),
+	sst()
+{
+}
+
+ShmSocket::~ShmSocket()
+{
+#ifdef SST_SHM
+	foreach (ShmChannel *ch, chans)
+		delete ch;
+	chans.clear();
+	foreach (int fd, pending.keys())
+		closePending(fd);
+	if (lfd >= 0)
+		::close(lfd);
+#endif
+}
+
+bool ShmSocket::bind(const QHostAddress &addr, quint16 port,
+			QUdpSocket::BindMode mode)
+{
+	if (!UdpSocket::bind(addr, port, mode))
+		return false;
+
+#ifdef SST_SHM
+	// Any of this host's IPv4 addresses can reach a local peer.
+	laddrs.clear();
+	laddrs.append(QHostAddress(QHostAddress::LocalHost));
+	foreach (const QHostAddress &a, localHostAddrs())
+		if (a.protocol() == QAbstractSocket::IPv4Protocol
+				&& !laddrs.contains(a))
+			laddrs.append(a);
+
+	// Listen under a name in the abstract namespace derived from our port,
+	// which the kernel scopes to our network namespace just like the port.
+	sockaddr_un sun;
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	int len = snprintf(sun.sun_path + 1, sizeof(sun.sun_path) - 1,
+			"sst-shm-%d", localPort()) + 1;
+	socklen_t sunlen = offsetof(sockaddr_un, sun_path) + len;
+
+	lfd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (lfd < 0 || ::bind(lfd, (sockaddr*)&sun, sunlen) < 0
+			|| ::listen(lfd, 16) < 0) {
+		qDebug() << this << "not offering shared memory:"
+			<< strerror(errno);
+		if (lfd >= 0)
+			::close(lfd);
+		lfd = -1;
+		return true;	// UDP alone still works
+	}
+	lnotifier = new QSocketNotifier(lfd, QSocketNotifier::Read, this);
+	connect(lnotifier, SIGNAL(activated(int)),
+		this, SLOT(acceptChannel()));
+#endif
+	return true;
+}
+
+// Find the channel to a local peer, trying to set one up if asked.
+ShmChannel *ShmSocket::channel(const Endpoint &ep, bool create)
+{
+#ifdef SST_SHM
+	if (lfd < 0 || ep.port == localPort() || !laddrs.contains(ep.addr))
+		return NULL;
+	ShmChannel *ch = chans.value(ep.port);
+	if (ch || !create)
+		return ch;
+
+	// Don't keep knocking on a port with no ShmSocket behind it.
+	qint64 now = time(NULL);
+	QHash<quint16, qint64>::const_iterator i = noshm.find(ep.port);
+	if (i != noshm.end() && now - *i < retryDelay)
+		return NULL;
+
+	ch = connectChannel(ep.port);
+	if (ch)
+		noshm.remove(ep.port);
+	else
+		noshm.insert(ep.port, now);
+	return ch;
+#else
+	(void)ep; (void)create;
+	return NULL;
+#endif
+}
+
+// Connect to a local peer's listener and hand it a new channel:
+// our port, then the shared memory and both eventfds.
+ShmChannel *ShmSocket::connectChannel(quint16 port)
+{
+#ifdef SST_SHM
+	sockaddr_un sun;
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	int len = snprintf(sun.sun_path + 1, sizeof(sun.sun_path) - 1,
+			"sst-shm-%d", port) + 1;
+	socklen_t sunlen = offsetof(sockaddr_un, sun_path) + len;
+
+	// Unix connections complete at once unless the listener's backlog
+	// is full, in which case we just try again after retryDelay,
+	// rather than stall our event loop on a peer that isn't serving it.
+	int cfd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK
+				| SOCK_CLOEXEC, 0);
+	if (cfd < 0)
+		return NULL;
+	if (::connect(cfd, (sockaddr*)&sun, sunlen) < 0) {
+		::close(cfd);
+		return NULL;	// Not a ShmSocket, or not local after all
+	}
+
+	// Don't hand our memory to whoever grabbed the name first.
+	if (!shmSameUser(cfd)) {
+		qDebug() << this << "local port" << port
+			<< "is served by another user";
+		::close(cfd);
+		return NULL;
+	}
+
+	ShmChannel *ch = new ShmChannel(this, port);
+	ch->cfd = cfd;
+	int memfd = shmMemfd("sst-shm");
+	ch->rxefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	ch->txefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (memfd < 0 || ch->rxefd < 0 || ch->txefd < 0
+			|| ftruncate(memfd, SHM_MEMSIZE) < 0) {
+		qWarning("Can't create shared packet rings: %s",
+			strerror(errno));
+		if (memfd >= 0)
+			::close(memfd);
+		delete ch;
+		return NULL;
+	}
+
+	// The peer's receive eventfd is our transmit one, and vice versa.
+	quint16 myport = localPort();
+	int fds[3] = { memfd, ch->txefd, ch->rxefd };
+	char ctl[CMSG_SPACE(sizeof(fds))];
+	iovec iov;
+	iov.iov_base = &myport;
+	iov.iov_len = sizeof(myport);
+	msghdr mh;
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = ctl;
+	mh.msg_controllen = sizeof(ctl);
+	cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+	if (::sendmsg(cfd, &mh, 0) < 0) {
+		qWarning("Can't pass shared packet rings: %s", strerror(errno));
+		::close(memfd);
+		delete ch;
+		return NULL;
+	}
+
+	if (!ch->map(memfd, true)) {
+		delete ch;
+		return NULL;
+	}
+	ch->watch();
+	chans.insert(port, ch);
+	sst.channels++;
+	qDebug() << this << "shared memory channel to local port" << port;
+	return ch;
+#else
+	(void)port;
+	return NULL;
+#endif
+}
+
+void ShmSocket::acceptChannel()
+{
+#ifdef SST_SHM
+	int cfd;
+	while ((cfd = accept4(lfd, NULL, NULL,
+				SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		if (!shmSameUser(cfd) || pending.size() >= SHM_PENDING_MAX) {
+			qDebug() << this << "refusing shared memory connection";
+			::close(cfd);
+			continue;
+		}
+
+		// The peer sends its half of the setup right after connecting,
+		// but wait for it from the event loop, not here.
+		QSocketNotifier *n = new QSocketNotifier(cfd,
+					QSocketNotifier::Read, this);
+		connect(n, SIGNAL(activated(int)),
+			this, SLOT(channelRequest(int)));
+		pending.insert(cfd, n);
+	}
+#endif
+}
+
+void ShmSocket::closePending(int fd)
+{
+#ifdef SST_SHM
+	// We may be called from the notifier's own signal.
+	QSocketNotifier *n = pending.take(fd);
+	n->setEnabled(false);
+	n->deleteLater();
+	::close(fd);
+#else
+	(void)fd;
+#endif
+}
+
+// Take the setup message from a connection accepted by acceptChannel().
+void ShmSocket::channelRequest(int cfd)
+{
+#ifdef SST_SHM
+	if (!pending.contains(cfd))
+		return;
+	quint16 port = 0;
+	int fds[3];
+	char ctl[CMSG_SPACE(sizeof(fds))];
+	iovec iov;
+	iov.iov_base = &port;
+	iov.iov_len = sizeof(port);
+	msghdr mh;
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = ctl;
+	mh.msg_controllen = sizeof(ctl);
+	ssize_t rc = ::recvmsg(cfd, &mh, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+	if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK
+			|| errno == EINTR))
+		return;
+	cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+	if (rc != sizeof(port) || port == 0 || cm == NULL
+			|| cm->cmsg_level != SOL_SOCKET
+			|| cm->cmsg_type != SCM_RIGHTS
+			|| cm->cmsg_len != CMSG_LEN(sizeof(fds))) {
+		qDebug() << this << "bad shared memory channel request";
+		if (cm && cm->cmsg_type == SCM_RIGHTS) {
+			int n = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			for (int i = 0; i < n && i < 3; i++)
+				::close(((int*)CMSG_DATA(cm))[i]);
+		}
+		closePending(cfd);
+		return;
+	}
+	memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+
+	// A peer reconnecting from the same port replaces its old channel,
+	// but only once the old one's connection has gone away:
+	// otherwise someone else is claiming that port.
+	if (ShmChannel *old = chans.value(port)) {
+		pollfd pfd;
+		pfd.fd = old->cfd;
+		pfd.events = POLLRDHUP;
+		pfd.revents = 0;
+		if (::poll(&pfd, 1, 0) <= 0
+				|| !(pfd.revents & (POLLHUP | POLLRDHUP | POLLERR))) {
+			qDebug() << this << "refusing second shared memory"
+				<< "channel from local port" << port;
+			for (int i = 0; i < 3; i++)
+				::close(fds[i]);
+			closePending(cfd);
+			return;
+		}
+		closeChannel(old);
+	}
+
+	// The connection is now the channel's to watch.
+	QSocketNotifier *n = pending.take(cfd);
+	n->setEnabled(false);
+	n->deleteLater();
+
+	ShmChannel *ch = new ShmChannel(this, port);
+	ch->cfd = cfd;
+	ch->rxefd = fds[1];
+	ch->txefd = fds[2];
+	if (!ch->map(fds[0], false)) {
+		delete ch;
+		return;
+	}
+	ch->watch();
+	chans.insert(port, ch);
+	noshm.remove(port);
+	sst.channels++;
+	qDebug() << this << "shared memory channel from local port" << port;
+#else
+	(void)cfd;
+#endif
+}
+
+void ShmSocket::closeChannel(ShmChannel *ch)
+{
+#ifdef SST_SHM
+	qDebug() << this << "closing shared memory channel to port" << ch->port;
+	chans.remove(ch->port);
+	QList<Endpoint> blocked = ch->blocked;
+	delete ch;
+
+	// Let waiting flows find out they'll have to manage without.
+	foreach (const Endpoint &ep, blocked)
+		readyTransmit(ep);
+#else
+	(void)ch;
+#endif
+}
+
+void ShmSocket::channelHangup(int fd)
+{
+#ifdef SST_SHM
+	foreach (ShmChannel *ch, chans)
+		if (ch->cfd == fd) {
+			closeChannel(ch);
+			return;
+		}
+#else
+	(void)fd;
+#endif
+}
+
+void ShmSocket::channelReadyRead(int fd)
+{
+#ifdef SST_SHM
+	ShmChannel *ch = NULL;
+	foreach (ShmChannel *c, chans)
+		if (c->rxefd == fd)
+			ch = c;
+	if (!ch)
+		return;
+
+	quint64 count;
+	if (::read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		qDebug() << this << "eventfd read:" << strerror(errno);
+
+	PacketPool &pool = host()->packetPool();
+	SocketEndpoint src;
+	src.sock = this;
+	src.port = ch->port;
+
+	// Send any responses we generate (e.g., ACKs) as one batch too.
+	SocketBatch txbatch(this);
+
+	ShmRing *rx = ch->rx;
+	quint32 tail = rx->tail;
+	quint32 head;
+	while ((head = __atomic_load_n(&rx->head, __ATOMIC_ACQUIRE)) != tail) {
+		do {
+			const char *slot = rx->slots[tail % ringSlots];
+			quint32 len, addr;
+			memcpy(&len, slot, 4);
+			memcpy(&addr, slot + 4, 4);
+			if (len > (quint32)(slotSize - SHM_SLOTHDR))
+				len = 0;	// Corrupt; drop it
+
+			QByteArray msg = pool.alloc(qMax((int)len, 1));
+			memcpy(msg.data(), slot + SHM_SLOTHDR, len);
+			msg.resize(len);
+			tail++;
+
+			src.addr.setAddress(addr);
+			sst.rxpackets++;
+			if (len > 0)
+				receive(msg, src);
+			pool.release(msg);
+		} while (tail != head);
+
+		// Free the slots, then wake the producer if it's waiting.
+		__atomic_store_n(&rx->tail, tail, __ATOMIC_SEQ_CST);
+		if (__atomic_exchange_n(&rx->wantspace, 0, __ATOMIC_SEQ_CST))
+			ch->signal(ch->txefd);
+	}
+
+	// The peer may have woken us because it freed space for us.
+	if (!ch->blocked.isEmpty() && ch->freeSlots() > 0) {
+		QList<Endpoint> blocked = ch->blocked;
+		ch->blocked.clear();
+		foreach (const Endpoint &ep, blocked)
+			readyTransmit(ep);
+	}
+#else
+	(void)fd;
+#endif
+}
+
+bool ShmSocket::send(const Endpoint &ep, const char *data, int size)
+{
+#ifdef SST_SHM
+	ShmChannel *ch = channel(ep, true);
+	if (!ch)
+		return UdpSocket::send(ep, data, size);
+
+	// Like a full socket buffer, a full ring drops the packet.
+	if (size > slotSize - SHM_SLOTHDR || ch->freeSlots() <= 0)
+		return false;
+
+	char *slot = ch->tx->slots[ch->txhead % ringSlots];
+	quint32 len = size;
+	quint32 addr = ep.addr.toIPv4Address();
+	memcpy(slot, &len, 4);
+	memcpy(slot + 4, &addr, 4);
+	memcpy(slot + SHM_SLOTHDR, data, size);
+	ch->txhead++;
+	sst.txpackets++;
+
+	// Outside a batch, send it right away.
+	if (!inBatch())
+		ch->publish();
+	return true;
+#else
+	return UdpSocket::send(ep, data, size);
+#endif
+}
+
+void ShmSocket::flushBatch()
+{
+	UdpSocket::flushBatch();
+#ifdef SST_SHM
+	foreach (ShmChannel *ch, chans)
+		ch->publish();
+#endif
+}
+
+bool ShmSocket::isCongestionControlled(const Endpoint &ep)
+{
+	return channel(ep, true) != NULL;
+}
+
+int ShmSocket::mayTransmit(const Endpoint &ep)
+{
+#ifdef SST_SHM
+	ShmChannel *ch = channel(ep, true);
+	if (!ch)
+		return 1;	// Peer went away; the flow will time out
+	int n = ch->freeSlots();
+	if (n > 0)
+		return n;
+
+	// Ask the consumer to wake us when it frees a slot,
+	// then check again in case it just did.
+	__atomic_store_n(&ch->tx->wantspace, 1, __ATOMIC_SEQ_CST);
+	n = ch->freeSlots();
+	if (n <= 0 && !ch->blocked.contains(ep))
+		ch->blocked.append(ep);
+	return qMax(n, 0);
+#else
+	(void)ep;
+	return 1;
+#endif
+}
+
+int ShmSocket::pathMtu(const Endpoint &ep)
+{
+	// Report the slot size as an IP MTU, as if it had UDP/IP headers.
+	if (channel(ep, false))
+		return slotSize - 8 + 20 + 8;
+	return UdpSocket::pathMtu(ep);
+}
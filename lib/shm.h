@@ -0,0 +1,149 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+//
+// Shared-memory shortcut for SST peers on the same host.
+//
+#ifndef SST_SHM_H
+#define SST_SHM_H
+
+#include <QHash>
+#include <QList>
+
+#include "sock.h"
+
+// Needs memfd_create(), eventfd(), and abstract Unix sockets.
+#if defined(__linux__)
+#define SST_SHM		1
+#endif
+
+class QSocketNotifier;
+
+
+namespace SST {
+
+struct ShmChannel;
+
+
+/** UdpSocket that exchanges packets with peers on the same host
+ * through shared memory instead of the kernel's UDP stack.
+ *
+ * Each ShmSocket also listens on an abstract Unix socket named for
+ * its UDP port. The first time we send to one of this host's own
+ * addresses, we try to connect there. If another ShmSocket answers,
+ * we pass it a memory-backed file holding a pair of single-producer,
+ * single-consumer packet rings, plus an eventfd for each direction,
+ * and from then on packets to that port go through the rings.
+ * Otherwise, and for all other peers, packets go over UDP as usual.
+ * The Unix connection stays open so that each side notices
+ * when the other goes away and falls back to UDP.
+ * Since abstract socket names carry no permissions,
+ * each side only deals with peers running as the same user,
+ * and a new channel never displaces a live one.
+ *
+ * Packets keep the addresses they would have had over UDP,
+ * so flows and streams work the same either way.
+ * But since the rings neither drop nor reorder packets,
+ * the socket reports local peers as congestion controlled,
+ * and flows to them take their transmit window from the ring's
+ * free space instead of running congestion control.
+ */
+class ShmSocket : public UdpSocket
+{
+	friend struct ShmChannel;
+	Q_OBJECT
+
+public:
+	/// Packet slots in each direction's ring.
+	static const int ringSlots = 256;
+
+	/// Bytes per ring slot, including an 8-byte header:
+	/// room for a jumbo packet as large as Flow ever sends.
+	static const int slotSize = 9216;
+
+	/// Seconds before trying shared memory again with a port
+	/// that didn't answer.
+	static const int retryDelay = 10;
+
+	/// Counters for packets taking the shared-memory path.
+	struct ShmStats {
+		quint64 rxpackets;	///< Packets received from rings
+		quint64 txpackets;	///< Packets sent into rings
+		quint64 wakeups;	///< Eventfd wakeups sent to peers
+		quint64 channels;	///< Channels established
+	};
+
+private:
+	int lfd;			// Listening Unix socket, -1 if none
+	QSocketNotifier *lnotifier;
+	QList<QHostAddress> laddrs;	// Addresses that mean this host
+	QHash<quint16, ShmChannel*> chans;	// Channels by peer port
+	QHash<int, QSocketNotifier*> pending;	// Connections awaiting setup
+	QHash<quint16, qint64> noshm;	// Ports that didn't answer, when
+	ShmStats sst;
+
+public:
+	ShmSocket(SocketHostState *host, QObject *parent = NULL);
+	~ShmSocket();
+
+	/** Bind the UDP socket as UdpSocket does,
+	 * and start listening for same-host peers. */
+	bool bind(const QHostAddress &addr = QHostAddress::Any,
+		quint16 port = 0,
+		QUdpSocket::BindMode mode = QUdpSocket::DefaultForPlatform);
+
+	bool send(const Endpoint &ep, const char *data, int size);
+
+	/// Returns true for peers reachable through shared memory.
+	virtual bool isCongestionControlled(const Endpoint &ep);
+
+	/// Returns the number of free slots in the ring to @a ep.
+	virtual int mayTransmit(const Endpoint &ep);
+
+	/// Returns the ring's packet size limit for local peers.
+	virtual int pathMtu(const Endpoint &ep);
+
+	/// Returns true if a shared-memory channel to @a ep is open.
+	inline bool isShared(const Endpoint &ep)
+		{ return channel(ep, false) != NULL; }
+
+	/// Return the shared-memory path's counters.
+	inline const ShmStats &shmStats() const { return sst; }
+	inline void resetShmStats() { sst = ShmStats(); }
+
+protected:
+	virtual void flushBatch();
+
+private:
+	ShmChannel *channel(const Endpoint &ep, bool create);
+	ShmChannel *connectChannel(quint16 port);
+	void closeChannel(ShmChannel *ch);
+	void closePending(int fd);
+
+private slots:
+	void acceptChannel();
+	void channelRequest(int fd);
+	void channelReadyRead(int fd);
+	void channelHangup(int fd);
+};
+
+
+} // namespace SST
+
+#endif	// SST_SHM_H
@@ -19,15 +19,37 @@
  */
 
 
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
 #include <QDataStream>
+#include <QtEndian>
 #include <QSettings>
+#include <QSocketNotifier>
 #include <QtDebug>
 
+// Headers for batched I/O; sock.h defines SST_UDP_BATCH on the same test.
+#if defined(__linux__)
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <unistd.h>
+#include <poll.h>
+#endif
+
 #include "util.h"
 #include "sock.h"
 #include "xdr.h"
 #include "os.h"
 
+// Linux sets Don't Fragment on request, and reports the path MTU
+// it has learned from ICMP to a connected socket.
+#if defined(__linux__) && defined(IP_MTU_DISCOVER) && defined(IP_MTU)
+#define SST_UDP_PMTU	1
+#endif
+
 using namespace SST;
 
 
@@ -63,6 +85,123 @@ uint qHash(const SST::SocketEndpoint &sep)
 }
 
 
+////////// FlowTable //////////
+
+FlowTable::FlowTable()
+:	slots(NULL),
+	mask(0),
+	count(0)
+{
+	resize(minSlots);
+}
+
+FlowTable::~FlowTable()
+{
+	delete [] slots;
+}
+
+FlowTable::Key FlowTable::key(const Endpoint &ep, Channel chan)
+{
+	Key k;
+	k.addr[0] = k.addr[1] = k.addr[2] = k.addr[3] = 0;
+	switch (ep.addr.protocol()) {
+	case QAbstractSocket::IPv4Protocol:
+		k.addr[3] = ep.addr.toIPv4Address();
+		k.family = 4;
+		break;
+	case QAbstractSocket::IPv6Protocol: {
+		Q_IPV6ADDR a6 = ep.addr.toIPv6Address();
+		memcpy(k.addr, &a6, sizeof(k.addr));
+		k.family = 6;
+		break; }
+	default:
+		k.family = 0;
+		break;
+	}
+	k.port = ep.port;
+	k.chan = chan;
+
+	// Multiply-xorshift mixing of the packed words.
+	quint64 x = ((quint64)k.addr[0] << 32 | k.addr[1])
+			* Q_UINT64_C(0x9e3779b97f4a7c15);
+	x ^= (quint64)k.addr[2] << 32 | k.addr[3];
+	x *= Q_UINT64_C(0xc2b2ae3d27d4eb4f);
+	x ^= (quint64)k.port << 16 | (quint64)k.chan << 8 | k.family;
+	x *= Q_UINT64_C(0x165667b19e3779f9);
+	k.hash = (quint32)(x ^ (x >> 32));
+	return k;
+}
+
+void FlowTable::insert(const Key &k, SocketFlow *flow)
+{
+	Q_ASSERT(flow != NULL);
+	Q_ASSERT(value(k) == NULL);
+
+	// Keep the table at most half full so probe runs stay short.
+	if (2 * (count + 1) > (int)mask + 1)
+		resize(2 * ((int)mask + 1));
+	place(k, flow);
+	count++;
+}
+
+bool FlowTable::remove(const Key &k)
+{
+	quint32 i = k.hash & mask;
+	while (slots[i].flow != NULL && !(slots[i].key == k))
+		i = (i + 1) & mask;
+	if (slots[i].flow == NULL)
+		return false;
+
+	// Shift later members of the probe run back into the gap,
+	// so lookups never need tombstones.
+	for (quint32 j = (i + 1) & mask; slots[j].flow != NULL;
+			j = (j + 1) & mask) {
+		quint32 home = slots[j].key.hash & mask;
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			slots[i] = slots[j];
+			i = j;
+		}
+	}
+	slots[i].flow = NULL;
+	count--;
+	return true;
+}
+
+QList<SocketFlow*> FlowTable::values() const
+{
+	QList<SocketFlow*> l;
+	for (quint32 i = 0; i <= mask; i++)
+		if (slots[i].flow != NULL)
+			l.append(slots[i].flow);
+	return l;
+}
+
+void FlowTable::resize(int nslots)
+{
+	Q_ASSERT((nslots & (nslots - 1)) == 0);
+
+	Slot *old = slots;
+	int nold = old ? (int)mask + 1 : 0;
+	slots = new Slot[nslots];
+	memset(slots, 0, nslots * sizeof(Slot));
+	mask = nslots - 1;
+
+	for (int i = 0; i < nold; i++)
+		if (old[i].flow != NULL)
+			place(old[i].key, old[i].flow);
+	delete [] old;
+}
+
+void FlowTable::place(const Key &k, SocketFlow *flow)
+{
+	quint32 i = k.hash & mask;
+	while (slots[i].flow != NULL)
+		i = (i + 1) & mask;
+	slots[i].key = k;
+	slots[i].flow = flow;
+}
+
+
 ////////// Socket //////////
 
 Socket::~Socket()
@@ -92,11 +231,18 @@ Socket::bindFlow(const Endpoint &remoteep, Channel localchan, SocketFlow *fl)
 {
 	Q_ASSERT(flow(remoteep, localchan) == NULL);
 
-	QPair<Endpoint,Channel> p(remoteep, localchan);
-	flows.insert(p, fl);
+	flows.insert(FlowTable::key(remoteep, localchan), fl);
 	return true;
 }
 
+void
+Socket::readyTransmit(const Endpoint &ep)
+{
+	foreach (SocketFlow *fl, flows.values())
+		if (fl->remoteep == ep)
+			fl->readyTransmit();
+}
+
 void
 Socket::receive(QByteArray &msg, const SocketEndpoint &src)
 {
@@ -109,23 +255,44 @@ Socket::receive(QByteArray &msg, const SocketEndpoint &src)
 	// First interpret the first byte as a channel number
 	// to try to find an endpoint-specific flow.
 	Channel chan = msg.at(0);
-	SocketFlow *fl = flow(src, chan);
+	SocketFlow *fl = flows.value(src, chan);
 	if (fl != NULL)
 		return fl->receive(msg, src);
 
 	// If that doesn't work, it may be a global control packet:
 	// if so, pass it to the appropriate SocketReceiver.
-	XdrStream rs(&msg, QIODevice::ReadOnly);
-	quint32 magic;
-	rs >> magic;
+	// Read the magic straight from the packet, and only set up
+	// an XdrStream once we know some receiver wants it.
+	quint32 magic = qFromBigEndian<quint32>(
+				(const uchar*)msg.constData());
 	SocketReceiver *rcv = h->receivers.value(magic);
-	if (rcv)
+	if (rcv) {
+		XdrStream rs(&msg, QIODevice::ReadOnly);
+		rs >> magic;
 		return rcv->receive(msg, rs, src);
+	}
 
 	qDebug("Received control message for unknown flow/receiver %08x",
 		magic);
 }
 
+void
+Socket::receive(QByteArray &msg, const SocketEndpoint &src, int ecn)
+{
+	rxecn = ecn;
+	receive(msg, src);
+	rxecn = EcnNotEct;
+}
+
+void Socket::flushBatch()
+{
+}
+
+void Socket::setEcnCapable(bool enable)
+{
+	ecncap = enable;
+}
+
 bool Socket::isCongestionControlled(const Endpoint &)
 {
 	return false;
@@ -137,6 +304,15 @@ int Socket::mayTransmit(const Endpoint &)
 	return -1;
 }
 
+int Socket::pathMtu(const Endpoint &)
+{
+	return 0;
+}
+
+void Socket::peerAuthenticated(const Endpoint &)
+{
+}
+
 QString Socket::toString() const
 {
 	return QString("%1(0x%2)")
@@ -145,26 +321,339 @@ QString Socket::toString() const
 }
 
 
+////////// UdpBatch //////////
+
+#ifdef SST_UDP_BATCH
+
+// Older system headers may lack the UDP offload socket options.
+#ifndef SOL_UDP
+#define SOL_UDP		17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT	103	// Linux 4.18+: UDP generic segmentation
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO		104	// Linux 5.0+: UDP generic receive offload
+#endif
+#ifndef SO_REUSEPORT
+#define SO_REUSEPORT	15	// Linux 3.9+: load-balanced port sharing
+#endif
+
+// Size of the ancillary data buffer for a UDP_SEGMENT or UDP_GRO cmsg,
+// plus an IP_TOS cmsg carrying the ECN bits of a received datagram.
+#define UDPCMSGLEN	(CMSG_SPACE(sizeof(int)) * 2)
+
+// Private state for batched datagram I/O on a UdpSocket.
+struct SST::UdpBatch
+{
+	bool gso;		// Kernel accepts UDP_SEGMENT sends
+	bool gro;		// Kernel delivers UDP_GRO-coalesced datagrams
+
+	// Receive state: one slot per datagram in a recvmmsg() call
+	char *rxbuf;
+	mmsghdr rxmsgs[UdpSocket::rxBatchMax];
+	iovec rxiovs[UdpSocket::rxBatchMax];
+	sockaddr_in rxaddrs[UdpSocket::rxBatchMax];
+	char rxctl[UdpSocket::rxBatchMax][UDPCMSGLEN];
+
+	// Transmit state: packets held contiguously in txbuf
+	char txbuf[UdpSocket::txBufSize];
+	int ntx;		// Number of packets held
+	int txused;		// Bytes of txbuf in use
+	int txofs[UdpSocket::txBatchMax];
+	int txlen[UdpSocket::txBatchMax];
+	sockaddr_in txaddrs[UdpSocket::txBatchMax];
+
+	// Per-call transmit message vector
+	mmsghdr txmsgs[UdpSocket::txBatchMax];
+	iovec txiovs[UdpSocket::txBatchMax];
+	char txctl[UdpSocket::txBatchMax][UDPCMSGLEN];
+	int txfirst[UdpSocket::txBatchMax];	// First packet in each message
+
+	// Watches for room in the socket buffer while packets are held
+	// after the kernel refused them with EAGAIN.
+	QSocketNotifier *txnotifier;
+
+	UdpBatch();
+	~UdpBatch();
+
+	void discard(int n);
+
+	inline bool sameDest(int i, int j) const {
+		return txaddrs[i].sin_addr.s_addr == txaddrs[j].sin_addr.s_addr
+			&& txaddrs[i].sin_port == txaddrs[j].sin_port; }
+};
+
+UdpBatch::UdpBatch()
+:	gso(false), gro(false),
+	ntx(0), txused(0),
+	txnotifier(NULL)
+{
+	rxbuf = new char[UdpSocket::rxBatchMax * UdpSocket::rxSlotSize];
+}
+
+UdpBatch::~UdpBatch()
+{
+	delete txnotifier;
+	delete [] rxbuf;
+}
+
+// Remove the first n held packets, keeping the rest in order.
+void UdpBatch::discard(int n)
+{
+	Q_ASSERT(n >= 0 && n <= ntx);
+	if (n == ntx) {
+		ntx = txused = 0;
+		return;
+	}
+	int ofs = txofs[n];
+	memmove(txbuf, txbuf + ofs, txused - ofs);
+	txused -= ofs;
+	for (int i = n; i < ntx; i++) {
+		txofs[i-n] = txofs[i] - ofs;
+		txlen[i-n] = txlen[i];
+		txaddrs[i-n] = txaddrs[i];
+	}
+	ntx -= n;
+}
+
+#endif	// SST_UDP_BATCH
+
+
 ////////// UdpSocket //////////
 
 UdpSocket::UdpSocket(SocketHostState *host, QObject *parent)
-:	Socket(host, parent)
+:	Socket(host, parent),
+	batchmode(true),
+	reuseport(false),
+	batch(NULL),
+	st()
 {
 	connect(&usock, SIGNAL(readyRead()), this, SLOT(udpReadyRead()));
 }
 
+UdpSocket::~UdpSocket()
+{
+	freeBatch();
+}
+
 bool UdpSocket::bind(const QHostAddress &addr, quint16 port,
 			QUdpSocket::BindMode mode)
 {
 	Q_ASSERT(!active());
 
-	if (!usock.bind(addr, port, mode))
+	if (reuseport ? !bindReusePort(addr, port)
+			: !usock.bind(addr, port, mode))
 		return false;
 
+	if (batchmode)
+		initBatch();
+	if (ecnCapable())
+		initEcn();
+	initPmtu();
+
 	setActive(true);
 	return true;
 }
 
+// QUdpSocket can't set socket options before binding,
+// so bind a descriptor of our own and hand it over once bound.
+bool UdpSocket::bindReusePort(const QHostAddress &addr, quint16 port)
+{
+#ifdef SST_UDP_BATCH
+	sockaddr_in sin;
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	if (addr == QHostAddress::Any)
+		sin.sin_addr.s_addr = htonl(INADDR_ANY);
+	else if (addr.protocol() == QAbstractSocket::IPv4Protocol)
+		sin.sin_addr.s_addr = htonl(addr.toIPv4Address());
+	else {
+		qWarning("SO_REUSEPORT binding supports only IPv4");
+		return false;
+	}
+
+	int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+	int val = 1;
+	if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEPORT,
+					&val, sizeof(val)) < 0
+			|| ::bind(fd, (sockaddr*)&sin, sizeof(sin)) < 0) {
+		qWarning("Can't bind shared UDP port %d: %s",
+			port, strerror(errno));
+		if (fd >= 0)
+			::close(fd);
+		return false;
+	}
+
+	if (!usock.setSocketDescriptor(fd, QAbstractSocket::BoundState)) {
+		::close(fd);
+		return false;
+	}
+	return true;
+#else
+	return usock.bind(addr, port, QUdpSocket::ShareAddress);
+#endif
+}
+
+void UdpSocket::setEcnCapable(bool enable)
+{
+	Socket::setEcnCapable(enable);
+	if (usock.state() == QAbstractSocket::BoundState)
+		initEcn();
+}
+
+void UdpSocket::initEcn()
+{
+#ifdef SST_UDP_BATCH
+	int fd = usock.socketDescriptor();
+	Q_ASSERT(fd >= 0);
+
+	int tos = ecnCapable() ? EcnEct0 : EcnNotEct;
+	if (setsockopt(fd, IPPROTO_IP, IP_TOS, &tos, sizeof(tos)) < 0)
+		qWarning("Can't set IP TOS for ECN: %s", strerror(errno));
+
+#ifdef IP_RECVTOS
+	int val = ecnCapable();
+	if (setsockopt(fd, IPPROTO_IP, IP_RECVTOS, &val, sizeof(val)) < 0)
+		qDebug() << this << "IP_RECVTOS failed:" << strerror(errno);
+#endif
+#else
+	if (ecnCapable())
+		qWarning("ECN not supported on this platform");
+#endif
+}
+
+// Never let the OS fragment our packets, and have it set Don't Fragment
+// so that routers tell it via ICMP when they're too big for the path;
+// Flow's path MTU discovery picks that up through pathMtu().
+void UdpSocket::initPmtu()
+{
+#ifdef SST_UDP_PMTU
+	int fd = usock.socketDescriptor();
+	Q_ASSERT(fd >= 0);
+
+	int val = IP_PMTUDISC_DO;
+	if (setsockopt(fd, IPPROTO_IP, IP_MTU_DISCOVER, &val, sizeof(val)) < 0)
+		qDebug() << this << "IP_MTU_DISCOVER failed:" << strerror(errno);
+#endif
+}
+
+int UdpSocket::pathMtu(const Endpoint &ep)
+{
+#ifdef SST_UDP_PMTU
+	if (ep.addr.protocol() != QAbstractSocket::IPv4Protocol)
+		return 0;
+
+	// Probes to one destination come in bursts,
+	// so only ask the OS again once our answer has aged a bit.
+	quint32 addr = ep.addr.toIPv4Address();
+	qint64 now = time(NULL);
+	QHash<quint32, PmtuCache>::const_iterator i = pmtus.find(addr);
+	if (i != pmtus.end() && now - i->when < pmtuCacheSecs)
+		return i->mtu;
+
+	// The OS only reports the MTU to a connected socket's peer,
+	// so ask through a scratch socket; it shares the route cache.
+	int mtu = 0;
+	int fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd >= 0) {
+		sockaddr_in sin;
+		memset(&sin, 0, sizeof(sin));
+		sin.sin_family = AF_INET;
+		sin.sin_addr.s_addr = htonl(addr);
+		sin.sin_port = htons(ep.port);
+		socklen_t len = sizeof(mtu);
+		if (::connect(fd, (sockaddr*)&sin, sizeof(sin)) < 0
+			|| getsockopt(fd, IPPROTO_IP, IP_MTU, &mtu, &len) < 0)
+			mtu = 0;
+		::close(fd);
+	}
+
+	if (pmtus.size() >= pmtuCacheMax)
+		pmtus.clear();
+	PmtuCache &pc = pmtus[addr];
+	pc.mtu = mtu;
+	pc.when = now;
+	return mtu;
+#else
+	(void)ep;
+	return 0;
+#endif
+}
+
+void UdpSocket::setBatchMode(bool enable)
+{
+	batchmode = enable;
+	if (usock.state() != QAbstractSocket::BoundState)
+		return;		// takes effect on bind()
+	if (enable)
+		initBatch();
+	else
+		freeBatch();
+}
+
+void UdpSocket::initBatch()
+{
+#ifdef SST_UDP_BATCH
+	if (batch)
+		return;
+	int fd = usock.socketDescriptor();
+	Q_ASSERT(fd >= 0);
+
+	batch = new UdpBatch;
+
+	// Probe for UDP segmentation offload on transmit...
+	int val = 0;
+	socklen_t vallen = sizeof(val);
+	batch->gso = getsockopt(fd, SOL_UDP, UDP_SEGMENT, &val, &vallen) == 0;
+
+	// ...and ask for coalesced receives, which we split up again.
+	val = 1;
+	batch->gro = setsockopt(fd, SOL_UDP, UDP_GRO, &val, sizeof(val)) == 0;
+
+	qDebug() << this << "batched I/O enabled:"
+		<< "gso" << batch->gso << "gro" << batch->gro;
+#endif
+}
+
+void UdpSocket::freeBatch()
+{
+#ifdef SST_UDP_BATCH
+	if (!batch)
+		return;
+
+	// Don't strand any held packets.
+	// If the kernel's buffer was full, wait for room for the rest
+	// as a blocking socket would, though not forever.
+	flushBatch();
+	int fd = usock.socketDescriptor();
+	while (batch->ntx > 0 && fd >= 0) {
+		pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = POLLOUT;
+		pfd.revents = 0;
+		if (::poll(&pfd, 1, freeWaitMax) <= 0) {
+			qDebug() << this << "freeBatch: dropped"
+				<< batch->ntx << "held packets";
+			break;
+		}
+		batch->txnotifier->setEnabled(false);
+		flushBatch();
+	}
+
+	// The unbatched receive path can't split GRO datagrams.
+	if (batch->gro) {
+		int val = 0;
+		setsockopt(usock.socketDescriptor(), SOL_UDP, UDP_GRO,
+				&val, sizeof(val));
+	}
+
+	delete batch;
+	batch = NULL;
+#endif
+}
+
 bool
 UdpSocket::send(const Endpoint &ep, const char *data, int size)
 {
@@ -178,6 +667,20 @@ UdpSocket::send(const Endpoint &ep, const char *data, int size)
 	if (ep.addr.protocol() != QAbstractSocket::IPv4Protocol)
 		return false;
 
+	// Hold the packet if a transmit batch is open.
+	if (batch && inBatch() && size <= txBufSize)
+		return batchSend(ep, data, size);
+
+	// Don't let an unbatched packet overtake held ones.
+	// If some are still waiting for buffer space, so must this one.
+	if (batch) {
+		flushBatch();
+		if (batch->ntx > 0)
+			return false;
+	}
+
+	st.txpackets++;
+	st.txcalls++;
 	bool rc = usock.writeDatagram(data, size, ep.addr, ep.port) == size;
 	if (!rc)
 		qDebug() << "Socket::send:" << errorString();
@@ -188,25 +691,281 @@ UdpSocket::send(const Endpoint &ep, const char *data, int size)
 	return rc;
 }
 
+bool UdpSocket::batchSend(const Endpoint &ep, const char *data, int size)
+{
+#ifdef SST_UDP_BATCH
+	UdpBatch &b = *batch;
+
+	// Make room for this packet if necessary.
+	// If the kernel's buffer is full too, drop it as it would.
+	if (b.ntx == txBatchMax || b.txused + size > txBufSize) {
+		flushBatch();
+		if (b.ntx == txBatchMax || b.txused + size > txBufSize)
+			return false;
+	}
+
+	// Copy the packet into the batch buffer,
+	// since the caller's buffer is usually a temporary.
+	int i = b.ntx++;
+	memcpy(b.txbuf + b.txused, data, size);
+	b.txofs[i] = b.txused;
+	b.txlen[i] = size;
+	b.txused += size;
+
+	sockaddr_in &sin = b.txaddrs[i];
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(ep.addr.toIPv4Address());
+	sin.sin_port = htons(ep.port);
+
+	return true;
+#else
+	Q_ASSERT(0);
+	(void)ep; (void)data; (void)size;
+	return false;
+#endif
+}
+
+void UdpSocket::flushBatch()
+{
+#ifdef SST_UDP_BATCH
+	if (!batch || batch->ntx == 0)
+		return;
+	UdpBatch &b = *batch;
+	int fd = usock.socketDescriptor();
+
+	// Still waiting for room in the socket buffer.
+	if (b.txnotifier && b.txnotifier->isEnabled())
+		return;
+
+	// Build one message per packet, or per segmentable run of packets:
+	// consecutive packets to one destination, all the same size
+	// except possibly the last, which may be shorter.
+	// Since held packets are contiguous in txbuf, so is each run.
+	int nmsgs = 0;
+	for (int i = 0; i < b.ntx; ) {
+		int j = i + 1;
+		if (b.gso) {
+			while (j < b.ntx && b.sameDest(i, j)
+					&& b.txlen[j-1] == b.txlen[i]
+					&& b.txlen[j] <= b.txlen[i])
+				j++;
+		}
+
+		iovec &iov = b.txiovs[nmsgs];
+		iov.iov_base = b.txbuf + b.txofs[i];
+		iov.iov_len = b.txofs[j-1] + b.txlen[j-1] - b.txofs[i];
+
+		b.txfirst[nmsgs] = i;
+		msghdr &mh = b.txmsgs[nmsgs].msg_hdr;
+		memset(&mh, 0, sizeof(mh));
+		mh.msg_name = &b.txaddrs[i];
+		mh.msg_namelen = sizeof(sockaddr_in);
+		mh.msg_iov = &iov;
+		mh.msg_iovlen = 1;
+
+		if (j - i > 1) {
+			// Let the kernel split the run into txlen[i] segments.
+			mh.msg_control = b.txctl[nmsgs];
+			mh.msg_controllen = CMSG_SPACE(sizeof(quint16));
+			cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+			cm->cmsg_level = SOL_UDP;
+			cm->cmsg_type = UDP_SEGMENT;
+			cm->cmsg_len = CMSG_LEN(sizeof(quint16));
+			*(quint16*)CMSG_DATA(cm) = b.txlen[i];
+		}
+
+		nmsgs++;
+		i = j;
+	}
+
+	// Ship them all out, in as few calls as the kernel allows.
+	int sent = 0;
+	bool full = false, resegment = false;
+	while (sent < nmsgs) {
+		int rc = sendmmsg(fd, b.txmsgs + sent, nmsgs - sent, 0);
+		st.txcalls++;
+		if (rc > 0) {
+			sent += rc;
+			continue;
+		}
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			// Socket buffer full: hold on to the rest
+			// until the socket becomes writable again.
+			full = true;
+			break;
+		}
+		if (rc < 0 && errno == EIO && b.gso) {
+			// The outgoing device can't segment after all:
+			// stop using UDP_SEGMENT, and resend the rest singly.
+			qDebug() << this << "UDP_SEGMENT failed; disabling";
+			b.gso = false;
+			resegment = true;
+			break;
+		}
+		if (rc < 0 && (errno == EMSGSIZE || errno == ENETUNREACH
+				|| errno == EHOSTUNREACH || errno == ECONNREFUSED
+				|| errno == EACCES || errno == EPERM)) {
+			// A problem with this datagram or its destination,
+			// e.g., a path MTU probe too big for the path
+			// as far as the OS knows: drop just this one.
+			qDebug() << this << "flushBatch:" << strerror(errno);
+			sent++;
+			continue;
+		}
+		qDebug() << "UdpSocket::flushBatch:" << strerror(errno)
+			<< "dropped" << (nmsgs - sent) << "of" << nmsgs;
+		sent = nmsgs;
+		break;
+	}
+
+	// Forget what went out, and keep what didn't.
+	int done = sent < nmsgs ? b.txfirst[sent] : b.ntx;
+	st.txpackets += done;
+	b.discard(done);
+
+	if (full) {
+		if (!b.txnotifier) {
+			b.txnotifier = new QSocketNotifier(fd,
+					QSocketNotifier::Write);
+			connect(b.txnotifier, SIGNAL(activated(int)),
+				this, SLOT(udpReadyWrite()));
+		} else
+			b.txnotifier->setEnabled(true);
+	} else if (resegment)
+		flushBatch();
+#endif
+}
+
+void UdpSocket::udpReadyWrite()
+{
+#ifdef SST_UDP_BATCH
+	if (!batch || !batch->txnotifier)
+		return;
+	batch->txnotifier->setEnabled(false);
+	flushBatch();
+#endif
+}
+
 void
 UdpSocket::udpReadyRead()
 {
+	if (batch)
+		return batchReadyRead();
+
+	PacketPool &pool = host()->packetPool();
 	SocketEndpoint src;
 	src.sock = this;
-	QByteArray msg;
 	int size;
 	while ((size = usock.pendingDatagramSize()) >= 0) {
 
-		// Read the datagram
-		msg.resize(size);
+		// Read the datagram into a pooled buffer
+		QByteArray msg = pool.alloc(qMax(size, 1));
 		if (usock.readDatagram(msg.data(), size, &src.addr, &src.port)
 				!= size) {
 			qWarning("Error reading %d-byte UDP datagram", size);
 			break;
 		}
+		msg.resize(size);
+
+		// Qt checks for and then reads each datagram separately.
+		st.rxcalls += 2;
+		st.rxpackets++;
 
 		receive(msg, src);
+
+		// Recycle the buffer unless an upper layer held onto it.
+		pool.release(msg);
 	}
+	st.rxcalls++;	// the final check that found nothing pending
+}
+
+void UdpSocket::batchReadyRead()
+{
+#ifdef SST_UDP_BATCH
+	UdpBatch &b = *batch;
+	int fd = usock.socketDescriptor();
+
+	PacketPool &pool = host()->packetPool();
+	SocketEndpoint src;
+	src.sock = this;
+
+	// Send any responses we generate (e.g., ACKs) as one batch too.
+	SocketBatch txbatch(this);
+
+	int n;
+	do {
+		// Set up the receive slots.
+		for (int i = 0; i < rxBatchMax; i++) {
+			b.rxiovs[i].iov_base = b.rxbuf + i * rxSlotSize;
+			b.rxiovs[i].iov_len = rxSlotSize;
+			msghdr &mh = b.rxmsgs[i].msg_hdr;
+			mh.msg_name = &b.rxaddrs[i];
+			mh.msg_namelen = sizeof(sockaddr_in);
+			mh.msg_iov = &b.rxiovs[i];
+			mh.msg_iovlen = 1;
+			mh.msg_control = b.rxctl[i];
+			mh.msg_controllen = UDPCMSGLEN;
+			mh.msg_flags = 0;
+		}
+
+		n = recvmmsg(fd, b.rxmsgs, rxBatchMax, MSG_DONTWAIT, NULL);
+		st.rxcalls++;
+		if (n < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK
+					&& errno != EINTR)
+				qWarning("Error receiving UDP datagrams: %s",
+					strerror(errno));
+			break;
+		}
+
+		for (int i = 0; i < n; i++) {
+			msghdr &mh = b.rxmsgs[i].msg_hdr;
+			int len = b.rxmsgs[i].msg_len;
+			if (mh.msg_flags & MSG_TRUNC) {
+				qWarning("Dropping oversized UDP datagram");
+				continue;
+			}
+			const sockaddr_in &sin = b.rxaddrs[i];
+			if (sin.sin_family != AF_INET)
+				continue;
+			src.addr.setAddress(ntohl(sin.sin_addr.s_addr));
+			src.port = ntohs(sin.sin_port);
+
+			// A GRO-coalesced datagram carries its segment size.
+			// With IP_RECVTOS we also get the ECN bits,
+			// which GRO only coalesces datagrams if they share.
+			int segsize = len;
+			int ecn = EcnNotEct;
+			for (cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm != NULL;
+					cm = CMSG_NXTHDR(&mh, cm)) {
+				if (cm->cmsg_level == SOL_UDP
+						&& cm->cmsg_type == UDP_GRO)
+					segsize = *(int*)CMSG_DATA(cm);
+				else if (cm->cmsg_level == IPPROTO_IP
+						&& cm->cmsg_type == IP_TOS)
+					ecn = *(quint8*)CMSG_DATA(cm) & 3;
+			}
+			if (segsize <= 0)
+				segsize = len;
+
+			// Dispatch each original datagram.
+			const char *data = (const char*)b.rxiovs[i].iov_base;
+			for (int ofs = 0; ofs < len; ofs += segsize) {
+				int size = qMin(segsize, len - ofs);
+				QByteArray msg = pool.alloc(size);
+				memcpy(msg.data(), data + ofs, size);
+				st.rxpackets++;
+				receive(msg, src, ecn);
+				pool.release(msg);
+			}
+		}
+
+		// A short batch means we've drained the socket.
+	} while (n == rxBatchMax && batch != NULL);
+#endif
 }
 
 QList<Endpoint> UdpSocket::localEndpoints()
@@ -304,9 +1063,9 @@ void SocketFlow::unbind()
 
 	if (sock) {
 		//qDebug() << this << "unbind from sock" << sock;
-		QPair<Endpoint,Channel> p(remoteep, localchan);
-		Q_ASSERT(sock->flows.value(p) == this);
-		sock->flows.remove(p);
+		FlowTable::Key k = FlowTable::key(remoteep, localchan);
+		Q_ASSERT(sock->flows.value(k) == this);
+		sock->flows.remove(k);
 
 		sock = NULL;
 		localchan = 0;
@@ -34,9 +34,16 @@
 #include <QPointer>
 
 #include "util.h"
+#include "pkt.h"
 
 #define NETSTERIA_DEFAULT_PORT	8661
 
+// Linux supports batched datagram I/O via recvmmsg()/sendmmsg(),
+// plus UDP segmentation/receive offload (UDP_SEGMENT, UDP_GRO).
+#if defined(__linux__)
+#define SST_UDP_BATCH	1
+#endif
+
 class QSettings;
 
 
@@ -47,6 +54,7 @@ class Socket;
 class SocketFlow;
 class SocketReceiver;
 class SocketHostState;
+struct UdpBatch;
 
 
 // SST expresses current link status as one of three states:
@@ -60,6 +68,15 @@ enum LinkStatus {
 };
 
 
+// ECN codepoints carried in the low two bits of the IP TOS byte (RFC 3168).
+enum EcnCodepoint {
+	EcnNotEct = 0,		// Not ECN-capable transport
+	EcnEct1 = 1,		// ECN-capable transport, ECT(1)
+	EcnEct0 = 2,		// ECN-capable transport, ECT(0)
+	EcnCE = 3		// Congestion Experienced
+};
+
+
 // An 8-bit channel number distinguishes different flows
 // between the same pair of socket-layer endpoints.
 // Channel number 0 is always invalid.
@@ -92,6 +109,85 @@ struct SocketEndpoint : public Endpoint
 };
 
 
+/** Table of the flows bound to a Socket, keyed on remote endpoint
+ * and channel, consulted for every packet the Socket receives.
+ * Each key packs the address, port, and channel
+ * into a fixed-size record carrying its own precomputed hash,
+ * and the table is a flat array of such keys searched by linear probing,
+ * so a lookup hashes no QHostAddress and usually touches one cache line.
+ */
+class FlowTable
+{
+public:
+	/// A packed (address, port, channel) tuple and its hash.
+	struct Key {
+		quint32 addr[4];	///< IPv6 address, or IPv4 in addr[3]
+		quint16 port;		///< Remote UDP port
+		Channel chan;		///< Local channel number
+		quint8 family;		///< 4 or 6, or 0 if neither
+		quint32 hash;		///< Hash of all the above
+
+		inline bool operator==(const Key &o) const
+			{ return hash == o.hash && port == o.port
+				&& chan == o.chan && family == o.family
+				&& addr[3] == o.addr[3] && addr[2] == o.addr[2]
+				&& addr[1] == o.addr[1]
+				&& addr[0] == o.addr[0]; }
+	};
+
+	/// Initial number of slots; always a power of two.
+	static const int minSlots = 16;
+
+private:
+	struct Slot {
+		Key key;
+		SocketFlow *flow;	// NULL if the slot is empty
+	};
+
+	Slot *slots;		// Array of nslots slots
+	quint32 mask;		// nslots - 1
+	int count;		// Slots in use
+
+public:
+	FlowTable();
+	~FlowTable();
+
+	/// Pack an endpoint and channel into a lookup key.
+	static Key key(const Endpoint &ep, Channel chan);
+
+	/// Return the number of flows in the table.
+	inline int size() const { return count; }
+	inline bool isEmpty() const { return count == 0; }
+
+	/// Find the flow bound to a key, NULL if none.
+	inline SocketFlow *value(const Key &k) const {
+		for (quint32 i = k.hash & mask; ; i = (i + 1) & mask) {
+			const Slot &s = slots[i];
+			if (s.flow == NULL || s.key == k)
+				return s.flow;
+		} }
+	inline SocketFlow *value(const Endpoint &ep, Channel chan) const
+		{ return value(key(ep, chan)); }
+
+	/// Bind a flow to a key not already in the table.
+	void insert(const Key &k, SocketFlow *flow);
+
+	/// Remove a key from the table, returning false if it wasn't there.
+	bool remove(const Key &k);
+
+	/// Return all the flows in the table.
+	QList<SocketFlow*> values() const;
+
+private:
+	void resize(int nslots);
+	void place(const Key &k, SocketFlow *flow);
+
+	// Not copyable
+	FlowTable(const FlowTable &);
+	FlowTable &operator=(const FlowTable &);
+};
+
+
 /** Abstract base class representing network attachments
  * for the SST protocols to use.
  * @see UdpSocket
@@ -106,17 +202,30 @@ private:
 	SocketHostState *const h;
 
 	/// Lookup table of flows currently attached to this socket.
-	QHash<QPair<Endpoint,Channel>, SocketFlow*> flows;
+	FlowTable flows;
 
 	/// True if this socket is fair game for use by upper level protocols.
 	bool act;
 
+	/// Nesting depth of beginBatch()/endBatch() calls in progress.
+	int batchdepth;
+
+	/// True if we mark outgoing packets ECN-capable.
+	bool ecncap;
+
+	/// ECN codepoint of the datagram currently being dispatched.
+	quint8 rxecn;
+
 
 public:
 	inline Socket(SocketHostState *host, QObject *parent = NULL)
-		: QObject(parent), h(host), act(false) { }
+		: QObject(parent), h(host), act(false), batchdepth(0),
+		  ecncap(false), rxecn(EcnNotEct) { }
 	virtual ~Socket();
 
+	/// Return the host state instance this Socket is attached to.
+	inline SocketHostState *host() const { return h; }
+
 	/** Determine whether this socket is active.
 	 * Only active sockets are returned by SocketHostState::activeSockets().
 	 * @return true if socket is active. */
@@ -144,6 +253,22 @@ public:
 	inline bool send(const Endpoint &ep, const QByteArray &msg)
 		{ return send(ep, msg.constData(), msg.size()); }
 
+	/** Begin a batch of transmissions on this socket.
+	 * Between beginBatch() and the matching endBatch(),
+	 * the socket implementation may hold packets passed to send()
+	 * so that it can transmit them together in fewer system calls.
+	 * Batches may nest; packets go out when the outermost batch ends.
+	 * @see SocketBatch */
+	inline void beginBatch() { batchdepth++; }
+
+	/** End a batch of transmissions started with beginBatch(). */
+	inline void endBatch()
+		{ Q_ASSERT(batchdepth > 0);
+		  if (--batchdepth == 0) flushBatch(); }
+
+	/// Returns true if a transmit batch is currently open.
+	inline bool inBatch() const { return batchdepth > 0; }
+
 	/** Find all known local endpoints referring to this socket.
 	 * @return a list of Endpoint objects. */
 	virtual QList<Endpoint> localEndpoints() = 0;
@@ -152,7 +277,7 @@ public:
 
 	/// Find flow associations attached to this socket.
 	inline SocketFlow *flow(const Endpoint &dst, Channel chan)
-		{ return flows.value(QPair<Endpoint,Channel>(dst, chan)); }
+		{ return flows.value(dst, chan); }
 
 	/// Return a description of any error detected on bind() or send().
 	virtual QString errorString() = 0;
@@ -167,8 +292,35 @@ public:
 	// to a particular target endpoint
 	virtual int mayTransmit(const Endpoint &ep);
 
+	/** Return the path MTU to a remote endpoint, in bytes
+	 * including IP and UDP headers, as learned by the OS
+	 * from ICMP "packet too big" messages.
+	 * @return the path MTU, or 0 if unknown (the default). */
+	virtual int pathMtu(const Endpoint &ep);
+
+	/** Called by a flow bound to this socket each time it accepts
+	 * an authenticated packet from its remote endpoint @a ep,
+	 * so that the socket may trust how that packet reached it.
+	 * The default implementation does nothing. */
+	virtual void peerAuthenticated(const Endpoint &ep);
+
 	virtual QString toString() const;
 
+	/** Determine whether this socket sends ECN-capable packets. */
+	inline bool ecnCapable() const { return ecncap; }
+
+	/** Mark outgoing packets ECN-capable (ECT(0)) and report
+	 * the ECN codepoints of received packets via receivedEcn().
+	 * Only enable this if all the flows using this socket
+	 * react to congestion marks, or arrange for their peers to.
+	 * The default implementation just records the setting. */
+	virtual void setEcnCapable(bool enable);
+
+	/** Return the ECN codepoint of the packet being dispatched,
+	 * for use by a SocketFlow or SocketReceiver during receive().
+	 * @return an EcnCodepoint, EcnNotEct if unknown. */
+	inline int receivedEcn() const { return rxecn; }
+
 
 protected:
 
@@ -177,11 +329,39 @@ protected:
 	 * @param src the source from which the packet arrived */
 	void receive(QByteArray &msg, const SocketEndpoint &src);
 
+	/** Receive a packet that arrived with a known ECN codepoint. */
+	void receive(QByteArray &msg, const SocketEndpoint &src, int ecn);
+
 	/** Bind a new SocketFlow to this Socket.
 	 * Called by SocketFlow::bind() to register in the table of flows.
 	 */
 	virtual bool bindFlow(const Endpoint &remoteep, Channel localchan,
 				SocketFlow *flow);
+
+	/** Tell the flows bound to a remote endpoint that mayTransmit()
+	 * may now allow more packets, for sockets that provide
+	 * their own flow control. */
+	void readyTransmit(const Endpoint &ep);
+
+	/** Transmit any packets held during a transmit batch.
+	 * Called when the outermost batch ends;
+	 * the default implementation does nothing,
+	 * since the default send() never holds packets. */
+	virtual void flushBatch();
+};
+
+
+/** Helper to hold a Socket in a transmit batch for the duration of a scope.
+ * Tolerates a NULL socket, and the socket's deletion within the scope. */
+class SocketBatch
+{
+	QPointer<Socket> sock;
+
+public:
+	inline SocketBatch(Socket *s) : sock(s)
+		{ if (sock) sock->beginBatch(); }
+	inline ~SocketBatch()
+		{ if (sock) sock->endBatch(); }
 };
 
 
@@ -190,10 +370,53 @@ class UdpSocket : public Socket
 {
 	Q_OBJECT
 
+public:
+	/// Max datagrams to receive per recvmmsg() call.
+	static const int rxBatchMax = 16;
+
+	/// Receive buffer space per datagram: large enough for a GRO burst.
+	static const int rxSlotSize = 65536;
+
+	/// Max datagrams to hold in a transmit batch before flushing.
+	/// Also the kernel's limit on segments per UDP_SEGMENT send.
+	static const int txBatchMax = 64;
+
+	/// Transmit batch buffer size; also the max UDP_SEGMENT send size.
+	static const int txBufSize = 65000;
+
+	/// Seconds to reuse the OS's path MTU for a destination,
+	/// and the most destinations to remember it for.
+	static const int pmtuCacheSecs = 1;
+	static const int pmtuCacheMax = 1024;
+
+	/// Milliseconds to wait for the kernel to take held packets
+	/// when batching is turned off or the socket is destroyed.
+	static const int freeWaitMax = 1000;
+
+	/// Counters for measuring per-packet system call overhead.
+	struct Stats {
+		quint64 rxpackets;	///< Datagrams received
+		quint64 rxcalls;	///< Receive-side system calls
+		quint64 txpackets;	///< Datagrams sent
+		quint64 txcalls;	///< Transmit-side system calls
+	};
+
+private:
+	struct PmtuCache {
+		int mtu;		// OS's path MTU, 0 if unknown
+		qint64 when;		// time() we asked for it
+	};
+
 	QUdpSocket usock;
+	bool batchmode;		// Use batched I/O when available
+	bool reuseport;		// Share our port via SO_REUSEPORT
+	UdpBatch *batch;	// Batched I/O state, if active
+	QHash<quint32, PmtuCache> pmtus;	// Path MTUs by IPv4 address
+	Stats st;
 
 public:
 	UdpSocket(SocketHostState *host, QObject *parent = NULL);
+	~UdpSocket();
 
 	/** Bind this UDP socket to a port and activate it if successful.
 	 * @param addr the address to bind to, normally QHostAddress::Any.
@@ -217,9 +440,54 @@ public:
 	/// Return a description of any error detected on bind() or send().
 	inline QString errorString() { return usock.errorString(); }
 
+	/** Enable or disable batched datagram I/O.
+	 * When enabled (the default) and supported by the OS,
+	 * the socket drains received datagrams with recvmmsg(),
+	 * and sends packets held in a transmit batch with sendmmsg(),
+	 * coalescing same-size runs to one destination via UDP_SEGMENT
+	 * and accepting UDP_GRO-coalesced datagrams where available.
+	 * Held packets the kernel has no buffer space for stay held
+	 * until the socket becomes writable again. */
+	void setBatchMode(bool enable);
+	inline bool batchMode() const { return batch != NULL; }
+
+	/** Let several sockets bind the same IPv4 port via SO_REUSEPORT,
+	 * so that the OS spreads incoming datagrams among them
+	 * by hashing each sender's address and port.
+	 * Must be set before bind(), and on every socket sharing the port.
+	 * Where SO_REUSEPORT is unavailable, binds with ShareAddress. */
+	inline void setReusePort(bool enable) { reuseport = enable; }
+	inline bool reusePort() const { return reuseport; }
+
+	/// Return the socket's system call counters.
+	inline const Stats &stats() const { return st; }
+	inline void resetStats() { st = Stats(); }
+
+	/** Mark outgoing packets ECT(0) via the IP TOS byte,
+	 * and read received packets' ECN codepoints.
+	 * Received codepoints are only available in batch mode. */
+	virtual void setEcnCapable(bool enable);
+
+	/** Read the OS's path MTU for an endpoint where supported.
+	 * Once bound, the socket sets the Don't Fragment bit
+	 * on everything it sends, so that the OS learns it. */
+	virtual int pathMtu(const Endpoint &ep);
+
+protected:
+	virtual void flushBatch();
+
+private:
+	void initEcn();
+	void initPmtu();
+	bool bindReusePort(const QHostAddress &addr, quint16 port);
+	void initBatch();
+	void freeBatch();
+	void batchReadyRead();
+	bool batchSend(const Endpoint &ep, const char *data, int size);
 
 private slots:
 	void udpReadyRead();
+	void udpReadyWrite();
 };
 
 
@@ -286,6 +554,14 @@ protected:
 	inline bool udpSend(QByteArray &pkt) const
 		{ Q_ASSERT(active); return sock->send(remoteep, pkt); }
 
+	// Return the socket's path MTU to our remote endpoint, 0 if unknown.
+	inline int udpPathMtu() const
+		{ return sock ? sock->pathMtu(remoteep) : 0; }
+
+	// Tell the socket we accepted an authentic packet from our peer.
+	inline void udpAuthenticated() const
+		{ if (sock) sock->peerAuthenticated(remoteep); }
+
 	virtual void receive(QByteArray &msg, const SocketEndpoint &src);
 
 	// When the underlying socket is already flow/congestion-controlled,
@@ -356,6 +632,9 @@ class SocketHostState : public QObject
 	 * keyed on their 24-bit magic control packet type. */
 	QHash<quint32, SocketReceiver*> receivers;
 
+	/** Pool of packet buffers shared by all sockets and flows. */
+	PacketPool pktpool;
+
 
 public:
 	inline SocketHostState() : mainsock(NULL) { }
@@ -376,6 +655,13 @@ public:
 	inline SocketReceiver *lookupReceiver(quint32 magic)
 		{ return receivers.value(magic); }
 
+	/** Obtain this host's packet buffer pool.
+	 * Sockets allocate received datagrams from this pool,
+	 * and the flow and stream layers build outgoing packets in it.
+	 * @see PacketPool */
+	inline PacketPool &packetPool()
+		{ return pktpool; }
+
 
 	/** Create a new network Socket.
 	 * The default implementation creates a UdpSocket,
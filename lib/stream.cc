@@ -406,6 +406,11 @@ Flow *StreamResponder::newFlow(const SocketEndpoint &epi, const QByteArray &idi,
 		delete flow;
 		return NULL;
 	}
+	if (!host()->admitFlow(flow, idi)) {
+		qDebug("StreamResponder: host refused new flow");
+		delete flow;
+		return NULL;
+	}
 
 	return flow;
 }
@@ -516,3 +521,8 @@ StreamPeer *StreamHostState::streamPeer(const QByteArray &id, bool create)
 	return peer;
 }
 
+bool StreamHostState::admitFlow(Flow *, const QByteArray &)
+{
+	return true;
+}
+
@@ -770,6 +770,13 @@ public:
 	StreamPeer *streamPeer(const QByteArray &id, bool create = true);
 
 	virtual Host *host() = 0;
+
+protected:
+	// Called for each flow a remote host initiates to us,
+	// once it is bound but before it starts,
+	// to let a host refuse it by returning false.
+	// The default implementation accepts every flow.
+	virtual bool admitFlow(Flow *flow, const QByteArray &idi);
 };
 
 } // namespace SST
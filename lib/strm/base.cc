@@ -47,15 +47,15 @@ void StreamTxAttachment::clear()
 	// Remove the stream from the flow's waiting streams list
 	int rc = fl->dequeueStream(strm);
 	Q_ASSERT(rc <= 1);
-	strm->tqflow = false;
-
-	// Clear out packets for this stream from flow's ackwait table
-	foreach (qint64 txseq, fl->ackwait.keys()) {
-		BaseStream::Packet &p = fl->ackwait[txseq];
-		Q_ASSERT(!p.isNull());
-		Q_ASSERT(p.strm);
-		if (p.strm != strm)
+	queued = false;
+
+	// Clear out packets for this stream from flow's transmit ring
+	for (quint64 txseq = fl->txevts.base();
+			txseq < fl->txevts.end(); txseq++) {
+		BaseStream::Packet *pp = fl->ackWaiting(txseq);
+		if (pp == NULL || pp->strm != strm)
 			continue;
+		BaseStream::Packet p = fl->ackUnwait(txseq);
 
 		// Move the packet back to the stream's transmit queue
 		if (!p.late) {
@@ -63,7 +63,6 @@ void StreamTxAttachment::clear()
 			strm->missed(fl, p);
 		} else
 			strm->expire(fl, p);
-		fl->ackwait.remove(txseq);
 	}
 }
 
@@ -103,7 +102,7 @@ BaseStream::BaseStream(Host *h, QByteArray peerid, BaseStream *parent)
 	endread(false),
 	endwrite(false),
 	tcuratt(NULL),
-	tasn(0), twin(0), tflt(0), tqflow(false), twaitsize(0),
+	tasn(0), twin(0), tflt(0), twaitsize(0),
 	tswin(0), tsflt(0),
 	rsn(0),
 	ravail(0), rmsgavail(0), rbufused(0),
@@ -217,6 +216,13 @@ void BaseStream::tattach()
 	StreamFlow *flow = peer->flow;
 	Q_ASSERT(flow->isActive());
 
+	// In multipath mode we may already be attached to it
+	// as an additional path, in which case it just becomes our current one.
+	if (TxAttachment *att = tattFor(flow)) {
+		tcuratt = att;
+		return txenqflow(true);
+	}
+
 	// If we're initiating a new stream and our peer hasn't acked it yet,
 	// make sure we have a parent USID to refer to in creating the stream.
 	if (init && pusid.isNull()) {
@@ -240,6 +246,28 @@ void BaseStream::tattach()
 		}
 	}
 
+	// Attach to the flow, using a new SID and attachment slot.
+	tcuratt = tattachTo(flow);
+
+	// Fill in the new stream's USID, if it doesn't have one yet.
+	if (usid.isNull()) {
+		setUsid(UniqueStreamId(tcuratt->sid, flow->txChannelId()));
+		qDebug() << this << "creating stream" << usid;
+	}
+
+	// Get us in line to transmit on the flow.
+	// We at least need to transmit an attach message of some kind;
+	// in the case of Init or Reply it might also include data.
+	Q_ASSERT(!flow->tstreams.contains(this));
+	txenqflow();
+	if (flow->mayTransmit())
+		flow->readyTransmit();
+}
+
+// Allocate a StreamId and a free attachment slot for this stream
+// on a given flow, and start attaching with them.
+BaseStream::TxAttachment *BaseStream::tattachTo(StreamFlow *flow)
+{
 	// Allocate a StreamId for this stream.
 	// Scan forward through our SID space a little ways for a free SID;
 	// if there are none, then pick a random one and detach it.
@@ -273,21 +301,42 @@ void BaseStream::tattach()
 
 	// Attach to the stream using the selected slot.
 	tatt[slot].setAttaching(flow, ctr);
-	tcuratt = &tatt[slot];
+	return &tatt[slot];
+}
 
-	// Fill in the new stream's USID, if it doesn't have one yet.
-	if (usid.isNull()) {
-		setUsid(UniqueStreamId(ctr, flow->txChannelId()));
-		qDebug() << this << "creating stream" << usid;
+// In multipath mode, once our current attachment is up,
+// also attach to our peer's additional paths as slots permit,
+// so that we can send data segments on any of them.
+// The stream already exists at the other end by now,
+// so a plain Attach packet on each new flow does the job.
+void BaseStream::tattachPaths()
+{
+	if (!peer || !peer->multipath || init
+			|| !tcuratt || !tcuratt->isActive())
+		return;
+
+	foreach (StreamFlow *flow, peer->paths) {
+		if (tattFor(flow) || !flow->isActive())
+			continue;
+
+		int slot = 0;
+		while (slot < maxAttach && tatt[slot].isInUse())
+			slot++;
+		if (slot == maxAttach)
+			return;
+
+		qDebug() << this << "attaching to additional path" << flow;
+		txAttach(tattachTo(flow));
 	}
+}
 
-	// Get us in line to transmit on the flow.
-	// We at least need to transmit an attach message of some kind;
-	// in the case of Init or Reply it might also include data.
-	Q_ASSERT(!flow->tstreams.contains(this));
-	txenqflow();
-	if (flow->mayTransmit())
-		flow->readyTransmit();
+// Find our transmit-attachment to a given flow, if any.
+BaseStream::TxAttachment *BaseStream::tattFor(StreamFlow *flow)
+{
+	for (int i = 0; i < maxAttach; i++)
+		if (tatt[i].flow == flow && flow != NULL)
+			return &tatt[i];
+	return NULL;
 }
 
 void BaseStream::gotParentAttached()
@@ -396,8 +445,10 @@ void BaseStream::setPriority(int newpri)
 	//qDebug() << this << "set priority" << newpri;
 	AbstractStream::setPriority(newpri);
 
-	if (tqflow) {
-		StreamFlow *flow = tcuratt->flow;
+	for (int i = 0; i < maxAttach; i++) {
+		if (!tatt[i].queued)
+			continue;
+		StreamFlow *flow = tatt[i].flow;
 		Q_ASSERT(flow->isActive());
 		int rc = flow->dequeueStream(this);
 		Q_ASSERT(rc == 1);
@@ -405,6 +456,18 @@ void BaseStream::setPriority(int newpri)
 	}
 }
 
+// Return the largest data segment we can send in one packet
+// on the flow we're attached to, or else on our peer's primary flow.
+// Only flows that have discovered their path MTU go beyond the default.
+int BaseStream::maxSegmentSize()
+{
+	StreamFlow *flow = tcuratt ? tcuratt->flow
+				: peer ? peer->flow : NULL;
+	if (!flow || !flow->pathMtuDiscovery())
+		return mtu;
+	return qMax((int)mtu, flow->txMtu() - hdrlenData);
+}
+
 void BaseStream::txenqueue(const Packet &pkt)
 {
 	// Add the packet to our stream-local transmit queue.
@@ -434,19 +497,33 @@ void BaseStream::txenqflow(bool immed)
 	Q_ASSERT(flow && flow->isActive());
 
 	// Enqueue this stream to the flow's transmit queue.
-	if (!tqflow) {
+	if (!tcuratt->queued) {
 		if (tqueue.isEmpty()) {
 			if (strm) // Nothing to transmit - prod application.
 				strm->readyWrite();
 		} else {
 			flow->enqueueStream(this);
-			tqflow = true;
+			tcuratt->queued = true;
 		}
 	}
 
 	// Prod the flow to transmit immediately if possible
 	if (immed && flow->mayTransmit())
 		flow->readyTransmit();
+
+	// In multipath mode, also line up on our other attached paths,
+	// so that whichever has room first can take our next segment.
+	if (!tcuratt->isActive() || tqueue.isEmpty())
+		return;
+	for (int i = 0; i < maxAttach; i++) {
+		TxAttachment *att = &tatt[i];
+		if (att == tcuratt || !att->isActive() || att->queued)
+			continue;
+		att->flow->enqueueStream(this);
+		att->queued = true;
+		if (immed && att->flow->mayTransmit())
+			att->flow->readyTransmit();
+	}
 }
 
 // Called by StreamFlow::readyTransmit()
@@ -458,12 +535,16 @@ void BaseStream::txenqflow(bool immed)
 // but our latest receive window update may be out-of-date.
 void BaseStream::transmit(StreamFlow *flow)
 {
-	Q_ASSERT(tqflow);
-	Q_ASSERT(tcuratt != NULL);
-	Q_ASSERT(flow == tcuratt->flow);
+	TxAttachment *att = tattFor(flow);
+	Q_ASSERT(att != NULL && att->queued);
 	Q_ASSERT(!tqueue.isEmpty());
 
-	tqflow = false;	// flow just dequeued us
+	att->queued = false;	// flow just dequeued us
+
+	// Only our current attachment can attach or initiate the stream;
+	// additional paths carry data only once that's done.
+	if (tcuratt == NULL || (att != tcuratt && !tcuratt->isAcked()))
+		return txenqflow();
 
 	// First garbage-collect any segments that have already been ACKed;
 	// this can happen if we retransmit a segment
@@ -487,6 +568,8 @@ void BaseStream::transmit(StreamFlow *flow)
 		// an ordinary data packet will do fine.
 		Q_ASSERT(!init);
 		Q_ASSERT(tcuratt->isActive());
+		if (att != tcuratt && !att->isAcked())
+			att = tcuratt;
 
 		// Throttle data transmission if flow window is full
 		if (tflt + segsize > twin) {
@@ -506,19 +589,21 @@ void BaseStream::transmit(StreamFlow *flow)
 		//qDebug() << this << "inflight Data" << hp->tsn
 		//	<< "bytes in flight" << tflt;
 
-		// Transmit the next segment in a regular Data packet.
+		// Transmit the next segment in a regular Data packet,
+		// on whichever of our paths the scheduler picks.
 		Packet p = tqueue.dequeue();
 		Q_ASSERT(p.type == DataPacket);
 		Q_ASSERT(hdrlenData == Flow::hdrlen + sizeof(DataHeader));
+		att = txpath(att);
 
 		DataHeader *hdr = (DataHeader*)(p.buf.data() + Flow::hdrlen);
-		hdr->sid = htons(tcuratt->sid);
+		hdr->sid = htons(att->sid);
 		hdr->type = (DataPacket << typeShift) |
 				(hdr->type & dataAllFlags);
 			// (flags already set - preserve)
 		hdr->win = receiveWindow();
 		hdr->tsn = htonl(p.tsn);		// Note: 32-bit TSN
-		return txData(p);
+		return txData(p, att);
 	}
 
 	// See if we can potentially use an optimized attach/data packet;
@@ -572,7 +657,7 @@ void BaseStream::transmit(StreamFlow *flow)
 
 	// We've exhausted all of our optimized-path options:
 	// we have to send a specialized Attach packet instead of useful data.
-	txAttach();
+	txAttach(tcuratt);
 
 	// Don't requeue onto our flow at this point -
 	// we can't transmit any data until we get that ack!
@@ -595,12 +680,39 @@ void BaseStream::txAttachData(PacketType type, StreamId refsid)
 	hdr->tsn = htons(p.tsn);		// Note: 16-bit TSN
 
 	// Transmit
-	return txData(p);
+	return txData(p, tcuratt);
 }
 
-void BaseStream::txData(Packet &p)
+// Choose the path for our next data segment, given the attachment
+// whose flow has room to send it: among our acknowledged attachments
+// whose flows have room right now, the one with the lowest round-trip
+// time weighted by congestion window headroom (see StreamFlow::pathCost).
+BaseStream::TxAttachment *BaseStream::txpath(TxAttachment *att)
 {
-	StreamFlow *flow = tcuratt->flow;
+	if (!peer || !peer->multipath)
+		return att;
+
+	float cost = att->flow->pathCost();
+	TxAttachment *best = att;
+	for (int i = 0; i < maxAttach; i++) {
+		TxAttachment *alt = &tatt[i];
+		if (alt == att || !alt->isActive())
+			continue;
+		StreamFlow *flow = alt->flow;
+		if (flow->linkStatus() != LinkUp || flow->mayTransmit() <= 0)
+			continue;
+		float altcost = flow->pathCost();
+		if (altcost < cost) {
+			best = alt;
+			cost = altcost;
+		}
+	}
+	return best;
+}
+
+void BaseStream::txData(Packet &p, TxAttachment *att)
+{
+	StreamFlow *flow = att->flow;
 
 	// Transmit the packet on our current flow.
 	quint64 pktseq;
@@ -609,9 +721,9 @@ void BaseStream::txData(Packet &p)
 	//qDebug() << strm << "tx " << pktseq
 	//	<< "posn" << p.tsn << "size" << p.buf.size();
 
-	// Save the data packet in the flow's ackwait hash.
+	// Save the data packet in the flow's transmit ring until acked.
 	p.late = false;
-	flow->ackwait.insert(pktseq, p);
+	flow->ackWait(pktseq, p);
 
 	// Re-queue us on our flow immediately
 	// if we still have more data to send.
@@ -659,15 +771,15 @@ void BaseStream::txDatagram()
 	return txenqflow();
 }
 
-void BaseStream::txAttach()
+void BaseStream::txAttach(TxAttachment *att)
 {
 	qDebug() << this << "transmit Attach packet";
-	StreamFlow *flow = tcuratt->flow;
+	StreamFlow *flow = att->flow;
 	Q_ASSERT(!usid.isNull());	// XXX am I sure this holds here?
 	Q_ASSERT(!pusid.isNull());	// XXX am I sure this holds here?
 
 	// What slot are we trying to attach with?
-	unsigned slot = tcuratt - tatt;
+	unsigned slot = att - tatt;
 	Q_ASSERT(slot < (unsigned)maxAttach);
 	Q_ASSERT(attachSlotMask == maxAttach-1);
 
@@ -675,7 +787,7 @@ void BaseStream::txAttach()
 	Packet p(this, AttachPacket);
 	p.buf.resize(hdrlenAttach);
 	AttachHeader *hdr = (AttachHeader*)(p.buf.data() + Flow::hdrlen);
-	hdr->sid = htons(tcuratt->sid);
+	hdr->sid = htons(att->sid);
 	hdr->type = (AttachPacket << typeShift) | (init ? attachInitFlag : 0)				| slot;
 	hdr->win = receiveWindow();
 
@@ -688,14 +800,14 @@ void BaseStream::txAttach()
 		bodyxs << pusid;
 	p.buf.append(bodybuf);
 
-	// Transmit it on the current flow.
+	// Transmit it on the attachment's flow.
 	quint64 pktseq;
 	flow->flowTransmit(p.buf, pktseq);
 
-	// Save the attach packet in the flow's ackwait hash,
+	// Save the attach packet in the flow's transmit ring,
 	// so that we'll be notified when the attach packet gets acked.
 	p.late = false;
-	flow->ackwait.insert(pktseq, p);
+	flow->ackWait(pktseq, p);
 }
 
 void BaseStream::txReset(StreamFlow */*flow*/, quint16 /*sid*/,
@@ -716,10 +828,15 @@ void BaseStream::acked(StreamFlow *flow, const Packet &pkt, quint64 rxseq)
 		// Record this TSN as having been ACKed (if not already),
 		// so that we don't spuriously resend it
 		// if another instance is back in our transmit queue.
-		if (twait.remove(pkt.tsn)) {
-			twaitsize -= pkt.payloadSize();
-			//qDebug() << "twait remove" << pkt.tsn
-			//	<< "size" << pkt.payloadSize()
+		// If we've since split the segment up for retransmission,
+		// this ACK covers the pieces as well.
+		for (qint32 tsn = pkt.tsn, end = pkt.tsn + pkt.payloadSize();
+				tsn != end && twait.contains(tsn); ) {
+			qint32 size = twait.take(tsn);
+			twaitsize -= size;
+			tsn += size;
+			//qDebug() << "twait remove" << tsn
+			//	<< "size" << size
 			//	<< "new cnt" << twait.size()
 			//	<< "twaitsize" << twaitsize;
 		}
@@ -746,6 +863,16 @@ void BaseStream::acked(StreamFlow *flow, const Packet &pkt, quint64 rxseq)
 			attached();
 			if (strm && state == Connected)
 				strm->linkUp();
+
+			// Spread out onto any additional paths.
+			tattachPaths();
+		} else if (TxAttachment *att = tattFor(flow)) {
+			// An additional path is ready to carry data.
+			if (att->isAcked())
+				break;
+			qDebug() << this << "got path attach ack" << rxseq;
+			att->setActive(rxseq);
+			txenqflow(true);
 		}
 		break;
 
@@ -766,7 +893,7 @@ void BaseStream::acked(StreamFlow *flow, const Packet &pkt, quint64 rxseq)
 	}
 }
 
-bool BaseStream::missed(StreamFlow *, const Packet &pkt)
+bool BaseStream::missed(StreamFlow *flow, const Packet &pkt)
 {
 	Q_ASSERT(pkt.late);
 
@@ -781,11 +908,20 @@ bool BaseStream::missed(StreamFlow *, const Packet &pkt)
 		// Mark the segment no longer "in flight".
 		endflight(pkt);
 
-		txenqueue(pkt);	// Retransmit reliable segments...
+		// Retransmit reliable segments, split up if our path MTU
+		// has shrunk since we sent them...
+		if (pkt.payloadSize() > maxSegmentSize())
+			txresegment(pkt);
+		else
+			txenqueue(pkt);
 		return true;	// ...but keep the tx record until expiry
 				// in case it gets acked late!
 	case AttachPacket:
 		qDebug() << "Attach packet lost: trying again to attach";
+		if (TxAttachment *att = tattFor(flow)) {
+			if (att != tcuratt && !att->isAcked())
+				txAttach(att);
+		}
 		txenqflow();
 		return true;
 
@@ -812,6 +948,44 @@ void BaseStream::expire(StreamFlow *, const Packet &)
 	// do nothing for now
 }
 
+// Requeue a lost data segment too large for our current path MTU
+// as several smaller segments covering the same TSN range.
+// Only the last piece carries the original segment's flags.
+void BaseStream::txresegment(const Packet &pkt)
+{
+	int remain = pkt.payloadSize();
+	if (twait.value(pkt.tsn) != remain)
+		return;		// Already ACKed, or already split up
+
+	const DataHeader *ohdr = (const DataHeader*)
+				(pkt.buf.constData() + Flow::hdrlen);
+	quint8 flags = ohdr->type & dataAllFlags;
+	const char *data = pkt.buf.constData() + pkt.hdrlen;
+	qint32 tsn = pkt.tsn;
+	int segsize = maxSegmentSize();
+	qDebug() << this << "resegment bsn" << tsn << "size" << remain
+		<< "into" << segsize;
+
+	do {
+		int size = qMin(remain, segsize);
+		Packet p(this, DataPacket);
+		p.tsn = tsn;
+		p.buf = h->packetPool().alloc(hdrlenData + size);
+		p.hdrlen = hdrlenData;
+
+		DataHeader *hdr = (DataHeader*)(p.buf.data() + Flow::hdrlen);
+		hdr->type = size == remain ? flags : 0;
+		memcpy(hdr+1, data, size);
+
+		twait.insert(tsn, size);
+		txenqueue(p);
+
+		tsn += size;
+		data += size;
+		remain -= size;
+	} while (remain > 0);
+}
+
 void BaseStream::endflight(const Packet &pkt)
 {
 	// Cancel its allocation in our or our parent stream's state,
@@ -1503,7 +1677,12 @@ int BaseStream::readData(char *data, int maxSize)
 		}
 
 		// If this segment has the end-marker set, that's it...
-		if (rseg.flags() & dataCloseFlag)
+		bool close = rseg.flags() & dataCloseFlag;
+
+		// Hand the segment's buffer back for reuse.
+		h->packetPool().release(rseg.buf);
+
+		if (close)
 			shutdown(Stream::Read);
 	}
 
@@ -1556,7 +1735,7 @@ int BaseStream::writeData(const char *data, int totsize, quint8 endflags)
 	qint64 actsize = 0;
 	do {
 		// Choose the size of this segment.
-		int size = mtu;
+		int size = maxSegmentSize();
 		quint8 flags = 0;
 		if (totsize <= size) {
 			flags = dataPushFlag | endflags;
@@ -1567,7 +1746,7 @@ int BaseStream::writeData(const char *data, int totsize, quint8 endflags)
 		// Build the appropriate packet header.
 		Packet p(this, DataPacket);
 		p.tsn = tasn;
-		p.buf.resize(hdrlenData + size);
+		p.buf = h->packetPool().alloc(hdrlenData + size);
 
 		// Prepare the header
 		DataHeader *hdr = (DataHeader*)(p.buf.data() + Flow::hdrlen);
@@ -1585,7 +1764,7 @@ int BaseStream::writeData(const char *data, int totsize, quint8 endflags)
 		memcpy(payload, data, size);
 
 		// Hold onto the packet data until it gets ACKed
-		twait.insert(p.tsn);
+		twait.insert(p.tsn, size);
 		twaitsize += size;
 		//qDebug() << "twait insert" << p.tsn << "size" << size
 		//	<< "new cnt" << twait.size()
@@ -1609,7 +1788,8 @@ int BaseStream::writeData(const char *data, int totsize, quint8 endflags)
 qint32 BaseStream::writeDatagram(const char *data, qint32 totsize,
 				bool reliable)
 {
-	if (reliable || totsize > mtu /* XXX maxStatelessDatagram */ )
+	int segsize = maxSegmentSize();
+	if (reliable || totsize > segsize /* XXX maxStatelessDatagram */ )
 	{
 		// Datagram too large to send using the stateless optimization:
 		// just send it as a regular substream.
@@ -1626,7 +1806,7 @@ qint32 BaseStream::writeDatagram(const char *data, qint32 totsize,
 	quint8 flags = dgramBeginFlag;
 	do {
 		// Choose the size of this fragment.
-		int size = mtu;
+		int size = segsize;
 		if (remain <= size) {
 			flags |= dgramEndFlag;
 			size = remain;
@@ -1643,7 +1823,7 @@ qint32 BaseStream::writeDatagram(const char *data, qint32 totsize,
 		p.tsn = tasn;
 
 		// Build the DatagramHeader.
-		p.buf.resize(hdrlenDatagram + size);
+		p.buf = h->packetPool().alloc(hdrlenDatagram + size);
 		Q_ASSERT(hdrlenDatagram == Flow::hdrlen
 					+ sizeof(DatagramHeader));
 		DatagramHeader *hdr = (DatagramHeader*)
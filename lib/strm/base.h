@@ -1,7 +1,7 @@
 #ifndef SST_STRM_BASE_H
 #define SST_STRM_BASE_H
 
-#include <QSet>
+#include <QHash>
 #include <QQueue>
 #include <QPointer>
 
@@ -32,8 +32,9 @@ struct StreamTxAttachment : public StreamAttachment
 {
 	bool		active;		// Currently active and usable
 	bool		deprecated;	// Opening a replacement channel
+	bool		queued;		// On the flow's transmit queue
 
-	inline StreamTxAttachment() { active = deprecated = false; }
+	inline StreamTxAttachment() { active = deprecated = queued = false; }
 
 	inline bool isInUse() { return flow != NULL; }
 	inline bool isAcked() { return sidseq != maxPacketSeq; }
@@ -126,23 +127,9 @@ private:
 		Disconnected		// Connection terminated
 	};
 
-	struct Packet {
-		BaseStream *strm;
-		//qint64 txseq;			// Transmit sequence number
-		qint64 tsn;			// Logical byte position
-		QByteArray buf;			// Packet buffer incl. headers
-		int hdrlen;			// Size of flow + stream hdrs
-		PacketType type;		// Type of packet
-		bool late;			// on ackwait and presumed lost
-
-		inline Packet() : strm(NULL), type(InvalidPacket) { }
-		inline Packet(BaseStream *strm, PacketType type)
-			: strm(strm), type(type) { }
-
-		inline bool isNull() const { return strm == NULL; }
-		inline int payloadSize() const
-			{ return buf.size() - hdrlen; }
-	};
+	// Transmitted packets are held in the flow's transmit ring
+	// until acknowledged, so their record is defined in flow.h.
+	typedef StreamTxPacket Packet;
 
 	struct RxSegment {
 		qint32 rsn;			// Logical byte position
@@ -191,13 +178,13 @@ private:
 	TxAttachment	tatt[maxAttach];	// Our channel attachments
 	RxAttachment	ratt[maxAttach];	// Peer's channel attachments
 	TxAttachment	*tcuratt;		// Current transmit-attachment
+						// (others: multipath only)
 
 	// Byte transmit state
 	qint32		tasn;			// Next transmit BSN to assign
 	qint32		twin;			// Current transmit window
 	qint32		tflt;			// Bytes currently in flight
-	bool		tqflow;			// We're on flow's tx queue
-	QSet<qint32>	twait;			// Segments waiting to be ACKed
+	QHash<qint32,qint32> twait;		// Segments waiting to be ACKed
 	QQueue<Packet>	tqueue;			// Packets to be transmitted
 	qint32		twaitsize;		// Bytes in twait segments
 
@@ -232,17 +219,23 @@ private:
 
 	// Actively initiate a transmit-attachment
 	void tattach();
+	TxAttachment *tattachTo(StreamFlow *flow);
+	void tattachPaths();
+	TxAttachment *tattFor(StreamFlow *flow);
 	void setUsid(const UniqueStreamId &usid);
 
 	// Data transmission
+	int maxSegmentSize();
 	void txenqueue(const Packet &pkt);	// Queue a pkt for transmission
+	void txresegment(const Packet &pkt);	// Requeue a pkt split up
 	void txenqflow(bool immed = false);
 	//void txPrepare(Packet &pkt, StreamFlow *flow);
 	void transmit(StreamFlow *flow);
+	TxAttachment *txpath(TxAttachment *att);
 	void txAttachData(PacketType type, StreamId refsid);
-	void txData(Packet &p);
+	void txData(Packet &p, TxAttachment *att);
 	void txDatagram();
-	void txAttach();
+	void txAttach(TxAttachment *att);
 	static void txReset(StreamFlow *flow, quint16 sid, quint8 flags);
 
 	// Data reception
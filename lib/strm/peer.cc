@@ -18,7 +18,8 @@ using namespace SST;
 ////////// StreamPeer //////////
 
 StreamPeer::StreamPeer(Host *h, const QByteArray &id)
-:	h(h), id(id), flow(NULL), recontimer(h), stallcount(0)
+:	h(h), id(id), flow(NULL), recontimer(h), stallcount(0),
+	ccmode(h->defaultCCMode()), multipath(false)
 {
 	Q_ASSERT(!id.isEmpty());
 
@@ -46,7 +47,7 @@ void StreamPeer::connectFlow()
 {
 	Q_ASSERT(!id.isEmpty());
 
-	if (flow && flow->linkStatus() == LinkUp)
+	if (flow && flow->linkStatus() == LinkUp && !wantPaths())
 		return;	// Already have a flow working; don't need another yet.
 
 	// XXX need a working way to determine if streams need to send...
@@ -169,16 +170,55 @@ void StreamPeer::foundEndpoint(const Endpoint &ep)
 		initiate(sock, ep);
 }
 
+void StreamPeer::setCCMode(CCMode mode)
+{
+	ccmode = mode;
+	if (flow && flow->ccMode() != mode)
+		flow->setCCMode(mode);
+	foreach (StreamFlow *fl, paths)
+		if (fl->ccMode() != mode)
+			fl->setCCMode(mode);
+}
+
+void StreamPeer::setMultipath(bool enabled)
+{
+	multipath = enabled;
+	if (enabled) {
+		if (flow)
+			connectFlow();
+		return;
+	}
+
+	// Fold back onto the primary flow, leaving the other paths
+	// to serve only as alternatives for failover.
+	foreach (StreamFlow *fl, paths)
+		fl->detachAll();
+	paths.clear();
+}
+
+bool StreamPeer::hasFlowTo(const SocketEndpoint &sep)
+{
+	if (flow && flow->remoteEndpoint() == sep)
+		return true;
+	foreach (StreamFlow *fl, paths)
+		if (fl->remoteEndpoint() == sep)
+			return true;
+	return false;
+}
+
 void StreamPeer::initiate(Socket *sock, const Endpoint &ep)
 {
 	Q_ASSERT(!ep.isNull());
 
-	// No need to initiate new flows if we already have a working one...
-	if (flow && flow->linkStatus() == LinkUp)
+	// No need to initiate new flows if we already have a working one,
+	// unless we're looking for more paths to use at once.
+	if (flow && flow->linkStatus() == LinkUp && !wantPaths())
 		return;
 
 	// Don't simultaneously initiate multiple flows to the same endpoint.
 	SocketEndpoint sep(ep, sock);
+	if (multipath && hasFlowTo(sep))
+		return;
 	if (initors.contains(sep)) {
 		//qDebug() << this << "already attmpting connection to"
 		//	<< ep.toString();
@@ -260,9 +300,12 @@ void StreamPeer::flowStarted(StreamFlow *fl)
 
 	if (flow) {
 		// If we already have a working primary flow,
-		// we don't need a new one.
-		if (flow->linkStatus() == LinkUp)
-			return;	
+		// we don't need a new one - except as another path.
+		if (flow->linkStatus() == LinkUp) {
+			if (fl != flow && wantPaths() && !paths.contains(fl))
+				addPath(fl);
+			return;
+		}
 
 		// But if the current primary is on the blink,
 		// replace it.
@@ -289,6 +332,20 @@ void StreamPeer::flowStarted(StreamFlow *fl)
 	linkStatusChanged(LinkUp);
 }
 
+// Start using a newly started flow as an additional path,
+// and get existing streams attached to it.
+void StreamPeer::addPath(StreamFlow *fl)
+{
+	qDebug() << this << "new path" << fl
+		<< "to" << fl->remoteEndpoint().toString();
+
+	paths.append(fl);
+	fl->setParent(this);
+
+	foreach (BaseStream *bs, allstreams)
+		bs->tattachPaths();
+}
+
 void StreamPeer::clearPrimary()
 {
 	if (!flow)
@@ -302,6 +359,17 @@ void StreamPeer::clearPrimary()
 	disconnect(old, SIGNAL(linkStatusChanged(LinkStatus)),
 		this, SLOT(primaryStatusChanged(LinkStatus)));
 
+	// In multipath mode, promote another path right away,
+	// so that streams can fail over to it without waiting.
+	// Streams already attached to it simply adopt that attachment.
+	if (!paths.isEmpty()) {
+		flow = paths.takeFirst();
+		stallcount = 0;
+		qDebug() << this << "promoting path" << flow << "to primary";
+		connect(flow, SIGNAL(linkStatusChanged(LinkStatus)),
+			this, SLOT(primaryStatusChanged(LinkStatus)));
+	}
+
 	// Clear all transmit-attachments
 	// and return outstanding packets to the streams they came from.
 	old->detachAll();
@@ -320,7 +388,10 @@ void StreamPeer::primaryStatusChanged(LinkStatus newstatus)
 		// (If we were to kill a non-early KeyInitiator,
 		// the receiver might pick one of those streams
 		// as _its_ primary and be left with a dangling flow!)
+		// In multipath mode, keep at them while we need more paths.
 		stallcount = 0;
+		if (wantPaths())
+			return;
 		foreach (KeyInitiator *ki, initors.values()) {
 			if (!ki->isEarly())
 				continue;	// too late - let it finish
@@ -2,11 +2,13 @@
 #define SST_STRM_PEER_H
 
 #include <QSet>
+#include <QList>
 #include <QHash>
 #include <QByteArray>
 #include <QPointer>
 
 #include "timer.h"
+#include "flow.h"
 #include "strm/proto.h"
 
 namespace SST {
@@ -46,6 +48,14 @@ class StreamPeer : public QObject, public StreamProtocol
 	QSet<RegClient*> lookups;	// Outstanding lookups in progress
 	Timer recontimer;		// For persistent lookup requests
 	int stallcount;			// Stall warnings before new lookup
+	CCMode ccmode;			// Congestion control for our flows
+
+	// Multipath mode: additional flows over other paths,
+	// each with its own congestion control, that carry stream data
+	// concurrently with the primary flow.  A stream can attach to
+	// at most maxAttach flows, which limits how many we use.
+	bool multipath;
+	QList<StreamFlow*> paths;
 
 	// Set of RegClients we've connected to so far
 	QPointerSet<RegClient> connrcs;
@@ -82,13 +92,38 @@ class StreamPeer : public QObject, public StreamProtocol
 	// (either incoming or outgoing) successfully starts.
 	void flowStarted(StreamFlow *flow);
 
+	// Start using a flow as an additional path in multipath mode.
+	void addPath(StreamFlow *flow);
+
 	// Clear the peer's current primary flow.
 	void clearPrimary();
 
+	// True if we're in multipath mode and could use another path.
+	inline bool wantPaths() const
+		{ return multipath && paths.size() < maxAttach - 1; }
+
+	// True if we already have a flow to a given endpoint.
+	bool hasFlowTo(const SocketEndpoint &sep);
+
 public:
 	// Supply an endpoint hint that may be useful for finding this peer.
 	void foundEndpoint(const Endpoint &ep);
 
+	// Select the congestion control mode for flows to this peer,
+	// overriding the host's defaultCCMode(): e.g., CC_LEDBAT
+	// so that bulk transfers to a backup server yield to other traffic.
+	// Applies to the current primary flow immediately.
+	void setCCMode(CCMode mode);
+	inline CCMode ccMode() const { return ccmode; }
+
+	// Select multipath mode, in which we keep flows to this peer
+	// over several local sockets or remote endpoints at once,
+	// rather than only using alternatives for failover,
+	// and stripe our streams' data across them.
+	// Must be set before connecting to take full effect.
+	void setMultipath(bool enabled);
+	inline bool isMultipath() const { return multipath; }
+
 signals:
 	void flowConnected();	// Primary flow connection attempt succeeded
 	void flowFailed();	// Connection attempt or primary flow failed
@@ -57,7 +57,9 @@ public:
 	// 0x535354 = 'SST': 'Structured Stream Transport'
 	static const quint32 magic = 0x00535354;
 
-	// Maximum transmission unit. XX should be dynamic.
+	// Default maximum segment size, and the minimum we ever use.
+	// Flows that discover their path MTU may carry larger segments;
+	// see BaseStream::maxSegmentSize().
 	static const int mtu = 1200;
 
 	// Minimum receive buffer size. XX should be dynamically based on mtu.
@@ -3,6 +3,7 @@
 
 #include <QtDebug>
 
+#include "host.h"
 #include "strm/base.h"
 #include "strm/peer.h"
 #include "strm/sflow.h"
@@ -33,6 +34,10 @@ StreamFlow::StreamFlow(Host *h, StreamPeer *peer, const QByteArray &peerid)
 	// Listen on the root stream for top-level application streams
 	root.listen(Stream::Unlimited);
 
+	// Use the congestion controller selected for this peer
+	if (peer->ccMode() != ccMode())
+		setCCMode(peer->ccMode());
+
 	//XXX channel IDs
 
 	connect(this, SIGNAL(readyTransmit()),
@@ -67,14 +72,27 @@ void StreamFlow::enqueueStream(BaseStream *strm)
 	tstreams.insert(i, strm);
 }
 
+// Paths we have no RTT sample for yet cost nothing,
+// so that the scheduler tries them right away.
+float StreamFlow::pathCost()
+{
+	int win = txCongestionWindow();
+	int room = qMax(1, win - txPacketsInFlight());
+	return (float)txSmoothedRtt() * win / room;
+}
+
 void StreamFlow::detachAll()
 {
-	// Save off and clear the flow's entire ackwait table -
+	// Pull all the waiting packets out of the flow's transmit ring -
 	// it'll be more efficient to go through it once
 	// and send all the waiting packets back to their streams,
 	// than for each stream to pull out its packets individually.
-	QHash<qint64,BaseStream::Packet> ackbak = ackwait;
-	ackwait.clear();
+	QList<BaseStream::Packet> ackbak;
+	for (quint64 seq = txevts.base(); seq < txevts.end(); seq++) {
+		BaseStream::Packet p = ackUnwait(seq);
+		if (!p.isNull())
+			ackbak.append(p);
+	}
 
 	// Detach all the streams with transmit-attachments to this flow.
 	foreach (TxAttachment *att, txsids)
@@ -119,6 +137,9 @@ void StreamFlow::gotReadyTransmit()
 	if (tstreams.isEmpty())
 		return;
 
+	// Hand this whole burst to the socket as one transmit batch.
+	SocketBatch batch(remoteEndpoint().sock);
+
 	// Round-robin between our streams for now.
 	do {
 		// Grab the next stream in line to transmit
@@ -135,13 +156,16 @@ void StreamFlow::acked(quint64 txseq, int npackets, quint64 rxseq)
 {
 	for (; npackets > 0; txseq++, npackets--) {
 		// find and remove the packet
-		BaseStream::Packet p = ackwait.take(txseq);
+		BaseStream::Packet p = ackUnwait(txseq);
 		if (p.isNull())
 			continue;
 
 		//qDebug() << "Got ack for packet" << txseq
 		//	<< "of size" << p.buf.size();
 		p.strm->acked(this, p, rxseq);
+
+		// Recycle the buffer if no retransmission still holds it.
+		host()->packetPool().release(p.buf);
 	}
 }
 
@@ -149,19 +173,22 @@ void StreamFlow::missed(quint64 txseq, int npackets)
 {
 	for (; npackets > 0; txseq++, npackets--) {
 		// find but don't remove (common case for missed packets)
-		if (!ackwait.contains(txseq)) {
+		BaseStream::Packet *p = ackWaiting(txseq);
+		if (p == NULL) {
 			//qDebug() << "Missed packet" << txseq
 			//	<< "but can't find it!";
 			continue;
 		}
-		BaseStream::Packet &p = ackwait[txseq];
 
 		//qDebug() << "Missed packet" << txseq
-		//	<< "of size" << p.buf.size();
-		if (!p.late) {
-			p.late = true;
-			if (!p.strm->missed(this, p))
-				ackwait.remove(txseq);
+		//	<< "of size" << p->buf.size();
+		if (!p->late) {
+			// Work on a copy, since the stream may transmit
+			// and thereby grow (and move) the transmit ring.
+			p->late = true;
+			BaseStream::Packet pc = *p;
+			if (!pc.strm->missed(this, pc))
+				ackUnwait(txseq);
 		}
 	}
 }
@@ -170,7 +197,7 @@ void StreamFlow::expire(quint64 txseq, int npackets)
 {
 	for (; npackets > 0; txseq++, npackets--) {
 		// find and unconditionally remove packet when it expires
-		BaseStream::Packet p = ackwait.take(txseq);
+		BaseStream::Packet p = ackUnwait(txseq);
 		if (p.isNull()) {
 			//qDebug() << "Missed packet" << txseq
 			//	<< "but can't find it!";
@@ -180,6 +207,7 @@ void StreamFlow::expire(quint64 txseq, int npackets)
 		//qDebug() << "Missed packet" << txseq
 		//	<< "of size" << p.buf.size();
 		p.strm->expire(this, p);
+		host()->packetPool().release(p.buf);
 	}
 }
 
@@ -206,6 +234,7 @@ void StreamFlow::gotLinkStatusChanged(LinkStatus newstatus)
 			<< "failed";
 		peer->clearPrimary();
 	}
+	peer->paths.removeAll(this);
 
 	// Stop and destroy this flow.
 	stop();
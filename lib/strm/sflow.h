@@ -58,13 +58,10 @@ private:
 //	// XX would prefer a smarter scheduling algorithm, e.g., stride.
 //	QQueue<TxAttachment*> tattq;
 
-	// Packets transmitted and waiting for acknowledgment,
-	// indexed by assigned transmit sequence number.
-	QHash<qint64,BaseStream::Packet> ackwait;
-
-	// Packets already presumed lost ("missed")
-	// but still waiting for potential acknowledgment until expiry.
-	QHash<qint64,BaseStream::Packet> expwait;
+	// Packets transmitted and waiting for acknowledgment
+	// are kept in the TxEvent for their transmit sequence number
+	// in Flow::txevts, along with packets already presumed lost
+	// ("missed") but still waiting for acknowledgment until expiry.
 
 	// RxSID of stream on which we last received a packet -
 	// this determines for which stream we send receive window info
@@ -81,6 +78,32 @@ private:
 
 	inline StreamPeer *target() { return peer; }
 
+	// Save a just-transmitted packet until it is acknowledged.
+	inline void ackWait(quint64 txseq, const BaseStream::Packet &p)
+		{ txevts[txseq].pkt = p; }
+
+	// Find the packet waiting for acknowledgment at a sequence number,
+	// returning NULL if there is none.
+	inline BaseStream::Packet *ackWaiting(quint64 txseq) {
+		if (!txevts.contains(txseq))
+			return NULL;
+		BaseStream::Packet &p = txevts[txseq].pkt;
+		return p.isNull() ? NULL : &p;
+	}
+
+	// Remove and return the packet waiting at a sequence number,
+	// or a null packet if there is none.
+	inline BaseStream::Packet ackUnwait(quint64 txseq) {
+		BaseStream::Packet p;
+		if (txevts.contains(txseq))
+			qSwap(p, txevts[txseq].pkt);
+		return p;
+	}
+
+	// Multipath scheduling cost of sending a packet on this flow now:
+	// its round-trip time, scaled up as its congestion window fills.
+	float pathCost();
+
 	inline int dequeueStream(BaseStream *strm)
 		{ return tstreams.removeAll(strm); }
 	void enqueueStream(BaseStream *strm);
@@ -19,8 +19,18 @@
  */
 
 
+#ifndef WIN32
+#include <sys/time.h>
+#endif
+#ifdef __linux__
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
+
 #include <QDateTime>
 #include <QTimerEvent>
+#include <QSocketNotifier>
 #include <QtDebug>
 
 #include "timer.h"
@@ -29,6 +39,20 @@
 using namespace SST;
 
 
+// Read the system clock with the best resolution we can get:
+// microseconds where available, else QDateTime's milliseconds.
+static qint64 usecClock()
+{
+#ifndef WIN32
+	struct timeval tv;
+	if (gettimeofday(&tv, NULL) == 0)
+		return (qint64)tv.tv_sec * 1000000 + tv.tv_usec;
+	qWarning("gettimeofday failed");
+#endif
+	return Time::fromQDateTime(QDateTime::currentDateTime()).usecs;
+}
+
+
 ////////// Time //////////
 
 QString Time::toString() const
@@ -120,13 +144,52 @@ Timer::Timer(TimerHostState *host, QObject *parent)
 DefaultTimerEngine::~DefaultTimerEngine()
 {
 	stop();
+#ifdef __linux__
+	delete tnotifier;
+	if (tfd >= 0)
+		::close(tfd);
+#endif
 }
 
 void DefaultTimerEngine::start(quint64 usecs)
 {
-	if (timerid)
-		QObject::killTimer(timerid);
-	timerid = QObject::startTimer(usecs / 1000);
+	stop();
+
+	// QObject timers only have millisecond granularity.
+#ifdef __linux__
+	// For shorter intervals use a timerfd of our own,
+	// which the event loop sleeps on like any other descriptor.
+	if (usecs < 1000) {
+		if (tfd < 0) {
+			tfd = timerfd_create(CLOCK_MONOTONIC,
+					TFD_NONBLOCK | TFD_CLOEXEC);
+			if (tfd >= 0) {
+				tnotifier = new QSocketNotifier(tfd,
+						QSocketNotifier::Read, this);
+				connect(tnotifier, SIGNAL(activated(int)),
+					this, SLOT(timerfdExpired()));
+			} else
+				qWarning("DefaultTimerEngine: "
+					"can't create timerfd");
+		}
+		if (tfd >= 0) {
+			// A zero it_value would disarm the timerfd.
+			struct itimerspec its;
+			memset(&its, 0, sizeof(its));
+			its.it_value.tv_nsec = qMax(usecs, (quint64)1) * 1000;
+			if (timerfd_settime(tfd, 0, &its, NULL) == 0) {
+				tnotifier->setEnabled(true);
+				return;
+			}
+			qWarning("DefaultTimerEngine: can't arm timerfd");
+		}
+	}
+#endif
+
+	// Elsewhere round sub-millisecond intervals up to a millisecond;
+	// a zero-interval timer would fire on every pass
+	// through the event loop and keep it spinning until then.
+	timerid = QObject::startTimer(qMax(usecs / 1000, (quint64)1));
 	//qDebug() << "startTimer" << usecs << "id" << timerid
 	//	<< "at" << QTime::currentTime().msec();
 }
@@ -138,6 +201,14 @@ void DefaultTimerEngine::stop()
 		QObject::killTimer(timerid);
 		timerid = 0;
 	}
+#ifdef __linux__
+	if (tnotifier && tnotifier->isEnabled()) {
+		tnotifier->setEnabled(false);
+		struct itimerspec its;
+		memset(&its, 0, sizeof(its));
+		timerfd_settime(tfd, 0, &its, NULL);
+	}
+#endif
 }
 
 void DefaultTimerEngine::timerEvent(QTimerEvent *ev)
@@ -151,12 +222,23 @@ void DefaultTimerEngine::timerEvent(QTimerEvent *ev)
 	}
 }
 
+void DefaultTimerEngine::timerfdExpired()
+{
+#ifdef __linux__
+	quint64 expirations;
+	if (::read(tfd, &expirations, sizeof(expirations)) < 0)
+		return;		// spurious wakeup, not yet expired
+	tnotifier->setEnabled(false);
+	timeout();
+#endif
+}
+
 
 ////////// TimerHostState //////////
 
 Time TimerHostState::currentTime()
 {
-	return Time::fromQDateTime(QDateTime::currentDateTime());
+	return Time(usecClock());
 }
 
 TimerEngine *TimerHostState::newTimerEngine(Timer *timer)
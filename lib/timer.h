@@ -25,6 +25,7 @@
 
 class QDateTime;
 class QTimerEvent;
+class QSocketNotifier;
 
 
 namespace SST {
@@ -225,8 +226,11 @@ class DefaultTimerEngine : public TimerEngine
 
 	Q_OBJECT
 	int timerid;
+	int tfd;		// timerfd for sub-millisecond timers, or -1
+	QSocketNotifier *tnotifier;	// Watches tfd while it's armed
 
-	inline DefaultTimerEngine(Timer *t) : TimerEngine(t), timerid(0) { }
+	inline DefaultTimerEngine(Timer *t)
+		: TimerEngine(t), timerid(0), tfd(-1), tnotifier(NULL) { }
 	~DefaultTimerEngine();
 
 	virtual void start(quint64 usecs);
@@ -234,6 +238,9 @@ class DefaultTimerEngine : public TimerEngine
 
 	/// Override QObject's timerEvent() method.
 	virtual void timerEvent(QTimerEvent *);
+
+private slots:
+	void timerfdExpired();
 };
 
 
@@ -22,6 +22,7 @@
 
 #include <QList>
 #include <QHash>
+#include <QVector>
 #include <QString>
 #include <QByteArray>
 #include <QPointer>
@@ -130,6 +131,164 @@ public:
 };
 
 
+// Ring buffer holding one item for each of a dense, contiguous range
+// of 64-bit sequence numbers, such as a flow's packets in flight.
+// Items are appended at the end of the range and removed from its base,
+// and any item in between is found in constant time by sequence number.
+// The ring's capacity is always a power of two, doubling as needed.
+// Removed items are reset to T() so that they release any resources.
+template<typename T> class SeqRing
+{
+	QVector<T> items;
+	quint64 lo, hi;		// Range of sequence numbers held
+	quint64 mask;		// items.size() - 1
+
+	void grow() {
+		QVector<T> n(items.size() * 2);
+		quint64 nmask = n.size() - 1;
+		for (quint64 seq = lo; seq < hi; seq++)
+			qSwap(n[seq & nmask], items[seq & mask]);
+		items = n;
+		mask = nmask;
+	}
+
+public:
+	inline SeqRing(int capacity = 64, quint64 base = 0)
+		: items(capacity), lo(base), hi(base), mask(capacity - 1)
+		{ Q_ASSERT((capacity & (capacity - 1)) == 0); }
+
+	// Sequence number of the oldest item, and one past the newest.
+	inline quint64 base() const { return lo; }
+	inline quint64 end() const { return hi; }
+
+	inline int size() const { return hi - lo; }
+	inline int capacity() const { return items.size(); }
+	inline bool isEmpty() const { return hi == lo; }
+	inline bool contains(quint64 seq) const
+		{ return seq >= lo && seq < hi; }
+
+	inline T &operator[](quint64 seq)
+		{ Q_ASSERT(contains(seq)); return items[seq & mask]; }
+	inline const T &operator[](quint64 seq) const
+		{ Q_ASSERT(contains(seq)); return items[seq & mask]; }
+
+	inline T &head() { return (*this)[lo]; }
+
+	// Append an item, assigning it sequence number end().
+	// References to existing items may be invalidated.
+	inline void append(const T &item) {
+		if (hi - lo == (quint64)items.size())
+			grow();
+		items[hi++ & mask] = item;
+	}
+
+	// Remove the item at base(), advancing base() by one.
+	inline void removeFirst()
+		{ Q_ASSERT(!isEmpty()); items[lo++ & mask] = T(); }
+
+	// Remove all items and restart the range at a given base.
+	inline void clear(quint64 base = 0) {
+		while (lo < hi)
+			removeFirst();
+		lo = hi = base;
+	}
+};
+
+
+// Sliding window of one-bit flags for 64-bit sequence numbers,
+// covering the most recent bits() sequence numbers up to top(),
+// the highest one set so far, e.g., to record which packets
+// have been received for replay protection and acknowledgment.
+// The window is kept as a ring of 32-bit words,
+// so it actually slides in 32-packet steps.
+class SeqMask
+{
+	QVector<quint32> words;
+	quint64 hiseq;		// Highest sequence number set
+	quint32 wmask;		// words.size() - 1
+
+	inline quint32 &word(quint64 seq) { return words[(seq >> 5) & wmask]; }
+	inline quint32 word(quint64 seq) const
+		{ return words[(seq >> 5) & wmask]; }
+
+public:
+	// Bits is rounded up to a power of two and at least 32.
+	// Initially only sequence number 'top' is set.
+	inline SeqMask(int bits = 32, quint64 top = 0) { reset(bits, top); }
+
+	inline void reset(int bits, quint64 top) {
+		int nwords = 1;
+		while (nwords * 32 < bits)
+			nwords *= 2;
+		words = QVector<quint32>(nwords, 0);
+		wmask = nwords - 1;
+		hiseq = top;
+		word(top) = 1 << (top & 31);
+	}
+
+	inline int bits() const { return words.size() * 32; }
+	inline quint64 top() const { return hiseq; }
+
+	// Lowest sequence number still within the window.
+	inline quint64 base() const {
+		quint64 w = (hiseq >> 5) + 1;
+		return w > (quint64)words.size() ? (w - words.size()) << 5 : 0;
+	}
+
+	inline bool contains(quint64 seq) const
+		{ return seq <= hiseq && seq >= base(); }
+
+	// Sequence numbers beyond top() are never set;
+	// those that have fallen below base() are unknown.
+	inline bool test(quint64 seq) const {
+		Q_ASSERT(seq > hiseq || seq >= base());
+		return seq <= hiseq && (word(seq) & (1 << (seq & 31)));
+	}
+
+	// Set a flag, sliding the window forward if seq is beyond top().
+	inline void set(quint64 seq) {
+		if (seq > hiseq) {
+			// Clear the words we're sliding into.
+			quint64 w = hiseq >> 5, nw = seq >> 5;
+			for (int i = 0; w < nw && i <= (int)wmask; i++)
+				words[++w & wmask] = 0;
+			hiseq = seq;
+		}
+		Q_ASSERT(seq >= base());
+		word(seq) |= 1 << (seq & 31);
+	}
+
+	// Find the highest sequence number at or below seq and above limit
+	// whose flag equals value, looking only within the window.
+	// Returns limit if there is none.
+	inline quint64 findBelow(quint64 seq, bool value, quint64 limit) const {
+		if (seq > hiseq) {
+			if (!value)
+				return seq;
+			seq = hiseq;
+		}
+		quint64 lo = qMax(base(), limit + 1);
+		while (seq >= lo) {
+			quint32 w = word(seq);
+			if (!value)
+				w = ~w;
+			int b = seq & 31;
+			if (b != 31)
+				w &= (2u << b) - 1;
+			if (w) {
+				quint64 found = (seq & ~(quint64)31)
+						| (31 - __builtin_clz(w));
+				return found >= lo ? found : limit;
+			}
+			if (seq < 32)
+				break;
+			seq = (seq & ~(quint64)31) - 1;
+		}
+		return limit;
+	}
+};
+
+
 // Generate cryptographically random and pseudo-random bytes
 QByteArray randBytes(int size);
 QByteArray pseudoRandBytes(int size);
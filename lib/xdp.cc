@@ -0,0 +1,884 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <QHash>
+#include <QVector>
+#include <QSocketNotifier>
+#include <QtEndian>
+#include <QtDebug>
+
+// xdp.h defines SST_XDP on the same test.
+#if defined(__linux__)
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#endif
+
+#include "xdp.h"
+
+using namespace SST;
+
+
+#ifdef SST_XDP
+
+// Older C library headers may lack the AF_XDP constants.
+#ifndef AF_XDP
+#define AF_XDP		44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP		283
+#endif
+
+// Entries in each of the four rings: enough for every frame
+// in the half of UMEM that ring's traffic uses.
+#define XDP_RING_SIZE	(XdpSocket::numFrames / 2)
+
+
+////////// XdpRing //////////
+
+// One of the rings an AF_XDP socket shares with the kernel.
+// We produce into the fill and transmit rings,
+// and consume from the receive and completion rings,
+// caching our own index and publishing it in batches.
+struct XdpRing
+{
+	quint32 *producer;
+	quint32 *consumer;
+	void *descs;
+	quint32 prod, cons;	// Our cached copies of the indexes
+	void *map;
+	size_t maplen;
+
+	inline XdpRing() : map(NULL) { }
+	bool init(int fd, const xdp_ring_offset &off, size_t descsize,
+			off_t pgoff);
+	void free();
+
+	inline quint64 &addr(quint32 i)
+		{ return ((quint64*)descs)[i & (XDP_RING_SIZE - 1)]; }
+	inline xdp_desc &desc(quint32 i)
+		{ return ((xdp_desc*)descs)[i & (XDP_RING_SIZE - 1)]; }
+
+	// Kernel-side index, and publishing ours
+	inline quint32 kernelProducer()
+		{ return __atomic_load_n(producer, __ATOMIC_ACQUIRE); }
+	inline void publishProducer()
+		{ __atomic_store_n(producer, prod, __ATOMIC_RELEASE); }
+	inline void publishConsumer()
+		{ __atomic_store_n(consumer, cons, __ATOMIC_RELEASE); }
+};
+
+bool XdpRing::init(int fd, const xdp_ring_offset &off, size_t descsize,
+			off_t pgoff)
+{
+	maplen = off.desc + XDP_RING_SIZE * descsize;
+	map = mmap(NULL, maplen, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, pgoff);
+	if (map == MAP_FAILED) {
+		map = NULL;
+		return false;
+	}
+	producer = (quint32*)((char*)map + off.producer);
+	consumer = (quint32*)((char*)map + off.consumer);
+	descs = (char*)map + off.desc;
+	prod = *producer;
+	cons = *consumer;
+	return true;
+}
+
+void XdpRing::free()
+{
+	if (map)
+		munmap(map, maplen);
+	map = NULL;
+}
+
+
+////////// XdpProgram //////////
+
+static inline long bpfCall(int cmd, bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+// Assembles our XDP program, which redirects IPv4 UDP datagrams
+// without IP options or fragmentation addressed to our port,
+// and to our address if bound to one, into the XSKMAP entry
+// for the receiving queue; everything else gets XDP_PASS.
+// All header fields are loaded and compared in network byte order.
+class XdpProgram
+{
+	QVector<bpf_insn> insns;
+	QList<int> topass;	// Jumps to patch to point at the pass exit
+
+	inline void insn(quint8 code, quint8 dst, quint8 src,
+			qint16 off, qint32 imm) {
+		bpf_insn i;
+		i.code = code;
+		i.dst_reg = dst;
+		i.src_reg = src;
+		i.off = off;
+		i.imm = imm;
+		insns.append(i); }
+
+	// Load a header field at @a ofs from the packet start into r5
+	inline void field(int size, int ofs)
+		{ insn(BPF_LDX | size | BPF_MEM, 5, 2, ofs, 0); }
+
+	// Pass the packet to the stack unless r5 equals @a imm
+	inline void passUnless(int jmpclass, qint32 imm) {
+		topass.append(insns.size());
+		insn(jmpclass | BPF_JNE | BPF_K, 5, 0, 0, imm); }
+
+public:
+	XdpProgram(int mapfd, quint32 daddr, quint16 dport);
+
+	int load(QString &err);
+};
+
+XdpProgram::XdpProgram(int mapfd, quint32 daddr, quint16 dport)
+{
+	// r6 = ctx, r2 = data, r3 = data_end
+	insn(BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0);
+	insn(BPF_LDX | BPF_W | BPF_MEM, 2, 6, 0, 0);
+	insn(BPF_LDX | BPF_W | BPF_MEM, 3, 6, 4, 0);
+
+	// Is the frame long enough for all our headers?
+	insn(BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0);
+	insn(BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, XdpSocket::hdrLen);
+	topass.append(insns.size());
+	insn(BPF_JMP | BPF_JGT | BPF_X, 4, 3, 0, 0);
+
+	field(BPF_H, 12);			// EtherType: IPv4
+	passUnless(BPF_JMP, htons(0x0800));
+	field(BPF_B, 14);			// Version 4, no IP options
+	passUnless(BPF_JMP, 0x45);
+	field(BPF_B, 14 + 9);			// Protocol: UDP
+	passUnless(BPF_JMP, IPPROTO_UDP);
+	field(BPF_H, 14 + 6);			// Not a fragment
+	insn(BPF_ALU64 | BPF_AND | BPF_K, 5, 0, 0, htons(0x3fff));
+	passUnless(BPF_JMP, 0);
+	field(BPF_H, 14 + 20 + 2);		// Our UDP port
+	passUnless(BPF_JMP, htons(dport));
+	if (daddr != htonl(INADDR_ANY)) {
+		field(BPF_W, 14 + 16);		// Our IP address
+		passUnless(BPF_JMP32, (qint32)daddr);
+	}
+
+	// return bpf_redirect_map(map, ctx->rx_queue_index, XDP_PASS);
+	insn(BPF_LDX | BPF_W | BPF_MEM, 2, 6, 16, 0);
+	insn(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, mapfd);
+	insn(0, 0, 0, 0, 0);
+	insn(BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS);
+	insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map);
+	insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+
+	// pass: return XDP_PASS;
+	int pass = insns.size();
+	insn(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS);
+	insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+
+	foreach (int i, topass)
+		insns[i].off = pass - i - 1;
+}
+
+int XdpProgram::load(QString &err)
+{
+	static char log[16384];
+	log[0] = 0;
+
+	bpf_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (quint64)(quintptr)insns.constData();
+	attr.insn_cnt = insns.size();
+	attr.license = (quint64)(quintptr)"GPL and additional rights";
+	attr.log_buf = (quint64)(quintptr)log;
+	attr.log_size = sizeof(log);
+	attr.log_level = 1;
+
+	int fd = bpfCall(BPF_PROG_LOAD, &attr);
+	if (fd < 0) {
+		err = QString("Can't load XDP program: %1").arg(strerror(errno));
+		qDebug() << "XDP verifier log:" << log;
+	}
+	return fd;
+}
+
+
+////////// XdpState //////////
+
+// Private state of an attached XdpSocket.
+struct SST::XdpState
+{
+	int ifindex;		// Interface index
+	int mtu;		// Interface MTU
+	quint8 mac[6];		// Interface Ethernet address
+	int fd;			// AF_XDP socket
+	int resfd;		// UDP socket reserving our port, if we picked it
+	int mapfd;		// XSKMAP pointing the program at fd
+	int progfd;		// XDP program
+	int linkfd;		// Attachment of the program to the interface
+	bool native;		// Attached in driver mode
+	char *umem;		// Frames shared with the kernel
+	XdpRing fill, comp, rx, tx;
+	QVector<quint64> txfree;// Transmit frames available
+	int txheld;		// Transmit descriptors not yet published
+	QSocketNotifier *notifier;
+
+	// Ethernet addresses to reach peers by, by IPv4 address:
+	// the last each sender used whose packet we haven't authenticated,
+	// and those we trust, either from authenticated packets
+	// or from the kernel's neighbor table
+	QHash<quint32, quint64> heard;
+	QHash<quint32, quint64> macs;
+
+	quint32 netaddr, netmask;	// Interface's subnet
+	quint32 gwaddr;		// Default gateway on it, 0 if none
+	quint64 gateway;	// Gateway's Ethernet address if set, else 0
+
+	XdpState();
+	~XdpState();
+};
+
+// Most peers' Ethernet addresses we'll remember
+#define XDP_MACS_MAX	65536
+
+// Most unauthenticated senders' addresses we'll hold at once.
+// Entries only need to last until a flow authenticates the packet,
+// so when full we just forget them all, spoofed ones included.
+#define XDP_HEARD_MAX	1024
+
+XdpState::XdpState()
+:	ifindex(0), mtu(1500),
+	fd(-1), resfd(-1), mapfd(-1), progfd(-1), linkfd(-1),
+	native(false),
+	umem(NULL),
+	txheld(0),
+	notifier(NULL),
+	netaddr(0), netmask(0), gwaddr(0),
+	gateway(0)
+{
+}
+
+XdpState::~XdpState()
+{
+	delete notifier;
+
+	// Closing the link detaches the program from the interface.
+	if (linkfd >= 0) ::close(linkfd);
+	if (progfd >= 0) ::close(progfd);
+	if (mapfd >= 0) ::close(mapfd);
+	fill.free();
+	comp.free();
+	rx.free();
+	tx.free();
+	if (fd >= 0) ::close(fd);
+	if (resfd >= 0) ::close(resfd);
+	if (umem)
+		munmap(umem, (size_t)XdpSocket::numFrames * XdpSocket::frameSize);
+}
+
+#endif	// SST_XDP
+
+
+////////// XdpSocket //////////
+
+XdpSocket::XdpSocket(SocketHostState *host, const QString &ifname,
+			int queue, QObject *parent)
+:	Socket(host, parent),
+	ifname(ifname),
+	queue(queue),
+	x(NULL),
+	lport(0),
+	st()
+{
+}
+
+XdpSocket::~XdpSocket()
+{
+	flushBatch();
+	detach();
+}
+
+bool XdpSocket::bind(const QHostAddress &addr, quint16 port,
+			QUdpSocket::BindMode)
+{
+	Q_ASSERT(!active());
+#ifdef SST_XDP
+	quint32 saddr;
+	if (addr == QHostAddress::Any)
+		saddr = htonl(INADDR_ANY);
+	else if (addr.protocol() == QAbstractSocket::IPv4Protocol)
+		saddr = htonl(addr.toIPv4Address());
+	else {
+		err = "XdpSocket supports only IPv4";
+		return false;
+	}
+
+	x = new XdpState;
+	lport = port;
+	if (!attach(saddr)) {
+		detach();
+		return false;
+	}
+
+	qDebug() << this << "attached to" << ifname << "queue" << queue
+		<< "port" << lport
+		<< (x->native ? "native" : "generic") << "mode"
+		<< (isZeroCopy() ? "zero-copy" : "copying");
+	setActive(true);
+	return true;
+#else
+	(void)addr; (void)port;
+	err = "AF_XDP is only available on Linux";
+	return false;
+#endif
+}
+
+#ifdef SST_XDP
+// Set up everything in the order the kernel needs it:
+// UMEM and rings, the bound AF_XDP socket, the XSKMAP entry for it,
+// and finally the program that redirects into the map.
+bool XdpSocket::attach(quint32 saddr)
+{
+	XdpState &x = *this->x;
+	QByteArray name = ifname.toLocal8Bit();
+
+	// Find the interface and its addresses.
+	x.ifindex = if_nametoindex(name.constData());
+	if (x.ifindex == 0) {
+		err = QString("No such interface: %1").arg(ifname);
+		return false;
+	}
+	int ifs = ::socket(AF_INET, SOCK_DGRAM, 0);
+	ifreq ifr;
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, name.constData(), IFNAMSIZ - 1);
+	bool ok = ioctl(ifs, SIOCGIFHWADDR, &ifr) == 0;
+	if (ok)
+		memcpy(x.mac, ifr.ifr_hwaddr.sa_data, 6);
+	if (ok && ioctl(ifs, SIOCGIFMTU, &ifr) == 0)
+		x.mtu = ifr.ifr_mtu;
+	if (ok && ioctl(ifs, SIOCGIFNETMASK, &ifr) == 0)
+		x.netmask = ((sockaddr_in*)&ifr.ifr_netmask)->sin_addr.s_addr;
+	if (ok && saddr == htonl(INADDR_ANY)) {
+		ok = ioctl(ifs, SIOCGIFADDR, &ifr) == 0;
+		if (ok)
+			saddr = ((sockaddr_in*)&ifr.ifr_addr)->sin_addr.s_addr;
+		else
+			errno = EADDRNOTAVAIL;
+	}
+	::close(ifs);
+	if (!ok) {
+		err = QString("Can't get addresses of %1: %2")
+			.arg(ifname).arg(strerror(errno));
+		return false;
+	}
+	laddr.setAddress(ntohl(saddr));
+	x.netaddr = saddr & x.netmask;
+	findGateway();
+
+	// Have the OS pick a port if we weren't given one,
+	// and keep it from handing the same one to anyone else.
+	if (lport == 0) {
+		sockaddr_in sin;
+		memset(&sin, 0, sizeof(sin));
+		sin.sin_family = AF_INET;
+		socklen_t len = sizeof(sin);
+		x.resfd = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+		if (x.resfd < 0
+				|| ::bind(x.resfd, (sockaddr*)&sin, sizeof(sin)) < 0
+				|| getsockname(x.resfd, (sockaddr*)&sin, &len) < 0) {
+			err = QString("Can't reserve a UDP port: %1")
+				.arg(strerror(errno));
+			return false;
+		}
+		lport = ntohs(sin.sin_port);
+	}
+
+	// Register UMEM and size the rings.
+	size_t umemsize = (size_t)numFrames * frameSize;
+	x.umem = (char*)mmap(NULL, umemsize, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (x.umem == MAP_FAILED) {
+		x.umem = NULL;
+		err = QString("Can't allocate UMEM: %1").arg(strerror(errno));
+		return false;
+	}
+
+	x.fd = ::socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+	if (x.fd < 0) {
+		err = QString("Can't create AF_XDP socket: %1")
+			.arg(strerror(errno));
+		return false;
+	}
+
+	xdp_umem_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.addr = (quint64)(quintptr)x.umem;
+	reg.len = umemsize;
+	reg.chunk_size = frameSize;
+	int rs = XDP_RING_SIZE;
+	xdp_mmap_offsets off;
+	socklen_t offlen = sizeof(off);
+	if (setsockopt(x.fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0
+	    || setsockopt(x.fd, SOL_XDP, XDP_UMEM_FILL_RING, &rs, sizeof(rs)) < 0
+	    || setsockopt(x.fd, SOL_XDP, XDP_UMEM_COMPLETION_RING,
+				&rs, sizeof(rs)) < 0
+	    || setsockopt(x.fd, SOL_XDP, XDP_RX_RING, &rs, sizeof(rs)) < 0
+	    || setsockopt(x.fd, SOL_XDP, XDP_TX_RING, &rs, sizeof(rs)) < 0
+	    || getsockopt(x.fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &offlen) < 0
+	    || !x.fill.init(x.fd, off.fr, sizeof(quint64),
+				XDP_UMEM_PGOFF_FILL_RING)
+	    || !x.comp.init(x.fd, off.cr, sizeof(quint64),
+				XDP_UMEM_PGOFF_COMPLETION_RING)
+	    || !x.rx.init(x.fd, off.rx, sizeof(xdp_desc), XDP_PGOFF_RX_RING)
+	    || !x.tx.init(x.fd, off.tx, sizeof(xdp_desc), XDP_PGOFF_TX_RING)) {
+		err = QString("Can't set up AF_XDP rings: %1")
+			.arg(strerror(errno));
+		return false;
+	}
+
+	// Hand the kernel the receive half of UMEM,
+	// and keep the transmit half for ourselves.
+	for (int i = 0; i < numFrames / 2; i++)
+		x.fill.addr(x.fill.prod++) = (quint64)i * frameSize;
+	x.fill.publishProducer();
+	x.txfree.reserve(numFrames / 2);
+	for (int i = numFrames / 2; i < numFrames; i++)
+		x.txfree.append((quint64)i * frameSize);
+
+	sockaddr_xdp sxdp;
+	memset(&sxdp, 0, sizeof(sxdp));
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = x.ifindex;
+	sxdp.sxdp_queue_id = queue;
+	if (::bind(x.fd, (sockaddr*)&sxdp, sizeof(sxdp)) < 0) {
+		err = QString("Can't bind AF_XDP socket to %1 queue %2: %3")
+			.arg(ifname).arg(queue).arg(strerror(errno));
+		return false;
+	}
+
+	// Point the map entry for our queue at the socket.
+	bpf_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof(quint32);
+	attr.value_size = sizeof(quint32);
+	attr.max_entries = queue + 1;
+	x.mapfd = bpfCall(BPF_MAP_CREATE, &attr);
+	quint32 key = queue, val = x.fd;
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = x.mapfd;
+	attr.key = (quint64)(quintptr)&key;
+	attr.value = (quint64)(quintptr)&val;
+	if (x.mapfd < 0 || bpfCall(BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+		err = QString("Can't create XSKMAP: %1").arg(strerror(errno));
+		return false;
+	}
+
+	XdpProgram prog(x.mapfd, saddr, lport);
+	x.progfd = prog.load(err);
+	if (x.progfd < 0)
+		return false;
+
+	// Attach in the driver if it supports XDP, else generically.
+	static const quint32 modes[] = { XDP_FLAGS_DRV_MODE, XDP_FLAGS_SKB_MODE };
+	for (int i = 0; i < 2 && x.linkfd < 0; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.link_create.prog_fd = x.progfd;
+		attr.link_create.target_ifindex = x.ifindex;
+		attr.link_create.attach_type = BPF_XDP;
+		attr.link_create.flags = modes[i];
+		x.linkfd = bpfCall(BPF_LINK_CREATE, &attr);
+		x.native = (i == 0);
+	}
+	if (x.linkfd < 0) {
+		err = QString("Can't attach XDP program to %1: %2")
+			.arg(ifname).arg(strerror(errno));
+		return false;
+	}
+
+	x.notifier = new QSocketNotifier(x.fd, QSocketNotifier::Read);
+	connect(x.notifier, SIGNAL(activated(int)),
+		this, SLOT(xskReadyRead()));
+	return true;
+}
+
+// Find our interface's default gateway in the kernel's routing table,
+// which lists addresses as raw network-order words in hex.
+void XdpSocket::findGateway()
+{
+	FILE *f = fopen("/proc/net/route", "r");
+	if (!f)
+		return;
+	QByteArray name = ifname.toLocal8Bit();
+	char line[256], dev[IFNAMSIZ+1];
+	unsigned dst, gw, flags, mask;
+	int metric, best = -1;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%16s %x %x %x %*d %*d %d %x",
+				dev, &dst, &gw, &flags, &metric, &mask) != 6
+				|| name != dev)
+			continue;
+		if (dst == 0 && mask == 0 && (flags & 0x2)	// RTF_GATEWAY
+				&& (best < 0 || metric < best)) {
+			x->gwaddr = gw;
+			best = metric;
+		}
+	}
+	fclose(f);
+}
+
+// Find the Ethernet address of the next hop toward @a daddr,
+// consulting the kernel's neighbor table for addresses we don't know.
+bool XdpSocket::resolve(quint32 daddr, quint64 &mac)
+{
+	XdpState &x = *this->x;
+	QHash<quint32, quint64>::const_iterator i = x.macs.find(daddr);
+	if (i != x.macs.end()) {
+		mac = *i;
+		return true;
+	}
+
+	quint32 hop = daddr;
+	if ((daddr & x.netmask) != x.netaddr) {
+		if (x.gateway) {
+			mac = x.gateway;
+			return true;
+		}
+		hop = x.gwaddr;
+		if (hop == 0)
+			return false;
+		if ((i = x.macs.find(hop)) != x.macs.end()) {
+			mac = *i;
+			return true;
+		}
+	}
+
+	// Only complete entries (ATF_COM) for our own interface will do.
+	FILE *f = fopen("/proc/net/arp", "r");
+	if (!f)
+		return false;
+	QByteArray name = ifname.toLocal8Bit();
+	char line[256], ipstr[32], hwstr[32], dev[IFNAMSIZ+1];
+	unsigned flags;
+	bool found = false;
+	while (!found && fgets(line, sizeof(line), f)) {
+		unsigned b[6];
+		in_addr ia;
+		if (sscanf(line, "%31s %*x %x %31s %*s %16s",
+				ipstr, &flags, hwstr, dev) != 4
+				|| !(flags & 0x2) || name != dev
+				|| inet_pton(AF_INET, ipstr, &ia) != 1
+				|| ia.s_addr != hop
+				|| sscanf(hwstr, "%x:%x:%x:%x:%x:%x", &b[0],
+					&b[1], &b[2], &b[3], &b[4], &b[5]) != 6)
+			continue;
+		quint8 hw[6];
+		for (int j = 0; j < 6; j++)
+			hw[j] = b[j];
+		mac = 0;
+		memcpy(&mac, hw, 6);
+		found = true;
+	}
+	fclose(f);
+
+	if (found && x.macs.size() < XDP_MACS_MAX)
+		x.macs.insert(hop, mac);
+	return found;
+}
+#endif	// SST_XDP
+
+void XdpSocket::detach()
+{
+#ifdef SST_XDP
+	if (!x)
+		return;
+	delete x;
+	x = NULL;
+	setActive(false);
+#endif
+}
+
+void XdpSocket::setGateway(const QByteArray &mac)
+{
+#ifdef SST_XDP
+	Q_ASSERT(mac.size() == 6);
+	if (x)
+		memcpy(&x->gateway, mac.constData(), 6);
+#else
+	(void)mac;
+#endif
+}
+
+bool XdpSocket::isNativeMode() const
+{
+#ifdef SST_XDP
+	return x && x->native;
+#else
+	return false;
+#endif
+}
+
+bool XdpSocket::isZeroCopy() const
+{
+#if defined(SST_XDP) && defined(XDP_OPTIONS)
+	xdp_options opts;
+	socklen_t len = sizeof(opts);
+	return x && getsockopt(x->fd, SOL_XDP, XDP_OPTIONS, &opts, &len) == 0
+		&& (opts.flags & XDP_OPTIONS_ZEROCOPY);
+#else
+	return false;
+#endif
+}
+
+int XdpSocket::pathMtu(const Endpoint &)
+{
+#ifdef SST_XDP
+	if (x)
+		return qMin(x->mtu, frameSize - 14);
+#endif
+	return 0;
+}
+
+void XdpSocket::peerAuthenticated(const Endpoint &ep)
+{
+#ifdef SST_XDP
+	if (!x || ep.addr.protocol() != QAbstractSocket::IPv4Protocol)
+		return;
+	quint32 addr = htonl(ep.addr.toIPv4Address());
+	QHash<quint32, quint64>::iterator i = x->heard.find(addr);
+	if (i == x->heard.end())
+		return;
+	quint64 mac = *i;
+	x->heard.erase(i);
+	QHash<quint32, quint64>::iterator j = x->macs.find(addr);
+	if (j != x->macs.end())
+		*j = mac;
+	else if (x->macs.size() < XDP_MACS_MAX)
+		x->macs.insert(addr, mac);
+#else
+	(void)ep;
+#endif
+}
+
+QList<Endpoint> XdpSocket::localEndpoints()
+{
+	QList<Endpoint> eps;
+	if (active())
+		eps.append(Endpoint(laddr, lport));
+	return eps;
+}
+
+bool XdpSocket::send(const Endpoint &ep, const char *data, int size)
+{
+#ifdef SST_XDP
+	if (!x || ep.addr.protocol() != QAbstractSocket::IPv4Protocol)
+		return false;
+	XdpState &x = *this->x;
+	if (size > x.mtu - 20 - 8 || size > frameSize - hdrLen) {
+		// e.g., a path MTU probe too big for the link
+		err = "Message too long";
+		return false;
+	}
+
+	// Find the next hop's Ethernet address;
+	// guessing, e.g. broadcasting, would leak our traffic.
+	quint32 daddr = htonl(ep.addr.toIPv4Address());
+	quint64 dmac;
+	if (!resolve(daddr, dmac)) {
+		err = "No Ethernet address for next hop";
+		return false;
+	}
+
+	// Get a transmit frame, reclaiming completed ones if we're out.
+	if (x.txfree.isEmpty())
+		reclaim();
+	if (x.txfree.isEmpty()) {
+		kick();
+		reclaim();
+		if (x.txfree.isEmpty()) {
+			err = "AF_XDP transmit ring full";
+			return false;
+		}
+	}
+	quint64 addr = x.txfree.last();
+	x.txfree.pop_back();
+	uchar *f = (uchar*)x.umem + addr;
+
+	// Ethernet header
+	memcpy(f, &dmac, 6);
+	memcpy(f + 6, x.mac, 6);
+	qToBigEndian<quint16>(0x0800, f + 12);
+
+	// IPv4 header, with Don't Fragment set as UdpSocket does
+	uchar *ip = f + 14;
+	ip[0] = 0x45;
+	ip[1] = ecnCapable() ? EcnEct0 : EcnNotEct;
+	qToBigEndian<quint16>(20 + 8 + size, ip + 2);
+	qToBigEndian<quint16>(0, ip + 4);
+	qToBigEndian<quint16>(0x4000, ip + 6);
+	ip[8] = 64;
+	ip[9] = IPPROTO_UDP;
+	qToBigEndian<quint16>(0, ip + 10);
+	qToBigEndian<quint32>(laddr.toIPv4Address(), ip + 12);
+	memcpy(ip + 16, &daddr, 4);
+	quint32 sum = 0;
+	for (int i = 0; i < 20; i += 2)
+		sum += qFromBigEndian<quint16>(ip + i);
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum += sum >> 16;
+	qToBigEndian<quint16>(~sum, ip + 10);
+
+	// UDP header, leaving the checksum out as IPv4 permits;
+	// SST authenticates its packets end to end anyway.
+	uchar *udp = ip + 20;
+	qToBigEndian<quint16>(lport, udp);
+	qToBigEndian<quint16>(ep.port, udp + 2);
+	qToBigEndian<quint16>(8 + size, udp + 4);
+	qToBigEndian<quint16>(0, udp + 6);
+
+	memcpy(f + hdrLen, data, size);
+
+	xdp_desc &d = x.tx.desc(x.tx.prod++);
+	d.addr = addr;
+	d.len = hdrLen + size;
+	d.options = 0;
+	x.txheld++;
+	st.txpackets++;
+
+	// Outside a batch, send it right away.
+	if (!inBatch())
+		flushBatch();
+	return true;
+#else
+	(void)ep; (void)data; (void)size;
+	return false;
+#endif
+}
+
+void XdpSocket::flushBatch()
+{
+#ifdef SST_XDP
+	if (!x || x->txheld == 0)
+		return;
+	x->tx.publishProducer();
+	x->txheld = 0;
+	kick();
+	reclaim();
+#endif
+}
+
+// Tell the kernel there's something to transmit.
+void XdpSocket::kick()
+{
+#ifdef SST_XDP
+	st.txcalls++;
+	if (sendto(x->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0
+			&& errno != EAGAIN && errno != EBUSY
+			&& errno != ENOBUFS && errno != ENETDOWN)
+		qDebug() << this << "kick:" << strerror(errno);
+#endif
+}
+
+// Take back transmit frames the kernel is done with.
+void XdpSocket::reclaim()
+{
+#ifdef SST_XDP
+	XdpRing &comp = x->comp;
+	quint32 prod = comp.kernelProducer();
+	if (comp.cons == prod)
+		return;
+	while (comp.cons != prod)
+		x->txfree.append(comp.addr(comp.cons++));
+	comp.publishConsumer();
+#endif
+}
+
+void XdpSocket::xskReadyRead()
+{
+#ifdef SST_XDP
+	XdpState &x = *this->x;
+	XdpRing &rx = x.rx;
+	PacketPool &pool = host()->packetPool();
+	SocketEndpoint src;
+	src.sock = this;
+
+	// Send any responses we generate (e.g., ACKs) as one batch too.
+	SocketBatch txbatch(this);
+
+	st.rxcalls++;
+	quint32 prod = rx.kernelProducer();
+	while (rx.cons != prod) {
+		const xdp_desc &d = rx.desc(rx.cons++);
+		const uchar *f = (const uchar*)x.umem + d.addr;
+		const uchar *ip = f + 14;
+		const uchar *udp = ip + 20;
+
+		// Our XDP program only hands us IPv4 UDP without options,
+		// but the lengths are still the sender's to get wrong.
+		int size = qFromBigEndian<quint16>(udp + 4) - 8;
+		if (d.len >= (quint32)hdrLen && size >= 0
+				&& hdrLen + size <= (int)d.len) {
+
+			// Note where the sender's packet came from,
+			// but only trust it once a flow authenticates it.
+			quint32 saddr;
+			memcpy(&saddr, ip + 12, 4);
+			quint64 smac = 0;
+			memcpy(&smac, f + 6, 6);
+			if (x.heard.size() >= XDP_HEARD_MAX
+					&& !x.heard.contains(saddr))
+				x.heard.clear();
+			x.heard.insert(saddr, smac);
+
+			src.addr.setAddress(ntohl(saddr));
+			src.port = qFromBigEndian<quint16>(udp);
+
+			QByteArray msg = pool.alloc(qMax(size, 1));
+			memcpy(msg.data(), f + hdrLen, size);
+			msg.resize(size);
+			st.rxpackets++;
+			receive(msg, src, ip[1] & 3);
+			pool.release(msg);
+		}
+
+		// Recycle the frame.
+		x.fill.addr(x.fill.prod++) = d.addr & ~(quint64)(frameSize - 1);
+	}
+	rx.publishConsumer();
+	x.fill.publishProducer();
+#endif
+}
@@ -0,0 +1,156 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+//
+// Kernel-bypass socket using Linux AF_XDP rings.
+//
+#ifndef SST_XDP_H
+#define SST_XDP_H
+
+#include <QHostAddress>
+
+#include "sock.h"
+
+// AF_XDP needs Linux 5.9 or later for the calls we use.
+#if defined(__linux__)
+#define SST_XDP		1
+#endif
+
+
+namespace SST {
+
+struct XdpState;
+
+
+/** Socket implementation that sends and receives UDP datagrams
+ * on one queue of a network interface through an AF_XDP socket,
+ * bypassing the kernel's network stack.
+ * The socket attaches a small XDP program to the interface
+ * that redirects IPv4 UDP datagrams for its own port to the socket,
+ * and passes everything else on to the regular stack,
+ * which continues to handle ARP, other ports, and so on.
+ * The socket frames outgoing datagrams itself,
+ * addressing each to the Ethernet address from which the peer's
+ * last authenticated packet arrived, or else to the next hop's
+ * entry in the kernel's neighbor (ARP) table: the peer itself
+ * if on the interface's subnet, otherwise the default gateway.
+ * Sends to a peer with neither fail, so an on-link peer
+ * we initiate to must already be known to the kernel.
+ *
+ * Only one XdpSocket may use a given interface at a time,
+ * and it only sees traffic arriving on its own receive queue,
+ * so on a multi-queue NIC the application must steer its port
+ * to that queue (e.g., with ethtool), or use a single queue.
+ * A veth pair is enough to try it out on a stock Linux box.
+ */
+class XdpSocket : public Socket
+{
+	Q_OBJECT
+
+public:
+	/// Number of UMEM frames: half for receiving, half for sending.
+	static const int numFrames = 4096;
+
+	/// Bytes per UMEM frame, bounding the largest frame we handle.
+	static const int frameSize = 4096;
+
+	/// Ethernet, IPv4, and UDP header bytes on each frame.
+	static const int hdrLen = 14 + 20 + 8;
+
+	/// Same counters as UdpSocket keeps.
+	/// Receive "calls" count wakeups, since receiving needs none,
+	/// and transmit calls count the kicks that start transmission.
+	typedef UdpSocket::Stats Stats;
+
+private:
+	const QString ifname;	// Interface to attach to
+	const int queue;	// Interface receive queue to bind to
+	XdpState *x;		// Rings and program, while bound
+	QHostAddress laddr;	// Local IPv4 address we send from
+	quint16 lport;		// Local UDP port we receive on
+	QString err;		// Last error description
+	Stats st;
+
+public:
+	/** Create an XdpSocket for a network interface.
+	 * @param ifname the interface name, e.g., "eth0".
+	 * @param queue the interface receive queue to attach to. */
+	XdpSocket(SocketHostState *host, const QString &ifname,
+		int queue = 0, QObject *parent = NULL);
+	~XdpSocket();
+
+	/** Attach to the interface and start receiving
+	 * datagrams sent to @a addr and @a port.
+	 * If @a addr is QHostAddress::Any, we send from
+	 * the interface's own IPv4 address.
+	 * If @a port is 0, reserves an unused port from the OS.
+	 * Requires CAP_NET_ADMIN and CAP_BPF, or root.
+	 * The @a mode is ignored. */
+	bool bind(const QHostAddress &addr = QHostAddress::Any,
+		quint16 port = 0,
+		QUdpSocket::BindMode mode = QUdpSocket::DefaultForPlatform);
+
+	bool send(const Endpoint &ep, const char *data, int size);
+
+	QList<Endpoint> localEndpoints();
+	quint16 localPort() { return lport; }
+	inline QString errorString() { return err; }
+
+	/** Set the Ethernet address to send to for off-link peers
+	 * we haven't yet heard from, normally the next-hop router's,
+	 * instead of looking up the default gateway's in the kernel. */
+	void setGateway(const QByteArray &mac);
+
+	/// Returns true if the XDP program runs in the driver
+	/// rather than in the generic, slower, skb-based mode.
+	bool isNativeMode() const;
+
+	/// Returns true if the kernel shares UMEM with the NIC directly
+	/// rather than copying frames in and out of it.
+	bool isZeroCopy() const;
+
+	/// Return the socket's counters.
+	inline const Stats &stats() const { return st; }
+	inline void resetStats() { st = Stats(); }
+
+	/// Returns the interface MTU, which no path may exceed.
+	virtual int pathMtu(const Endpoint &ep);
+
+	/// Trusts the Ethernet address the peer's last packet came from.
+	virtual void peerAuthenticated(const Endpoint &ep);
+
+protected:
+	virtual void flushBatch();
+
+private:
+	bool attach(quint32 saddr);
+	void detach();
+	void findGateway();
+	bool resolve(quint32 daddr, quint64 &mac);
+	void reclaim();
+	void kick();
+
+private slots:
+	void xskReadyRead();
+};
+
+
+} // namespace SST
+
+#endif	// SST_XDP_H
@@ -0,0 +1,137 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <netinet/in.h>
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QtDebug>
+
+#include "xdp.h"
+
+#include "main.h"
+#include "afxdp.h"
+
+using namespace SST;
+
+
+// Addresses the two ends use; XDP bypasses routing,
+// so the interfaces themselves need no addresses.
+#define XDP_SND_ADDR	"10.99.0.1"
+#define XDP_RCV_ADDR	"10.99.0.2"
+#define XDP_PORT	8661
+
+
+XdpBench::XdpBench()
+:	SocketReceiver(&rcv),
+	ssock(NULL),
+	rsock(NULL),
+	nrecv(0)
+{
+	bind(benchMagic);
+}
+
+XdpBench::~XdpBench()
+{
+	delete ssock;
+	delete rsock;
+	unbind();
+}
+
+bool XdpBench::attach()
+{
+	// The veth pair's names come from SST_XDP_PAIR if set.
+	QString pair = getenv("SST_XDP_PAIR");
+	QStringList ifs = (pair.isEmpty() ? QString("sstxdp0,sstxdp1") : pair)
+				.split(",");
+	if (ifs.size() != 2)
+		qFatal("SST_XDP_PAIR should be <ifname>,<ifname>");
+
+	ssock = new XdpSocket(&snd, ifs[0]);
+	rsock = new XdpSocket(&rcv, ifs[1]);
+	if (!ssock->bind(QHostAddress(XDP_SND_ADDR), XDP_PORT)) {
+		printf(" Can't attach to %s: %s\n", ifs[0].toLocal8Bit().data(),
+			ssock->errorString().toLocal8Bit().data());
+		return false;
+	}
+	if (!rsock->bind(QHostAddress(XDP_RCV_ADDR), XDP_PORT)) {
+		printf(" Can't attach to %s: %s\n", ifs[1].toLocal8Bit().data(),
+			rsock->errorString().toLocal8Bit().data());
+		return false;
+	}
+	printf(" %s mode, %s\n",
+		rsock->isNativeMode() ? "Native" : "Generic",
+		rsock->isZeroCopy() ? "zero-copy" : "copying");
+	return true;
+}
+
+void XdpBench::receive(QByteArray &, XdrStream &, const SocketEndpoint &)
+{
+	nrecv++;
+}
+
+void XdpBench::trial()
+{
+	ssock->resetStats();
+	rsock->resetStats();
+	rcv.packetPool().resetStats();
+	nrecv = 0;
+
+	QByteArray pkt(pktSize, 0);
+	*(quint32*)pkt.data() = htonl(benchMagic);
+	Endpoint dst(QHostAddress(XDP_RCV_ADDR), XDP_PORT);
+
+	qint64 start = benchTime();
+	for (int sent = 0; sent < totalPkts; sent += burstSize) {
+		ssock->beginBatch();
+		for (int i = 0; i < burstSize; i++)
+			ssock->send(dst, pkt);
+		ssock->endBatch();
+
+		QCoreApplication::processEvents();
+	}
+
+	// Drain whatever is still in flight.
+	quint64 last;
+	do {
+		last = nrecv;
+		QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+	} while (nrecv != last);
+	qint64 elapsed = benchTime() - start;
+
+	const XdpSocket::Stats &ts = ssock->stats();
+	const XdpSocket::Stats &rs = rsock->stats();
+	report("packets sent", ts.txpackets, "pkts");
+	report("packets received", nrecv, "pkts");
+	report("receive rate", nrecv * 1000000.0 / elapsed, "pkts/sec");
+	report("transmit kicks per packet",
+		(double)ts.txcalls / qMax(ts.txpackets, (quint64)1), "");
+	report("receive wakeups per packet",
+		(double)rs.rxcalls / qMax(rs.rxpackets, (quint64)1), "");
+}
+
+void XdpBench::run()
+{
+	XdpBench b;
+	if (b.attach())
+		b.trial();
+}
@@ -0,0 +1,68 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#ifndef AFXDP_H
+#define AFXDP_H
+
+#include "host.h"
+
+namespace SST {
+
+class XdpSocket;
+
+
+// Measures packets per second between two XdpSockets
+// attached to the two ends of a veth pair, for comparison
+// with UdpBench's loopback figures.
+// Needs root, and the pair set up as described in the README.
+class XdpBench : public SocketReceiver
+{
+	Q_OBJECT
+
+	// Control packet magic for benchmark traffic ('BNC')
+	static const quint32 benchMagic = 0x00424e43;
+
+	static const int pktSize = 1200;	// Bytes per datagram
+	static const int burstSize = 32;	// Datagrams per send burst
+	static const int totalPkts = 1000000;	// Datagrams per trial
+
+	Host snd, rcv;
+	XdpSocket *ssock, *rsock;
+	quint64 nrecv;
+
+public:
+	XdpBench();
+	~XdpBench();
+
+	// Attach to the veth pair, returning false if we can't.
+	bool attach();
+
+	void trial();
+
+	static void run();
+
+protected:
+	virtual void receive(QByteArray &msg, XdrStream &ds,
+				const SocketEndpoint &src);
+};
+
+
+} // namespace SST
+
+#endif	// AFXDP_H
@@ -0,0 +1,107 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+
+#include <QThread>
+#include <QCoreApplication>
+
+#include "flow.h"
+#include "key.h"
+#include "armor.h"
+#include "main.h"
+
+using namespace SST;
+
+
+////////// ArmorBench //////////
+
+ArmorBench::ArmorBench()
+:	ndone(0)
+{
+}
+
+void ArmorBench::armorTxDone(quint64, QByteArray &epkt)
+{
+	ndone++;
+	pool.release(epkt);
+}
+
+void ArmorBench::armorRxDone(quint64, QByteArray &, int)
+{
+	Q_ASSERT(0);	// we only encrypt
+}
+
+// Push pktsPerTrial packets through a pipeline and return Gb/s
+double ArmorBench::trial(FlowArmor *armor, int nthreads)
+{
+	ArmorPipeline pipe(nthreads);
+	QByteArray pkt(pktSize, 'x');
+
+	ndone = 0;
+	int nsent = 0;
+	qint64 start = benchTime();
+	while (ndone < pktsPerTrial) {
+		while (nsent < pktsPerTrial && nsent - ndone < window) {
+			QByteArray epkt = pool.alloc(pktSize);
+			pipe.submitTx(this, armor, nsent++, pkt, epkt);
+		}
+		QCoreApplication::processEvents();
+	}
+	qint64 elapsed = qMax(benchTime() - start, (qint64)1);
+
+	return (double)pktsPerTrial * pktSize * 8 / elapsed / 1000.0;
+}
+
+void ArmorBench::run()
+{
+	QByteArray key16(16, 'k'), key32(32, 'k');
+	struct {
+		const char *name;
+		FlowArmor *armor;
+	} armors[] = {
+		{ "AES-CTR+HMAC", new AESArmor(key16, key32, key16, key32) },
+		{ "AES-128-GCM",
+			new AEADArmor(KEYMETH_AESGCM, key16, key16) },
+		{ "ChaCha20-Poly1305",
+			AEADArmor::isSupported(KEYMETH_CHACHA)
+			? new AEADArmor(KEYMETH_CHACHA, key32, key32) : NULL },
+	};
+
+	ArmorBench b;
+	int maxthreads = qMax(QThread::idealThreadCount(), 1);
+	for (unsigned i = 0; i < sizeof(armors)/sizeof(armors[0]); i++) {
+		if (armors[i].armor == NULL)
+			continue;
+		printf(" %s, %d-byte packets:\n", armors[i].name, pktSize);
+
+		for (int n = 0; n <= maxthreads; n = n ? n * 2 : 1) {
+			char what[64];
+			if (n == 0)
+				snprintf(what, sizeof(what), "inline");
+			else
+				snprintf(what, sizeof(what), "%d worker thread%s",
+					n, n > 1 ? "s" : "");
+			report(what, b.trial(armors[i].armor, n), "Gb/s");
+		}
+		delete armors[i].armor;
+	}
+}
+
@@ -0,0 +1,54 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#ifndef ARMOR_H
+#define ARMOR_H
+
+#include "armorpipe.h"
+#include "pkt.h"
+
+namespace SST {
+
+
+// Measures FlowArmor encryption throughput through an ArmorPipeline
+// with zero (inline) up to one worker thread per available core.
+class ArmorBench : public ArmorClient
+{
+	static const int pktSize = 1200;	// Typical flow packet size
+	static const int window = 4096;		// Max packets in the pipeline
+	static const int pktsPerTrial = 500000;
+
+	PacketPool pool;
+	int ndone;
+
+	ArmorBench();
+
+	double trial(FlowArmor *armor, int nthreads);
+
+	virtual void armorTxDone(quint64 pktseq, QByteArray &epkt);
+	virtual void armorRxDone(quint64 pktseq, QByteArray &pkt, int ecn);
+
+public:
+	static void run();
+};
+
+
+} // namespace SST
+
+#endif	// ARMOR_H
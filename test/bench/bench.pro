@@ -0,0 +1,19 @@
+
+TEMPLATE = app
+TARGET = sstbench
+DESTDIR = .
+LIBS += -L../.. -lsst_test -lsst
+DEPENDPATH += . ../../lib ../lib
+INCLUDEPATH += . ../../lib ../lib
+QT = core network
+POST_TARGETDEPS += ../../libsst.* ../../libsst_test.*
+CONFIG -= app_bundle
+
+# Include variables filled in by the configure script
+!include(../../top.pri) {
+        error("top.pri not found - please run configure at top level.")
+}
+
+# Input sources
+HEADERS += main.h udp.h chksum.h armor.h txring.h cc.h evloop.h sharded.h afxdp.h local.h demux.h
+SOURCES += main.cc udp.cc chksum.cc armor.cc txring.cc cc.cc evloop.cc sharded.cc afxdp.cc local.cc demux.cc
@@ -0,0 +1,432 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+
+#include <QtAlgorithms>
+
+#include "host.h"
+#include "cc.h"
+#include "main.h"
+#include "strm/peer.h"
+
+using namespace SST;
+
+
+static const QHostAddress cliaddr("1.2.3.4");
+static const QHostAddress srvaddr("4.3.2.1");
+
+
+////////// CCBench //////////
+
+CCBench::CCBench(Simulator *sim, CCMode mode, int opts,
+		const LinkParams &params, CCBench *share, int paths)
+:	sim(sim),
+	clihost(sim),
+	srvhost(sim),
+	cli(&clihost),
+	srv(&srvhost),
+	srvs(NULL),
+	opts(opts),
+	sendtimer(&clihost),
+	stoptimer(&clihost),
+	recvtot(0), recvcnt(0), delaytot(0), mindelay(-1)
+{
+	bool ecn = opts & Ecn;
+	clihost.setDefaultCCMode(mode);
+	srvhost.setDefaultCCMode(mode);
+	clihost.setDefaultTxPacing(opts & Pacing);
+	srvhost.setDefaultTxPacing(opts & Pacing);
+	clihost.setDefaultEcnEcho(ecn);
+	srvhost.setDefaultEcnEcho(ecn);
+	clihost.setDefaultCoupledCC(opts & Coupled);
+	clihost.setDefaultAckFrequency(opts & AckFreq);
+	srvhost.setDefaultAckFrequency(opts & AckFreq);
+	clihost.setDefaultForwardErrorCorrection(opts & Fec);
+	srvhost.setDefaultForwardErrorCorrection(opts & Fec);
+
+	// Run additional paths from additional client sockets,
+	// all crossing the same link to the same server address.
+	for (int i = 1; i < paths; i++) {
+		Socket *sock = clihost.newSocket((SocketHostState*)&clihost);
+		if (!sock->bind())
+			qFatal("Can't bind additional client socket");
+	}
+	if (paths > 1)
+		clihost.streamPeer(srvhost.hostIdent().id())
+			->setMultipath(true);
+
+	foreach (Socket *sock, clihost.activeSockets())
+		sock->setEcnCapable(ecn);
+	foreach (Socket *sock, srvhost.activeSockets())
+		sock->setEcnCapable(ecn);
+
+	link.setLinkParams(params);
+	link.connect(&clihost, cliaddr, &srvhost, srvaddr);
+	if (share)
+		link.shareQueue(&share->link);
+
+	connect(&srv, SIGNAL(newConnection()),
+		this, SLOT(srvConnection()));
+	if (!srv.listen("bench", "SST benchmark server",
+			"cc", "Congestion control benchmark protocol"))
+		qFatal("Can't listen on service name");
+
+	cli.connectTo(srvhost.hostIdent(), "bench", "cc");
+	cli.connectAt(Endpoint(srvaddr, NETSTERIA_DEFAULT_PORT));
+	if (opts & Periodic) {
+		connect(&sendtimer, SIGNAL(timeout(bool)),
+			this, SLOT(sendTimeout()));
+		sendTimeout();
+	} else {
+		connect(&cli, SIGNAL(readyWrite()),
+			this, SLOT(cliReadyWrite()));
+		cliReadyWrite();
+	}
+
+	connect(&stoptimer, SIGNAL(timeout(bool)), this, SLOT(stopTimeout()));
+	stoptimer.start((qint64)runTime * 1000000);
+}
+
+void CCBench::cliReadyWrite()
+{
+	// Keep the stream's transmit buffer full of timestamped messages
+	qint64 stamp = sim->currentTime().usecs;
+	QByteArray buf((char*)&stamp, sizeof(stamp));
+	buf.resize(msgSize);
+	cli.writeMessage(buf);
+}
+
+// Send one message per sendInterval, to measure message latency
+// unclouded by queueing behind the sender's own backlog.
+void CCBench::sendTimeout()
+{
+	sendtimer.stop();
+	cliReadyWrite();
+	sendtimer.start(sendInterval);
+}
+
+void CCBench::srvConnection()
+{
+	Q_ASSERT(srvs == NULL);
+	srvs = srv.accept();
+	if (!srvs)
+		return;
+
+	srvs->listen(Stream::Unlimited);
+	connect(srvs, SIGNAL(readyReadMessage()), this, SLOT(srvMessage()));
+}
+
+void CCBench::srvMessage()
+{
+	forever {
+		QByteArray buf = srvs->readMessage();
+		if (buf.isNull())
+			return;
+
+		qint64 delay = sim->currentTime().usecs
+				- *(const qint64*)buf.constData();
+		recvtot += buf.size();
+		recvcnt++;
+		delaytot += delay;
+		if (mindelay < 0 || delay < mindelay)
+			mindelay = delay;
+		if (opts & Periodic)
+			delays.append(delay);
+	}
+}
+
+void CCBench::stopTimeout()
+{
+	sim->stop();
+}
+
+void CCBench::report(const char *name)
+{
+	char what[64];
+	snprintf(what, sizeof(what), "%s goodput", name);
+	SST::report(what, recvtot * 8.0 / runTime / 1000000.0, "Mbps");
+
+	// Queueing delay is measured against the smallest delay seen,
+	// which approximates the propagation plus transmission delay.
+	double qdelay = recvcnt ? (double)delaytot / recvcnt - mindelay : 0;
+	snprintf(what, sizeof(what), "%s queueing delay", name);
+	SST::report(what, qdelay / 1000.0, "ms");
+}
+
+void CCBench::runScenario(const char *name, const LinkParams &params)
+{
+	static const struct {
+		CCMode mode;
+		int opts;
+		const char *name;
+	} modes[] = {
+		{ CC_TCP, 0, "TCP" },
+		{ CC_TCP, Pacing, "Paced TCP" },
+		{ CC_TCP, Pacing | Ecn, "TCP+ECN" },
+		{ CC_VEGAS, 0, "Vegas" },
+		{ CC_BBR, Pacing, "BBR" },
+		{ CC_DCTCP, Pacing | Ecn, "DCTCP" },
+		{ CC_CUBIC, Pacing, "CUBIC" },
+		{ CC_LEDBAT, Pacing, "LEDBAT" },
+	};
+
+	printf(" %s: %.1f Mbps, %.1f ms delay, %.2f ms queue, "
+		"%.1f%% loss, %.1f ms jitter, %.1f%% reordered\n",
+		name, params.rate * 8.0 / 1000000.0, params.delay / 1000.0,
+		params.qlen / 1000.0, params.loss * 100.0,
+		params.jitter / 1000.0, params.reorder * 100.0);
+
+	for (unsigned i = 0; i < sizeof(modes)/sizeof(modes[0]); i++) {
+		Simulator sim;
+		CCBench b(&sim, modes[i].mode, modes[i].opts, params);
+		sim.run();
+		b.report(modes[i].name);
+	}
+}
+
+// Run a background transfer against a CC_TCP transfer
+// across the same bottleneck, to see how much each one gets:
+// a scavenger should leave nearly all of the bandwidth to TCP,
+// yet use whatever TCP leaves idle.
+void CCBench::runCompeting(const char *name, const LinkParams &params)
+{
+	static const struct {
+		CCMode mode;
+		const char *name;
+	} modes[] = {
+		{ CC_TCP, "TCP" },
+		{ CC_LEDBAT, "LEDBAT" },
+	};
+
+	printf(" %s: %.1f Mbps, %.1f ms delay, %.2f ms queue, "
+		"shared with TCP\n",
+		name, params.rate * 8.0 / 1000000.0, params.delay / 1000.0,
+		params.qlen / 1000.0);
+
+	for (unsigned i = 0; i < sizeof(modes)/sizeof(modes[0]); i++) {
+		Simulator sim;
+		CCBench fg(&sim, CC_TCP, Pacing, params);
+		CCBench bg(&sim, modes[i].mode, Pacing, params, &fg);
+		sim.run();
+
+		char what[64];
+		snprintf(what, sizeof(what), "TCP vs %s: TCP", modes[i].name);
+		fg.report(what);
+		snprintf(what, sizeof(what), "TCP vs %s: %s",
+			modes[i].name, modes[i].name);
+		bg.report(what);
+	}
+}
+
+// Run a two-flow transfer against a single-flow CC_TCP transfer
+// across the same bottleneck.  Uncoupled, the two flows together
+// take about twice TCP's share; coupled, they should take about
+// as much as TCP does, and no more.
+void CCBench::runCoupled(const char *name, const LinkParams &params)
+{
+	printf(" %s: %.1f Mbps, %.1f ms delay, %.2f ms queue, "
+		"two flows shared with TCP\n",
+		name, params.rate * 8.0 / 1000000.0, params.delay / 1000.0,
+		params.qlen / 1000.0);
+
+	for (int coupled = 0; coupled < 2; coupled++) {
+		Simulator sim;
+		CCBench fg(&sim, CC_TCP, Pacing, params);
+		CCBench bg(&sim, CC_TCP, Pacing | (coupled ? Coupled : 0),
+				params, &fg, 2);
+		sim.run();
+
+		const char *how = coupled ? "Coupled" : "Uncoupled";
+		char what[64];
+		snprintf(what, sizeof(what), "TCP vs %s: TCP", how);
+		fg.report(what);
+		snprintf(what, sizeof(what), "TCP vs %s: two flows", how);
+		bg.report(what);
+	}
+}
+
+// Run a bulk transfer across a fast link with and without
+// ACK frequency negotiation, and report the ACK packets and the real
+// time the run took per megabyte delivered.  Simulating a packet
+// costs little next to armoring and processing it,
+// so the latter approximates the flows' CPU cost per byte.
+void CCBench::runAckFreq(const char *name, const LinkParams &params)
+{
+	printf(" %s: %.1f Mbps, %.1f ms delay\n",
+		name, params.rate * 8.0 / 1000000.0, params.delay / 1000.0);
+
+	for (int on = 0; on <= 1; on++) {
+		const char *mode = on ? "negotiated" : "fixed";
+		Simulator sim;
+		CCBench b(&sim, CC_TCP, on ? AckFreq : 0, params);
+
+		qint64 start = benchTime();
+		sim.run();
+		qint64 elapsed = benchTime() - start;
+
+		// The server's packets to the client are almost all ACKs.
+		double mb = b.recvtot / 1000000.0;
+		char what[64];
+		snprintf(what, sizeof(what), "%s ACKs", mode);
+		b.report(what);
+		snprintf(what, sizeof(what), "%s ACKs: ACK packets", mode);
+		SST::report(what, b.link.downLinkPackets() / mb, "pkts/MB");
+		snprintf(what, sizeof(what), "%s ACKs: run time", mode);
+		SST::report(what, elapsed / mb, "us/MB");
+	}
+}
+
+void CCBench::runAckFrequency()
+{
+	// Gigabit LAN, where a window holds a few dozen packets
+	LinkParams lan = SimLink(Eth1000).downLinkParams();
+	lan.loss = 0;
+	runAckFreq("Eth1000 LAN", lan);
+
+	// Gigabit WAN path, where a window holds thousands of packets
+	LinkParams wan = lan;
+	wan.delay = 20*1000;
+	wan.qlen = 20*1000;
+	runAckFreq("Eth1000 WAN", wan);
+}
+
+// Run bulk and periodic transfers across a link with increasing
+// random loss, with and without FEC.  Losses show up in the tail
+// of the latency distribution, so report the 99th percentile
+// along with the mean.
+void CCBench::runFec(const char *name, const LinkParams &base)
+{
+	static const float losses[] = { 0.01, 0.02, 0.05, 0.10 };
+	static const int nlosses = sizeof(losses) / sizeof(losses[0]);
+
+	printf(" %s: %.1f Mbps, %.1f ms delay\n",
+		name, base.rate * 8.0 / 1000000.0, base.delay / 1000.0);
+
+	for (int i = 0; i < nlosses; i++) {
+		LinkParams params = base;
+		params.loss = losses[i];
+
+		for (int on = 0; on <= 1; on++) {
+			char what[64];
+			const char *mode = on ? "FEC" : "no FEC";
+			int fec = on ? Fec : 0;
+
+			Simulator bulksim;
+			CCBench bulk(&bulksim, CC_TCP, fec, params);
+			bulksim.run();
+			snprintf(what, sizeof(what), "%.0f%% loss, %s: goodput",
+				losses[i] * 100, mode);
+			SST::report(what,
+				bulk.recvtot * 8.0 / runTime / 1000000.0,
+				"Mbps");
+
+			Simulator msgsim;
+			CCBench msgs(&msgsim, CC_TCP, fec | Periodic, params);
+			msgsim.run();
+			QVector<qint64> &d = msgs.delays;
+			if (d.isEmpty())
+				continue;
+			qSort(d);
+			snprintf(what, sizeof(what),
+				"%.0f%% loss, %s: mean latency",
+				losses[i] * 100, mode);
+			SST::report(what,
+				(double)msgs.delaytot / d.size() / 1000.0, "ms");
+			snprintf(what, sizeof(what),
+				"%.0f%% loss, %s: 99th pct latency",
+				losses[i] * 100, mode);
+			SST::report(what, d[d.size() * 99 / 100] / 1000.0, "ms");
+		}
+	}
+}
+
+void CCBench::runForwardErrorCorrection()
+{
+	// Geostationary satellite link
+	runFec("Sat10", SimLink(Sat10).downLinkParams());
+
+	// Cellular backhaul: moderate rate and delay
+	LinkParams cell = SimLink(Cable5).downLinkParams();
+	cell.delay = 40*1000;
+	runFec("Cellular", cell);
+}
+
+void CCBench::run()
+{
+	// Deep-buffered WAN path, where loss-based CC fills the queue
+	LinkParams deep = SimLink(Eth10).downLinkParams();
+	deep.delay = 40*1000;
+	deep.qlen = 1000*1000;
+	deep.loss = 0;
+	runScenario("Deep-buffered WAN", deep);
+
+	// Long fat path, where TCP's additive increase takes
+	// minutes to refill the pipe after each loss
+	LinkParams fat = SimLink(Eth1000).downLinkParams();
+	fat.delay = 50*1000;
+	fat.qlen = 20*1000;
+	fat.loss = 0.0001;
+	runScenario("High-BDP WAN", fat);
+
+	// Lossy WAN path, where loss-based CC collapses
+	LinkParams lossy = deep;
+	lossy.qlen = 100*1000;
+	lossy.loss = 0.01;
+	runScenario("Lossy WAN", lossy);
+
+	// Shallow-buffered datacenter path, where unpaced bursts overflow
+	LinkParams shallow = SimLink(Eth1000).downLinkParams();
+	shallow.delay = 100;
+	shallow.qlen = 50;
+	shallow.loss = 0;
+	runScenario("Shallow-buffered LAN", shallow);
+
+	// Satellite link preset
+	runScenario("Sat10", SimLink(Sat10).downLinkParams());
+
+	// Datacenter path whose switch CE-marks ECN-capable packets
+	// once its queue exceeds a shallow threshold
+	LinkParams marking = shallow;
+	marking.qlen = 1000;
+	marking.ecnthresh = 100;
+	runScenario("ECN-marking LAN", marking);
+
+	// Jittery, lossy wireless link preset, where RTT estimation
+	// must avoid both spurious and sluggish retransmit timeouts
+	runScenario("WiFi20", SimLink(WiFi20).downLinkParams());
+
+	// Reordering datacenter path, where loss detection must
+	// not mistake late packets for lost ones
+	LinkParams reord = shallow;
+	reord.qlen = 1000;
+	reord.reorder = 0.02;
+	reord.reodelay = 300;
+	runScenario("Reordering LAN", reord);
+
+	// Background transfers sharing a WAN bottleneck with TCP
+	LinkParams shared = deep;
+	shared.qlen = 200*1000;
+	runCompeting("Shared WAN", shared);
+
+	// Two flows from one host sharing that bottleneck with TCP
+	runCoupled("Shared WAN", shared);
+}
+
@@ -0,0 +1,107 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#ifndef CC_H
+#define CC_H
+
+#include <QVector>
+
+#include "stream.h"
+#include "flow.h"
+#include "sim.h"
+
+namespace SST {
+
+
+// Runs a bulk stream transfer across a simulated bottleneck link
+// under a given congestion control mode, in virtual time,
+// measuring goodput and the queueing delay the transfer induces.
+// Several transfers may run in one simulation, competing
+// for a bottleneck whose queue their links share,
+// and a transfer may itself run over several flows at once.
+// The same fixture measures the flow features that trade
+// overhead against loss and congestion behavior,
+// such as ACK frequency and forward error correction.
+class CCBench : public QObject
+{
+	Q_OBJECT
+
+	// Flow features to enable on both hosts, or on the client alone
+	enum Option {
+		Pacing	= 0x01,		// Pace window-based CC modes
+		Ecn	= 0x02,		// ECN-capable sockets and ECN echo
+		Coupled	= 0x04,		// Coupled CC across the client's flows
+		AckFreq	= 0x08,		// ACK frequency negotiation
+		Fec	= 0x10,		// Forward error correction
+		Periodic = 0x20		// Send every sendInterval, not in bulk
+	};
+
+	static const int msgSize = 1200;	// Size of each timestamped message
+	static const int runTime = 60;		// Simulated seconds per run
+	static const int sendInterval = 20*1000; // Message spacing if Periodic
+
+	Simulator *const sim;
+	SimLink link;
+	SimHost clihost, srvhost;
+	Stream cli;
+	StreamServer srv;
+	Stream *srvs;
+	const int opts;
+	Timer sendtimer;
+	Timer stoptimer;
+
+	qint64 recvtot;		// Total bytes received
+	qint64 recvcnt;		// Total messages received
+	qint64 delaytot;	// Sum of one-way message delays
+	qint64 mindelay;	// Smallest one-way message delay
+	QVector<qint64> delays;	// Each message's delay, if Periodic
+
+	CCBench(Simulator *sim, CCMode mode, int opts,
+		const LinkParams &params, CCBench *share = NULL,
+		int paths = 1);
+
+	void report(const char *name);
+
+	static void runScenario(const char *name, const LinkParams &params);
+	static void runCompeting(const char *name, const LinkParams &params);
+	static void runCoupled(const char *name, const LinkParams &params);
+	static void runAckFreq(const char *name, const LinkParams &params);
+	static void runFec(const char *name, const LinkParams &params);
+
+public:
+	static void run();
+
+	// Measure what ACK frequency negotiation saves at high packet rates.
+	static void runAckFrequency();
+
+	// Measure what FEC buys on lossy long-delay links.
+	static void runForwardErrorCorrection();
+
+private slots:
+	void cliReadyWrite();
+	void sendTimeout();
+	void srvConnection();
+	void srvMessage();
+	void stopTimeout();
+};
+
+
+} // namespace SST
+
+#endif	// CC_H
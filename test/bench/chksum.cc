@@ -0,0 +1,63 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+
+#include <QByteArray>
+
+#include "chk32.h"
+#include "chksum.h"
+#include "main.h"
+
+using namespace SST;
+
+
+////////// ChecksumBench //////////
+
+void ChecksumBench::run()
+{
+	QByteArray buf(maxSize, 0);
+	for (int i = 0; i < maxSize; i++)
+		buf[i] = (char)(i * 7 + 13);
+
+	Chk32::Impl best = Chk32::impl();
+	for (int i = Chk32::Scalar; i < Chk32::NImpls; i++) {
+		Chk32::Impl impl = (Chk32::Impl)i;
+		if (!Chk32::setImpl(impl))
+			continue;
+		printf(" %s implementation:\n", Chk32::implName(impl));
+
+		for (int size = minSize; size <= maxSize; size *= 4) {
+			int reps = bytesPerTrial / size;
+			volatile quint32 sink = 0;	// keep the sums live
+
+			qint64 start = benchTime();
+			for (int r = 0; r < reps; r++)
+				sink += Chk32::sum(buf.constData(), size);
+			qint64 elapsed = qMax(benchTime() - start, (qint64)1);
+
+			char what[64];
+			snprintf(what, sizeof(what), "%d-byte buffers", size);
+			report(what, (double)reps * size / elapsed / 1000.0,
+				"GB/s");
+		}
+	}
+	Chk32::setImpl(best);
+}
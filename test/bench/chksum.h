@@ -0,0 +1,43 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#ifndef CHKSUM_H
+#define CHKSUM_H
+
+#include <QtGlobal>
+
+namespace SST {
+
+
+// Measures Chk32 throughput in GB/s on one core
+// for each available implementation across a range of packet sizes.
+class ChecksumBench
+{
+	static const int minSize = 64;		// Smallest buffer size
+	static const int maxSize = 65536;	// Largest buffer size
+	static const qint64 bytesPerTrial = 1 << 30;
+
+public:
+	static void run();
+};
+
+
+} // namespace SST
+
+#endif	// CHKSUM_H
@@ -0,0 +1,193 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <QHash>
+#include <QPair>
+
+#include "sock.h"
+#include "host.h"
+#include "xdr.h"
+
+#include "main.h"
+#include "demux.h"
+
+using namespace SST;
+
+
+////////// DemuxFlow //////////
+
+void DemuxFlow::receive(QByteArray &, const SocketEndpoint &)
+{
+	nrecv++;
+}
+
+
+////////// DemuxBench //////////
+
+DemuxBench::DemuxBench()
+:	SocketReceiver(&host),
+	nrecv(0)
+{
+	// Bind only now that the host is fully constructed.
+	bind(benchMagic);
+	sock = new DemuxSocket(&host);
+
+	// Peers spread over many addresses, a few ports each,
+	// with every eighth one an IPv6 peer.
+	for (int i = 0; i < nflows; i++) {
+		QHostAddress addr;
+		if (i % 8 == 7) {
+			Q_IPV6ADDR a6;
+			memset(&a6, 0, sizeof(a6));
+			a6[0] = 0x20; a6[1] = 0x01; a6[2] = 0x0d; a6[3] = 0xb8;
+			a6[14] = i >> 8; a6[15] = i;
+			addr.setAddress(a6);
+		} else
+			addr.setAddress(0x0a000000 + i / 4);
+		SocketEndpoint src(Endpoint(addr, 8661 + i % 4), sock);
+
+		DemuxFlow *fl = new DemuxFlow;
+		Channel chan = fl->bind(sock, src);
+		if (chan == 0)
+			qFatal("DemuxBench: can't bind flow %d", i);
+		flows.append(fl);
+		srcs.append(src);
+
+		QByteArray pkt(64, 0);
+		pkt[0] = chan;
+		pkts.append(pkt);
+	}
+
+	srand(1);
+	order.resize(lookups);
+	for (int i = 0; i < lookups; i++)
+		order[i] = rand() % nflows;
+}
+
+DemuxBench::~DemuxBench()
+{
+	qDeleteAll(flows);
+	delete sock;
+	unbind();
+}
+
+void DemuxBench::receive(QByteArray &, XdrStream &, const SocketEndpoint &)
+{
+	nrecv++;
+}
+
+// Look up flows in a QHash keyed as Socket used to key its flows.
+void DemuxBench::hashTrial()
+{
+	QHash<QPair<Endpoint,Channel>, SocketFlow*> hash;
+	for (int i = 0; i < nflows; i++)
+		hash.insert(QPair<Endpoint,Channel>(srcs[i],
+					flows[i]->localChannel()), flows[i]);
+
+	int hits = 0;
+	qint64 start = benchTime();
+	for (int i = 0; i < lookups; i++) {
+		int f = order[i];
+		Channel chan = pkts[f].at(0);
+		hits += hash.value(QPair<Endpoint,Channel>(srcs[f], chan))
+			!= NULL;
+	}
+	qint64 elapsed = benchTime() - start;
+	if (hits != lookups)
+		qFatal("DemuxBench: QHash missed %d flows", lookups - hits);
+
+	report("QHash lookup", elapsed * 1000.0 / lookups, "ns/packet");
+}
+
+void DemuxBench::tableTrial()
+{
+	int hits = 0;
+	qint64 start = benchTime();
+	for (int i = 0; i < lookups; i++) {
+		int f = order[i];
+		hits += sock->flow(srcs[f], pkts[f].at(0)) != NULL;
+	}
+	qint64 elapsed = benchTime() - start;
+	if (hits != lookups)
+		qFatal("DemuxBench: FlowTable missed %d flows", lookups - hits);
+
+	report("FlowTable lookup", elapsed * 1000.0 / lookups, "ns/packet");
+}
+
+// Dispatch data packets through Socket::receive() to their flows.
+void DemuxBench::flowTrial()
+{
+	foreach (DemuxFlow *fl, flows)
+		fl->nrecv = 0;
+
+	qint64 start = benchTime();
+	for (int i = 0; i < lookups; i++) {
+		int f = order[i];
+		sock->inject(pkts[f], srcs[f]);
+	}
+	qint64 elapsed = benchTime() - start;
+
+	quint64 got = 0;
+	foreach (DemuxFlow *fl, flows)
+		got += fl->nrecv;
+	if (got != (quint64)lookups)
+		qFatal("DemuxBench: %llu of %d packets reached their flows",
+			(unsigned long long)got, lookups);
+
+	report("receive() to flow", elapsed * 1000.0 / lookups,
+		"ns/packet");
+}
+
+// Dispatch control packets, which miss the flow table,
+// through Socket::receive() to a SocketReceiver.
+void DemuxBench::controlTrial()
+{
+	QByteArray pkt;
+	XdrStream ws(&pkt, QIODevice::WriteOnly);
+	ws << benchMagic << (quint32)0 << (quint32)0;
+
+	nrecv = 0;
+	qint64 start = benchTime();
+	for (int i = 0; i < lookups; i++)
+		sock->inject(pkt, srcs[order[i]]);
+	qint64 elapsed = benchTime() - start;
+
+	if (nrecv != (quint64)lookups)
+		qFatal("DemuxBench: %llu of %d control packets received",
+			(unsigned long long)nrecv, lookups);
+
+	report("receive() to control receiver", elapsed * 1000.0 / lookups,
+		"ns/packet");
+}
+
+void DemuxBench::run()
+{
+	printf(" %d flows bound:\n", nflows);
+
+	DemuxBench b;
+	b.hashTrial();
+	b.tableTrial();
+	b.flowTrial();
+	b.controlTrial();
+}
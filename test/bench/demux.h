@@ -0,0 +1,94 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef DEMUX_H
+#define DEMUX_H
+
+#include "host.h"
+
+namespace SST {
+
+
+// UdpSocket that lets the benchmark feed packets straight into
+// Socket::receive(), without any actual network I/O.
+class DemuxSocket : public UdpSocket
+{
+public:
+	inline DemuxSocket(SocketHostState *host) : UdpSocket(host) { }
+
+	inline void inject(QByteArray &msg, const SocketEndpoint &src)
+		{ receive(msg, src); }
+};
+
+
+// Flow that just counts the packets dispatched to it.
+class DemuxFlow : public SocketFlow
+{
+public:
+	quint64 nrecv;
+
+	inline DemuxFlow() : nrecv(0) { }
+
+protected:
+	virtual void receive(QByteArray &msg, const SocketEndpoint &src);
+};
+
+
+// Measures the cost of demultiplexing received packets
+// to one of many flows bound to a socket, and to a control receiver:
+// the old QHash index against FlowTable, then Socket::receive() itself.
+class DemuxBench : public SocketReceiver
+{
+	Q_OBJECT
+
+	// Control packet magic for benchmark traffic ('DMX')
+	static const quint32 benchMagic = 0x00444d58;
+
+	static const int nflows = 10000;	// Flows bound to the socket
+	static const int lookups = 4000000;	// Packets per trial
+
+	Host host;
+	DemuxSocket *sock;
+	QList<DemuxFlow*> flows;
+	QList<SocketEndpoint> srcs;	// Remote endpoint of each flow
+	QList<QByteArray> pkts;		// A data packet for each flow
+	QVector<int> order;		// Random order of flows to look up
+	quint64 nrecv;
+
+public:
+	DemuxBench();
+	~DemuxBench();
+
+	void hashTrial();
+	void tableTrial();
+	void flowTrial();
+	void controlTrial();
+
+	static void run();
+
+protected:
+	virtual void receive(QByteArray &msg, XdrStream &ds,
+				const SocketEndpoint &src);
+};
+
+
+} // namespace SST
+
+#endif	// DEMUX_H
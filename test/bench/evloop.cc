@@ -0,0 +1,170 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <netinet/in.h>
+
+#include <QCoreApplication>
+#include <QtDebug>
+
+#include "sock.h"
+#include "host.h"
+#include "epoll.h"
+
+#include "main.h"
+#include "evloop.h"
+
+using namespace SST;
+
+
+EpollBench::EpollBench(Host *host, EpollHost *eh)
+:	SocketReceiver(host),
+	host(host),
+	eh(eh),
+	nrecv(0),
+	timer(host),
+	armed(0), latesum(0), latemax(0), fired(0)
+{
+	bind(benchMagic);
+	connect(&timer, SIGNAL(timeout(bool)), this, SLOT(timeout()));
+
+	// Both sockets live on the one host, so one loop drives the trial.
+	ssock = host->newSocket();
+	rsock = host->newSocket();
+	if (!ssock->bind(QHostAddress::LocalHost, 0) ||
+	    !rsock->bind(QHostAddress::LocalHost, 0))
+		qFatal("EpollBench: can't bind loopback sockets");
+}
+
+EpollBench::~EpollBench()
+{
+	delete ssock;
+	delete rsock;
+	unbind();
+}
+
+void EpollBench::receive(QByteArray &, XdrStream &, const SocketEndpoint &)
+{
+	nrecv++;
+}
+
+// Make one pass through whichever event loop drives our host.
+void EpollBench::pump(int maxwaitms)
+{
+#ifdef SST_EPOLL
+	if (eh) {
+		eh->runOnce((qint64)maxwaitms * 1000);
+		return;
+	}
+#endif
+	if (maxwaitms > 0)
+		QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents,
+						maxwaitms);
+	else
+		QCoreApplication::processEvents();
+}
+
+void EpollBench::packets()
+{
+	nrecv = 0;
+	host->packetPool().resetStats();
+#ifdef SST_EPOLL
+	if (eh)
+		eh->resetStats();
+#endif
+
+	QByteArray pkt(pktSize, 0);
+	*(quint32*)pkt.data() = htonl(benchMagic);
+	Endpoint dst(QHostAddress::LocalHost, rsock->localPort());
+
+	qint64 start = benchTime();
+	for (int sent = 0; sent < totalPkts; sent += burstSize) {
+		ssock->beginBatch();
+		for (int i = 0; i < burstSize; i++)
+			ssock->send(dst, pkt);
+		ssock->endBatch();
+
+		pump(0);
+	}
+
+	// Drain whatever is still in flight.
+	quint64 last;
+	do {
+		last = nrecv;
+		pump(10);
+	} while (nrecv != last);
+	qint64 elapsed = benchTime() - start;
+
+	report("packets received", nrecv, "pkts");
+	report("receive rate", nrecv * 1000000.0 / elapsed, "pkts/sec");
+#ifdef SST_EPOLL
+	if (eh)
+		report("loop wakeups per packet",
+			(double)eh->stats().wakeups / qMax(nrecv, (quint64)1),
+			"");
+#endif
+}
+
+void EpollBench::timers()
+{
+	latesum = latemax = 0;
+	fired = 0;
+
+	armed = benchTime() + timerDelay;
+	timer.start(timerDelay);
+	while (fired < timerRounds)
+		pump(100);
+
+	report("mean timer lateness", (double)latesum / fired, "usec");
+	report("worst timer lateness", latemax, "usec");
+}
+
+void EpollBench::timeout()
+{
+	qint64 late = qMax(benchTime() - armed, (qint64)0);
+	latesum += late;
+	latemax = qMax(latemax, late);
+	if (++fired < timerRounds) {
+		armed = benchTime() + timerDelay;
+		timer.start(timerDelay);
+	}
+}
+
+void EpollBench::run()
+{
+	{
+		printf(" Qt event loop:\n");
+		Host h;
+		EpollBench b(&h, NULL);
+		b.packets();
+		b.timers();
+	}
+#ifdef SST_EPOLL
+	{
+		printf(" Native epoll loop:\n");
+		EpollHost h;
+		EpollBench b(&h, &h);
+		b.packets();
+		b.timers();
+	}
+#else
+	printf(" Native epoll loop not supported on this platform\n");
+#endif
+}
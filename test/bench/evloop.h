@@ -0,0 +1,81 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#ifndef EVLOOP_H
+#define EVLOOP_H
+
+#include "host.h"
+#include "timer.h"
+
+namespace SST {
+
+class EpollHost;
+
+
+// Compares Qt's event loop, with QUdpSocket and QTimer-based timers,
+// against EpollHost's native loop: loopback packets per second,
+// loop wakeups per packet, and how late timers fire.
+class EpollBench : public SocketReceiver
+{
+	Q_OBJECT
+
+	// Control packet magic for benchmark traffic ('BNC')
+	static const quint32 benchMagic = 0x00424e43;
+
+	static const int pktSize = 1200;	// Bytes per datagram
+	static const int burstSize = 32;	// Datagrams per send burst
+	static const int totalPkts = 200000;	// Datagrams per trial
+	static const int timerRounds = 2000;	// Timeouts per trial
+	static const int timerDelay = 1000;	// Microseconds per timeout
+
+	Host *const host;	// Host whose event loop we measure
+	EpollHost *const eh;	// Same host if it's an EpollHost, else NULL
+	Socket *ssock, *rsock;
+	quint64 nrecv;
+
+	Timer timer;
+	qint64 armed;		// Time the timer should fire
+	qint64 latesum, latemax;// Total and worst lateness in microseconds
+	int fired;
+
+public:
+	EpollBench(Host *host, EpollHost *eh);
+	~EpollBench();
+
+	// Measure packet throughput and timer lateness on this host.
+	void packets();
+	void timers();
+
+	static void run();
+
+protected:
+	virtual void receive(QByteArray &msg, XdrStream &ds,
+				const SocketEndpoint &src);
+
+private:
+	void pump(int maxwaitms);
+
+private slots:
+	void timeout();
+};
+
+
+} // namespace SST
+
+#endif	// EVLOOP_H
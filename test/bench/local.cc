@@ -0,0 +1,244 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <QCoreApplication>
+#include <QtDebug>
+
+#include "shm.h"
+
+#include "main.h"
+#include "local.h"
+
+using namespace SST;
+
+
+////////// ShmHost //////////
+
+Socket *ShmHost::newSocket(QObject *parent)
+{
+	return new ShmSocket(this, parent);
+}
+
+
+////////// LocalBench //////////
+
+LocalBench::LocalBench(bool shm)
+:	srvhost(shm ? new ShmHost : new Host),
+	clihost(shm ? new ShmHost : new Host),
+	srv(NULL),
+	sstrm(NULL),
+	cstrm(NULL),
+	shmsock(NULL),
+	bulk(false),
+	done(false),
+	rpcs(0),
+	sent(0),
+	rcvd(0)
+{
+}
+
+LocalBench::~LocalBench()
+{
+	delete cstrm;
+	delete sstrm;
+	delete srv;
+	delete clihost;
+	delete srvhost;
+}
+
+// Bring up both hosts and a stream between them.
+bool LocalBench::setup()
+{
+	Socket *ssock = srvhost->initSocket(NULL, 0);
+	srvhost->hostIdent(true);
+	shmsock = qobject_cast<ShmSocket*>(clihost->initSocket(NULL, 0));
+	clihost->hostIdent(true);
+
+	srv = new StreamServer(srvhost);
+	QObject::connect(srv, SIGNAL(newConnection()),
+			this, SLOT(newConnection()));
+	if (!srv->listen("bench", "SST benchmark server",
+			"local", "Same-host benchmark protocol"))
+		qFatal("Can't listen for benchmark streams");
+
+	cstrm = new Stream(clihost);
+	QObject::connect(cstrm, SIGNAL(readyReadMessage()),
+			this, SLOT(clientReadyRead()));
+	QObject::connect(cstrm, SIGNAL(readyWrite()),
+			this, SLOT(clientReadyWrite()));
+	cstrm->connectTo(srvhost->hostIdent().id(), "bench", "local");
+	cstrm->connectAt(Endpoint(QHostAddress::LocalHost,
+					ssock->localPort()));
+
+	// The stream is up once the first round trip completes.
+	rpcs = 1;
+	done = false;
+	request();
+	return wait();
+}
+
+// Run the event loop until the current phase finishes.
+bool LocalBench::wait()
+{
+	qint64 deadline = benchTime() + (qint64)timeLimit * 1000000;
+	while (!done) {
+		if (benchTime() > deadline) {
+			qDebug("LocalBench: timed out");
+			return false;
+		}
+		QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents,
+						100);
+	}
+	return true;
+}
+
+void LocalBench::request()
+{
+	char buf[rpcSize];
+	memset(buf, 'q', sizeof(buf));
+	cstrm->writeMessage(buf, sizeof(buf));
+}
+
+void LocalBench::newConnection()
+{
+	while (Stream *strm = srv->accept()) {
+		delete sstrm;
+		sstrm = strm;
+		sstrm->setParent(NULL);
+		QObject::connect(sstrm, SIGNAL(readyReadMessage()),
+				this, SLOT(serverReadyRead()));
+		QObject::connect(sstrm, SIGNAL(readyRead()),
+				this, SLOT(serverReadyRead()));
+		serverReadyRead();
+	}
+}
+
+// Echo requests, or soak up bulk data.
+void LocalBench::serverReadyRead()
+{
+	if (bulk) {
+		char buf[65536];
+		int act;
+		while ((act = sstrm->read(buf, sizeof(buf))) > 0)
+			rcvd += act;
+		if (rcvd >= bulkBytes)
+			done = true;
+		return;
+	}
+
+	char buf[rpcSize];
+	while (sstrm->hasPendingMessages()) {
+		qint64 act = sstrm->readMessage(buf, sizeof(buf));
+		if (act > 0)
+			sstrm->writeMessage(buf, act);
+	}
+}
+
+void LocalBench::clientReadyRead()
+{
+	while (cstrm->hasPendingMessages()) {
+		cstrm->readMessage();
+		if (--rpcs > 0)
+			request();
+		else
+			done = true;
+	}
+}
+
+void LocalBench::clientReadyWrite()
+{
+	if (!bulk)
+		return;
+
+	static const char buf[bulkChunk] = { 0 };
+	while (sent < bulkBytes) {
+		int act = cstrm->write(buf, qMin(bulkBytes - sent,
+						(qint64)sizeof(buf)));
+		if (act <= 0)
+			break;
+		sent += act;
+	}
+}
+
+void LocalBench::rpcTrial()
+{
+	rpcs = rpcWarmup;
+	done = false;
+	request();
+	if (!wait())
+		return;
+
+	rpcs = rpcCount;
+	done = false;
+	qint64 start = benchTime();
+	request();
+	if (!wait())
+		return;
+	qint64 elapsed = benchTime() - start;
+
+	report("mean round-trip time", (double)elapsed / rpcCount, "us");
+	report("request/response rate",
+		rpcCount / (elapsed / 1000000.0), "RPCs/sec");
+}
+
+void LocalBench::bulkTrial()
+{
+	bulk = true;
+	done = false;
+	sent = rcvd = 0;
+	qint64 start = benchTime();
+	clientReadyWrite();
+	if (!wait())
+		return;
+	qint64 elapsed = benchTime() - start;
+
+	report("bulk throughput", rcvd / (elapsed / 1000000.0) / 1e6,
+		"MB/sec");
+}
+
+void LocalBench::run()
+{
+	for (int shm = 0; shm < 2; shm++) {
+		printf(" %s:\n", shm ? "shared memory" : "loopback UDP");
+		LocalBench b(shm);
+		if (!b.setup())
+			continue;
+		if (b.shmsock)
+			b.shmsock->resetShmStats();
+
+		b.rpcTrial();
+		b.bulkTrial();
+
+		if (b.shmsock) {
+			const ShmSocket::ShmStats &st = b.shmsock->shmStats();
+			report("packets sent through rings", st.txpackets,
+				"packets");
+			report("packets received from rings", st.rxpackets,
+				"packets");
+			report("wakeups per packet sent",
+				st.txpackets ? (double)st.wakeups
+						/ st.txpackets : 0,
+				"wakeups");
+		}
+	}
+}
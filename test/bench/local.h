@@ -0,0 +1,88 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef LOCAL_H
+#define LOCAL_H
+
+#include "host.h"
+#include "stream.h"
+
+namespace SST {
+
+class ShmSocket;
+
+
+// Host whose sockets take the shared-memory path to local peers.
+class ShmHost : public Host
+{
+protected:
+	virtual Socket *newSocket(QObject *parent = NULL);
+};
+
+
+// Measures request/response latency and bulk throughput
+// between two hosts in the same process talking over loopback,
+// first through UdpSockets and then through ShmSockets.
+class LocalBench : public QObject
+{
+	Q_OBJECT
+
+	static const int rpcSize = 64;		// Bytes per request/response
+	static const int rpcWarmup = 100;	// Untimed round trips
+	static const int rpcCount = 10000;	// Timed round trips
+	static const int bulkChunk = 16384;	// Bytes per bulk write
+	static const qint64 bulkBytes = 64 << 20; // Bytes per bulk trial
+	static const int timeLimit = 60;	// Seconds per phase at most
+
+	Host *srvhost, *clihost;
+	StreamServer *srv;
+	Stream *sstrm;		// Server's end
+	Stream *cstrm;		// Client's end
+	ShmSocket *shmsock;	// Client's socket, if a ShmSocket
+	bool bulk;		// In the bulk phase
+	bool done;		// Current phase finished
+	int rpcs;		// Round trips left in the current phase
+	qint64 sent, rcvd;	// Bulk bytes written and read
+
+public:
+	LocalBench(bool shm);
+	~LocalBench();
+
+	bool setup();
+	void rpcTrial();
+	void bulkTrial();
+
+	static void run();
+
+private:
+	bool wait();
+	void request();
+
+private slots:
+	void newConnection();
+	void serverReadyRead();
+	void clientReadyRead();
+	void clientReadyWrite();
+};
+
+
+} // namespace SST
+
+#endif	// LOCAL_H
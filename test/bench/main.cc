@@ -0,0 +1,120 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <QCoreApplication>
+
+#include "main.h"
+#include "udp.h"
+#include "chksum.h"
+#include "armor.h"
+#include "txring.h"
+#include "cc.h"
+#include "evloop.h"
+#include "sharded.h"
+#include "afxdp.h"
+#include "local.h"
+#include "demux.h"
+
+using namespace SST;
+
+
+struct Benchmark {
+	void (*run)();
+	const char *name;
+	const char *descr;
+} benchmarks[] = {
+	{UdpBench::run, "udp", "Batched vs unbatched loopback UDP I/O"},
+	{ChecksumBench::run, "chk32", "Chk32 throughput per implementation"},
+	{ArmorBench::run, "armor", "Armor pipeline scaling across cores"},
+	{TxRingBench::run, "txring", "Packets-in-flight tracking structures"},
+	{CCBench::run, "cc", "Simulated congestion control comparison"},
+	{CCBench::runAckFrequency, "ackfreq", "ACK frequency negotiation cost per byte"},
+	{CCBench::runForwardErrorCorrection, "fec", "Forward error correction on lossy links"},
+	{EpollBench::run, "epoll", "Qt vs native epoll event loop overhead"},
+	{ShardBench::run, "shard", "Sharded server scaling with many clients"},
+	{XdpBench::run, "xdp", "AF_XDP packet rate across a veth pair"},
+	{LocalBench::run, "local", "Shared memory vs loopback UDP between local hosts"},
+	{DemuxBench::run, "demux", "Received packet demultiplexing with 10k flows"},
+};
+#define NBENCH ((int)(sizeof(benchmarks)/sizeof(benchmarks[0])))
+
+
+qint64 SST::benchTime()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (qint64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void SST::report(const char *what, double value, const char *units)
+{
+	printf("  %-40s %14.3f %s\n", what, value, units);
+	fflush(stdout);
+}
+
+void usage(const char *appname)
+{
+	fprintf(stderr, "Usage: %s [<benchname>]   - to run a specific benchmark\n"
+			"   or: %s all             - to run all benchmarks\n"
+			"Benchmarks:\n", appname, appname);
+	for (int i = 0; i < NBENCH; i++)
+		fprintf(stderr, "  %-10s %s\n",
+			benchmarks[i].name, benchmarks[i].descr);
+	exit(1);
+}
+
+void runbench(int n)
+{
+	Benchmark &b = benchmarks[n];
+
+	printf("Running benchmark '%s': %s\n", b.name, b.descr);
+	fflush(stdout);
+
+	b.run();
+}
+
+int main(int argc, char **argv)
+{
+	QCoreApplication app(argc, argv);
+
+	if (argc != 2)
+		usage(argv[0]);
+
+	if (strcasecmp(argv[1], "all") == 0) {
+		for (int i = 0; i < NBENCH; i++)
+			runbench(i);
+		return 0;
+	}
+
+	for (int i = 0; i < NBENCH; i++) {
+		if (strcasecmp(argv[1], benchmarks[i].name) == 0) {
+			runbench(i);
+			return 0;
+		}
+	}
+	usage(argv[0]);	// Benchmark not found
+	return 1;
+}
+
@@ -0,0 +1,37 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#ifndef MAIN_H
+#define MAIN_H
+
+#include <QtGlobal>
+
+
+namespace SST {
+
+// Return a monotonic wall-clock timestamp in microseconds,
+// for timing benchmark runs independently of any SST Host.
+qint64 benchTime();
+
+// Print a benchmark result line in a uniform format.
+void report(const char *what, double value, const char *units);
+
+} // namespace SST
+
+#endif	// MAIN_H
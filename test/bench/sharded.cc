@@ -0,0 +1,220 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+
+#include <QtDebug>
+
+#include "stream.h"
+#include "shard.h"
+
+#include "main.h"
+#include "sharded.h"
+
+using namespace SST;
+
+
+////////// ShardBenchReader //////////
+
+ShardBenchReader::ShardBenchReader(ShardBenchServer *srv, Stream *strm)
+:	QObject(strm),
+	srv(srv),
+	strm(strm)
+{
+	connect(strm, SIGNAL(readyRead()), this, SLOT(readyRead()));
+}
+
+void ShardBenchReader::readyRead()
+{
+	srv->readStream(strm);
+}
+
+
+////////// ShardBenchServer //////////
+
+ShardBenchServer::ShardBenchServer(int nshards)
+:	ShardGroup(NULL, 0, nshards),
+	rxbytes(0)
+{
+	for (int i = 0; i < count(); i++)
+		nstreams.append(0);
+	listen("bench", "SST benchmark server",
+		"shard", "Sharded host benchmark protocol");
+}
+
+// Wait until at least @a bytes have arrived or @a msecs pass,
+// and return the number of bytes received.
+qint64 ShardBenchServer::waitReceived(qint64 bytes, int msecs)
+{
+	QMutexLocker lock(&mutex);
+	qint64 deadline = benchTime() + (qint64)msecs * 1000;
+	while (rxbytes < bytes) {
+		qint64 left = deadline - benchTime();
+		if (left <= 0)
+			break;
+		rxcond.wait(&mutex, left / 1000 + 1);
+	}
+	return rxbytes;
+}
+
+QList<int> ShardBenchServer::streamsPerShard()
+{
+	QMutexLocker lock(&mutex);
+	return nstreams;
+}
+
+// Called on the accepting shard's thread.
+void ShardBenchServer::newStream(Shard *shard, Stream *strm)
+{
+	{
+		QMutexLocker lock(&mutex);
+		nstreams[shard->index()]++;
+	}
+
+	// Read on the shard's thread too, not on ours.
+	strm->listen(Stream::Unlimited);
+	(void)new ShardBenchReader(this, strm);
+	readStream(strm);
+}
+
+// Called on the stream's shard's thread.
+void ShardBenchServer::readStream(Stream *strm)
+{
+	char buf[65536];
+	qint64 got = 0;
+	int act;
+	while ((act = strm->read(buf, sizeof(buf))) > 0)
+		got += act;
+
+	QMutexLocker lock(&mutex);
+	rxbytes += got;
+	rxcond.wakeAll();
+}
+
+
+////////// ShardBenchClient //////////
+
+ShardBenchClient::ShardBenchClient(const QByteArray &srvid, quint16 srvport,
+				qint64 bytes)
+:	strm(&host),
+	remain(bytes)
+{
+	// Each client binds its own port, so steering can tell them apart.
+	host.initSocket(NULL, 0);
+	host.hostIdent(true);
+
+	connect(&strm, SIGNAL(readyWrite()), this, SLOT(readyWrite()));
+	strm.connectTo(srvid, "bench", "shard");
+	strm.connectAt(Endpoint(QHostAddress::LocalHost, srvport));
+	readyWrite();
+}
+
+void ShardBenchClient::readyWrite()
+{
+	static const char buf[16384] = { 0 };
+	while (remain > 0) {
+		int act = strm.write(buf, qMin(remain, (qint64)sizeof(buf)));
+		if (act <= 0)
+			break;
+		remain -= act;
+	}
+}
+
+
+////////// ShardBenchClients //////////
+
+ShardBenchClients::ShardBenchClients(const QByteArray &srvid, quint16 srvport,
+				int nclients, qint64 bytes)
+:	srvid(srvid),
+	srvport(srvport),
+	nclients(nclients),
+	bytes(bytes)
+{
+}
+
+void ShardBenchClients::run()
+{
+	QList<ShardBenchClient*> clis;
+	for (int i = 0; i < nclients; i++)
+		clis.append(new ShardBenchClient(srvid, srvport, bytes));
+
+	exec();
+
+	qDeleteAll(clis);
+}
+
+
+////////// ShardBench //////////
+
+void ShardBench::trial(int nshards)
+{
+	printf(" %d shard%s:\n", nshards, nshards == 1 ? "" : "s");
+
+	ShardBenchServer srv(nshards);
+	srv.start();
+
+	// Run the clients on as many threads as we have cores.
+	int nthreads = qMin(qMax(QThread::idealThreadCount(), 1),
+				totalClients);
+	QList<ShardBenchClients*> threads;
+	for (int i = 0; i < nthreads; i++) {
+		int n = totalClients / nthreads
+			+ (i < totalClients % nthreads);
+		threads.append(new ShardBenchClients(srv.hostId(),
+					srv.localPort(), n, clientBytes));
+	}
+
+	qint64 target = (qint64)totalClients * clientBytes;
+	qint64 start = benchTime();
+	foreach (ShardBenchClients *t, threads)
+		t->start();
+	qint64 got = srv.waitReceived(target, timeLimit * 1000);
+	qint64 elapsed = benchTime() - start;
+
+	foreach (ShardBenchClients *t, threads) {
+		do {
+			t->quit();
+		} while (!t->wait(100));
+	}
+	qDeleteAll(threads);
+	srv.stop();
+
+	QList<int> per = srv.streamsPerShard();
+	int conns = 0, minconns = totalClients, maxconns = 0;
+	foreach (int n, per) {
+		conns += n;
+		minconns = qMin(minconns, n);
+		maxconns = qMax(maxconns, n);
+	}
+	report("connections accepted", conns, "streams");
+	report("fewest streams on a shard", minconns, "streams");
+	report("most streams on a shard", maxconns, "streams");
+	report("bytes received", got, "bytes");
+	report("aggregate throughput", got / (elapsed / 1000000.0) / 1e6,
+		"MB/sec");
+}
+
+void ShardBench::run()
+{
+	int cores = qMax(QThread::idealThreadCount(), 1);
+	for (int n = 1; n < cores; n *= 2)
+		trial(n);
+	trial(cores);
+}
@@ -0,0 +1,130 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#ifndef SHARDED_H
+#define SHARDED_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include "shard.h"
+
+namespace SST {
+
+class ShardBenchServer;
+
+
+// Reads one accepted stream on its shard's thread,
+// where it lives as a child of the stream.
+class ShardBenchReader : public QObject
+{
+	Q_OBJECT
+
+	ShardBenchServer *const srv;
+	Stream *const strm;
+
+public:
+	ShardBenchReader(ShardBenchServer *srv, Stream *strm);
+
+private slots:
+	void readyRead();
+};
+
+
+// Server side of the sharded-host benchmark:
+// a ShardGroup that counts the bytes it receives on all shards.
+class ShardBenchServer : public ShardGroup
+{
+	friend class ShardBenchReader;
+	Q_OBJECT
+
+	QMutex mutex;
+	QWaitCondition rxcond;	// Signaled when data arrives
+	qint64 rxbytes;		// Total bytes received
+	QList<int> nstreams;	// Streams accepted per shard
+
+public:
+	ShardBenchServer(int nshards);
+
+	qint64 waitReceived(qint64 bytes, int msecs);
+	QList<int> streamsPerShard();
+
+protected:
+	virtual void newStream(Shard *shard, Stream *strm);
+
+private:
+	void readStream(Stream *strm);
+};
+
+
+// One benchmark client: a Host of its own
+// with a stream that writes a fixed amount of data to the server.
+class ShardBenchClient : public QObject
+{
+	Q_OBJECT
+
+	Host host;
+	Stream strm;
+	qint64 remain;
+
+public:
+	ShardBenchClient(const QByteArray &srvid, quint16 srvport,
+			qint64 bytes);
+
+private slots:
+	void readyWrite();
+};
+
+
+// A thread running a group of clients, so client load spreads too.
+class ShardBenchClients : public QThread
+{
+	const QByteArray srvid;
+	const quint16 srvport;
+	const int nclients;
+	const qint64 bytes;
+
+public:
+	ShardBenchClients(const QByteArray &srvid, quint16 srvport,
+			int nclients, qint64 bytes);
+
+protected:
+	virtual void run();
+};
+
+
+// Measures how connection count and aggregate throughput
+// scale with the number of shards in a ShardGroup,
+// with many client hosts streaming to it over loopback.
+class ShardBench
+{
+	static const int totalClients = 64;	// Client hosts per trial
+	static const qint64 clientBytes = 1 << 20; // Bytes each one sends
+	static const int timeLimit = 60;	// Seconds per trial at most
+
+public:
+	static void trial(int nshards);
+	static void run();
+};
+
+
+} // namespace SST
+
+#endif	// SHARDED_H
@@ -0,0 +1,159 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+
+#include <QHash>
+#include <QQueue>
+
+#include "flow.h"
+#include "sim.h"
+#include "txring.h"
+#include "main.h"
+
+using namespace SST;
+
+
+namespace {
+
+// Mirrors Flow::TxEvent without and with its stream packet handle.
+struct OldTxEvent {
+	qint32 size;
+	bool data, pipe;
+
+	inline OldTxEvent(qint32 size = 0)
+		: size(size), data(true), pipe(true) { }
+};
+
+struct NewTxEvent {
+	qint32 size;
+	bool data, pipe;
+	StreamTxPacket pkt;
+
+	inline NewTxEvent(qint32 size = 0)
+		: size(size), data(true), pipe(true) { }
+};
+
+// Expiry horizon behind the highest ack, as with the classic 32-bit txackmask
+const int expireBits = 32;
+
+} // namespace
+
+
+////////// TxRingBench //////////
+
+// Each trial keeps "window" packets in flight:
+// each new transmission is recorded, the oldest packet in flight
+// is acknowledged (or every lossInterval'th packet first missed),
+// and records falling behind the expiry horizon are discarded.
+// Returns nanoseconds per packet.
+double TxRingBench::hashTrial(int window)
+{
+	QQueue<OldTxEvent> txevts;
+	quint64 txevtseq = 1;
+	QHash<qint64, StreamTxPacket> ackwait;
+	StreamTxPacket p(NULL, 0);
+	p.buf = QByteArray(pktSize, 0);
+	p.strm = (BaseStream*)&txevts;	// any non-null value
+
+	qint64 start = benchTime();
+	for (quint64 seq = 1; seq <= (quint64)pktsPerTrial; seq++) {
+		txevts.enqueue(OldTxEvent(pktSize));
+		ackwait.insert(seq, p);
+
+		if (seq <= (quint64)window)
+			continue;
+		quint64 ackseq = seq - window;
+		OldTxEvent &e = txevts[ackseq - txevtseq];
+		e.pipe = false;
+		if (ackseq % lossInterval == 0) {
+			if (ackwait.contains(ackseq))
+				ackwait[ackseq].late = true;
+		} else
+			ackwait.take(ackseq);
+
+		while (txevtseq + expireBits <= ackseq) {
+			txevts.removeFirst();
+			ackwait.take(txevtseq++);
+		}
+	}
+	qint64 elapsed = benchTime() - start;
+	return (double)elapsed * 1000.0 / pktsPerTrial;
+}
+
+double TxRingBench::ringTrial(int window)
+{
+	SeqRing<NewTxEvent> txevts(64, 1);
+	StreamTxPacket p(NULL, 0);
+	p.buf = QByteArray(pktSize, 0);
+	p.strm = (BaseStream*)&txevts;
+
+	qint64 start = benchTime();
+	for (quint64 seq = 1; seq <= (quint64)pktsPerTrial; seq++) {
+		txevts.append(NewTxEvent(pktSize));
+		txevts[seq].pkt = p;
+
+		if (seq <= (quint64)window)
+			continue;
+		quint64 ackseq = seq - window;
+		NewTxEvent &e = txevts[ackseq];
+		e.pipe = false;
+		if (ackseq % lossInterval == 0) {
+			if (!e.pkt.isNull())
+				e.pkt.late = true;
+		} else
+			e.pkt = StreamTxPacket();
+
+		while (txevts.base() + expireBits <= ackseq)
+			txevts.removeFirst();
+	}
+	qint64 elapsed = benchTime() - start;
+	return (double)elapsed * 1000.0 / pktsPerTrial;
+}
+
+void TxRingBench::run()
+{
+	LinkParams sat10 = SimLink(Sat10).downLinkParams();
+	LinkParams eth1000 = SimLink(Eth1000).downLinkParams();
+
+	// A gigabit path with a satellite hop keeps ~100k packets in flight.
+	LinkParams lfn = eth1000;
+	lfn.delay = sat10.delay;
+
+	struct {
+		const char *name;
+		LinkParams params;
+	} configs[] = {
+		{ "Sat10", sat10 },
+		{ "Eth1000", eth1000 },
+		{ "Eth1000 rate, Sat10 delay", lfn },
+	};
+
+	for (unsigned i = 0; i < sizeof(configs)/sizeof(configs[0]); i++) {
+		const LinkParams &lp = configs[i].params;
+		int window = qMax((qint64)1, (qint64)lp.rate * 2 * lp.delay
+					/ 1000000 / pktSize);
+		printf(" %s: %d packets in flight\n", configs[i].name, window);
+
+		report("QQueue + QHash", hashTrial(window), "ns/packet");
+		report("SeqRing", ringTrial(window), "ns/packet");
+	}
+}
+
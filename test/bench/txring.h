@@ -0,0 +1,48 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#ifndef TXRING_H
+#define TXRING_H
+
+#include <QtGlobal>
+
+namespace SST {
+
+
+// Compares the cost of tracking packets in flight
+// with the old TxEvent queue plus ackwait hash
+// against the flow's combined sequence-indexed transmit ring,
+// with window sizes drawn from the Simulator's link presets.
+class TxRingBench
+{
+	static const int pktSize = 1200;	// Typical flow packet size
+	static const int pktsPerTrial = 2000000;
+	static const int lossInterval = 100;	// Every Nth packet missed
+
+	static double hashTrial(int window);
+	static double ringTrial(int window);
+
+public:
+	static void run();
+};
+
+
+} // namespace SST
+
+#endif	// TXRING_H
@@ -0,0 +1,116 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <netinet/in.h>
+
+#include <QCoreApplication>
+#include <QtDebug>
+
+#include "sock.h"
+#include "host.h"
+
+#include "main.h"
+#include "udp.h"
+
+using namespace SST;
+
+
+UdpBench::UdpBench()
+:	SocketReceiver(&rcv),
+	nrecv(0)
+{
+	// Bind only now that the receiving host is fully constructed.
+	bind(benchMagic);
+
+	ssock = new UdpSocket(&snd);
+	rsock = new UdpSocket(&rcv);
+	if (!ssock->bind(QHostAddress::LocalHost, 0) ||
+	    !rsock->bind(QHostAddress::LocalHost, 0))
+		qFatal("UdpBench: can't bind loopback sockets");
+}
+
+UdpBench::~UdpBench()
+{
+	// Clean up before the hosts go away underneath us.
+	delete ssock;
+	delete rsock;
+	unbind();
+}
+
+void UdpBench::receive(QByteArray &, XdrStream &, const SocketEndpoint &)
+{
+	nrecv++;
+}
+
+void UdpBench::trial(bool batched)
+{
+	ssock->setBatchMode(batched);
+	rsock->setBatchMode(batched);
+	ssock->resetStats();
+	rsock->resetStats();
+	rcv.packetPool().resetStats();
+	nrecv = 0;
+
+	printf(" %s I/O:\n", batched ? "Batched" : "Unbatched");
+
+	QByteArray pkt(pktSize, 0);
+	*(quint32*)pkt.data() = htonl(benchMagic);
+	Endpoint dst(QHostAddress::LocalHost, rsock->localPort());
+
+	// Send in bursts, the way a flow does on readyTransmit(),
+	// letting the receiver catch up between bursts.
+	qint64 start = benchTime();
+	for (int sent = 0; sent < totalPkts; sent += burstSize) {
+		ssock->beginBatch();
+		for (int i = 0; i < burstSize; i++)
+			ssock->send(dst, pkt);
+		ssock->endBatch();
+
+		QCoreApplication::processEvents();
+	}
+
+	// Drain whatever is still in flight.
+	quint64 last;
+	do {
+		last = nrecv;
+		QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+	} while (nrecv != last);
+	qint64 elapsed = benchTime() - start;
+
+	const UdpSocket::Stats &ts = ssock->stats();
+	const UdpSocket::Stats &rs = rsock->stats();
+	report("packets received", nrecv, "pkts");
+	report("receive rate", nrecv * 1000000.0 / elapsed, "pkts/sec");
+	report("transmit syscalls per packet",
+		(double)ts.txcalls / qMax(ts.txpackets, (quint64)1), "");
+	report("receive syscalls per packet",
+		(double)rs.rxcalls / qMax(rs.rxpackets, (quint64)1), "");
+	report("receive buffer allocations per packet",
+		rcv.packetPool().allocsPerPacket(), "");
+}
+
+void UdpBench::run()
+{
+	UdpBench b;
+	b.trial(false);
+	b.trial(true);
+}
+
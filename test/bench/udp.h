@@ -0,0 +1,63 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#ifndef UDP_H
+#define UDP_H
+
+#include "host.h"
+
+namespace SST {
+
+
+// Measures packets per second and system calls per packet
+// for UdpSocket over the loopback interface,
+// with batched datagram I/O disabled and then enabled.
+class UdpBench : public SocketReceiver
+{
+	Q_OBJECT
+
+	// Control packet magic for benchmark traffic ('BNC')
+	static const quint32 benchMagic = 0x00424e43;
+
+	static const int pktSize = 1200;	// Bytes per datagram
+	static const int burstSize = 32;	// Datagrams per send burst
+	static const int totalPkts = 200000;	// Datagrams per trial
+
+	Host snd, rcv;
+	UdpSocket *ssock, *rsock;
+	quint64 nrecv;
+
+public:
+	UdpBench();
+	~UdpBench();
+
+	// Run one trial with batching enabled or disabled.
+	void trial(bool batched);
+
+	static void run();
+
+protected:
+	virtual void receive(QByteArray &msg, XdrStream &ds,
+				const SocketEndpoint &src);
+};
+
+
+} // namespace SST
+
+#endif	// UDP_H
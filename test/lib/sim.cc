@@ -48,6 +48,7 @@ using namespace SST;
 
 //#define CUTOFF	(DELAY*10)	// max delay before we drop packets
 #define PKTOH	32		// Bytes of link/inet overhead per packet
+#define IPUDPOH	28		// Bytes of IPv4 and UDP headers per packet
 
 
 // Typical ADSL uplink/downlink bandwidths and combinations (all in Kbps)
@@ -143,6 +144,12 @@ const LinkParams eth1000 =
 const LinkParams sat10 =
 	{ ETH10_RATE, 500000, 1024*1024 };
 
+// Wi-Fi link parameters: contention and link-layer retries
+// show up as delay jitter and residual loss (XXX wild guesses)
+#define WIFI20_RATE	(20*1024*1024/8)
+const LinkParams wifi20 =
+	{ WIFI20_RATE, 2000, 50*1000, 0.005, 20*1000 };
+
 
 static bool tracepkts = false;
 
@@ -155,10 +162,17 @@ QString LinkParams::toString()
 	QString speed = rate < 1024*1024
 		? QString("%1Kbps").arg((float)rate * 8 / (1024))
 		: QString("%1Mbps").arg((float)rate * 8 / (1024*1024));
-	return QString("%1 delay %2ms qlen %3ms")
+	return QString("%1 delay %2ms qlen %3ms loss %4% jitter %5ms "
+			"reorder %6% by %7ms ecn %8ms mtu %9")
 		.arg(speed)
 		.arg((float)delay / 1000)
-		.arg((float)qlen / 1000);
+		.arg((float)qlen / 1000)
+		.arg(loss * 100)
+		.arg((float)jitter / 1000)
+		.arg(reorder * 100)
+		.arg((float)reodelay / 1000)
+		.arg((float)ecnthresh / 1000)
+		.arg(mtu);
 }
 
 
@@ -202,11 +216,12 @@ void SimTimerEngine::stop()
 
 SimPacket::SimPacket(SimHost *srch, const Endpoint &src, 
 			SimLink *lnk, const Endpoint &dst,
-			const char *data, int size)
+			const char *data, int size, int ecn)
 :	QObject(srch->sim),
 	sim(srch->sim),
 	src(src), dst(dst), dsth(NULL),
-	buf(data, size), timer(srch, this)
+	buf(data, size), timer(srch, this),
+	ecn(ecn)
 {
 	Q_ASSERT(srch->links.value(src.addr) == lnk);
 
@@ -225,7 +240,15 @@ SimPacket::SimPacket(SimHost *srch, const Endpoint &src,
 
 	// Pick the correct set of link parameters to simulate with
 	LinkParams &p = lnk->params[!w];
-	qint64 &arr = lnk->arrival[!w];
+	qint64 &arr = lnk->queue->arrival[!w];
+
+	// Drop packets too big for the link, like a router
+	// whose ICMP "packet too big" messages never make it back.
+	if (p.mtu && size + IPUDPOH > p.mtu) {
+		qDebug() << this << "oversize DROP" << size;
+		deleteLater();
+		return;
+	}
 
 	// Simulate random loss if appropriate
 	if (p.loss && drand48() <= p.loss) {
@@ -234,8 +257,11 @@ SimPacket::SimPacket(SimHost *srch, const Endpoint &src,
 		return;
 	}
 
-	// Earliest time packet could start to arrive based on network delay
+	// Earliest time packet could start to arrive based on network delay,
+	// plus any random jitter.  Packets still arrive in order.
 	qint64 nomarr = curusecs + p.delay;
+	if (p.jitter)
+		nomarr += (qint64)(drand48() * p.jitter);
 
 	// Compute the time the packet's first bit will actually arrive -
 	// it can't start arriving sooner than the last packet finished.
@@ -245,6 +271,13 @@ SimPacket::SimPacket(SimHost *srch, const Endpoint &src,
 	// Implement a standard, basic drop-tail policy.
 	bool drop = actarr > nomarr + p.qlen;
 
+	// Like an ECN-enabled router with a simple step marking threshold,
+	// mark ECN-capable packets instead of dropping them
+	// when the queue is above the threshold but not yet full.
+	if (!drop && p.ecnthresh && ecn != EcnNotEct
+			&& actarr > nomarr + p.ecnthresh)
+		ecn = EcnCE;
+
 	// Compute the amount of wire time this packet takes to transmit,
 	// including some per-packet link/inet overhead
 	qint64 psize = buf.size() + PKTOH;
@@ -271,12 +304,22 @@ SimPacket::SimPacket(SimHost *srch, const Endpoint &src,
 	// Finally, record the time the packet will finish arriving,
 	// and schedule the packet to arrive at that time.
 	arr = actarr + ptime;
+	lnk->npackets[!w]++;
+	lnk->maxqueue[!w] = qMax(lnk->maxqueue[!w], actarr - nomarr);
+
+	// Simulate reordering, as on a multipath or ECMP fabric,
+	// by holding some packets back without delaying those behind them.
+	qint64 hold = 0;
+	if (p.reorder && drand48() <= p.reorder) {
+		qDebug() << this << "random REORDER";
+		hold = p.reodelay;
+	}
 
 	// Add it to the host's receive packet queue
 	dsth->pqueue.append(this);
 
 	connect(&timer, SIGNAL(timeout(bool)), this, SLOT(arrive()));
-	timer.start(arr - curusecs);
+	timer.start(arr + hold - curusecs);
 }
 
 void SimPacket::arrive()
@@ -311,7 +354,7 @@ void SimPacket::arrive()
 	dsth = NULL;
 
 	SocketEndpoint sep(src, dsts);
-	dsts->receive(buf, sep);
+	dsts->receive(buf, sep, ecn);
 
 	deleteLater();
 }
@@ -387,7 +430,8 @@ bool SimSocket::send(const Endpoint &dst, const char *data, int size)
 	SimLink *link = host->linkAt(src.addr);
 	Q_ASSERT(link);
 
-	(void)new SimPacket(host, src, link, dst, data, size);
+	(void)new SimPacket(host, src, link, dst, data, size,
+			ecnCapable() ? EcnEct0 : EcnNotEct);
 	return true;
 }
 
@@ -484,6 +528,9 @@ SimLink::SimLink(LinkPreset preset)
 {
 	hosts[0] = hosts[1] = NULL;
 	arrival[0] = arrival[1] = 0;
+	npackets[0] = npackets[1] = 0;
+	maxqueue[0] = maxqueue[1] = 0;
+	queue = this;
 
 	setPreset(preset);
 }
@@ -502,6 +549,7 @@ void SimLink::setPreset(LinkPreset preset)
 	case Eth10:	setLinkParams(eth10); break;
 	case Eth100:	setLinkParams(eth100); break;
 	case Eth1000:	setLinkParams(eth1000); break;
+	case WiFi20:	setLinkParams(wifi20); break;
 	default:
 		qFatal("SimLink: unknown preset %d", preset);
 	}
@@ -552,7 +600,8 @@ void SimLink::disconnect()
 ////////// Simulator //////////
 
 Simulator::Simulator(bool realtime)
-:	realtime(realtime)
+:	realtime(realtime),
+	stopped(false)
 {
 	cur.usecs = 0;
 }
@@ -580,7 +629,8 @@ void Simulator::run()
 		qFatal("Simulator::run() is only for use with virtual time:\n"
 			"for real time, use QCoreApplication::exec() instead.");
 
-	while (!timers.isEmpty()) {
+	stopped = false;
+	while (!timers.isEmpty() && !stopped) {
 		SimTimerEngine *next = timers.dequeue();
 		Q_ASSERT(next->wake >= cur.usecs);
 
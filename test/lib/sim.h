@@ -37,6 +37,11 @@ struct LinkParams {
 	int delay;	// Link delay in microseconds
 	int qlen;	// Router queue length in microseconds
 	float loss;	// Random loss rate, form 0.0 to 1.0
+	int jitter;	// Max random extra delay in microseconds
+	float reorder;	// Rate of packets held back past later ones
+	int reodelay;	// Extra delay of such packets in microseconds
+	int ecnthresh;	// Queue delay beyond which to CE-mark, 0 for none
+	int mtu;	// Largest IP packet in bytes, 0 for no limit
 
 	QString toString();
 };
@@ -48,6 +53,7 @@ enum LinkPreset {
 	Eth10,		// 10Mbps Ethernet link
 	Eth100,		// 100Mbps Ethernet link
 	Eth1000,	// 1000Mbps Ethernet link
+	WiFi20,		// 20Mbps Wi-Fi link with jitter and some loss
 };
 
 class SimTimerEngine : public TimerEngine
@@ -79,11 +85,12 @@ private:
 	QByteArray buf;
 	Timer timer;
 	bool isclient;
+	int ecn;	// ECN codepoint in the packet's IP header
 
 public:
 	SimPacket(SimHost *srch, const Endpoint &src, 
 			SimLink *link, const Endpoint &dst,
-			const char *data, int size);
+			const char *data, int size, int ecn = EcnNotEct);
 	~SimPacket();
 
 private slots:
@@ -182,6 +189,15 @@ private:
 	// Minimum network arrival time for next packet to be received
 	qint64 arrival[2];
 
+	// Packets the link has carried in each direction without dropping
+	qint64 npackets[2];
+
+	// Longest queueing delay any such packet saw, in microseconds
+	qint64 maxqueue[2];
+
+	// Link whose queues and arrival times this link's packets use
+	SimLink *queue;
+
 	inline int which(SimHost *h) {
 		Q_ASSERT(h == hosts[0] || h == hosts[1]);
 		return h == hosts[1];
@@ -199,9 +215,25 @@ public:
 	// Disconnect this link
 	void disconnect();
 
+	// Make this link's packets queue behind those of another link,
+	// as if both links crossed the same bottleneck router in the
+	// same orientation: e.g., to run flows between separate pairs
+	// of hosts against each other.  The links' parameters should match.
+	inline void shareQueue(SimLink *other) { queue = other->queue; }
+
 	inline LinkParams downLinkParams() const { return params[0]; }
 	inline LinkParams upLinkParams() const { return params[1]; }
 
+	// Number of packets the link has delivered or will deliver
+	// toward the down and up host, respectively
+	inline qint64 downLinkPackets() const { return npackets[0]; }
+	inline qint64 upLinkPackets() const { return npackets[1]; }
+
+	// Longest router queueing delay in microseconds any packet
+	// toward the down and up host saw, respectively
+	inline qint64 downLinkMaxQueue() const { return maxqueue[0]; }
+	inline qint64 upLinkMaxQueue() const { return maxqueue[1]; }
+
 	void setPreset(LinkPreset preset);
 
 	void setLinkParams(const LinkParams &down, const LinkParams &up);
@@ -227,6 +259,12 @@ public:
 	inline void setLinkLoss(float down, float up)
 		{ params[0].loss = down; params[1].loss = up; }
 	inline void setLinkLoss(float loss) { setLinkLoss(loss, loss); }
+
+	// Set the largest IP packet in bytes the link carries, 0 for no limit.
+	// Larger packets vanish without a trace, as into a black hole.
+	inline void setLinkMtu(int down, int up)
+		{ params[0].mtu = down; params[1].mtu = up; }
+	inline void setLinkMtu(int bytes) { setLinkMtu(bytes, bytes); }
 };
 
 class Simulator : public QObject
@@ -247,6 +285,9 @@ private:
 	// List of all currently active timers sorted by wake time
 	QQueue<SimTimerEngine*> timers;
 
+	// Set by stop() to make run() return
+	bool stopped;
+
 	// Table of all hosts in the simulation
 	//QHash<QHostAddress, SimHost*> hosts;
 
@@ -258,6 +299,10 @@ public:
 
 	void run();
 
+	// Make run() return after the current event,
+	// even though simulated timers are still pending.
+	inline void stop() { stopped = true; }
+
 signals:
 	// The simulator emits this signal after each event processing step,
 	// but before waiting for the next event to occur.
@@ -0,0 +1,89 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <QByteArray>
+#include <QtDebug>
+
+#include "chk32.h"
+
+#include "main.h"
+#include "chksum.h"
+
+using namespace SST;
+
+
+// Checksum 'size' bytes at 'data' using the current implementation,
+// feeding it in randomly-sized pieces.
+static quint32 piecewiseSum(const char *data, int size)
+{
+	Chk32 c;
+	while (size > 0) {
+		int n = qrand() % (size + 1);
+		c.update(data, n);
+		data += n;
+		size -= n;
+	}
+	return c.final();
+}
+
+void ChecksumTest::run()
+{
+	Chk32::Impl best = Chk32::impl();
+	qsrand(65537);
+
+	QByteArray buf(maxSize + 4, 0);
+	int nimpls = 0;
+	for (int t = 0; t < ntrials; t++) {
+
+		// Mostly packet-sized buffers, occasionally huge ones,
+		// at random alignments; every so often all-ones,
+		// to push the vector lane counters to their limits.
+		int size = qrand() % (t % 50 ? 4096 : maxSize);
+		int ofs = qrand() % 4;
+		bool ones = (t % 7 == 0);
+		for (int i = 0; i < size; i++)
+			buf[ofs + i] = ones ? (char)0xff : (char)qrand();
+		const char *data = buf.constData() + ofs;
+
+		Chk32::setImpl(Chk32::Scalar);
+		quint32 ref = Chk32::sum(data, size);
+
+		nimpls = 0;
+		for (int i = Chk32::Scalar + 1; i < Chk32::NImpls; i++) {
+			Chk32::Impl impl = (Chk32::Impl)i;
+			if (!Chk32::setImpl(impl))
+				continue;
+			nimpls++;
+
+			quint32 sum = piecewiseSum(data, size);
+			if (sum != ref)
+				qWarning("%s checksum %08x != scalar %08x "
+					"for %d bytes at offset %d",
+					Chk32::implName(impl), sum, ref,
+					size, ofs);
+			check(sum == ref);
+		}
+	}
+	Chk32::setImpl(best);
+
+	qDebug() << "Checked" << nimpls << "vector implementations against"
+		<< ntrials << "random buffers";
+	success = true;
+}
@@ -36,6 +36,11 @@
 #include "dgram.h"
 #include "migrate.h"
 #include "seg.h"
+#include "chksum.h"
+#include "pmtu.h"
+#include "multipath.h"
+#include "sack.h"
+#include "pace.h"
 
 using namespace SST;
 
@@ -56,6 +61,11 @@ struct RegressionTest {
 	{DatagramTest::run, "dgram", "Best-effort datagram data transfer"},
 	{MigrateTest::run, "migrate", "Endpoint migration test"},
 	{SegTest::run, "seg", "Segmented path test"},
+	{ChecksumTest::run, "chk32", "Vectorized checksum equivalence"},
+	{PmtuTest::run, "pmtu", "Path MTU discovery and black hole fallback"},
+	{MultipathTest::run, "multipath", "Striping a stream across two links"},
+	{SackTest::run, "sack", "Selective ACKs over a lossy link"},
+	{PaceTest::run, "pace", "Transmit pacing on a sub-millisecond path"},
 };
 #define NTESTS ((int)(sizeof(tests)/sizeof(tests[0])))
 
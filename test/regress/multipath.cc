@@ -0,0 +1,85 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <QtDebug>
+
+#include "main.h"
+#include "multipath.h"
+#include "strm/peer.h"
+
+using namespace SST;
+
+
+#define NMSGS		100		// Messages to transfer
+#define MSGSIZE		(64*1024)	// Size of each message
+#define DELAY2		(10*1000)	// One-way delay of the second link
+#define MAXTIME		60		// Simulated seconds to allow
+
+static const QHostAddress cliaddr2("1.2.3.5");
+static const QHostAddress srvaddr2("4.3.2.2");
+
+
+MultipathTest::MultipathTest(bool multipath)
+:	XferTest("multipath", "Multipath test protocol",
+		NMSGS, MSGSIZE, MAXTIME),
+	link2(Eth10),
+	multipath(multipath)
+{
+	link.connect(&clihost, cliaddr, &srvhost, srvaddr);
+	link2.setLinkDelay(DELAY2);
+	link2.connect(&clihost, cliaddr2, &srvhost, srvaddr2);
+
+	start();
+}
+
+void MultipathTest::connectClient()
+{
+	// Tell the client about both of the server's addresses.
+	clihost.streamPeer(srvhost.hostIdent().id())->setMultipath(multipath);
+	cli.connectTo(srvhost.hostIdent(), "regress", "multipath");
+	cli.connectAt(Endpoint(srvaddr, NETSTERIA_DEFAULT_PORT));
+	cli.connectAt(Endpoint(srvaddr2, NETSTERIA_DEFAULT_PORT));
+}
+
+void MultipathTest::run()
+{
+	MultipathTest single(false);
+	single.sim.run();
+	qDebug() << "Single-path transfer:" << single.narrived
+		<< "of" << NMSGS << "in" << single.donetime / 1000 << "ms";
+	check(single.narrived == NMSGS);
+
+	MultipathTest multi(true);
+	multi.sim.run();
+	qint64 pkts = multi.link.upLinkPackets();
+	qint64 pkts2 = multi.link2.upLinkPackets();
+	qDebug() << "Multipath transfer:" << multi.narrived
+		<< "of" << NMSGS << "in" << multi.donetime / 1000 << "ms,"
+		<< pkts << "and" << pkts2 << "packets on the two links";
+
+	success = true;
+	check(multi.narrived == NMSGS);
+
+	// Both links should carry a good share of the data,
+	// and together beat one link by a wide margin.
+	check(pkts2 * 4 > pkts + pkts2);
+	check(pkts * 4 > pkts + pkts2);
+	check(multi.donetime * 4 < single.donetime * 3);
+}
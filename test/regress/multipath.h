@@ -0,0 +1,52 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#ifndef MULTIPATH_H
+#define MULTIPATH_H
+
+#include "xfer.h"
+
+
+namespace SST {
+
+
+// Transfers a stream of large messages between two hosts
+// connected by two separate links, as with a server's two uplinks,
+// the second with a longer delay than the first.
+// In multipath mode the client opens a flow over each link
+// and stripes the stream across both, so the transfer should
+// use both links and finish well before one link alone could carry it.
+class MultipathTest : public XferTest
+{
+	SimLink link2;
+	const bool multipath;
+
+public:
+	MultipathTest(bool multipath);
+
+	static void run();
+
+protected:
+	virtual void connectClient();
+};
+
+
+} // namespace SST
+
+#endif	// MULTIPATH_H
@@ -0,0 +1,74 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <QtDebug>
+
+#include "main.h"
+#include "pace.h"
+#include "flow.h"
+
+using namespace SST;
+
+
+#define NMSGS		200		// Messages to transfer
+#define MSGSIZE		(64*1024)	// Size of each message
+#define MAXTIME		30		// Simulated seconds to allow
+
+
+PaceTest::PaceTest(bool pacing)
+:	XferTest("pace", "Transmit pacing test protocol",
+		NMSGS, MSGSIZE, MAXTIME)
+{
+	clihost.setDefaultTxPacing(pacing);
+
+	link.setPreset(Eth1000);
+	link.connect(&clihost, cliaddr, &srvhost, srvaddr);
+
+	start();
+}
+
+void PaceTest::run()
+{
+	PaceTest plain(false);
+	plain.sim.run();
+	qint64 plainq = plain.link.upLinkMaxQueue();
+	qDebug() << "Unpaced transfer:" << plain.narrived
+		<< "of" << NMSGS << "in" << plain.donetime / 1000 << "ms,"
+		<< "peak queue" << plainq << "us";
+	check(plain.narrived == NMSGS);
+
+	PaceTest paced(true);
+	paced.sim.run();
+	Flow *fl = paced.clientFlow();
+	qint64 pacedq = paced.link.upLinkMaxQueue();
+	qDebug() << "Paced transfer:" << paced.narrived
+		<< "of" << NMSGS << "in" << paced.donetime / 1000 << "ms,"
+		<< "peak queue" << pacedq << "us, SRTT"
+		<< (fl ? fl->txSmoothedRtt() : 0) << "us";
+
+	success = true;
+	check(paced.narrived == NMSGS);
+
+	// The path must really be sub-millisecond and the flow paced,
+	// and pacing must have kept its bursts well below the unpaced ones.
+	check(fl != NULL && fl->txSmoothedRtt() < 1000);
+	check(fl != NULL && fl->txPacingRate() > 0);
+	check(pacedq * 2 < plainq);
+}
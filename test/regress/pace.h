@@ -0,0 +1,46 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#ifndef PACE_H
+#define PACE_H
+
+#include "xfer.h"
+
+
+namespace SST {
+
+
+// Transfers a stream of messages across a gigabit link
+// whose round-trip time is well under a millisecond,
+// once unpaced and once with transmit pacing enabled.
+// Pacing must spread each window out over the short round trip,
+// leaving much less of a standing queue at the bottleneck
+// than the unpaced flow's window-sized bursts do.
+class PaceTest : public XferTest
+{
+public:
+	PaceTest(bool pacing);
+
+	static void run();
+};
+
+
+} // namespace SST
+
+#endif	// PACE_H
@@ -0,0 +1,84 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <QtDebug>
+
+#include "main.h"
+#include "pmtu.h"
+#include "flow.h"
+
+using namespace SST;
+
+
+#define NMSGS		200		// Messages to transfer
+#define MSGSIZE		(64*1024)	// Size of each message
+#define JUMBOMTU	4000		// Initial link MTU
+#define SMALLMTU	1500		// Link MTU after NMSGS/2 messages
+#define MAXTIME		120		// Simulated seconds to allow
+
+
+PmtuTest::PmtuTest()
+:	XferTest("pmtu", "Path MTU discovery test protocol",
+		NMSGS, MSGSIZE, MAXTIME),
+	bigmtu(0),
+	endmtu(0)
+{
+	clihost.setDefaultPathMtuDiscovery(true);
+	srvhost.setDefaultPathMtuDiscovery(true);
+
+	link.setLinkMtu(JUMBOMTU);
+	link.connect(&clihost, cliaddr, &srvhost, srvaddr);
+
+	start();
+}
+
+void PmtuTest::gotMessage()
+{
+	// Shrink the path out from under the transfer,
+	// noting what discovery found beforehand and ended up with.
+	Flow *fl = clientFlow();
+	if (narrived == NMSGS/2) {
+		bigmtu = fl ? fl->pathMtu() : 0;
+		link.setLinkMtu(SMALLMTU);
+	}
+	if (narrived == NMSGS)
+		endmtu = fl ? fl->pathMtu() : 0;
+
+	XferTest::gotMessage();
+}
+
+void PmtuTest::run()
+{
+	PmtuTest test;
+	test.sim.run();
+
+	qDebug() << "Path MTU test complete:" << test.narrived
+		<< "of" << NMSGS << "delivered, path MTU" << test.bigmtu
+		<< "before the shrink and" << test.endmtu << "after";
+	success = true;
+	check(test.narrived == NMSGS);
+
+	// Discovery must have raised the MTU above the base on the jumbo link,
+	// then fallen back to what the shrunken link carries.
+	check(test.bigmtu > Flow::pmtuBase);
+	check(test.bigmtu <= JUMBOMTU);
+	check(test.endmtu >= Flow::pmtuBase);
+	check(test.endmtu <= SMALLMTU);
+}
@@ -0,0 +1,52 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#ifndef PMTU_H
+#define PMTU_H
+
+#include "xfer.h"
+
+
+namespace SST {
+
+
+// Transfers a stream of large messages across a link
+// with a jumbo path MTU, which partway through shrinks
+// without warning, as when a route changes into a tunnel.
+// Path MTU discovery has to find the larger MTU to start with,
+// then notice the black hole and fall back to the smaller one,
+// resegmenting any lost packets that no longer fit.
+class PmtuTest : public XferTest
+{
+	int bigmtu;		// Client's path MTU before the shrink
+	int endmtu;		// Client's path MTU at the end
+
+public:
+	PmtuTest();
+
+	static void run();
+
+protected:
+	virtual void gotMessage();
+};
+
+
+} // namespace SST
+
+#endif	// PMTU_H
@@ -15,6 +15,6 @@ CONFIG -= app_bundle
 }
 
 # Input sources
-HEADERS += main.h srv.h cli.h dgram.h migrate.h seg.h
-SOURCES += main.cc srv.cc cli.cc dgram.cc migrate.cc seg.cc
+HEADERS += main.h srv.h cli.h dgram.h migrate.h seg.h chksum.h xfer.h pmtu.h multipath.h sack.h pace.h
+SOURCES += main.cc srv.cc cli.cc dgram.cc migrate.cc seg.cc chksum.cc xfer.cc pmtu.cc multipath.cc sack.cc pace.cc
 
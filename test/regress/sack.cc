@@ -0,0 +1,77 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <QtDebug>
+
+#include "main.h"
+#include "sack.h"
+#include "flow.h"
+
+using namespace SST;
+
+
+#define NMSGS		100		// Messages to transfer
+#define MSGSIZE		(64*1024)	// Size of each message
+#define LOSS		0.03		// Loss rate in each direction
+#define MAXTIME		120		// Simulated seconds to allow
+
+
+SackTest::SackTest(bool sack)
+:	XferTest("sack", "Selective acknowledgment test protocol",
+		NMSGS, MSGSIZE, MAXTIME)
+{
+	clihost.setDefaultSelectiveAcks(sack);
+
+	link.setLinkLoss(LOSS);
+	link.connect(&clihost, cliaddr, &srvhost, srvaddr);
+
+	start();
+}
+
+void SackTest::run()
+{
+	SackTest plain(false);
+	plain.sim.run();
+	Flow *plainfl = plain.clientFlow();
+	qint64 plainpkts = plain.link.upLinkPackets();
+	qDebug() << "Transfer without SACK:" << plain.narrived
+		<< "of" << NMSGS << "in" << plainpkts << "packets";
+	check(plain.narrived == NMSGS);
+	check(plainfl != NULL && !plainfl->selectiveAcks());
+	check(plainfl == NULL || plainfl->selectivelyAcked() == 0);
+
+	SackTest sack(true);
+	sack.sim.run();
+	Flow *sackfl = sack.clientFlow();
+	qint64 sackpkts = sack.link.upLinkPackets();
+	qDebug() << "Transfer with SACK:" << sack.narrived
+		<< "of" << NMSGS << "in" << sackpkts << "packets,"
+		<< (sackfl ? sackfl->selectivelyAcked() : 0)
+		<< "learned of from SACK ranges";
+
+	success = true;
+	check(sack.narrived == NMSGS);
+
+	// The flow must have negotiated SACK, and the ranges must have
+	// told the sender of packets whose own ACKs were lost,
+	// leaving loss recovery to retransmit only the real holes.
+	check(sackfl != NULL && sackfl->selectiveAcks());
+	check(sackfl == NULL || sackfl->selectivelyAcked() > 0);
+}
@@ -0,0 +1,45 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#ifndef SACK_H
+#define SACK_H
+
+#include "xfer.h"
+
+
+namespace SST {
+
+
+// Transfers a stream of messages across a link that randomly drops
+// both data and ACK packets, once with selective ACKs negotiated
+// and once with them disabled on the client.
+// With SACK the sender should learn of packets delivered
+// beyond the holes that lost ACKs leave, and retransmit only the rest.
+class SackTest : public XferTest
+{
+public:
+	SackTest(bool sack);
+
+	static void run();
+};
+
+
+} // namespace SST
+
+#endif	// SACK_H
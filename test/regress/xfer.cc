@@ -0,0 +1,135 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <QtDebug>
+
+#include "main.h"
+#include "xfer.h"
+#include "flow.h"
+
+using namespace SST;
+
+
+XferTest::XferTest(const QString &proto, const QString &protodesc,
+		int nmsgs, int msgsize, int maxtime)
+:	link(Eth10),
+	clihost(&sim),
+	srvhost(&sim),
+	cli(&clihost),
+	srv(&srvhost),
+	srvs(NULL),
+	stoptimer(&clihost),
+	nmsgs(nmsgs),
+	msgsize(msgsize),
+	nsent(0),
+	narrived(0),
+	donetime(0),
+	proto(proto)
+{
+	connect(&srv, SIGNAL(newConnection()),
+		this, SLOT(gotConnection()));
+	if (!srv.listen("regress", "SST regression test server",
+			proto, protodesc))
+		qFatal("Can't listen on service name");
+
+	// Some flow features keep timers running indefinitely,
+	// so the simulation won't always run out of events on its own.
+	connect(&stoptimer, SIGNAL(timeout(bool)), this, SLOT(stopTimeout()));
+	stoptimer.start((qint64)maxtime * 1000000);
+}
+
+void XferTest::start()
+{
+	connectClient();
+	connect(&cli, SIGNAL(readyWrite()), this, SLOT(cliReadyWrite()));
+	cliReadyWrite();
+}
+
+void XferTest::connectClient()
+{
+	cli.connectTo(Ident::fromIpAddress(
+				srvaddr, NETSTERIA_DEFAULT_PORT).id(),
+			"regress", proto);
+}
+
+Flow *XferTest::clientFlow()
+{
+	Endpoint ep(srvaddr, NETSTERIA_DEFAULT_PORT);
+	foreach (Socket *sock, clihost.activeSockets()) {
+		for (int chan = 1; chan <= (int)Flow::chanMax; chan++) {
+			Flow *fl = qobject_cast<Flow*>(sock->flow(ep, chan));
+			if (fl)
+				return fl;
+		}
+	}
+	return NULL;
+}
+
+void XferTest::cliReadyWrite()
+{
+	// Send the next message, filled with its sequence number.
+	if (nsent == nmsgs)
+		return;
+	QByteArray buf(msgsize, (char)nsent);
+	cli.writeMessage(buf);
+	nsent++;
+}
+
+void XferTest::gotConnection()
+{
+	qDebug() << this << "gotConnection";
+	Q_ASSERT(srvs == NULL);
+
+	srvs = srv.accept();
+	if (!srvs) return;
+
+	srvs->listen(Stream::Unlimited);
+
+	connect(srvs, SIGNAL(readyReadMessage()), this, SLOT(srvReadyRead()));
+	srvReadyRead();
+}
+
+void XferTest::srvReadyRead()
+{
+	while (true) {
+		QByteArray buf = srvs->readMessage();
+		if (buf.isNull())
+			return;
+
+		check(buf.size() == msgsize);
+		check(buf.count((char)narrived) == buf.size());
+		narrived++;
+		gotMessage();
+	}
+}
+
+void XferTest::gotMessage()
+{
+	if (narrived == nmsgs) {
+		donetime = sim.currentTime().usecs;
+		sim.stop();
+	}
+}
+
+void XferTest::stopTimeout()
+{
+	stoptimer.stop();
+	sim.stop();
+}
@@ -0,0 +1,89 @@
+/*
+ * Structured Stream Transport
+ * Copyright (C) 2006-2008 Massachusetts Institute of Technology
+ * Author: Bryan Ford
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#ifndef XFER_H
+#define XFER_H
+
+#include "stream.h"
+#include "sim.h"
+
+
+namespace SST {
+
+class Flow;
+
+
+// Common fixture for tests that transfer a stream of equal-sized messages
+// from a client to a server across simulated links, each message filled
+// with its sequence number so that loss, corruption or reordering shows.
+// A subclass sets up its links and hosts in its constructor,
+// then calls start() to connect the client and start sending.
+class XferTest : public QObject
+{
+	Q_OBJECT
+
+protected:
+	Simulator sim;
+	SimLink link;
+	SimHost clihost;
+	SimHost srvhost;
+	Stream cli;
+	StreamServer srv;
+	Stream *srvs;
+	Timer stoptimer;
+	const int nmsgs;
+	const int msgsize;
+	int nsent;
+	int narrived;
+	qint64 donetime;	// Virtual time the last message arrived
+
+	// Listen for service 'proto' on the server host,
+	// and stop the simulation after 'maxtime' simulated seconds
+	// in case the transfer doesn't complete.
+	XferTest(const QString &proto, const QString &protodesc,
+		int nmsgs, int msgsize, int maxtime);
+
+	// Connect the client and send the first message.
+	void start();
+
+	// Connect the client stream to the server.
+	// The default connects to the server's primary address.
+	virtual void connectClient();
+
+	// Called after each message arrives intact, with narrived updated.
+	// The default stops the simulation once all have arrived.
+	virtual void gotMessage();
+
+	// Find the client's flow to the server's primary address.
+	Flow *clientFlow();
+
+private:
+	const QString proto;
+
+private slots:
+	void cliReadyWrite();
+	void gotConnection();
+	void srvReadyRead();
+	void stopTimeout();
+};
+
+
+} // namespace SST
+
+#endif	// XFER_H
@@ -1,4 +1,4 @@
 
 TEMPLATE = subdirs
-SUBDIRS = lib regress web ucbweb
+SUBDIRS = lib regress bench web ucbweb
 
@@ -283,6 +283,8 @@ void SockClient::gotReadyRead()
 				- tc->bstart.usecs;
 		tc->logstrm << qSetFieldWidth(0) << "rqend  "
 			<< qSetFieldWidth(12) << size << elapsed << endl;
+		tc->count++;
+		tc->rqtotal += elapsed;
 
 		if (!reqs.isEmpty()) {
 			remain = reqs.head();
@@ -318,6 +320,8 @@ void SockClient::udpReadyRead()
 	qint64 elapsed = tc->host->currentTime().usecs
 			- tc->bstart.usecs;
 	tc->logstrm << "req " << size << ' ' << elapsed << endl;
+	tc->count++;
+	tc->rqtotal += elapsed;
 	if (!reqs.isEmpty()) {
 		remain = reqs.head();
 		started = false;
@@ -364,7 +368,7 @@ static bool isSecondary(const QByteArray &ext)
 
 TestClient::TestClient(Host *host, const QHostAddress &addr, quint16 port)
 :	host(host), addr(addr), port(port),
-	count(0), reqno(0), sockcnt(0),
+	count(0), rqtotal(0), reqno(0), sockcnt(0),
 	logfile("log"), logstrm(&logfile),
 	pritimer(host)
 {
@@ -711,6 +715,9 @@ void TestClient::complete()
 {
 	qDebug() << "Testing complete!";
 	qDebug() << "Total requests processed:" << count;
+	if (count)
+		qDebug() << "Mean request completion time:"
+			<< (double)rqtotal / count / 1000.0 << "ms";
 
 	QCoreApplication::exit(0);
 }
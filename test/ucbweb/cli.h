@@ -100,6 +100,7 @@ private:
 
 	QList<SockClient*>	socks;	// Streams currently in use
 	int			count;	// Total requests processed
+	qint64			rqtotal; // Sum of their completion times
 	int			reqno;	// Req # in current batch
 	Time			pstart;	// Start timestamp for this page
 	Time			bstart;	// Start timestamp for this batch
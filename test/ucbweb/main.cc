@@ -39,15 +39,33 @@ using namespace SST;
 
 TestProto SST::testproto = TESTPROTO_SST;
 
+// Flow startup options, to compare request completion times
+static int initwnd;		// Initial congestion window, 0 for default
+static bool hystart;		// Leave slow start with HyStart++
+static bool metrics;		// Start new flows from cached path metrics
+
 void usage(const char *appname)
 {
 	fprintf(stderr, "Usage:\n"
-			"(client) %s <hostname> [<port>]\n"
-			"(server) %s server [<port>]\n",
-		appname, appname);
+			"(client) %s [<options>] <hostname> [<port>]\n"
+			"(server) %s [<options>] server [<port>]\n"
+			"(simulator) %s [<options>] sim\n"
+			"Options:\n"
+			"  -iw <packets>  initial congestion window\n"
+			"  -hystart       HyStart++ slow start\n"
+			"  -metrics       cached per-peer path metrics\n",
+		appname, appname, appname);
 	exit(1);
 }
 
+void configure(Host *host)
+{
+	if (initwnd)
+		host->setDefaultInitialWindow(initwnd);
+	host->setDefaultHyStart(hystart);
+	host->setPathMetricsCache(metrics);
+}
+
 void simulate()
 {
 	QHostAddress cliaddr("1.2.3.4");
@@ -59,6 +77,8 @@ void simulate()
 	SimHost srvhost(&sim);
 
 	link.connect(&clihost, cliaddr, &srvhost, srvaddr);
+	configure(&clihost);
+	configure(&srvhost);
 
 	TestClient cli(&clihost, srvaddr, NETSTERIA_DEFAULT_PORT);
 	TestServer srv(&srvhost, NETSTERIA_DEFAULT_PORT);
@@ -73,6 +93,21 @@ int main(int argc, char **argv)
 
 	int i = 1;
 
+	// Flow startup options
+	while (argc > i && argv[i][0] == '-') {
+		if (strcmp(argv[i], "-iw") == 0 && argc > i+1) {
+			initwnd = atoi(argv[++i]);
+			if (initwnd <= 0)
+				usage(argv[0]);
+		} else if (strcmp(argv[i], "-hystart") == 0)
+			hystart = true;
+		else if (strcmp(argv[i], "-metrics") == 0)
+			metrics = true;
+		else
+			usage(argv[0]);
+		i++;
+	}
+
 	// Target host name if client, or "server" keyword
 	bool issim = false;
 	bool isserver = false;
@@ -109,12 +144,16 @@ int main(int argc, char **argv)
 	if (argc > i)
 		usage(argv[0]);
 
-	if (issim)
+	if (issim) {
 		simulate();
-	else if (isserver)
-		new TestServer(new Host(NULL, port), port);
-	else
-		new TestClient(new Host(NULL, port), hostaddr, port);
+	} else {
+		Host *host = new Host(NULL, port);
+		configure(host);
+		if (isserver)
+			new TestServer(host, port);
+		else
+			new TestClient(host, hostaddr, port);
+	}
 
 	return app.exec();
 }